@@ -83,6 +83,15 @@ zx_status_t arch_mp_send_ipi(mp_ipi_target_t target, cpu_mask_t mask, mp_ipi_t i
     return interrupt_send_ipi(mask, ipi);
 }
 
+uint arch_cpu_cache_distance(cpu_num_t a, cpu_num_t b) {
+    if (a == b) {
+        return 0;
+    }
+
+    // cpus in a cluster share the L2
+    return (arm64_cpu_cluster_ids[a] == arm64_cpu_cluster_ids[b]) ? 1 : 2;
+}
+
 void arm64_init_percpu_early(void) {
     // slow lookup the current cpu id and setup the percpu structure
     uint cpu = arch_curr_cpu_num_slow();
@@ -41,8 +41,7 @@ private:
     IntermediatePtFlags intermediate_flags() final;
     PtFlags terminal_flags(PageTableLevel level, uint flags) final;
     PtFlags split_flags(PageTableLevel level, PtFlags flags) final;
-    void TlbInvalidatePage(PageTableLevel level, vaddr_t vaddr, bool global_page,
-                           bool was_terminal) final;
+    void TlbInvalidate(PendingTlbInvalidation* pending) final;
     uint pt_flags_to_mmu_flags(PtFlags flags, PageTableLevel level) final;
     bool needs_cache_flushes() final { return false; }
 
@@ -64,8 +63,7 @@ private:
     IntermediatePtFlags intermediate_flags() final;
     PtFlags terminal_flags(PageTableLevel level, uint flags) final;
     PtFlags split_flags(PageTableLevel level, PtFlags flags) final;
-    void TlbInvalidatePage(PageTableLevel level, vaddr_t vaddr, bool global_page,
-                           bool was_terminal) final;
+    void TlbInvalidate(PendingTlbInvalidation* pending) final;
     uint pt_flags_to_mmu_flags(PtFlags flags, PageTableLevel level) final;
     bool needs_cache_flushes() final { return false; }
 };
@@ -87,17 +85,35 @@ public:
     zx_status_t Unmap(vaddr_t vaddr, size_t count, size_t* unmapped) override;
     zx_status_t Protect(vaddr_t vaddr, size_t count, uint mmu_flags) override;
     zx_status_t Query(vaddr_t vaddr, paddr_t* paddr, uint* mmu_flags) override;
+    zx_status_t QueryPageSize(vaddr_t vaddr, size_t* page_size) override;
 
     vaddr_t PickSpot(vaddr_t base, uint prev_region_mmu_flags,
                      vaddr_t end, uint next_region_mmu_flags,
                      vaddr_t align, size_t size, uint mmu_flags) override;
 
+    size_t LargePageSize() const override { return 1UL << PD_SHIFT; }
+
     paddr_t arch_table_phys() const override { return pt_->phys(); }
     paddr_t pt_phys() const { return pt_->phys(); }
     size_t pt_pages() const { return pt_->pages(); }
 
     int active_cpus() { return active_cpus_.load(); }
 
+    // Process-context ID used to tag this aspace's TLB entries, or kNoPcid
+    // if it shares PCID 0 and is flushed on every switch.
+    uint16_t pcid() const { return pcid_; }
+    static constexpr uint16_t kNoPcid = 0;
+
+    // Called when the page tables have changed, before the CPUs in
+    // |active_cpus()| are sent a TLB shootdown.  CPUs that are not running in
+    // the aspace are not interrupted; instead they flush its PCID the next
+    // time they switch to it.
+    void InvalidateInactiveTlbs() { tlb_cpus_.store(0); }
+
+    // Called on a CPU running in this aspace once its TLB is consistent with
+    // the page tables again.
+    void MarkTlbConsistent(int cpu_bit) { tlb_cpus_.fetch_or(cpu_bit); }
+
     IoBitmap& io_bitmap() { return io_bitmap_; }
 
     static void ContextSwitch(X86ArchVmAspace* from, X86ArchVmAspace* to);
@@ -131,6 +147,13 @@ private:
     // CPUs that are currently executing in this aspace.
     // Actually an mp_cpu_mask_t, but header dependencies.
     fbl::atomic_int active_cpus_{0};
+
+    uint16_t pcid_ = kNoPcid;
+
+    // CPUs whose TLB entries tagged with |pcid_| are known to be consistent
+    // with the page tables, and so may be kept across a switch to this
+    // aspace.  Actually an mp_cpu_mask_t, but header dependencies.
+    fbl::atomic_int tlb_cpus_{0};
 };
 
 using ArchVmAspace = X86ArchVmAspace;
@@ -27,6 +27,9 @@
 #define X86_CR4_OSXSAVE                 0x00040000 /* os supports xsave */
 #define X86_CR4_SMEP                    0x00100000 /* SMEP protection enabling */
 #define X86_CR4_SMAP                    0x00200000 /* SMAP protection enabling */
+#define X86_CR3_PCID_MASK               0x0000000000000fff /* process-context ID */
+#define X86_CR3_BASE_MASK               0x7ffffffffffff000 /* top level page table */
+#define X86_CR3_NOFLUSH                 0x8000000000000000 /* keep the PCID's TLB entries */
 #define X86_EFER_SCE                    0x00000001 /* enable SYSCALL */
 #define X86_EFER_LME                    0x00000100 /* long mode enable */
 #define X86_EFER_LMA                    0x00000400 /* long mode active */
@@ -16,6 +16,11 @@
 #include <arch/x86/feature.h>
 #include <arch/x86/mmu.h>
 #include <arch/x86/mmu_mem_types.h>
+#include <bitmap/raw-bitmap.h>
+#include <bitmap/storage.h>
+#include <fbl/auto_lock.h>
+#include <fbl/mutex.h>
+#include <kernel/cmdline.h>
 #include <kernel/mp.h>
 #include <vm/arch_vm_aspace.h>
 #include <vm/pmm.h>
@@ -33,6 +38,12 @@ uint8_t g_paddr_width = 32;
 /* True if the system supports 1GB pages */
 static bool supports_huge_pages = false;
 
+/* True if user aspaces tag their TLB entries with process-context IDs */
+static bool use_pcid = false;
+
+/* True if the INVPCID instruction can be used for TLB invalidations */
+static bool use_invpcid = false;
+
 /* top level kernel page tables, initialized in start.S */
 volatile pt_entry_t pml4[NO_OF_PT_ENTRIES] __ALIGNED(PAGE_SIZE);
 volatile pt_entry_t pdp[NO_OF_PT_ENTRIES] __ALIGNED(PAGE_SIZE); /* temporary */
@@ -58,6 +69,63 @@ paddr_t x86_kernel_cr3(void) {
     return kernel_pt_phys;
 }
 
+namespace {
+
+/* Highest usable PCID; PCID 0 is shared by the kernel aspace and by any
+ * aspace that could not get one of its own. */
+constexpr uint16_t kMaxPcid = X86_CR3_PCID_MASK;
+
+class PcidAllocator {
+public:
+    PcidAllocator() { bitmap_.Reset(kMaxPcid + 1); }
+    ~PcidAllocator() = default;
+
+    zx_status_t Alloc(uint16_t* pcid);
+    void Free(uint16_t pcid);
+
+private:
+    DISALLOW_COPY_ASSIGN_AND_MOVE(PcidAllocator);
+
+    fbl::Mutex lock_;
+    uint16_t last_ TA_GUARDED(lock_) = X86ArchVmAspace::kNoPcid;
+
+    bitmap::RawBitmapGeneric<bitmap::FixedStorage<kMaxPcid + 1>> bitmap_ TA_GUARDED(lock_);
+};
+
+zx_status_t PcidAllocator::Alloc(uint16_t* pcid) {
+    fbl::AutoLock al(&lock_);
+
+    // Start the search from the last PCID handed out, so that recently freed
+    // PCIDs are reused as late as possible.
+    size_t val;
+    bool notfound = bitmap_.Get(last_ + 1, kMaxPcid + 1, &val);
+    if (unlikely(notfound)) {
+        notfound = bitmap_.Get(X86ArchVmAspace::kNoPcid + 1, kMaxPcid + 1, &val);
+        if (unlikely(notfound)) {
+            return ZX_ERR_NO_RESOURCES;
+        }
+    }
+    bitmap_.SetOne(val);
+
+    DEBUG_ASSERT(val <= kMaxPcid);
+    last_ = static_cast<uint16_t>(val);
+    *pcid = last_;
+
+    LTRACEF("new pcid %#x\n", *pcid);
+    return ZX_OK;
+}
+
+void PcidAllocator::Free(uint16_t pcid) {
+    LTRACEF("free pcid %#x\n", pcid);
+
+    fbl::AutoLock al(&lock_);
+    bitmap_.ClearOne(pcid);
+}
+
+PcidAllocator pcid_allocator;
+
+} // namespace
+
 /**
  * @brief  check if the virtual address is canonical
  */
@@ -105,10 +173,34 @@ static bool x86_mmu_check_paddr(paddr_t paddr) {
     return paddr <= max_paddr;
 }
 
+/* INVPCID invalidation types, see the INVPCID entry in Intel 2A */
+enum invpcid_type : uint64_t {
+    INVPCID_INDIVIDUAL_ADDRESS = 0,
+    INVPCID_SINGLE_CONTEXT = 1,
+    INVPCID_ALL_INCLUDING_GLOBAL = 2,
+    INVPCID_ALL_NON_GLOBAL = 3,
+};
+
+static void x86_invpcid(invpcid_type type, uint16_t pcid, vaddr_t vaddr) {
+    struct {
+        uint64_t pcid;
+        uint64_t vaddr;
+    } desc = {pcid, vaddr};
+    __asm__ volatile("invpcid %0, %1" ::"m"(desc), "r"(static_cast<uint64_t>(type))
+                     : "memory");
+}
+
 /**
  * @brief  invalidate all TLB entries, including global entries
+ *
+ * This also drops the entries of every PCID, not just the current one.
  */
 static void x86_tlb_global_invalidate() {
+    if (use_invpcid) {
+        x86_invpcid(INVPCID_ALL_INCLUDING_GLOBAL, 0, 0);
+        return;
+    }
+
     /* See Intel 3A section 4.10.4.1 */
     ulong cr4 = x86_get_cr4();
     if (likely(cr4 & X86_CR4_PGE)) {
@@ -119,55 +211,103 @@ static void x86_tlb_global_invalidate() {
     }
 }
 
-/* Task used for invalidating a TLB entry on each CPU */
+/**
+ * @brief  invalidate all non-global TLB entries of the current PCID
+ */
+static void x86_tlb_nonglobal_invalidate() {
+    ulong cr3 = x86_get_cr3();
+    if (use_invpcid) {
+        x86_invpcid(INVPCID_SINGLE_CONTEXT, cr3 & X86_CR3_PCID_MASK, 0);
+    } else {
+        x86_set_cr3(cr3);
+    }
+}
+
+/* Task used for invalidating a set of TLB entries on each CPU */
 struct TlbInvalidatePage_context {
     ulong target_cr3;
-    vaddr_t vaddr;
-    enum PageTableLevel level;
-    bool global_page;
+    X86ArchVmAspace* aspace;
+    const PendingTlbInvalidation* pending;
 };
 static void TlbInvalidatePage_task(void* raw_context) {
     DEBUG_ASSERT(arch_ints_disabled());
     TlbInvalidatePage_context* context = (TlbInvalidatePage_context*)raw_context;
+    const PendingTlbInvalidation* pending = context->pending;
 
-    ulong cr3 = x86_get_cr3();
-    if (context->target_cr3 != cr3 && !context->global_page) {
+    bool is_target = context->target_cr3 == (x86_get_cr3() & X86_CR3_BASE_MASK);
+    if (!is_target && !pending->contains_global) {
         /* This invalidation doesn't apply to this CPU, ignore it */
         return;
     }
 
-    switch (context->level) {
-    case PML4_L:
-        x86_tlb_global_invalidate();
-        break;
-    case PDP_L:
-    case PD_L:
-    case PT_L:
-        __asm__ volatile("invlpg %0" ::"m"(*(uint8_t*)context->vaddr));
-        break;
+    if (pending->full_shootdown) {
+        if (pending->contains_global) {
+            x86_tlb_global_invalidate();
+        } else {
+            x86_tlb_nonglobal_invalidate();
+        }
+    } else {
+        for (uint i = 0; i < pending->count; ++i) {
+            const PendingTlbInvalidation::Item& item = pending->item[i];
+            switch (item.level()) {
+            case PML4_L:
+                panic("PML4_L invalidation should have been a full shootdown\n");
+            case PDP_L:
+            case PD_L:
+            case PT_L:
+                __asm__ volatile("invlpg %0" ::"m"(*(uint8_t*)item.vaddr()));
+                break;
+            }
+        }
+    }
+
+    /* This CPU's entries for the aspace are consistent again, so it may keep
+     * them the next time it switches back to the aspace. */
+    if (is_target && context->aspace) {
+        context->aspace->MarkTlbConsistent(cpu_num_to_mask(arch_curr_cpu_num()));
     }
 }
 
 /**
- * @brief Invalidate a single page at a given page table level
+ * @brief Execute a batch of pending TLB invalidations
  *
  * @param pt The page table we're invalidating for (if nullptr, assume for current one)
- * @param vaddr The virtual address we are invalidating the TLB entry for
- * @param level The page table level that maps this vaddr
- * @param global_page True if we are invalidating a global mapping
+ * @param pending The queued invalidations.  Cleared on return.
  *
- * TODO(ZX-979): Optimize this.  This is horribly inefficient.
- * We should also change this to pool invalidations from a single
- * "transaction" and then only execute a single mp_sync_exec for that
- * transaction, rather than one per page.
+ * All of the invalidations are carried out in a single mp_sync_exec, so an
+ * operation over many pages costs one round of IPIs rather than one per page.
  */
-static void x86_tlb_invalidate_page(X86PageTableBase* pt, vaddr_t vaddr,
-                                    enum PageTableLevel level, bool global_page) {
-    ulong cr3 = pt ? pt->phys() : x86_get_cr3();
+static void x86_tlb_invalidate_page(X86PageTableBase* pt, PendingTlbInvalidation* pending) {
+    if (pending->empty()) {
+        return;
+    }
+
+    /* INVLPG only drops paging-structure cache entries of the current PCID,
+     * but every PCID caches the shared kernel tables.  Changes above the
+     * leaves of the kernel page tables thus need a flush of all PCIDs. */
+    if (use_pcid && pending->contains_global && !pending->full_shootdown) {
+        for (uint i = 0; i < pending->count; ++i) {
+            if (pending->item[i].is_global() && !pending->item[i].is_terminal()) {
+                pending->full_shootdown = true;
+                break;
+            }
+        }
+    }
+
+    X86ArchVmAspace* aspace = pt ? static_cast<X86ArchVmAspace*>(pt->ctx()) : nullptr;
+    ulong cr3 = pt ? pt->phys() : (x86_get_cr3() & X86_CR3_BASE_MASK);
     struct TlbInvalidatePage_context task_context = {
-        .target_cr3 = cr3, .vaddr = vaddr, .level = level, .global_page = global_page,
+        .target_cr3 = cr3, .aspace = aspace, .pending = pending,
     };
 
+    /* CPUs that have run in the aspace but are not running in it now may
+     * still hold entries tagged with its PCID.  Rather than interrupting
+     * them, make them flush those entries when they next switch to it.  This
+     * must happen before |active_cpus| is sampled below. */
+    if (aspace) {
+        aspace->InvalidateInactiveTlbs();
+    }
+
     /* Target only CPUs this aspace is active on.  It may be the case that some
      * other CPU will become active in it after this load, or will have left it
      * just before this load.  In the former case, it is becoming active after
@@ -175,14 +315,15 @@ static void x86_tlb_invalidate_page(X86PageTableBase* pt, vaddr_t vaddr,
      * case, it will get a spurious request to flush. */
     mp_ipi_target_t target;
     cpu_mask_t target_mask = 0;
-    if (global_page || pt == nullptr) {
+    if (pending->contains_global || pt == nullptr) {
         target = MP_IPI_TARGET_ALL;
     } else {
         target = MP_IPI_TARGET_MASK;
-        target_mask = static_cast<X86ArchVmAspace*>(pt->ctx())->active_cpus();
+        target_mask = aspace->active_cpus();
     }
 
     mp_sync_exec(target, target_mask, TlbInvalidatePage_task, &task_context);
+    pending->clear();
 }
 
 bool X86PageTableMmu::check_paddr(paddr_t paddr) {
@@ -282,9 +423,8 @@ X86PageTableBase::PtFlags X86PageTableMmu::split_flags(PageTableLevel level,
     return flags;
 }
 
-void X86PageTableMmu::TlbInvalidatePage(PageTableLevel level, vaddr_t vaddr, bool global_page,
-                                        bool was_terminal) {
-    x86_tlb_invalidate_page(this, vaddr, level, global_page);
+void X86PageTableMmu::TlbInvalidate(PendingTlbInvalidation* pending) {
+    x86_tlb_invalidate_page(this, pending);
 }
 
 uint X86PageTableMmu::pt_flags_to_mmu_flags(PtFlags flags, PageTableLevel level) {
@@ -392,9 +532,9 @@ X86PageTableBase::PtFlags X86PageTableEpt::split_flags(PageTableLevel level,
     return flags;
 }
 
-void X86PageTableEpt::TlbInvalidatePage(PageTableLevel level, vaddr_t vaddr, bool global_page,
-                                        bool was_terminal) {
+void X86PageTableEpt::TlbInvalidate(PendingTlbInvalidation* pending) {
     // TODO(ZX-981): Implement this.
+    pending->clear();
 }
 
 uint X86PageTableEpt::pt_flags_to_mmu_flags(PtFlags flags, PageTableLevel level) {
@@ -420,7 +560,9 @@ void x86_mmu_early_init() {
 
     // Unmap the lower identity mapping.
     pml4[0] = 0;
-    x86_tlb_invalidate_page(nullptr, 0, PML4_L, false);
+    PendingTlbInvalidation tlb;
+    tlb.enqueue(0, PML4_L, /* global */ true, /* terminal */ false);
+    x86_tlb_invalidate_page(nullptr, &tlb);
 
     /* get the address width from the CPU */
     uint8_t vaddr_width = x86_linear_address_width();
@@ -439,7 +581,20 @@ void x86_mmu_early_init() {
     LTRACEF("paddr_width %u vaddr_width %u\n", g_paddr_width, g_vaddr_width);
 }
 
-void x86_mmu_init(void) {}
+void x86_mmu_init(void) {
+    use_pcid = x86_feature_test(X86_FEATURE_PCID) &&
+               !cmdline_get_bool("kernel.x86.disable_pcid", false);
+    use_invpcid = use_pcid && x86_feature_test(X86_FEATURE_INVPCID);
+    dprintf(INFO, "x86: PCIDs %s, INVPCID %s\n", use_pcid ? "enabled" : "disabled",
+            use_invpcid ? "enabled" : "disabled");
+
+    /* The secondary CPUs turn PCIDs on in x86_mmu_percpu_init() as they come
+     * up, which happens after this point. */
+    if (use_pcid) {
+        DEBUG_ASSERT((x86_get_cr3() & X86_CR3_PCID_MASK) == 0);
+        x86_set_cr4(x86_get_cr4() | X86_CR4_PCIDE);
+    }
+}
 
 X86PageTableBase::X86PageTableBase() {
 }
@@ -532,6 +687,13 @@ zx_status_t X86ArchVmAspace::Init(vaddr_t base, size_t size, uint mmu_flags) {
             return status;
         }
 
+        // Running out of PCIDs is not fatal; the aspace then shares PCID 0
+        // and flushes its TLB entries on every switch, as without PCIDs.
+        if (use_pcid && pcid_allocator.Alloc(&pcid_) != ZX_OK) {
+            LTRACEF("out of PCIDs, aspace %p runs without one\n", this);
+            pcid_ = kNoPcid;
+        }
+
         LTRACEF("user aspace: pt phys %#" PRIxPTR ", virt %p\n", pt_->phys(), pt_->virt());
     }
     fbl::atomic_init(&active_cpus_, 0);
@@ -548,6 +710,13 @@ zx_status_t X86ArchVmAspace::Destroy() {
     } else {
         static_cast<X86PageTableMmu*>(pt_)->Destroy(base_, size_);
     }
+
+    // Other CPUs may still hold entries tagged with the PCID.  Its next owner
+    // starts out with an empty |tlb_cpus_|, so they are flushed before use.
+    if (pcid_ != kNoPcid) {
+        pcid_allocator.Free(pcid_);
+        pcid_ = kNoPcid;
+    }
     return ZX_OK;
 }
 
@@ -585,14 +754,28 @@ void X86ArchVmAspace::ContextSwitch(X86ArchVmAspace* old_aspace, X86ArchVmAspace
     cpu_mask_t cpu_bit = cpu_num_to_mask(arch_curr_cpu_num());
     if (aspace != nullptr) {
         aspace->canary_.Assert();
+        DEBUG_ASSERT(aspace != old_aspace);
         paddr_t phys = aspace->pt_phys();
-        LTRACEF_LEVEL(3, "switching to aspace %p, pt %#" PRIXPTR "\n", aspace, phys);
-        x86_set_cr3(phys);
+        LTRACEF_LEVEL(3, "switching to aspace %p, pt %#" PRIXPTR ", pcid %#x\n", aspace, phys,
+                      aspace->pcid_);
+
+        // Become a shootdown target before deciding whether the entries
+        // tagged with the aspace's PCID can be kept.  Any shootdown that
+        // misses us has already cleared our bit in |tlb_cpus_|.
+        aspace->active_cpus_.fetch_or(cpu_bit);
+
+        ulong cr3 = phys;
+        if (aspace->pcid_ != kNoPcid) {
+            cr3 |= aspace->pcid_;
+            if (aspace->tlb_cpus_.fetch_or(cpu_bit) & cpu_bit) {
+                cr3 |= X86_CR3_NOFLUSH;
+            }
+        }
+        x86_set_cr3(cr3);
 
         if (old_aspace != nullptr) {
             old_aspace->active_cpus_.fetch_and(~cpu_bit);
         }
-        aspace->active_cpus_.fetch_or(cpu_bit);
     } else {
         LTRACEF_LEVEL(3, "switching to kernel aspace, pt %#" PRIxPTR "\n", kernel_pt_phys);
         x86_set_cr3(kernel_pt_phys);
@@ -614,7 +797,14 @@ zx_status_t X86ArchVmAspace::Query(vaddr_t vaddr, paddr_t* paddr, uint* mmu_flag
     if (!IsValidVaddr(vaddr))
         return ZX_ERR_INVALID_ARGS;
 
-    return pt_->QueryVaddr(vaddr, paddr, mmu_flags);
+    return pt_->QueryVaddr(vaddr, paddr, mmu_flags, nullptr);
+}
+
+zx_status_t X86ArchVmAspace::QueryPageSize(vaddr_t vaddr, size_t* page_size) {
+    if (!IsValidVaddr(vaddr))
+        return ZX_ERR_INVALID_ARGS;
+
+    return pt_->QueryVaddr(vaddr, nullptr, nullptr, page_size);
 }
 
 void x86_mmu_percpu_init(void) {
@@ -631,6 +821,10 @@ void x86_mmu_percpu_init(void) {
         cr4 |= X86_CR4_SMEP;
     if (x86_feature_test(X86_FEATURE_SMAP))
         cr4 |= X86_CR4_SMAP;
+    /* CR3 still points at the kernel page tables with PCID 0 here, as
+     * required for setting PCIDE. */
+    if (use_pcid)
+        cr4 |= X86_CR4_PCIDE;
     x86_set_cr4(cr4);
 
     // Set NXE bit in X86_MSR_IA32_EFER.
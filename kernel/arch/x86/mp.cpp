@@ -199,6 +199,28 @@ int x86_apic_id_to_cpu_num(uint32_t apic_id) {
     return -1;
 }
 
+uint arch_cpu_cache_distance(cpu_num_t a, cpu_num_t b) {
+    if (a == b) {
+        return 0;
+    }
+
+    DEBUG_ASSERT(a < x86_num_cpus && b < x86_num_cpus);
+    uint32_t apic_a = (a == 0) ? bp_percpu.apic_id : ap_percpus[a - 1].apic_id;
+    uint32_t apic_b = (b == 0) ? bp_percpu.apic_id : ap_percpus[b - 1].apic_id;
+    if (apic_a == INVALID_APIC_ID || apic_b == INVALID_APIC_ID) {
+        return 2;
+    }
+
+    x86_cpu_topology_t topo_a, topo_b;
+    x86_cpu_topology_decode(apic_a, &topo_a);
+    x86_cpu_topology_decode(apic_b, &topo_b);
+    if (topo_a.package_id != topo_b.package_id) {
+        return 2;
+    }
+    // SMT siblings share every level of cache; other cores in the package share the LLC.
+    return (topo_a.core_id == topo_b.core_id) ? 0 : 1;
+}
+
 zx_status_t arch_mp_send_ipi(mp_ipi_target_t target, cpu_mask_t mask, mp_ipi_t ipi) {
     uint8_t vector = 0;
     switch (ipi) {
@@ -8,6 +8,7 @@
 
 #include <fbl/canary.h>
 #include <fbl/mutex.h>
+#include <zircon/types.h>
 
 typedef uint64_t pt_entry_t;
 #define PRIxPTE PRIx64
@@ -20,6 +21,58 @@ enum PageTableLevel {
     PML4_L,
 };
 
+// Structure for tracking an upcoming TLB invalidation.  Page table updates
+// queue their invalidations here and the owning page table issues them all
+// at once, so an operation over many pages costs a single round of IPIs.
+struct PendingTlbInvalidation {
+    // Maximum number of individual invalidations to track.  Beyond this it
+    // is cheaper to flush the entire TLB than to invlpg each page.
+    static constexpr uint kMaxPendingItems = 32;
+
+    // An individual invalidation.  |vaddr| is page aligned, which leaves its
+    // low bits free to carry the rest of the item.
+    struct Item {
+        uint64_t raw;
+
+        vaddr_t vaddr() const { return raw & ~kFlagsMask; }
+        PageTableLevel level() const {
+            return static_cast<PageTableLevel>(raw & kLevelMask);
+        }
+        bool is_global() const { return raw & kGlobalBit; }
+        bool is_terminal() const { return raw & kTerminalBit; }
+
+        static constexpr uint64_t kLevelMask = 0x3;
+        static constexpr uint64_t kGlobalBit = 1u << 2;
+        static constexpr uint64_t kTerminalBit = 1u << 3;
+        static constexpr uint64_t kFlagsMask = 0xf;
+    };
+
+    // Add address |v|, translated at depth |level|, to the set of addresses
+    // to be invalidated.  |is_terminal| should be true iff this invalidation
+    // is targeting the final step of the translation rather than a higher
+    // page table entry.  |is_global| should be true iff this page was
+    // mapped with the global bit set.
+    void enqueue(vaddr_t v, PageTableLevel level, bool is_global, bool is_terminal);
+
+    // Clear the list of pending invalidations.
+    void clear();
+
+    // Whether there is anything to invalidate.
+    bool empty() const { return count == 0 && !full_shootdown; }
+
+    ~PendingTlbInvalidation();
+
+    // If true, ignore the item list and invalidate everything in the
+    // affected address space.
+    bool full_shootdown = false;
+    // If true, at least one enqueued entry was for a global page.
+    bool contains_global = false;
+    // Number of valid elements in |item|.
+    uint count = 0;
+    // List of addresses queued for invalidation.
+    Item item[kMaxPendingItems];
+};
+
 class X86PageTableBase {
 public:
     X86PageTableBase();
@@ -47,7 +100,7 @@ public:
     zx_status_t UnmapPages(vaddr_t vaddr, const size_t count, size_t* unmapped);
     zx_status_t ProtectPages(vaddr_t vaddr, size_t count, uint flags);
 
-    zx_status_t QueryVaddr(vaddr_t vaddr, paddr_t* paddr, uint* mmu_flags);
+    zx_status_t QueryVaddr(vaddr_t vaddr, paddr_t* paddr, uint* mmu_flags, size_t* page_size);
 
 protected:
     // Initialize an empty page table, assigning this given context to it.
@@ -74,9 +127,9 @@ protected:
     // Return the hardware flags to use on smaller pages after a splitting a
     // large page with flags |flags|.
     virtual PtFlags split_flags(PageTableLevel level, PtFlags flags) = 0;
-    // Invalidate a single page at the given level
-    virtual void TlbInvalidatePage(PageTableLevel level, vaddr_t vaddr, bool global_page,
-                                   bool was_terminal) = 0;
+    // Execute the given pending invalidation.  |pending| is cleared on
+    // return.
+    virtual void TlbInvalidate(PendingTlbInvalidation* pending) = 0;
     // Convert PtFlags to ARCH_MMU_* flags.
     virtual uint pt_flags_to_mmu_flags(PtFlags flags, PageTableLevel level) = 0;
     // Returns true if a cache flush is necessary for pagetable changes to be
@@ -98,28 +151,29 @@ private:
     DISALLOW_COPY_ASSIGN_AND_MOVE(X86PageTableBase);
 
     class CacheLineFlusher;
+    class ConsistencyManager;
     struct MappingCursor;
 
     zx_status_t AddMapping(volatile pt_entry_t* table, uint mmu_flags,
                            PageTableLevel level, const MappingCursor& start_cursor,
-                           MappingCursor* new_cursor) TA_REQ(lock_);
+                           MappingCursor* new_cursor, ConsistencyManager* cm) TA_REQ(lock_);
     zx_status_t AddMappingL0(volatile pt_entry_t* table, uint mmu_flags,
                              const MappingCursor& start_cursor,
-                             MappingCursor* new_cursor) TA_REQ(lock_);
+                             MappingCursor* new_cursor, ConsistencyManager* cm) TA_REQ(lock_);
 
     bool RemoveMapping(volatile pt_entry_t* table,
                        PageTableLevel level, const MappingCursor& start_cursor,
-                       MappingCursor* new_cursor) TA_REQ(lock_);
+                       MappingCursor* new_cursor, ConsistencyManager* cm) TA_REQ(lock_);
     bool RemoveMappingL0(volatile pt_entry_t* table,
                          const MappingCursor& start_cursor,
-                         MappingCursor* new_cursor) TA_REQ(lock_);
+                         MappingCursor* new_cursor, ConsistencyManager* cm) TA_REQ(lock_);
 
     zx_status_t UpdateMapping(volatile pt_entry_t* table, uint mmu_flags,
                               PageTableLevel level, const MappingCursor& start_cursor,
-                              MappingCursor* new_cursor) TA_REQ(lock_);
+                              MappingCursor* new_cursor, ConsistencyManager* cm) TA_REQ(lock_);
     zx_status_t UpdateMappingL0(volatile pt_entry_t* table, uint mmu_flags,
                                 const MappingCursor& start_cursor,
-                                MappingCursor* new_cursor) TA_REQ(lock_);
+                                MappingCursor* new_cursor, ConsistencyManager* cm) TA_REQ(lock_);
 
     zx_status_t GetMapping(volatile pt_entry_t* table, vaddr_t vaddr,
                            PageTableLevel level,
@@ -130,12 +184,12 @@ private:
                              volatile pt_entry_t** mapping) TA_REQ(lock_);
 
     zx_status_t SplitLargePage(PageTableLevel level, vaddr_t vaddr,
-                               volatile pt_entry_t* pte) TA_REQ(lock_);
+                               volatile pt_entry_t* pte, ConsistencyManager* cm) TA_REQ(lock_);
 
-    void UpdateEntry(CacheLineFlusher* flusher,
+    void UpdateEntry(CacheLineFlusher* flusher, ConsistencyManager* cm,
                      PageTableLevel level, vaddr_t vaddr, volatile pt_entry_t* pte,
                      paddr_t paddr, PtFlags flags, bool was_terminal) TA_REQ(lock_);
-    void UnmapEntry(CacheLineFlusher* flusher,
+    void UnmapEntry(CacheLineFlusher* flusher, ConsistencyManager* cm,
                     PageTableLevel level, vaddr_t vaddr, volatile pt_entry_t* pte,
                     bool was_terminal) TA_REQ(lock_);
 
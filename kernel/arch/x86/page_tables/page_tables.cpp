@@ -157,7 +157,89 @@ public:
     size_t size;
 };
 
-void X86PageTableBase::UpdateEntry(CacheLineFlusher* flusher,
+void PendingTlbInvalidation::enqueue(vaddr_t v, PageTableLevel level, bool is_global,
+                                     bool is_terminal) {
+    if (is_global) {
+        contains_global = true;
+    }
+
+    // PML4_L entries cover so much address space that a full flush is the
+    // only sensible way to invalidate them.
+    if (full_shootdown || count >= kMaxPendingItems || level == PML4_L) {
+        full_shootdown = true;
+        return;
+    }
+
+    DEBUG_ASSERT(IS_PAGE_ALIGNED(v));
+    item[count].raw = v | static_cast<uint64_t>(level) |
+                      (is_global ? Item::kGlobalBit : 0) |
+                      (is_terminal ? Item::kTerminalBit : 0);
+    count++;
+}
+
+void PendingTlbInvalidation::clear() {
+    count = 0;
+    full_shootdown = false;
+    contains_global = false;
+}
+
+PendingTlbInvalidation::~PendingTlbInvalidation() {
+    DEBUG_ASSERT(empty());
+}
+
+// Utility for batching up the side effects of a page table operation.  TLB
+// invalidations are accumulated while the tables are modified and issued
+// together by Finish(), and page tables that were unlinked are only returned
+// to the PMM once no CPU can still be walking them.
+class X86PageTableBase::ConsistencyManager {
+public:
+    explicit ConsistencyManager(X86PageTableBase* pt);
+    ~ConsistencyManager();
+
+    // Queue a page table page to be freed after the pending invalidations
+    // have been issued.
+    void QueueFree(vm_page_t* page) {
+        list_add_tail(&to_free_, &page->free.node);
+    }
+
+    PendingTlbInvalidation* pending_tlb() { return &tlb_; }
+
+    // Issue the pending invalidations and free any queued pages.  Must be
+    // called with |pt_->lock_| held, after all CacheLineFlushers used for
+    // the operation have been retired.
+    void Finish();
+
+private:
+    DISALLOW_COPY_ASSIGN_AND_MOVE(ConsistencyManager);
+
+    X86PageTableBase* pt_;
+    PendingTlbInvalidation tlb_;
+    list_node to_free_;
+};
+
+X86PageTableBase::ConsistencyManager::ConsistencyManager(X86PageTableBase* pt)
+    : pt_(pt), to_free_(LIST_INITIAL_VALUE(to_free_)) {
+}
+
+X86PageTableBase::ConsistencyManager::~ConsistencyManager() {
+    DEBUG_ASSERT(pt_ == nullptr);
+    DEBUG_ASSERT(list_is_empty(&to_free_));
+}
+
+void X86PageTableBase::ConsistencyManager::Finish() {
+    if (!tlb_.empty()) {
+        pt_->TlbInvalidate(&tlb_);
+    }
+    DEBUG_ASSERT(tlb_.empty());
+
+    // No CPU can still hold a cached reference to the freed tables now.
+    if (!list_is_empty(&to_free_)) {
+        pmm_free(&to_free_);
+    }
+    pt_ = nullptr;
+}
+
+void X86PageTableBase::UpdateEntry(CacheLineFlusher* flusher, ConsistencyManager* cm,
                                    PageTableLevel level, vaddr_t vaddr, volatile pt_entry_t* pte,
                                    paddr_t paddr, PtFlags flags, bool was_terminal) {
     DEBUG_ASSERT(pte);
@@ -171,15 +253,14 @@ void X86PageTableBase::UpdateEntry(CacheLineFlusher* flusher,
 
     /* attempt to invalidate the page */
     if (IS_PAGE_PRESENT(olde)) {
-        // Force the flush before the TLB invalidation, to avoid a race in which
-        // non-coherent remapping hardware sees the old PTE after the
-        // invalidation.
-        flusher->ForceFlush();
-        TlbInvalidatePage(level, vaddr, is_kernel_address(vaddr), was_terminal);
+        // The invalidation is only queued here.  All cache line flushers
+        // are retired before |cm| issues it, so non-coherent remapping
+        // hardware cannot see the old PTE after the invalidation.
+        cm->pending_tlb()->enqueue(vaddr, level, is_kernel_address(vaddr), was_terminal);
     }
 }
 
-void X86PageTableBase::UnmapEntry(CacheLineFlusher* flusher,
+void X86PageTableBase::UnmapEntry(CacheLineFlusher* flusher, ConsistencyManager* cm,
                                   PageTableLevel level, vaddr_t vaddr, volatile pt_entry_t* pte,
                                   bool was_terminal) {
     DEBUG_ASSERT(pte);
@@ -191,11 +272,7 @@ void X86PageTableBase::UnmapEntry(CacheLineFlusher* flusher,
 
     /* attempt to invalidate the page */
     if (IS_PAGE_PRESENT(olde)) {
-        // Force the flush before the TLB invalidation, to avoid a race in which
-        // non-coherent remapping hardware sees the old PTE after the
-        // invalidation.
-        flusher->ForceFlush();
-        TlbInvalidatePage(level, vaddr, is_kernel_address(vaddr), was_terminal);
+        cm->pending_tlb()->enqueue(vaddr, level, is_kernel_address(vaddr), was_terminal);
     }
 }
 
@@ -219,7 +296,7 @@ static volatile pt_entry_t* _map_alloc_page(void) {
  * @brief Split the given large page into smaller pages
  */
 zx_status_t X86PageTableBase::SplitLargePage(PageTableLevel level, vaddr_t vaddr,
-                                             volatile pt_entry_t* pte) {
+                                             volatile pt_entry_t* pte, ConsistencyManager* cm) {
     DEBUG_ASSERT_MSG(level != PT_L, "tried splitting PT_L");
     LTRACEF_LEVEL(2, "splitting table %p at level %d\n", pte, level);
 
@@ -242,7 +319,7 @@ zx_status_t X86PageTableBase::SplitLargePage(PageTableLevel level, vaddr_t vaddr
         volatile pt_entry_t* e = m + i;
         // If this is a PDP_L (i.e. huge page), flags will include the
         // PS bit still, so the new PD entries will be large pages.
-        UpdateEntry(&clf, lower_level(level), new_vaddr, e, new_paddr, flags,
+        UpdateEntry(&clf, cm, lower_level(level), new_vaddr, e, new_paddr, flags,
                     false /* was_terminal */);
         new_vaddr += ps;
         new_paddr += ps;
@@ -250,7 +327,8 @@ zx_status_t X86PageTableBase::SplitLargePage(PageTableLevel level, vaddr_t vaddr
     DEBUG_ASSERT(new_vaddr == vaddr + page_size(level));
 
     flags = intermediate_flags();
-    UpdateEntry(&clf, level, vaddr, pte, X86_VIRT_TO_PHYS(m), flags, true /* was_terminal */);
+    UpdateEntry(&clf, cm, level, vaddr, pte, X86_VIRT_TO_PHYS(m), flags,
+                true /* was_terminal */);
     pages_++;
     return ZX_OK;
 }
@@ -335,14 +413,15 @@ zx_status_t X86PageTableBase::GetMappingL0(volatile pt_entry_t* table, vaddr_t v
  * @return true if at least one page was unmapped at this level
  */
 bool X86PageTableBase::RemoveMapping(volatile pt_entry_t* table, PageTableLevel level,
-                                     const MappingCursor& start_cursor, MappingCursor* new_cursor) {
+                                     const MappingCursor& start_cursor, MappingCursor* new_cursor,
+                                     ConsistencyManager* cm) {
     DEBUG_ASSERT(table);
     LTRACEF("L: %d, %016" PRIxPTR " %016zx\n", level, start_cursor.vaddr,
             start_cursor.size);
     DEBUG_ASSERT(check_vaddr(start_cursor.vaddr));
 
     if (level == PT_L) {
-        return RemoveMappingL0(table, start_cursor, new_cursor);
+        return RemoveMappingL0(table, start_cursor, new_cursor, cm);
     }
 
     *new_cursor = start_cursor;
@@ -365,7 +444,7 @@ bool X86PageTableBase::RemoveMapping(volatile pt_entry_t* table, PageTableLevel
             bool vaddr_level_aligned = page_aligned(level, new_cursor->vaddr);
             // If the request covers the entire large page, just unmap it
             if (vaddr_level_aligned && new_cursor->size >= ps) {
-                UnmapEntry(&clf, level, new_cursor->vaddr, e, true /* was_terminal */);
+                UnmapEntry(&clf, cm, level, new_cursor->vaddr, e, true /* was_terminal */);
                 unmapped = true;
 
                 new_cursor->vaddr += ps;
@@ -375,11 +454,11 @@ bool X86PageTableBase::RemoveMapping(volatile pt_entry_t* table, PageTableLevel
             }
             // Otherwise, we need to split it
             vaddr_t page_vaddr = new_cursor->vaddr & ~(ps - 1);
-            zx_status_t status = SplitLargePage(level, page_vaddr, e);
+            zx_status_t status = SplitLargePage(level, page_vaddr, e, cm);
             if (status != ZX_OK) {
                 // If split fails, just unmap the whole thing, and let a
                 // subsequent page fault clean it up.
-                UnmapEntry(&clf, level, new_cursor->vaddr, e, true /* was_terminal */);
+                UnmapEntry(&clf, cm, level, new_cursor->vaddr, e, true /* was_terminal */);
                 unmapped = true;
 
                 new_cursor->SkipEntry(level);
@@ -391,7 +470,7 @@ bool X86PageTableBase::RemoveMapping(volatile pt_entry_t* table, PageTableLevel
         MappingCursor cursor;
         volatile pt_entry_t* next_table = get_next_table_from_entry(pt_val);
         bool lower_unmapped = RemoveMapping(next_table, lower_level(level),
-                                            *new_cursor, &cursor);
+                                            *new_cursor, &cursor, cm);
 
         // If we were requesting to unmap everything in the lower page table,
         // we know we can unmap the lower level page table.  Otherwise, if
@@ -415,7 +494,7 @@ bool X86PageTableBase::RemoveMapping(volatile pt_entry_t* table, PageTableLevel
             LTRACEF("L: %d free pt v %#" PRIxPTR " phys %#" PRIxPTR "\n",
                     level, (uintptr_t)next_table, ptable_phys);
 
-            UnmapEntry(&clf, level, new_cursor->vaddr, e, false /* was_terminal */);
+            UnmapEntry(&clf, cm, level, new_cursor->vaddr, e, false /* was_terminal */);
             vm_page_t* page = paddr_to_vm_page(ptable_phys);
 
             DEBUG_ASSERT(page);
@@ -423,7 +502,9 @@ bool X86PageTableBase::RemoveMapping(volatile pt_entry_t* table, PageTableLevel
                              "page %p state %u, paddr %#" PRIxPTR "\n", page, page->state,
                              X86_VIRT_TO_PHYS(next_table));
 
-            pmm_free_page(page);
+            // The table may still be cached by other CPUs' page walkers, so
+            // it is only freed once the invalidation has been issued.
+            cm->QueueFree(page);
             pages_--;
             unmapped = true;
         }
@@ -439,7 +520,7 @@ bool X86PageTableBase::RemoveMapping(volatile pt_entry_t* table, PageTableLevel
 // Base case of RemoveMapping for smallest page size.
 bool X86PageTableBase::RemoveMappingL0(volatile pt_entry_t* table,
                                        const MappingCursor& start_cursor,
-                                       MappingCursor* new_cursor) {
+                                       MappingCursor* new_cursor, ConsistencyManager* cm) {
     LTRACEF("%016" PRIxPTR " %016zx\n", start_cursor.vaddr, start_cursor.size);
     DEBUG_ASSERT(IS_PAGE_ALIGNED(start_cursor.size));
 
@@ -451,7 +532,7 @@ bool X86PageTableBase::RemoveMappingL0(volatile pt_entry_t* table,
     for (; index != NO_OF_PT_ENTRIES && new_cursor->size != 0; ++index) {
         volatile pt_entry_t* e = table + index;
         if (IS_PAGE_PRESENT(*e)) {
-            UnmapEntry(&clf, PT_L, new_cursor->vaddr, e, true /* was_terminal */);
+            UnmapEntry(&clf, cm, PT_L, new_cursor->vaddr, e, true /* was_terminal */);
             unmapped = true;
         }
 
@@ -479,7 +560,7 @@ bool X86PageTableBase::RemoveMappingL0(volatile pt_entry_t* table,
  */
 zx_status_t X86PageTableBase::AddMapping(volatile pt_entry_t* table, uint mmu_flags,
                                          PageTableLevel level, const MappingCursor& start_cursor,
-                                         MappingCursor* new_cursor) {
+                                         MappingCursor* new_cursor, ConsistencyManager* cm) {
     DEBUG_ASSERT(table);
     DEBUG_ASSERT(check_vaddr(start_cursor.vaddr));
     DEBUG_ASSERT(check_paddr(start_cursor.paddr));
@@ -488,7 +569,7 @@ zx_status_t X86PageTableBase::AddMapping(volatile pt_entry_t* table, uint mmu_fl
     *new_cursor = start_cursor;
 
     if (level == PT_L) {
-        return AddMappingL0(table, mmu_flags, start_cursor, new_cursor);
+        return AddMappingL0(table, mmu_flags, start_cursor, new_cursor, cm);
     }
 
     // Disable thread safety analysis, since Clang has trouble noticing that
@@ -500,7 +581,7 @@ zx_status_t X86PageTableBase::AddMapping(volatile pt_entry_t* table, uint mmu_fl
             // new_cursor->size should be how much is left to be mapped still
             cursor.size -= new_cursor->size;
             if (cursor.size > 0) {
-                RemoveMapping(table, level, cursor, &result);
+                RemoveMapping(table, level, cursor, &result, cm);
                 DEBUG_ASSERT(result.size == 0);
             }
         }
@@ -528,7 +609,7 @@ zx_status_t X86PageTableBase::AddMapping(volatile pt_entry_t* table, uint mmu_fl
         if (level_supports_large_pages && !IS_PAGE_PRESENT(pt_val) && level_valigned &&
             level_paligned && new_cursor->size >= ps) {
 
-            UpdateEntry(&clf, level, new_cursor->vaddr, table + index,
+            UpdateEntry(&clf, cm, level, new_cursor->vaddr, table + index,
                         new_cursor->paddr, term_flags | X86_MMU_PG_PS, false /* was_terminal */);
             new_cursor->paddr += ps;
             new_cursor->vaddr += ps;
@@ -544,7 +625,7 @@ zx_status_t X86PageTableBase::AddMapping(volatile pt_entry_t* table, uint mmu_fl
 
                 LTRACEF_LEVEL(2, "new table %p at level %d\n", m, level);
 
-                UpdateEntry(&clf, level, new_cursor->vaddr, e,
+                UpdateEntry(&clf, cm, level, new_cursor->vaddr, e,
                             X86_VIRT_TO_PHYS(m), interm_flags, false /* was_terminal */);
                 pt_val = *e;
                 pages_++;
@@ -552,7 +633,7 @@ zx_status_t X86PageTableBase::AddMapping(volatile pt_entry_t* table, uint mmu_fl
 
             MappingCursor cursor;
             ret = AddMapping(get_next_table_from_entry(pt_val), mmu_flags,
-                             lower_level(level), *new_cursor, &cursor);
+                             lower_level(level), *new_cursor, &cursor, cm);
             *new_cursor = cursor;
             DEBUG_ASSERT(new_cursor->size <= start_cursor.size);
             if (ret != ZX_OK) {
@@ -567,7 +648,7 @@ zx_status_t X86PageTableBase::AddMapping(volatile pt_entry_t* table, uint mmu_fl
 // Base case of AddMapping for smallest page size.
 zx_status_t X86PageTableBase::AddMappingL0(volatile pt_entry_t* table, uint mmu_flags,
                                            const MappingCursor& start_cursor,
-                                           MappingCursor* new_cursor) {
+                                           MappingCursor* new_cursor, ConsistencyManager* cm) {
     DEBUG_ASSERT(IS_PAGE_ALIGNED(start_cursor.size));
 
     *new_cursor = start_cursor;
@@ -582,7 +663,7 @@ zx_status_t X86PageTableBase::AddMappingL0(volatile pt_entry_t* table, uint mmu_
             return ZX_ERR_ALREADY_EXISTS;
         }
 
-        UpdateEntry(&clf, PT_L, new_cursor->vaddr, e, new_cursor->paddr, term_flags,
+        UpdateEntry(&clf, cm, PT_L, new_cursor->vaddr, e, new_cursor->paddr, term_flags,
                     false /* was_terminal */);
 
         new_cursor->paddr += PAGE_SIZE;
@@ -607,14 +688,14 @@ zx_status_t X86PageTableBase::AddMappingL0(volatile pt_entry_t* table, uint mmu_
  */
 zx_status_t X86PageTableBase::UpdateMapping(volatile pt_entry_t* table, uint mmu_flags,
                                             PageTableLevel level, const MappingCursor& start_cursor,
-                                            MappingCursor* new_cursor) {
+                                            MappingCursor* new_cursor, ConsistencyManager* cm) {
     DEBUG_ASSERT(table);
     LTRACEF("L: %d, %016" PRIxPTR " %016zx\n", level, start_cursor.vaddr,
             start_cursor.size);
     DEBUG_ASSERT(check_vaddr(start_cursor.vaddr));
 
     if (level == PT_L) {
-        return UpdateMappingL0(table, mmu_flags, start_cursor, new_cursor);
+        return UpdateMappingL0(table, mmu_flags, start_cursor, new_cursor, cm);
     }
 
     zx_status_t ret = ZX_OK;
@@ -639,7 +720,7 @@ zx_status_t X86PageTableBase::UpdateMapping(volatile pt_entry_t* table, uint mmu
             // If the request covers the entire large page, just change the
             // permissions
             if (vaddr_level_aligned && new_cursor->size >= ps) {
-                UpdateEntry(&clf, level, new_cursor->vaddr, e,
+                UpdateEntry(&clf, cm, level, new_cursor->vaddr, e,
                             paddr_from_pte(level, pt_val),
                             term_flags | X86_MMU_PG_PS, true /* was_terminal */);
                 new_cursor->vaddr += ps;
@@ -649,7 +730,7 @@ zx_status_t X86PageTableBase::UpdateMapping(volatile pt_entry_t* table, uint mmu
             }
             // Otherwise, we need to split it
             vaddr_t page_vaddr = new_cursor->vaddr & ~(ps - 1);
-            ret = SplitLargePage(level, page_vaddr, e);
+            ret = SplitLargePage(level, page_vaddr, e, cm);
             if (ret != ZX_OK) {
                 // If we failed to split the table, just unmap it.  Subsequent
                 // page faults will bring it back in.
@@ -658,7 +739,7 @@ zx_status_t X86PageTableBase::UpdateMapping(volatile pt_entry_t* table, uint mmu
                 cursor.size = ps;
 
                 MappingCursor tmp_cursor;
-                RemoveMapping(table, level, cursor, &tmp_cursor);
+                RemoveMapping(table, level, cursor, &tmp_cursor, cm);
 
                 new_cursor->SkipEntry(level);
             }
@@ -668,7 +749,7 @@ zx_status_t X86PageTableBase::UpdateMapping(volatile pt_entry_t* table, uint mmu
         MappingCursor cursor;
         volatile pt_entry_t* next_table = get_next_table_from_entry(pt_val);
         ret = UpdateMapping(next_table, mmu_flags, lower_level(level),
-                            *new_cursor, &cursor);
+                            *new_cursor, &cursor, cm);
         *new_cursor = cursor;
         if (ret != ZX_OK) {
             // Currently this can't happen
@@ -684,7 +765,7 @@ zx_status_t X86PageTableBase::UpdateMapping(volatile pt_entry_t* table, uint mmu
 zx_status_t X86PageTableBase::UpdateMappingL0(volatile pt_entry_t* table,
                                               uint mmu_flags,
                                               const MappingCursor& start_cursor,
-                                              MappingCursor* new_cursor) {
+                                              MappingCursor* new_cursor, ConsistencyManager* cm) {
     LTRACEF("%016" PRIxPTR " %016zx\n", start_cursor.vaddr, start_cursor.size);
     DEBUG_ASSERT(IS_PAGE_ALIGNED(start_cursor.size));
 
@@ -699,8 +780,8 @@ zx_status_t X86PageTableBase::UpdateMappingL0(volatile pt_entry_t* table,
         pt_entry_t pt_val = *e;
         // Skip unmapped pages (we may encounter these due to demand paging)
         if (IS_PAGE_PRESENT(pt_val)) {
-            UpdateEntry(&clf, PT_L, new_cursor->vaddr, e, paddr_from_pte(PT_L, pt_val), term_flags,
-                        true /* was_terminal */);
+            UpdateEntry(&clf, cm, PT_L, new_cursor->vaddr, e, paddr_from_pte(PT_L, pt_val),
+                        term_flags, true /* was_terminal */);
         }
 
         new_cursor->vaddr += PAGE_SIZE;
@@ -729,9 +810,11 @@ zx_status_t X86PageTableBase::UnmapPages(vaddr_t vaddr, const size_t count,
         .paddr = 0, .vaddr = vaddr, .size = count * PAGE_SIZE,
     };
 
+    ConsistencyManager cm(this);
     MappingCursor result;
-    RemoveMapping(virt_, top_level(), start, &result);
+    RemoveMapping(virt_, top_level(), start, &result, &cm);
     DEBUG_ASSERT(result.size == 0);
+    cm.Finish();
 
     if (unmapped)
         *unmapped = count;
@@ -762,6 +845,7 @@ zx_status_t X86PageTableBase::MapPages(vaddr_t vaddr, paddr_t* phys, size_t coun
     DEBUG_ASSERT(virt_);
 
     PageTableLevel top = top_level();
+    ConsistencyManager cm(this);
 
     // TODO(teisenbe): Improve performance of this function by integrating deeper into
     // the algorithm (e.g. make the cursors aware of the page array).
@@ -773,9 +857,10 @@ zx_status_t X86PageTableBase::MapPages(vaddr_t vaddr, paddr_t* phys, size_t coun
             };
 
             MappingCursor result;
-            RemoveMapping(virt_, top, start, &result);
+            RemoveMapping(virt_, top, start, &result, &cm);
             DEBUG_ASSERT(result.size == 0);
         }
+        cm.Finish();
     });
 
     vaddr_t v = vaddr;
@@ -784,7 +869,7 @@ zx_status_t X86PageTableBase::MapPages(vaddr_t vaddr, paddr_t* phys, size_t coun
             .paddr = phys[idx], .vaddr = v, .size = PAGE_SIZE,
         };
         MappingCursor result;
-        zx_status_t status = AddMapping(virt_, mmu_flags, top, start, &result);
+        zx_status_t status = AddMapping(virt_, mmu_flags, top, start, &result, &cm);
         if (status != ZX_OK) {
             dprintf(SPEW, "Add mapping failed with err=%d\n", status);
             return status;
@@ -798,6 +883,7 @@ zx_status_t X86PageTableBase::MapPages(vaddr_t vaddr, paddr_t* phys, size_t coun
         *mapped = count;
     }
     undo.cancel();
+    cm.Finish();
     return ZX_OK;
 }
 
@@ -825,8 +911,10 @@ zx_status_t X86PageTableBase::MapPagesContiguous(vaddr_t vaddr, paddr_t paddr,
     MappingCursor start = {
         .paddr = paddr, .vaddr = vaddr, .size = count * PAGE_SIZE,
     };
+    ConsistencyManager cm(this);
     MappingCursor result;
-    zx_status_t status = AddMapping(virt_, mmu_flags, top_level(), start, &result);
+    zx_status_t status = AddMapping(virt_, mmu_flags, top_level(), start, &result, &cm);
+    cm.Finish();
     if (status != ZX_OK) {
         dprintf(SPEW, "Add mapping failed with err=%d\n", status);
         return status;
@@ -858,8 +946,10 @@ zx_status_t X86PageTableBase::ProtectPages(vaddr_t vaddr, size_t count, uint mmu
     MappingCursor start = {
         .paddr = 0, .vaddr = vaddr, .size = count * PAGE_SIZE,
     };
+    ConsistencyManager cm(this);
     MappingCursor result;
-    zx_status_t status = UpdateMapping(virt_, mmu_flags, top_level(), start, &result);
+    zx_status_t status = UpdateMapping(virt_, mmu_flags, top_level(), start, &result, &cm);
+    cm.Finish();
     if (status != ZX_OK) {
         return status;
     }
@@ -867,7 +957,8 @@ zx_status_t X86PageTableBase::ProtectPages(vaddr_t vaddr, size_t count, uint mmu
     return ZX_OK;
 }
 
-zx_status_t X86PageTableBase::QueryVaddr(vaddr_t vaddr, paddr_t* paddr, uint* mmu_flags) {
+zx_status_t X86PageTableBase::QueryVaddr(vaddr_t vaddr, paddr_t* paddr, uint* mmu_flags,
+                                         size_t* page_size) {
     canary_.Assert();
 
     PageTableLevel ret_level;
@@ -913,6 +1004,22 @@ zx_status_t X86PageTableBase::QueryVaddr(vaddr_t vaddr, paddr_t* paddr, uint* mm
         *mmu_flags = pt_flags_to_mmu_flags(*last_valid_entry, ret_level);
     }
 
+    if (page_size) {
+        switch (ret_level) {
+        case PDP_L: /* 1GB page */
+            *page_size = 1ul << PDP_SHIFT;
+            break;
+        case PD_L: /* 2MB page */
+            *page_size = 1ul << PD_SHIFT;
+            break;
+        case PT_L: /* 4K page */
+            *page_size = PAGE_SIZE;
+            break;
+        default:
+            panic("arch_mmu_query: unhandled frame level\n");
+        }
+    }
+
     return ZX_OK;
 }
 
@@ -42,4 +42,9 @@ zx_status_t arch_mp_cpu_unplug(cpu_num_t cpu_id);
 
 void arch_mp_init_percpu(void);
 
+/* Relative cost of moving a thread between two cpus, based on the caches they share:
+ * 0 if they are the same core (or SMT siblings), 1 if they share a package or cluster,
+ * 2 otherwise. */
+uint arch_cpu_cache_distance(cpu_num_t a, cpu_num_t b);
+
 __END_CDECLS
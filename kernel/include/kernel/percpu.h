@@ -8,6 +8,7 @@
 #include <arch/ops.h>
 #include <kernel/align.h>
 #include <kernel/event.h>
+#include <kernel/spinlock.h>
 #include <kernel/stats.h>
 #include <kernel/thread.h>
 #include <kernel/timer.h>
@@ -18,15 +19,20 @@
 __BEGIN_CDECLS
 
 struct percpu {
-    /* per cpu timer queue */
-    struct list_node timer_queue;
-
     /* per cpu preemption timer */
     timer_t preempt_timer;
 
-    /* per cpu run queue and bitmap to indicate which queues are non empty */
+    /* per cpu run queue and bitmap to indicate which queues are non empty,
+     * guarded by run_queue_lock. see the lock ordering notes in sched.c.
+     */
+    spin_lock_t run_queue_lock;
     struct list_node run_queue[NUM_PRIORITIES];
     uint32_t run_queue_bitmap;
+    /* number of threads in run_queue; other cpus read it unlocked as a load hint */
+    volatile uint32_t run_queue_count;
+
+    /* last time this cpu looked for work to steal from busier cpus */
+    zx_time_t last_balance;
 
     /* thread/cpu level statistics */
     struct cpu_stats stats;
@@ -29,3 +29,7 @@ bool sched_unblock(thread_t* t) __WARN_UNUSED_RESULT;
 bool sched_unblock_list(struct list_node* list) __WARN_UNUSED_RESULT;
 
 void sched_transition_off_cpu(cpu_num_t old_cpu);
+
+/* return false if preempting the current thread would just pick it again; may be called
+ * without thread_lock */
+bool sched_preempt_needed(void);
@@ -40,6 +40,12 @@ typedef struct timer {
 
     volatile int active_cpu; // <0 if inactive
     volatile bool cancel;    // true if cancel is pending
+
+    // The cpu whose timer wheel lock guards this timer: the one it is queued
+    // on or running on. <0 if neither.
+    volatile int cpu;
+    // Where in that wheel the timer is queued; see timer.c.
+    uint32_t wheel_slot;
 } timer_t;
 
 #define TIMER_INITIAL_VALUE(t)              \
@@ -52,6 +58,8 @@ typedef struct timer {
         .arg = NULL,                        \
         .active_cpu = -1,                   \
         .cancel = false,                    \
+        .cpu = -1,                          \
+        .wheel_slot = 0,                    \
     }
 
 /* Rules for Timers:
@@ -105,6 +113,12 @@ void timer_set(timer_t* timer, zx_time_t deadline,
  */
 bool timer_cancel(timer_t*);
 
+/* Returns the slack that a TIMER_SLACK_LATE timer for a thread blocking until
+ * |deadline| may use, given the current time |now|. It grows with the length of
+ * the wait, so that long waits coalesce with other timers more readily.
+ */
+uint64_t timer_deadline_slack(zx_time_t deadline, zx_time_t now);
+
 /* Equivalent to timer_set with a slack of 0 */
 static inline void timer_set_oneshot(
     timer_t* timer, zx_time_t deadline, timer_callback callback, void* arg) {
@@ -9,11 +9,13 @@
 #include <assert.h>
 #include <debug.h>
 #include <err.h>
+#include <arch/mp.h>
 #include <inttypes.h>
 #include <kernel/mp.h>
 #include <kernel/percpu.h>
 #include <kernel/thread.h>
 #include <lib/ktrace.h>
+#include <limits.h>
 #include <list.h>
 #include <platform.h>
 #include <printf.h>
@@ -52,6 +54,45 @@
 /* threads get 10ms to run before they use up their time slice and the scheduler is invoked */
 #define THREAD_INITIAL_TIME_SLICE ZX_MSEC(10)
 
+/* Locking:
+ *
+ * Each cpu's run queue, bitmap and count are guarded by that cpu's run_queue_lock. Thread
+ * state and the wait queues are still guarded by thread_lock, and every run queue change
+ * is part of a thread state transition made with it held, so the ordering is:
+ *
+ *   thread_lock -> percpu[n].run_queue_lock
+ *
+ * Most paths hold one run queue lock at a time: moving a thread between cpus pulls it out
+ * of the old queue and drops that lock before taking the new one, which is safe because
+ * thread_lock pins the thread's state in between. Work stealing compares two queues and
+ * moves a thread between them in one step, so it holds both; two run queue locks are
+ * always taken in ascending cpu order (see run_queue_lock_pair()).
+ *
+ * A cpu may take its own run queue lock without thread_lock. The preemption path uses
+ * this to skip thread_lock entirely when rescheduling would only pick the current thread
+ * again; see sched_preempt_needed().
+ */
+
+/* Work stealing:
+ *
+ * A cpu that is about to run its idle thread first tries to pull a waiting thread from
+ * another cpu's run queue, and every busy cpu periodically pulls from cpus whose queues
+ * are noticeably deeper than its own. Victims are searched nearest cache domain first
+ * (see arch_cpu_cache_distance()), and only threads whose affinity allows the stealing
+ * cpu are taken, highest priority first.
+ */
+
+/* how often a busy cpu checks whether it should pull work from a busier one */
+#define SCHED_BALANCE_INTERVAL ZX_MSEC(20)
+
+/* don't pull work across packages/clusters unless the victim has at least this many
+ * threads waiting, to avoid trading a short wait for a cold cache */
+#define SCHED_REMOTE_STEAL_MIN 2u
+
+/* reasons recorded in the SCHED_STEAL trace record */
+#define SCHED_STEAL_IDLE 0u
+#define SCHED_STEAL_BALANCE 1u
+
 static bool local_migrate_if_needed(thread_t* curr_thread);
 
 /* compute the effective priority of a thread */
@@ -194,29 +235,74 @@ static cpu_mask_t find_cpu_mask(thread_t* t) {
     return mask;
 }
 
+/* take the run queue locks of two different cpus, lower numbered cpu first */
+static void run_queue_lock_pair(cpu_num_t a, cpu_num_t b) {
+    DEBUG_ASSERT(a != b);
+
+    spin_lock(&percpu[MIN(a, b)].run_queue_lock);
+    spin_lock(&percpu[MAX(a, b)].run_queue_lock);
+}
+
+static void run_queue_unlock_pair(cpu_num_t a, cpu_num_t b) {
+    spin_unlock(&percpu[MAX(a, b)].run_queue_lock);
+    spin_unlock(&percpu[MIN(a, b)].run_queue_lock);
+}
+
 /* run queue manipulation */
-static void insert_in_run_queue_head(cpu_num_t cpu, thread_t* t) {
+static void insert_in_run_queue_locked(cpu_num_t cpu, thread_t* t, bool head) {
     DEBUG_ASSERT(!list_in_list(&t->queue_node));
 
     int ep = effec_priority(t);
 
-    list_add_head(&percpu[cpu].run_queue[ep], &t->queue_node);
-    percpu[cpu].run_queue_bitmap |= (1u << ep);
+    struct percpu* c = &percpu[cpu];
+    DEBUG_ASSERT(spin_lock_held(&c->run_queue_lock));
+    if (head) {
+        list_add_head(&c->run_queue[ep], &t->queue_node);
+    } else {
+        list_add_tail(&c->run_queue[ep], &t->queue_node);
+    }
+    c->run_queue_bitmap |= (1u << ep);
+    c->run_queue_count++;
 
     /* mark the cpu as busy since the run queue now has at least one item in it */
     mp_set_cpu_busy(cpu);
 }
 
+static void kick_idle_cpu(cpu_num_t cpu, const thread_t* t, uint32_t count);
+
+static void insert_in_run_queue_head(cpu_num_t cpu, thread_t* t) {
+    spin_lock(&percpu[cpu].run_queue_lock);
+    insert_in_run_queue_locked(cpu, t, true);
+    uint32_t count = percpu[cpu].run_queue_count;
+    spin_unlock(&percpu[cpu].run_queue_lock);
+
+    kick_idle_cpu(cpu, t, count);
+}
+
 static void insert_in_run_queue_tail(cpu_num_t cpu, thread_t* t) {
-    DEBUG_ASSERT(!list_in_list(&t->queue_node));
+    spin_lock(&percpu[cpu].run_queue_lock);
+    insert_in_run_queue_locked(cpu, t, false);
+    uint32_t count = percpu[cpu].run_queue_count;
+    spin_unlock(&percpu[cpu].run_queue_lock);
 
-    int ep = effec_priority(t);
+    kick_idle_cpu(cpu, t, count);
+}
 
-    list_add_tail(&percpu[cpu].run_queue[ep], &t->queue_node);
-    percpu[cpu].run_queue_bitmap |= (1u << ep);
+/* pull a ready thread out of the run queue of the cpu it is waiting on */
+static void remove_from_run_queue(thread_t* t) {
+    DEBUG_ASSERT_MSG(list_in_list(&t->queue_node), "thread %p name %s curr_cpu %u\n", t, t->name, t->curr_cpu);
+    DEBUG_ASSERT(is_valid_cpu_num(t->curr_cpu));
 
-    /* mark the cpu as busy since the run queue now has at least one item in it */
-    mp_set_cpu_busy(cpu);
+    int pri = effec_priority(t);
+
+    struct percpu* c = &percpu[t->curr_cpu];
+    spin_lock(&c->run_queue_lock);
+    list_delete(&t->queue_node);
+    if (list_is_empty(&c->run_queue[pri])) {
+        c->run_queue_bitmap &= ~(1u << pri);
+    }
+    c->run_queue_count--;
+    spin_unlock(&c->run_queue_lock);
 }
 
 static thread_t* sched_get_top_thread(cpu_num_t cpu) {
@@ -224,6 +310,7 @@ static thread_t* sched_get_top_thread(cpu_num_t cpu) {
      * queued up on the passed in cpu.
      */
     struct percpu* c = &percpu[cpu];
+    spin_lock(&c->run_queue_lock);
     if (likely(c->run_queue_bitmap)) {
         uint highest_queue = HIGHEST_PRIORITY - __builtin_clz(c->run_queue_bitmap) -
                              (sizeof(c->run_queue_bitmap) * CHAR_BIT - NUM_PRIORITIES);
@@ -238,16 +325,198 @@ static thread_t* sched_get_top_thread(cpu_num_t cpu) {
 
         if (list_is_empty(&c->run_queue[highest_queue]))
             c->run_queue_bitmap &= ~(1u << highest_queue);
+        c->run_queue_count--;
+        spin_unlock(&c->run_queue_lock);
 
         LOCAL_KTRACE2("sched_get_top", newthread->priority_boost, newthread->base_priority);
 
         return newthread;
     }
+    spin_unlock(&c->run_queue_lock);
 
     /* no threads to run, select the idle thread for this cpu */
     return &c->idle_thread;
 }
 
+/* how many threads |victim| must have waiting before |cpu|, which has |count| waiting, takes
+ * one of them. |lead| is how many more than |cpu| it must have; cpus in another package or
+ * cluster must also have at least SCHED_REMOTE_STEAL_MIN.
+ */
+static uint32_t steal_threshold(cpu_num_t cpu, cpu_num_t victim, uint32_t count, uint32_t lead) {
+    uint32_t needed = count + lead;
+    if (arch_cpu_cache_distance(cpu, victim) >= 2)
+        needed = MAX(needed, SCHED_REMOTE_STEAL_MIN);
+    return needed;
+}
+
+/* move the highest priority thread that is allowed to run on |cpu| out of |victim|'s run
+ * queue, if |victim| still meets steal_threshold() once both queues are locked. if
+ * |enqueue|, the thread goes on the tail of |cpu|'s run queue under the same locks,
+ * otherwise the caller runs it directly. returns NULL if nothing there can move.
+ */
+static thread_t* steal_from_run_queue(cpu_num_t victim, cpu_num_t cpu, uint32_t lead,
+                                      bool enqueue) {
+    struct percpu* c = &percpu[victim];
+    cpu_mask_t cpu_mask = cpu_num_to_mask(cpu);
+    thread_t* stolen = NULL;
+
+    run_queue_lock_pair(victim, cpu);
+    uint32_t needed = steal_threshold(cpu, victim, percpu[cpu].run_queue_count, lead);
+    uint32_t bitmap = (c->run_queue_count >= needed) ? c->run_queue_bitmap : 0;
+    while (bitmap && !stolen) {
+        uint pri = (sizeof(bitmap) * CHAR_BIT - 1) - __builtin_clz(bitmap);
+
+        thread_t* t;
+        list_for_every_entry (&c->run_queue[pri], t, thread_t, queue_node) {
+            if (t->cpu_affinity & cpu_mask) {
+                DEBUG_ASSERT(t->state == THREAD_READY);
+                DEBUG_ASSERT(t->curr_cpu == victim);
+
+                list_delete(&t->queue_node);
+                if (list_is_empty(&c->run_queue[pri]))
+                    c->run_queue_bitmap &= ~(1u << pri);
+                c->run_queue_count--;
+
+                t->curr_cpu = cpu;
+                if (enqueue)
+                    insert_in_run_queue_locked(cpu, t, false);
+                stolen = t;
+                break;
+            }
+        }
+
+        bitmap &= ~(1u << pri);
+    }
+    run_queue_unlock_pair(victim, cpu);
+
+    return stolen;
+}
+
+/* try to take a thread from another cpu for |cpu|. a victim must meet steal_threshold()
+ * for |lead|; the nearest such victim in cache terms wins, and among equally near ones the
+ * deepest queue. see steal_from_run_queue() for |enqueue|.
+ */
+static thread_t* sched_steal(cpu_num_t cpu, uint32_t lead, bool enqueue, uint32_t reason) {
+    DEBUG_ASSERT(spin_lock_held(&thread_lock));
+
+    cpu_num_t best[3] = {INVALID_CPU, INVALID_CPU, INVALID_CPU};
+    uint32_t best_count[3] = {0, 0, 0};
+
+    uint32_t local_count = percpu[cpu].run_queue_count;
+    cpu_mask_t candidates = mp_get_active_mask() & ~cpu_num_to_mask(cpu);
+    while (candidates) {
+        cpu_num_t victim = lowest_cpu_set(candidates);
+        candidates &= ~cpu_num_to_mask(victim);
+
+        /* the count is only a hint, it is rechecked under the victim's lock */
+        uint32_t count = percpu[victim].run_queue_count;
+        uint distance = MIN(arch_cpu_cache_distance(cpu, victim), 2u);
+        if (count >= steal_threshold(cpu, victim, local_count, lead) &&
+            count > best_count[distance]) {
+            best[distance] = victim;
+            best_count[distance] = count;
+        }
+    }
+
+    for (uint distance = 0; distance < countof(best); distance++) {
+        if (best[distance] == INVALID_CPU)
+            continue;
+
+        thread_t* t = steal_from_run_queue(best[distance], cpu, lead, enqueue);
+        if (t) {
+            CPU_STATS_INC(steals);
+            ktrace(TAG_SCHED_STEAL, (uint32_t)t->user_tid, (best[distance] << 16) | cpu,
+                   effec_priority(t), reason);
+            return t;
+        }
+    }
+
+    return NULL;
+}
+
+/* returns true if another cpu has enough threads waiting for |cpu| to try to steal one.
+ * the counts are read without their locks, so this is only a hint.
+ */
+static bool steal_candidate_exists(cpu_num_t cpu) {
+    cpu_mask_t candidates = mp_get_active_mask() & ~cpu_num_to_mask(cpu);
+    while (candidates) {
+        cpu_num_t victim = lowest_cpu_set(candidates);
+        candidates &= ~cpu_num_to_mask(victim);
+
+        if (percpu[victim].run_queue_count >= steal_threshold(cpu, victim, 0, 1))
+            return true;
+    }
+
+    return false;
+}
+
+/* |t| was just queued on |cpu|, which now has |count| threads waiting. an idle cpu only
+ * looks for work when it goes idle, so if the queue has grown deep enough for an idle cpu
+ * that |t| may run on to steal from it, wake the nearest such cpu. its preemption finds the
+ * work through sched_preempt_needed() and steals it in sched_resched_internal().
+ */
+static void kick_idle_cpu(cpu_num_t cpu, const thread_t* t, uint32_t count) {
+    cpu_mask_t idle = mp_get_idle_mask() & mp_get_active_mask() & t->cpu_affinity &
+                      ~cpu_num_to_mask(cpu) & ~cpu_num_to_mask(arch_curr_cpu_num());
+
+    cpu_num_t best = INVALID_CPU;
+    uint best_distance = UINT_MAX;
+    while (idle) {
+        cpu_num_t candidate = lowest_cpu_set(idle);
+        idle &= ~cpu_num_to_mask(candidate);
+
+        uint distance = arch_cpu_cache_distance(candidate, cpu);
+        if (count >= steal_threshold(candidate, cpu, 0, 1) && distance < best_distance) {
+            best = candidate;
+            best_distance = distance;
+        }
+    }
+
+    if (best != INVALID_CPU)
+        mp_reschedule(MP_IPI_TARGET_MASK, cpu_num_to_mask(best), 0);
+}
+
+/* called periodically on a busy cpu: if another cpu has at least two more threads
+ * waiting than this one, move one of them here.
+ */
+static void sched_balance(cpu_num_t cpu, zx_time_t now) {
+    struct percpu* c = &percpu[cpu];
+    if (now - c->last_balance < SCHED_BALANCE_INTERVAL)
+        return;
+    c->last_balance = now;
+
+    sched_steal(cpu, 2, true, SCHED_STEAL_BALANCE);
+}
+
+/* returns false if preempting the current thread would only pick it again: nothing is
+ * waiting in the local run queue, and the thread either still has time left in its slice
+ * on a cpu its affinity allows, or is the idle thread and no other cpu has work to steal.
+ * takes the local run queue lock but not thread_lock. a thread inserted here after this
+ * returns, or an affinity change, is always followed by a reschedule of this cpu, either
+ * locally or via ipi, so a stale answer is harmless.
+ */
+bool sched_preempt_needed(void) {
+    DEBUG_ASSERT(arch_ints_disabled());
+
+    thread_t* current_thread = get_current_thread();
+    cpu_num_t cpu = arch_curr_cpu_num();
+    if (!thread_is_idle(current_thread) &&
+        (current_thread->remaining_time_slice <= 0 ||
+         (current_thread->cpu_affinity & cpu_num_to_mask(cpu)) == 0)) {
+        return true;
+    }
+
+    struct percpu* c = &percpu[cpu];
+    spin_lock(&c->run_queue_lock);
+    bool empty = (c->run_queue_bitmap == 0);
+    spin_unlock(&c->run_queue_lock);
+
+    if (empty && thread_is_idle(current_thread) && mp_is_cpu_active(cpu))
+        return steal_candidate_exists(cpu);
+
+    return !empty;
+}
+
 void sched_block(void) {
     DEBUG_ASSERT(spin_lock_held(&thread_lock));
 
@@ -403,6 +672,8 @@ void sched_preempt(void) {
         } else {
             insert_in_run_queue_tail(curr_cpu, current_thread);
         }
+
+        sched_balance(curr_cpu, current_time());
     }
 
     sched_resched_internal();
@@ -527,16 +798,7 @@ void sched_migrate(thread_t* t) {
         }
 
         // it's sitting in a run queue somewhere, so pull it out of that one and find a new home
-        DEBUG_ASSERT_MSG(list_in_list(&t->queue_node), "thread %p name %s curr_cpu %u\n", t, t->name, t->curr_cpu);
-        list_delete(&t->queue_node);
-
-        DEBUG_ASSERT(is_valid_cpu_num(t->curr_cpu));
-
-        struct percpu* c = &percpu[t->curr_cpu];
-        int pri = effec_priority(t);
-        if (list_is_empty(&c->run_queue[pri])) {
-            c->run_queue_bitmap &= ~(1u << pri);
-        }
+        remove_from_run_queue(t);
 
         find_cpu_and_insert(t, &local_resched, &accum_cpu_mask);
         break;
@@ -614,6 +876,13 @@ void sched_resched_internal(void) {
     /* pick a new thread to run */
     thread_t* newthread = sched_get_top_thread(cpu);
 
+    /* rather than going idle, see if another cpu has work waiting */
+    if (thread_is_idle(newthread) && mp_is_cpu_active(cpu)) {
+        thread_t* stolen = sched_steal(cpu, 1, false, SCHED_STEAL_IDLE);
+        if (stolen)
+            newthread = stolen;
+    }
+
     DEBUG_ASSERT(newthread);
 
     newthread->state = THREAD_RUNNING;
@@ -738,7 +1007,9 @@ void sched_resched_internal(void) {
 
 void sched_init_early(void) {
     /* initialize the run queues */
-    for (unsigned int cpu = 0; cpu < SMP_MAX_CPUS; cpu++)
+    for (unsigned int cpu = 0; cpu < SMP_MAX_CPUS; cpu++) {
+        spin_lock_init(&percpu[cpu].run_queue_lock);
         for (unsigned int i = 0; i < NUM_PRIORITIES; i++)
             list_initialize(&percpu[cpu].run_queue[i]);
+    }
 }
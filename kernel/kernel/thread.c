@@ -794,6 +794,13 @@ void thread_preempt(void) {
     DEBUG_ASSERT(current_thread->state == THREAD_RUNNING);
     DEBUG_ASSERT(!arch_in_int_handler());
 
+    if (!sched_preempt_needed()) {
+        /* the current thread would just be picked again, so don't bother
+         * contending for the thread lock.
+         */
+        return;
+    }
+
     if (!thread_is_idle(current_thread)) {
         /* only track when a meaningful preempt happens */
         CPU_STATS_INC(irq_preempts);
@@ -855,18 +862,6 @@ static void thread_sleep_handler(timer_t* timer, zx_time_t now,
     spin_unlock(&thread_lock);
 }
 
-#define MIN_SLEEP_SLACK ZX_USEC(1)
-#define MAX_SLEEP_SLACK ZX_SEC(1)
-#define DIV_SLEEP_SLACK 10u
-
-/* computes the amount of slack the thread_sleep timer will use */
-static uint64_t sleep_slack(zx_time_t deadline, zx_time_t now) {
-    if (deadline < now)
-        return MIN_SLEEP_SLACK;
-    zx_duration_t slack = (deadline - now) / DIV_SLEEP_SLACK;
-    return MAX(MIN_SLEEP_SLACK, MIN(slack, MAX_SLEEP_SLACK));
-}
-
 /**
  * @brief  Put thread to sleep; deadline specified in ns
  *
@@ -911,7 +906,7 @@ zx_status_t thread_sleep_etc(zx_time_t deadline, bool interruptable) {
     }
 
     /* set a one shot timer to wake us up and reschedule */
-    uint64_t slack = sleep_slack(deadline, now);
+    uint64_t slack = timer_deadline_slack(deadline, now);
     timer_set(&timer, deadline, TIMER_SLACK_LATE, slack, thread_sleep_handler, current_thread);
 
     current_thread->state = THREAD_SLEEPING;
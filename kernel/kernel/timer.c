@@ -37,7 +37,259 @@
 
 #define LOCAL_TRACE 0
 
-static spin_lock_t timer_lock;
+// Each cpu keeps its pending timers in a hierarchical timing wheel, guarded by
+// its own spinlock.
+//
+// Level |l| of a wheel has TIMER_WHEEL_SLOTS slots, each covering
+// 2^(TIMER_WHEEL_SHIFT + l * TIMER_WHEEL_SLOT_BITS) ns of time, and the slots
+// of a level together cover the time from the wheel's |clk| onwards. A timer
+// goes in the first level whose slots reach far enough, in the slot its
+// scheduled time falls in; timers beyond the last level go in an overflow
+// list. Each slot is a list sorted by scheduled time, and a bitmap per level
+// records which slots are occupied.
+//
+// No pending timer is ever due before |clk|'s slot, so the earliest timer of a
+// level is at the head of its first occupied slot counting from |clk|'s, and
+// the earliest timer of the wheel is the earliest of those heads. Timers never
+// need to cascade to lower levels.
+//
+// Timers that are scheduled in the past are filed in |clk|'s slot.
+
+#define TIMER_WHEEL_LEVELS 4
+#define TIMER_WHEEL_SLOT_BITS 6
+#define TIMER_WHEEL_SLOTS (1u << TIMER_WHEEL_SLOT_BITS)
+#define TIMER_WHEEL_SHIFT 18 // level 0 slots are ~262us wide, level 3 slots ~68s
+
+// timer_t::wheel_slot of a timer in the overflow list.
+#define TIMER_WHEEL_OVERFLOW (TIMER_WHEEL_LEVELS * TIMER_WHEEL_SLOTS)
+
+typedef struct timer_wheel {
+    spin_lock_t lock;
+
+    // Only moves forward, and never past the earliest pending timer.
+    zx_time_t clk;
+
+    uint64_t occupied[TIMER_WHEEL_LEVELS];
+    struct list_node slots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];
+
+    // Timers beyond the last level, sorted by scheduled time.
+    struct list_node overflow;
+} __CPU_ALIGN timer_wheel_t;
+
+static_assert(TIMER_WHEEL_SLOTS == 64, "the occupied bitmaps are uint64_t");
+
+static timer_wheel_t timer_wheels[SMP_MAX_CPUS];
+
+static inline uint wheel_shift(uint level) {
+    return TIMER_WHEEL_SHIFT + level * TIMER_WHEEL_SLOT_BITS;
+}
+
+static inline struct list_node* wheel_list(timer_wheel_t* w, uint32_t wheel_slot) {
+    if (wheel_slot == TIMER_WHEEL_OVERFLOW)
+        return &w->overflow;
+    return &w->slots[wheel_slot / TIMER_WHEEL_SLOTS][wheel_slot % TIMER_WHEEL_SLOTS];
+}
+
+// Returns the occupied slots of |level| as absolute slot numbers' offsets from
+// |clk|'s slot: bit i is set if slot (clk's slot + i) is occupied.
+static inline uint64_t wheel_occupied_from_clk(const timer_wheel_t* w, uint level) {
+    uint c = (w->clk >> wheel_shift(level)) % TIMER_WHEEL_SLOTS;
+    uint64_t bits = w->occupied[level];
+    return c ? (bits >> c) | (bits << (TIMER_WHEEL_SLOTS - c)) : bits;
+}
+
+// Returns the list head of the slot |offset| slots past |clk|'s at |level|.
+static inline struct list_node* wheel_slot_from_clk(timer_wheel_t* w, uint level, uint offset) {
+    uint c = (uint)((w->clk >> wheel_shift(level)) + offset) % TIMER_WHEEL_SLOTS;
+    return &w->slots[level][c];
+}
+
+static timer_t* wheel_first(timer_wheel_t* w) {
+    timer_t* first = list_peek_head_type(&w->overflow, timer_t, node);
+    for (uint l = 0; l < TIMER_WHEEL_LEVELS; l++) {
+        uint64_t bits = wheel_occupied_from_clk(w, l);
+        if (bits == 0)
+            continue;
+        timer_t* t = list_peek_head_type(wheel_slot_from_clk(w, l, __builtin_ctzll(bits)),
+                                         timer_t, node);
+        if (first == NULL || t->scheduled_time < first->scheduled_time)
+            first = t;
+    }
+    return first;
+}
+
+// Moves |clk| up to |now|, but not past the earliest pending timer.
+static void wheel_advance(timer_wheel_t* w, zx_time_t now) {
+    timer_t* first = wheel_first(w);
+    if (first != NULL && first->scheduled_time < now)
+        now = first->scheduled_time;
+    if (now > w->clk)
+        w->clk = now;
+}
+
+static void wheel_add(timer_wheel_t* w, timer_t* timer) {
+    zx_time_t key = MAX(timer->scheduled_time, w->clk);
+
+    uint32_t wheel_slot = TIMER_WHEEL_OVERFLOW;
+    for (uint l = 0; l < TIMER_WHEEL_LEVELS; l++) {
+        uint shift = wheel_shift(l);
+        if ((key >> shift) - (w->clk >> shift) < TIMER_WHEEL_SLOTS) {
+            uint slot = (key >> shift) % TIMER_WHEEL_SLOTS;
+            wheel_slot = l * TIMER_WHEEL_SLOTS + slot;
+            w->occupied[l] |= 1ull << slot;
+            break;
+        }
+    }
+    timer->wheel_slot = wheel_slot;
+
+    // Keep the slot sorted; timers due at the same time stay in the order
+    // they were set.
+    struct list_node* list = wheel_list(w, wheel_slot);
+    timer_t* entry;
+    list_for_every_entry (list, entry, timer_t, node) {
+        if (entry->scheduled_time > timer->scheduled_time) {
+            list_add_before(&entry->node, &timer->node);
+            return;
+        }
+    }
+    list_add_tail(list, &timer->node);
+}
+
+static void wheel_remove(timer_wheel_t* w, timer_t* timer) {
+    list_delete(&timer->node);
+
+    uint32_t wheel_slot = timer->wheel_slot;
+    if (wheel_slot != TIMER_WHEEL_OVERFLOW && list_is_empty(wheel_list(w, wheel_slot))) {
+        w->occupied[wheel_slot / TIMER_WHEEL_SLOTS] &= ~(1ull << (wheel_slot % TIMER_WHEEL_SLOTS));
+    }
+}
+
+// Computes the range of slots of |level| that can hold timers due in
+// [|low|, |high|], as offsets from |clk|'s slot. The range is empty if
+// |first| > |last|.
+static void wheel_range_from_clk(const timer_wheel_t* w, uint level, zx_time_t low, zx_time_t high,
+                                 uint* first, uint* last) {
+    uint shift = wheel_shift(level);
+    uint64_t clk_slot = w->clk >> shift;
+    uint64_t low_slot = low >> shift;
+    uint64_t high_slot = high >> shift;
+    *first = low_slot > clk_slot ? (uint)MIN(low_slot - clk_slot, TIMER_WHEEL_SLOTS) : 0u;
+    *last = high_slot > clk_slot ? (uint)MIN(high_slot - clk_slot, TIMER_WHEEL_SLOTS - 1) : 0u;
+}
+
+// Returns the latest scheduled time in [|low|, |high|] of the pending timers of
+// |w|, if any.
+static bool wheel_find_latest(timer_wheel_t* w, zx_time_t low, zx_time_t high, zx_time_t* found) {
+    bool any = false;
+    timer_t* entry;
+
+    list_for_every_entry (&w->overflow, entry, timer_t, node) {
+        if (entry->scheduled_time > high)
+            break;
+        if (entry->scheduled_time >= low) {
+            *found = entry->scheduled_time;
+            any = true;
+        }
+    }
+
+    for (uint l = 0; l < TIMER_WHEEL_LEVELS; l++) {
+        // The slots that can hold timers due in [low, high], as offsets from
+        // clk's slot. Everything before clk's slot is filed in it.
+        uint first;
+        uint last;
+        wheel_range_from_clk(w, l, low, high, &first, &last);
+        if (first > last)
+            continue;
+
+        uint64_t bits = wheel_occupied_from_clk(w, l);
+        bits &= ~0ull >> (TIMER_WHEEL_SLOTS - 1 - last);
+        bits &= ~0ull << first;
+        while (bits != 0) {
+            uint offset = TIMER_WHEEL_SLOTS - 1 - __builtin_clzll(bits);
+            bool found_here = false;
+            list_for_every_entry (wheel_slot_from_clk(w, l, offset), entry, timer_t, node) {
+                if (entry->scheduled_time > high)
+                    break;
+                if (entry->scheduled_time >= low) {
+                    if (!any || entry->scheduled_time > *found)
+                        *found = entry->scheduled_time;
+                    any = true;
+                    found_here = true;
+                }
+            }
+            // The slots before this one only hold earlier timers.
+            if (found_here)
+                break;
+            bits &= ~(1ull << offset);
+        }
+    }
+    return any;
+}
+
+// Returns the earliest scheduled time in [|low|, |high|] of the pending timers
+// of |w|, if any.
+static bool wheel_find_earliest(timer_wheel_t* w, zx_time_t low, zx_time_t high, zx_time_t* found) {
+    bool any = false;
+    timer_t* entry;
+
+    list_for_every_entry (&w->overflow, entry, timer_t, node) {
+        if (entry->scheduled_time > high)
+            break;
+        if (entry->scheduled_time >= low) {
+            *found = entry->scheduled_time;
+            any = true;
+            break;
+        }
+    }
+
+    for (uint l = 0; l < TIMER_WHEEL_LEVELS; l++) {
+        uint first;
+        uint last;
+        wheel_range_from_clk(w, l, low, high, &first, &last);
+        if (first > last)
+            continue;
+
+        uint64_t bits = wheel_occupied_from_clk(w, l);
+        bits &= ~0ull >> (TIMER_WHEEL_SLOTS - 1 - last);
+        bits &= ~0ull << first;
+        while (bits != 0) {
+            uint offset = __builtin_ctzll(bits);
+            bool found_here = false;
+            list_for_every_entry (wheel_slot_from_clk(w, l, offset), entry, timer_t, node) {
+                if (entry->scheduled_time > high)
+                    break;
+                if (entry->scheduled_time >= low) {
+                    if (!any || entry->scheduled_time < *found)
+                        *found = entry->scheduled_time;
+                    any = true;
+                    found_here = true;
+                    break;
+                }
+            }
+            // The slots after this one only hold later timers.
+            if (found_here)
+                break;
+            bits &= ~(1ull << offset);
+        }
+    }
+    return any;
+}
+
+// Locks the wheel that guards |timer|, if any. Returns NULL, with nothing
+// locked, if the timer is neither queued nor running.
+static timer_wheel_t* timer_lock_wheel(timer_t* timer, spin_lock_saved_state_t* state) {
+    for (;;) {
+        int cpu = timer->cpu;
+        if (cpu < 0)
+            return NULL;
+        timer_wheel_t* w = &timer_wheels[cpu];
+        spin_lock_irqsave(&w->lock, *state);
+        if (timer->cpu == cpu)
+            return w;
+        // The timer moved to another wheel meanwhile.
+        spin_unlock_irqrestore(&w->lock, *state);
+    }
+}
 
 void timer_init(timer_t* timer) {
     *timer = (timer_t)TIMER_INITIAL_VALUE(*timer);
@@ -49,112 +301,72 @@ static void insert_timer_in_queue(uint cpu, timer_t* timer,
     DEBUG_ASSERT(arch_ints_disabled());
     LTRACEF("timer %p, cpu %u, scheduled %" PRIu64 "\n", timer, cpu, timer->scheduled_time);
 
+    timer_wheel_t* w = &timer_wheels[cpu];
+    timer->cpu = cpu;
+    timer->slack = 0;
+
+    if (early_slack == 0 && late_slack == 0) {
+        wheel_add(w, timer);
+        return;
+    }
+
     zx_time_t earliest_deadline = timer->scheduled_time - early_slack;
     zx_time_t latest_deadline = timer->scheduled_time + late_slack;
 
     // For inserting the timer we consider several cases. In general we
-    // want to coalesce with the current timer unless we can prove that
+    // want to coalesce with an existing timer unless we can prove that
     // either that:
-    //  1- there is no slack overlap with current timer OR
-    //  2- the next timer is a better fit.
+    //  1- there is no slack overlap with any existing timer OR
+    //  2- the next timer is a better fit than the previous one.
     //
     // In diagrams that follow
-    // - Let |e| be the current (existing) timer deadline
+    // - Let |p| be the latest existing timer deadline up to |t|, if any
     // - Let |t| be the deadline of the timer we are inserting
-    // - Let |n| be the next timer deadline if any
-    // - Let |x| be the end of the list (not a timer)
+    // - Let |n| be the next timer deadline after |t|, if any
     // - Let |(| and |)| the earliest_deadline and latest_deadline.
     //
-    timer_t* entry;
+    zx_time_t target = timer->scheduled_time;
+    zx_time_t prev;
+    zx_time_t next;
 
-    list_for_every_entry (&percpu[cpu].timer_queue, entry, timer_t, node) {
-        if (entry->scheduled_time > latest_deadline) {
-            // New timer latest is earlier than the current timer.
-            // Just add upfront as is, without slack.
+    if (wheel_find_latest(w, earliest_deadline, timer->scheduled_time, &prev)) {
+        if (prev == timer->scheduled_time) {
+            // Exact match, nothing to adjust.
             //
-            //   ---------t---)--e-------------------------------> time
+            //  --------(----p=t-----)----------------------------> time
             //
-            timer->slack = 0ull;
-            list_add_before(&entry->node, &timer->node);
-            return;
-        }
-
-        if (entry->scheduled_time >= timer->scheduled_time) {
-            //  New timer slack overlaps and is to the left (or equal). We
-            //  coalesce with current by scheduling late.
+        } else if (timer->scheduled_time < latest_deadline &&
+                   wheel_find_earliest(w, timer->scheduled_time + 1, latest_deadline - 1, &next) &&
+                   next - timer->scheduled_time < timer->scheduled_time - prev) {
+            // There is slack overlap with both timers, and the next one is
+            // closer. Coalesce by scheduling late.
             //
-            //  --------(----t---e-)----------------------------> time
+            //  --------------(-p-----t---n-)-----------------------> time
             //
-            timer->slack = entry->scheduled_time - timer->scheduled_time;
-            timer->scheduled_time = entry->scheduled_time;
-            list_add_after(&entry->node, &timer->node);
-            return;
-        }
-
-        if (entry->scheduled_time < earliest_deadline) {
-            // new timer earliest is later than the current timer. This case
-            // is handled in a future iteration.
+            target = next;
+        } else {
+            // There is overlap with the previous timer only, or it is at
+            // least as close as the next one. Coalesce by scheduling early.
             //
-            //   ----------------e--(---t-----------------------> time
+            //  -------------(--p---t----)---n-------------------> time
             //
-            continue;
+            target = prev;
         }
-
-        // New timer is to the right of current timer and there is overlap
-        // with the current timer, but could the next timer (if any) be
-        // a better fit?
-        //
-        //  -------------(--e---t-----?-------------------> time
-        //
-
-        const timer_t* next =
-            list_next_type(&percpu[cpu].timer_queue, &entry->node, timer_t, node);
-
-        if (next != NULL) {
-            if (next->scheduled_time <= timer->scheduled_time) {
-                // The new timer is to the right of the next timer. There is no
-                // chance the current timer is a better fit.
-                //
-                //  -------------(--e---n---t----------------------> time
-                //
-                continue;
-            }
-
-            if (next->scheduled_time < latest_deadline) {
-                // There is slack overlap with the next timer, and also with the
-                // current timer. Which coalescing is a better match?
-                //
-                //  --------------(-e---t---n-)-----------------------> time
-                //
-                zx_duration_t delta_entry = timer->scheduled_time - entry->scheduled_time;
-                zx_duration_t delta_next = next->scheduled_time - timer->scheduled_time;
-                if (delta_next < delta_entry) {
-                    // New timer is closer to the next timer, handle it in the
-                    // next iteration.
-                    continue;
-                }
-            }
-        }
-
-        // Handles the remaining cases, note that there is overlap with
-        // the current timer.
-        //
-        //  1- this is the last timer (next == NULL) or
-        //  2- there is no overlap with the next timer, or
-        //  3- there is overlap with both current and next but
-        //     current is closer.
+    } else if (wheel_find_earliest(w, timer->scheduled_time, latest_deadline, &next)) {
+        //  The slack only overlaps with the next timer. Coalesce by scheduling
+        //  late.
         //
-        //  So we coalesce by scheduling early.
+        //  --------(----t---n-)----------------------------> time
         //
-        timer->slack = entry->scheduled_time - timer->scheduled_time;
-        timer->scheduled_time = entry->scheduled_time;
-        list_add_after(&entry->node, &timer->node);
-        return;
+        target = next;
     }
+    // Otherwise there is no overlap with any timer: add it as is, without slack.
+    //
+    //   ---------t---)--n-------------------------------> time
 
-    // Walked off the end of the list and there was no overlap.
-    timer->slack = 0ull;
-    list_add_tail(&percpu[cpu].timer_queue, &timer->node);
+    timer->slack = (int64_t)(target - timer->scheduled_time);
+    timer->scheduled_time = target;
+    wheel_add(w, timer);
 }
 
 void timer_set(timer_t* timer, zx_time_t deadline,
@@ -196,9 +408,11 @@ void timer_set(timer_t* timer, zx_time_t deadline,
     }
 
     spin_lock_saved_state_t state;
-    spin_lock_irqsave(&timer_lock, state);
+    arch_interrupt_save(&state, SPIN_LOCK_FLAG_INTERRUPTS);
 
     uint cpu = arch_curr_cpu_num();
+    timer_wheel_t* w = &timer_wheels[cpu];
+    spin_lock(&w->lock);
 
     bool currently_active = (timer->active_cpu == (int)cpu);
     if (unlikely(currently_active)) {
@@ -218,16 +432,20 @@ void timer_set(timer_t* timer, zx_time_t deadline,
 
     LTRACEF("scheduled time %" PRIu64 "\n", timer->scheduled_time);
 
+    wheel_advance(w, current_time());
+    timer_t* oldhead = wheel_first(w);
+
     insert_timer_in_queue(cpu, timer, early_slack, late_slack);
 
-    if (list_peek_head_type(&percpu[cpu].timer_queue, timer_t, node) == timer) {
+    if (oldhead == NULL || timer->scheduled_time < oldhead->scheduled_time) {
         /* we just modified the head of the timer queue */
-        LTRACEF("setting new timer for %" PRIu64 " nsecs\n", deadline);
-        platform_set_oneshot_timer(deadline);
+        LTRACEF("setting new timer for %" PRIu64 " nsecs\n", timer->scheduled_time);
+        platform_set_oneshot_timer(timer->scheduled_time);
     }
 
 out:
-    spin_unlock_irqrestore(&timer_lock, state);
+    spin_unlock(&w->lock);
+    arch_interrupt_restore(state, SPIN_LOCK_FLAG_INTERRUPTS);
 }
 
 /* similar to timer_set_oneshot, with additional features/constraints:
@@ -243,17 +461,20 @@ void timer_reset_oneshot_local(timer_t* timer, zx_time_t deadline, timer_callbac
     DEBUG_ASSERT(arch_ints_disabled());
 
     uint cpu = arch_curr_cpu_num();
+    timer_wheel_t* w = &timer_wheels[cpu];
 
     /* no need to disable interrupts when acquiring this lock */
-    spin_lock(&timer_lock);
+    spin_lock(&w->lock);
 
     if (unlikely(timer->active_cpu >= 0)) {
         panic("timer %p currently active\n", timer);
     }
 
     /* remove it from the queue if it was present */
-    if (list_in_list(&timer->node))
-        list_delete(&timer->node);
+    if (list_in_list(&timer->node)) {
+        DEBUG_ASSERT(timer->cpu == (int)cpu);
+        wheel_remove(w, timer);
+    }
 
     /* set up the structure */
     timer->scheduled_time = deadline;
@@ -265,22 +486,35 @@ void timer_reset_oneshot_local(timer_t* timer, zx_time_t deadline, timer_callbac
 
     LTRACEF("scheduled time %" PRIu64 "\n", timer->scheduled_time);
 
+    timer_t* oldhead = wheel_first(w);
+
     insert_timer_in_queue(cpu, timer, 0u, 0u);
 
-    if (list_peek_head_type(&percpu[cpu].timer_queue, timer_t, node) == timer) {
+    if (oldhead == NULL || timer->scheduled_time < oldhead->scheduled_time) {
         /* we just modified the head of the timer queue */
         LTRACEF("setting new timer for %" PRIu64 " nsecs\n", deadline);
         platform_set_oneshot_timer(deadline);
     }
 
-    spin_unlock(&timer_lock);
+    spin_unlock(&w->lock);
 }
 
 bool timer_cancel(timer_t* timer) {
     DEBUG_ASSERT(timer->magic == TIMER_MAGIC);
 
     spin_lock_saved_state_t state;
-    spin_lock_irqsave(&timer_lock, state);
+    timer_wheel_t* w = timer_lock_wheel(timer, &state);
+
+    if (w == NULL) {
+        /* neither queued nor running, there is nothing to synchronize with */
+        timer->cancel = true;
+        smp_mb();
+        arch_spinloop_signal();
+
+        timer->callback = NULL;
+        timer->arg = NULL;
+        return false;
+    }
 
     uint cpu = arch_curr_cpu_num();
 
@@ -297,8 +531,12 @@ bool timer_cancel(timer_t* timer) {
         timer->callback = NULL;
         timer->arg = NULL;
 
+        /* remove it if the callback had set it again */
+        if (list_in_list(&timer->node))
+            wheel_remove(w, timer);
+
         /* we're done, so return back to the callback */
-        spin_unlock_irqrestore(&timer_lock, state);
+        spin_unlock_irqrestore(&w->lock, state);
         return false;
     }
 
@@ -309,10 +547,12 @@ bool timer_cancel(timer_t* timer) {
         callback_not_running = true;
 
         /* save a copy of the old head of the queue */
-        timer_t* oldhead = list_peek_head_type(&percpu[cpu].timer_queue, timer_t, node);
+        timer_t* oldhead = wheel_first(w);
 
         /* remove our timer from the queue */
-        list_delete(&timer->node);
+        wheel_remove(w, timer);
+        if (timer->active_cpu < 0)
+            timer->cpu = -1;
 
         /* TODO(cpu): if  after removing |timer| there is one other single timer with
            the same scheduled_time and slack non-zero then it is possible to return
@@ -320,8 +560,8 @@ bool timer_cancel(timer_t* timer) {
 
         /* see if we've just modified the head of this cpu's timer queue */
         /* if we modified another cpu's queue, we'll just let it fire and sort itself out */
-        if (unlikely(oldhead == timer)) {
-            timer_t* newhead = list_peek_head_type(&percpu[cpu].timer_queue, timer_t, node);
+        if (unlikely(oldhead == timer && w == &timer_wheels[cpu])) {
+            timer_t* newhead = wheel_first(w);
             if (newhead) {
                 LTRACEF("setting new timer to %" PRIu64 "\n", newhead->scheduled_time);
                 platform_set_oneshot_timer(newhead->scheduled_time);
@@ -334,7 +574,7 @@ bool timer_cancel(timer_t* timer) {
         callback_not_running = false;
     }
 
-    spin_unlock_irqrestore(&timer_lock, state);
+    spin_unlock_irqrestore(&w->lock, state);
 
     /* wait for the timer to become un-busy in case a callback is currently active on another cpu */
     while (timer->active_cpu >= 0) {
@@ -357,14 +597,15 @@ enum handler_return timer_tick(zx_time_t now) {
     CPU_STATS_INC(timer_ints);
 
     uint cpu = arch_curr_cpu_num();
+    timer_wheel_t* w = &timer_wheels[cpu];
 
     LTRACEF("cpu %u now %" PRIu64 ", sp %p\n", cpu, now, __GET_FRAME());
 
-    spin_lock(&timer_lock);
+    spin_lock(&w->lock);
 
     for (;;) {
         /* see if there's an event to process */
-        timer = list_peek_head_type(&percpu[cpu].timer_queue, timer_t, node);
+        timer = wheel_first(w);
         if (likely(timer == 0))
             break;
         LTRACEF("next item on timer queue %p at %" PRIu64 " now %" PRIu64 " (%p, arg %p)\n",
@@ -377,14 +618,14 @@ enum handler_return timer_tick(zx_time_t now) {
         DEBUG_ASSERT_MSG(timer && timer->magic == TIMER_MAGIC,
                          "ASSERT: timer failed magic check: timer %p, magic 0x%x\n",
                          timer, (uint)timer->magic);
-        list_delete(&timer->node);
+        wheel_remove(w, timer);
 
-        /* mark the timer busy */
+        /* mark the timer busy; it stays guarded by this wheel while it runs */
         timer->active_cpu = cpu;
         /* spinlock below acts as a memory barrier */
 
         /* we pulled it off the list, release the list lock to handle it */
-        spin_unlock(&timer_lock);
+        spin_unlock(&w->lock);
 
         LTRACEF("dequeued timer %p, scheduled %" PRIu64 "\n", timer, timer->scheduled_time);
 
@@ -395,7 +636,10 @@ enum handler_return timer_tick(zx_time_t now) {
 
         DEBUG_ASSERT(arch_ints_disabled());
         /* it may have been requeued, grab the lock so we can safely inspect it */
-        spin_lock(&timer_lock);
+        spin_lock(&w->lock);
+
+        if (!list_in_list(&timer->node))
+            timer->cpu = -1;
 
         /* mark it not busy */
         timer->active_cpu = -1;
@@ -405,8 +649,10 @@ enum handler_return timer_tick(zx_time_t now) {
         arch_spinloop_signal();
     }
 
+    /* everything due by now has run */
+    wheel_advance(w, now);
+
     /* reset the timer to the next event */
-    timer = list_peek_head_type(&percpu[cpu].timer_queue, timer_t, node);
     if (timer) {
         /* has to be the case or it would have fired already */
         DEBUG_ASSERT(timer->scheduled_time > now);
@@ -417,7 +663,7 @@ enum handler_return timer_tick(zx_time_t now) {
     }
 
     /* we're done manipulating the timer queue */
-    spin_unlock(&timer_lock);
+    spin_unlock(&w->lock);
 
     return INT_NO_RESCHEDULE;
 }
@@ -441,79 +687,128 @@ zx_status_t timer_trylock_or_cancel(timer_t* t, spin_lock_t* lock) {
 
 void timer_transition_off_cpu(uint old_cpu) {
     spin_lock_saved_state_t state;
-    spin_lock_irqsave(&timer_lock, state);
+    arch_interrupt_save(&state, SPIN_LOCK_FLAG_INTERRUPTS);
     uint cpu = arch_curr_cpu_num();
+    DEBUG_ASSERT(cpu != old_cpu);
+
+    timer_wheel_t* w = &timer_wheels[cpu];
+    timer_wheel_t* old_w = &timer_wheels[old_cpu];
 
-    timer_t* old_head = list_peek_head_type(&percpu[cpu].timer_queue, timer_t, node);
+    /* always take the wheel locks in cpu order */
+    spin_lock(cpu < old_cpu ? &w->lock : &old_w->lock);
+    spin_lock(cpu < old_cpu ? &old_w->lock : &w->lock);
+
+    wheel_advance(w, current_time());
+    timer_t* old_head = wheel_first(w);
 
-    timer_t *entry = NULL, *tmp_entry = NULL;
     /* Move all timers from old_cpu to this cpu */
-    list_for_every_entry_safe (&percpu[old_cpu].timer_queue, entry, tmp_entry, timer_t, node) {
-        list_delete(&entry->node);
+    timer_t* entry;
+    while ((entry = wheel_first(old_w)) != NULL) {
+        wheel_remove(old_w, entry);
         // We lost the original asymmetric slack information so when we combine them
         // with the other timer queue they are not coalesced again.
         // TODO(cpu): figure how important this case is.
         insert_timer_in_queue(cpu, entry, 0u, 0u);
     }
 
-    timer_t* new_head = list_peek_head_type(&percpu[cpu].timer_queue, timer_t, node);
+    timer_t* new_head = wheel_first(w);
     if (new_head != NULL && new_head != old_head) {
         /* we just modified the head of the timer queue */
         LTRACEF("setting new timer for %" PRIu64 " nsecs\n", new_head->scheduled_time);
         platform_set_oneshot_timer(new_head->scheduled_time);
     }
 
-    spin_unlock_irqrestore(&timer_lock, state);
+    spin_unlock(&old_w->lock);
+    spin_unlock(&w->lock);
+    arch_interrupt_restore(state, SPIN_LOCK_FLAG_INTERRUPTS);
 }
 
 void timer_thaw_percpu(void) {
     DEBUG_ASSERT(arch_ints_disabled());
-    spin_lock(&timer_lock);
 
     uint cpu = arch_curr_cpu_num();
+    timer_wheel_t* w = &timer_wheels[cpu];
 
-    timer_t* t = list_peek_head_type(&percpu[cpu].timer_queue, timer_t, node);
+    spin_lock(&w->lock);
+
+    timer_t* t = wheel_first(w);
     if (t) {
         LTRACEF("rescheduling timer for %" PRIu64 " nsecs\n", t->scheduled_time);
         platform_set_oneshot_timer(t->scheduled_time);
     }
 
-    spin_unlock(&timer_lock);
+    spin_unlock(&w->lock);
+}
+
+#define MIN_DEADLINE_SLACK ZX_USEC(1)
+#define MAX_DEADLINE_SLACK ZX_SEC(1)
+#define DIV_DEADLINE_SLACK 10u
+
+uint64_t timer_deadline_slack(zx_time_t deadline, zx_time_t now) {
+    if (deadline < now)
+        return MIN_DEADLINE_SLACK;
+    zx_duration_t slack = (deadline - now) / DIV_DEADLINE_SLACK;
+    return MAX(MIN_DEADLINE_SLACK, MIN(slack, MAX_DEADLINE_SLACK));
 }
 
 void timer_queue_init(void) {
-    timer_lock = SPIN_LOCK_INITIAL_VALUE;
     for (uint i = 0; i < SMP_MAX_CPUS; i++) {
-        list_initialize(&percpu[i].timer_queue);
+        timer_wheel_t* w = &timer_wheels[i];
+        w->lock = SPIN_LOCK_INITIAL_VALUE;
+        w->clk = 0;
+        for (uint l = 0; l < TIMER_WHEEL_LEVELS; l++) {
+            w->occupied[l] = 0;
+            for (uint s = 0; s < TIMER_WHEEL_SLOTS; s++) {
+                list_initialize(&w->slots[l][s]);
+            }
+        }
+        list_initialize(&w->overflow);
     }
 }
 
+static size_t dump_timer(char* buf, size_t len, const timer_t* t, zx_time_t now) {
+    zx_duration_t delta_now = (t->scheduled_time > now) ? (t->scheduled_time - now) : 0;
+    return snprintf(buf, len, "\ttime %" PRIu64 " delta_now %" PRIu64 " slack %" PRIi64
+                    " func %p arg %p\n",
+                    t->scheduled_time, delta_now, t->slack, t->callback, t->arg);
+}
+
 // print a timer queue dump into the passed in buffer
 static void dump_timer_queues(char* buf, size_t len) {
     size_t ptr = 0;
     zx_time_t now = current_time();
 
-    spin_lock_saved_state_t state;
-    spin_lock_irqsave(&timer_lock, state);
-
     for (uint i = 0; i < SMP_MAX_CPUS; i++) {
-        if (mp_is_cpu_online(i)) {
-            ptr += snprintf(buf + ptr, len - ptr, "cpu %u:\n", i);
-
-            timer_t* t;
-            zx_time_t last = now;
-            list_for_every_entry (&percpu[i].timer_queue, t, timer_t, node) {
-                zx_duration_t delta_now = (t->scheduled_time > now) ? (t->scheduled_time - now) : 0;
-                zx_duration_t delta_last = (t->scheduled_time > last) ? (t->scheduled_time - last) : 0;
-                ptr += snprintf(buf + ptr, len - ptr,
-                                "\ttime %" PRIu64 " delta_now %" PRIu64 " delta_last %" PRIu64 " func %p arg %p\n",
-                                t->scheduled_time, delta_now, delta_last, t->callback, t->arg);
-                last = t->scheduled_time;
+        if (!mp_is_cpu_online(i))
+            continue;
+
+        timer_wheel_t* w = &timer_wheels[i];
+        spin_lock_saved_state_t state;
+        spin_lock_irqsave(&w->lock, state);
+
+        ptr += snprintf(buf + ptr, len - ptr, "cpu %u:\n", i);
+
+        // Each level in time order, then the overflow list.
+        timer_t* t;
+        for (uint l = 0; l < TIMER_WHEEL_LEVELS && ptr < len; l++) {
+            for (uint offset = 0; offset < TIMER_WHEEL_SLOTS && ptr < len; offset++) {
+                list_for_every_entry (wheel_slot_from_clk(w, l, offset), t, timer_t, node) {
+                    if (ptr >= len)
+                        break;
+                    ptr += dump_timer(buf + ptr, len - ptr, t, now);
+                }
             }
         }
-    }
+        list_for_every_entry (&w->overflow, t, timer_t, node) {
+            if (ptr >= len)
+                break;
+            ptr += dump_timer(buf + ptr, len - ptr, t, now);
+        }
 
-    spin_unlock_irqrestore(&timer_lock, state);
+        spin_unlock_irqrestore(&w->lock, state);
+        if (ptr >= len)
+            break;
+    }
 }
 
 #if WITH_LIB_CONSOLE
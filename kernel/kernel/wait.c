@@ -49,7 +49,8 @@ static zx_status_t wait_queue_block_worker(wait_queue_t* wait, zx_time_t deadlin
     DEBUG_ASSERT(arch_ints_disabled());
     DEBUG_ASSERT(spin_lock_held(&thread_lock));
 
-    if (deadline != ZX_TIME_INFINITE && deadline <= current_time()) {
+    zx_time_t now = current_time();
+    if (deadline != ZX_TIME_INFINITE && deadline <= now) {
         return ZX_ERR_TIMED_OUT;
     }
 
@@ -68,10 +69,14 @@ static zx_status_t wait_queue_block_worker(wait_queue_t* wait, zx_time_t deadlin
     current_thread->blocking_wait_queue = wait;
     current_thread->blocked_status = ZX_OK;
 
-    /* if the deadline is nonzero or noninfinite, set a callback to yank us out of the queue */
+    /* if the deadline is nonzero or noninfinite, set a callback to yank us out of the queue.
+     * like thread_sleep, let the timeout fire a little late so it can share an interrupt
+     * with other timers.
+     */
     if (deadline != ZX_TIME_INFINITE) {
         timer_init(&timer);
-        timer_set_oneshot(&timer, deadline, wait_queue_timeout_handler, (void*)current_thread);
+        timer_set(&timer, deadline, TIMER_SLACK_LATE, timer_deadline_slack(deadline, now),
+                  wait_queue_timeout_handler, (void*)current_thread);
     }
 
     ktrace(TAG_KWAIT_BLOCK, (uintptr_t)wait >> 32, (uintptr_t)wait, 0, 0);
@@ -148,8 +148,9 @@ void Arena::Pool::Init(const char* name, fbl::RefPtr<VmMapping> mapping,
     strlcpy(const_cast<char*>(name_), name, sizeof(name_));
     slot_size_ = slot_size;
     mapping_ = mapping;
-    committed_max_ = committed_ = top_ = start_ =
+    committed_max_ = committed_ = start_ =
         reinterpret_cast<char*>(mapping_->base());
+    top_.store(reinterpret_cast<uintptr_t>(start_), fbl::memory_order_relaxed);
     end_ = start_ + mapping_->size();
 
     DEBUG_ASSERT(IS_PAGE_ALIGNED(start_));
@@ -163,11 +164,12 @@ static const size_t kPoolDecommitThreshold = 8 * PAGE_SIZE;
 static_assert(kPoolCommitIncrease < kPoolDecommitThreshold, "");
 
 void* Arena::Pool::Pop() {
-    if (static_cast<size_t>(end_ - top_) < slot_size_) {
+    char* top = reinterpret_cast<char*>(top_.load(fbl::memory_order_relaxed));
+    if (static_cast<size_t>(end_ - top) < slot_size_) {
         LTRACEF("%s: no room\n", name_);
         return nullptr;
     }
-    if (top_ + slot_size_ > committed_) {
+    if (top + slot_size_ > committed_) {
         // We've hit the end of our committed pages; commit some more.
         char* nc = committed_ + kPoolCommitIncrease;
         if (nc > end_) {
@@ -191,18 +193,19 @@ void* Arena::Pool::Pop() {
             committed_max_ = committed_;
         }
     }
-    char* slot = top_;
-    top_ += slot_size_;
-    return slot;
+    top_.store(reinterpret_cast<uintptr_t>(top + slot_size_), fbl::memory_order_relaxed);
+    return top;
 }
 
 void Arena::Pool::Push(void* p) {
     // Can only push the most-recently-popped slot.
-    ASSERT(reinterpret_cast<char*>(p) + slot_size_ == top_);
-    top_ -= slot_size_;
-    if (static_cast<size_t>(committed_ - top_) >= kPoolDecommitThreshold) {
+    char* top = reinterpret_cast<char*>(top_.load(fbl::memory_order_relaxed));
+    ASSERT(reinterpret_cast<char*>(p) + slot_size_ == top);
+    top -= slot_size_;
+    top_.store(reinterpret_cast<uintptr_t>(top), fbl::memory_order_relaxed);
+    if (static_cast<size_t>(committed_ - top) >= kPoolDecommitThreshold) {
         char* nc = reinterpret_cast<char*>(
-            ROUNDUP(reinterpret_cast<uintptr_t>(top_ + kPoolCommitIncrease),
+            ROUNDUP(reinterpret_cast<uintptr_t>(top + kPoolCommitIncrease),
                     PAGE_SIZE));
         if (nc > end_) {
             nc = end_;
@@ -223,8 +226,9 @@ void Arena::Pool::Dump() const {
     printf("  pool '%s' slot size %zu, %zu pages committed:\n",
            name_, slot_size_, mapping_->AllocatedPages());
     printf("  |     start 0x%p\n", start_);
-    size_t nslots = static_cast<size_t>(top_ - start_) / slot_size_;
-    printf("  |       top 0x%p (%zu slots popped)\n", top_, nslots);
+    char* top = reinterpret_cast<char*>(top_.load(fbl::memory_order_relaxed));
+    size_t nslots = static_cast<size_t>(top - start_) / slot_size_;
+    printf("  |       top 0x%p (%zu slots popped)\n", top, nslots);
     const size_t np = static_cast<size_t>(committed_ - start_) / PAGE_SIZE;
     const size_t npmax = static_cast<size_t>(committed_max_ - start_) / PAGE_SIZE;
     printf("  | committed 0x%p (%zu pages; %zu pages max)\n",
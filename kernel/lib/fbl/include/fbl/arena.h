@@ -11,6 +11,7 @@
 #include <vm/vm_address_region.h>
 
 #include <zxcpp/new.h>
+#include <fbl/atomic.h>
 #include <fbl/intrusive_single_list.h>
 #include <fbl/ref_ptr.h>
 #include <fbl/type_support.h>
@@ -34,6 +35,9 @@ public:
     zx_status_t Init(const char* name, size_t ob_size, size_t max_count);
     void* Alloc();
     void Free(void* addr);
+
+    // Unlike the other methods, may be called without serializing against
+    // Alloc() and Free(); the answer may then be stale.
     bool in_range(void* addr) const {
         return data_.InRange(static_cast<char*>(addr));
     }
@@ -82,9 +86,11 @@ private:
         void Push(void* p);
 
         // Returns true if |addr| could have been returned by Pop and has
-        // not been reclaimed by Push.
+        // not been reclaimed by Push. Safe to call concurrently with
+        // Pop and Push.
         bool InRange(void* addr) const {
-            return (addr >= start_ && addr < top_);
+            return (addr >= start_ &&
+                    reinterpret_cast<uintptr_t>(addr) < top_.load(fbl::memory_order_relaxed));
         }
 
         // The lowest address of the memory managed by this Pool.
@@ -104,7 +110,9 @@ private:
         fbl::RefPtr<VmMapping> mapping_;
         size_t slot_size_;
         char* start_;
-        char* top_;           // |start|..|top| contains all allocated slots.
+        // |start|..|top| contains all allocated slots. Atomic so that
+        // InRange can read it while another thread pops or pushes.
+        fbl::atomic<uintptr_t> top_;
         char* committed_;     // |start|..|mapped| is committed.
         char* committed_max_; // Largest committed_ value seen.
         char* end_;           // |mapped|..|end| is not committed.
@@ -17,9 +17,12 @@
 #include <err.h>
 #include <kernel/mutex.h>
 #include <kernel/spinlock.h>
+#include <kernel/align.h>
 #include <kernel/thread.h>
 #include <vm/vm.h>
+#include <lib/counters.h>
 #include <lib/heap.h>
+#include <lk/init.h>
 #include <platform.h>
 #include <trace.h>
 
@@ -113,6 +116,18 @@
 //   Exception: to avoid OS free/alloc churn when right on the edge, the heap
 //   will try to hold onto one entirely-free, non-large OS allocation instead of
 //   returning it to the OS. See cached_os_alloc.
+//
+// Per-cpu caches:
+//   Small memory areas (usable size up to CACHE_MAX_SIZE) are not returned to
+//   the buckets on free. They are pushed onto a per-cpu list for their size
+//   class and handed straight back out by the next cmpct_alloc() of that class
+//   on the same cpu, without taking theheap.lock. A cache miss takes the lock
+//   once and carves out CACHE_BATCH areas.
+//
+//   Cached areas are still tagged as allocated, so they do not coalesce with
+//   their neighbors until they are flushed back to the buckets. That happens
+//   when a size class overflows CACHE_DEPTH, every CACHE_FLUSH_INTERVAL frees
+//   on a cpu, on cmpct_trim(), and before the heap gives up on growing.
 
 #if defined(DEBUG) || LK_DEBUGLEVEL > 2
 #define CMPCT_DEBUG
@@ -205,6 +220,70 @@ struct heap {
 // Heap static vars.
 static struct heap theheap;
 
+// Areas with up to this many usable bytes are cached per cpu. The size
+// classes are the first CACHE_BUCKETS free buckets; an area is cached in the
+// class its size rounds down to and found by requests that round up to it, so
+// every area in a class can satisfy every request for it.
+#define CACHE_MAX_SIZE 512
+#define CACHE_BUCKETS 32
+
+// Maximum number of areas held per size class, per cpu.
+#define CACHE_DEPTH 16
+
+// Number of areas moved between a cpu cache and the buckets at a time.
+#define CACHE_BATCH 8
+
+// Number of frees into a cpu cache after which the whole cache is flushed,
+// letting long-idle areas coalesce.
+#define CACHE_FLUSH_INTERVAL 4096
+
+// Overlays the payload of a cached memory area.
+typedef struct cache_entry {
+    struct cache_entry* next;
+    // cache_tag(entry) while the area sits in a cpu cache, so that freeing it
+    // again can be caught like freeing an area in the buckets twice.
+    uintptr_t tag;
+} cache_entry_t;
+
+// Must fit in the part of the payload that the free fill check skips.
+static_assert(sizeof(cache_entry_t) <= sizeof(free_t) - sizeof(header_t), "");
+
+static inline uintptr_t cache_tag(const cache_entry_t* entry) {
+    return (uintptr_t)entry ^ 0xcac4edcac4edcac4;
+}
+
+static inline bool is_cached(const header_t* header) {
+    const cache_entry_t* entry = (const cache_entry_t*)(header + 1);
+    return entry->tag == cache_tag(entry);
+}
+
+typedef struct heap_cache {
+    // Guards all elements in this structure. Only contended when another cpu
+    // drains this cache.
+    spin_lock_t lock;
+
+    // LIFO lists of cached areas, indexed by free bucket.
+    cache_entry_t* lists[CACHE_BUCKETS];
+    uint32_t count[CACHE_BUCKETS];
+
+    // Total size of the cached areas, including headers.
+    size_t bytes;
+
+    // Areas pushed onto this cache since it was last flushed in full.
+    uint32_t frees;
+} __CPU_ALIGN heap_cache_t;
+
+static heap_cache_t heap_caches[SMP_MAX_CPUS];
+
+// Set once the cpu caches may be used. See cmpct_set_cache_enabled(). Read
+// once per allocation or free, and again under a cache's lock before anything
+// is pushed onto it, so that no area is left in a cache once it is disabled.
+static volatile bool heap_cache_enabled;
+
+KCOUNTER(heap_cache_alloc_hit, "kernel.heap.cache.alloc_hit");
+KCOUNTER(heap_cache_alloc_miss, "kernel.heap.cache.alloc_miss");
+KCOUNTER(heap_cache_flush, "kernel.heap.cache.flush");
+
 static ssize_t heap_grow(size_t len, free_t** bucket);
 
 static void lock(void) TA_ACQ(theheap.lock) {
@@ -244,15 +323,34 @@ void cmpct_dump(bool panic_time) TA_NO_THREAD_SAFETY_ANALYSIS {
         }
     }
 
+    // The cpu caches are read without their locks; the numbers are only a
+    // snapshot anyway.
+    dprintf(INFO, "\tcpu caches:\n");
+    for (uint i = 0; i < SMP_MAX_CPUS; i++) {
+        const heap_cache_t* cache = &heap_caches[i];
+        if (cache->bytes != 0) {
+            dprintf(INFO, "\t\tcpu %u: %zu bytes\n", i, cache->bytes);
+        }
+    }
+
     if (!panic_time) {
         unlock();
     }
 }
 
+// Returns the total size of the areas held in the cpu caches.
+static size_t cache_bytes(void) {
+    size_t bytes = 0;
+    for (uint i = 0; i < SMP_MAX_CPUS; i++) {
+        bytes += heap_caches[i].bytes;
+    }
+    return bytes;
+}
+
 void cmpct_get_info(size_t* size_bytes, size_t* free_bytes) {
     lock();
     *size_bytes = theheap.size;
-    *free_bytes = theheap.remaining;
+    *free_bytes = theheap.remaining + cache_bytes();
     unlock();
 }
 
@@ -741,6 +839,9 @@ static void cmpct_test_return_to_os(void) {
 }
 
 void cmpct_test(void) {
+    // The tests below expect frees to go straight to the buckets.
+    bool cache_enabled = cmpct_set_cache_enabled(false);
+
     cmpct_test_buckets();
     cmpct_test_get_back_newly_freed();
     cmpct_test_return_to_os();
@@ -799,6 +900,7 @@ void cmpct_test(void) {
     }
 
     cmpct_dump(false);
+    cmpct_set_cache_enabled(cache_enabled);
 }
 
 static void check_free_fill(void* ptr, size_t size) {
@@ -850,11 +952,272 @@ static void* large_alloc(size_t size) {
     return result;
 }
 
+// Returns the memory area at |header| to the buckets, coalescing it with its
+// free neighbors.
+static void free_locked(header_t* header) TA_REQ(theheap.lock) {
+    size_t size = header->size;
+    header_t* left = header->left;
+    if (left != NULL && is_tagged_as_free(left)) {
+        // Coalesce with left free object.
+        unlink_free_unknown_bucket((free_t*)left);
+        header_t* right = right_header(header);
+        if (is_tagged_as_free(right)) {
+            // Coalesce both sides.
+            unlink_free_unknown_bucket((free_t*)right);
+            header_t* right_right = right_header(right);
+            FixLeftPointer(right_right, left);
+            free_memory(left, left->left, left->size + size + right->size);
+        } else {
+            // Coalesce only left.
+            FixLeftPointer(right, left);
+            free_memory(left, left->left, left->size + size);
+        }
+    } else {
+        header_t* right = right_header(header);
+        if (is_tagged_as_free(right)) {
+            // Coalesce only right.
+            header_t* right_right = right_header(right);
+            unlink_free_unknown_bucket((free_t*)right);
+            FixLeftPointer(right_right, header);
+            free_memory(header, left, size + right->size);
+        } else {
+            free_memory(header, left, size);
+        }
+    }
+}
+
+// Returns a chain of areas taken out of the cpu caches to the buckets.
+static void cache_return_locked(cache_entry_t* entry) TA_REQ(theheap.lock) {
+    while (entry != NULL) {
+        cache_entry_t* next = entry->next;
+        free_locked((header_t*)entry - 1);
+        entry = next;
+    }
+}
+
+// Unlinks the areas of |cache| past the first |keep| in size class |bucket|,
+// appending them to |*chain|.
+static void cache_detach_locked(heap_cache_t* cache, int bucket, uint32_t keep,
+                                cache_entry_t** chain) {
+    cache_entry_t** link = &cache->lists[bucket];
+    for (uint32_t i = 0; i < keep && *link != NULL; i++) {
+        link = &(*link)->next;
+    }
+    cache_entry_t* entry = *link;
+    *link = NULL;
+    while (entry != NULL) {
+        cache_entry_t* next = entry->next;
+        cache->bytes -= ((header_t*)entry - 1)->size;
+        cache->count[bucket]--;
+        entry->tag = 0;
+        entry->next = *chain;
+        *chain = entry;
+        entry = next;
+    }
+}
+
+// Flushes every cpu cache back to the buckets. Returns true if anything was
+// flushed.
+static bool cache_drain_all_locked(void) TA_REQ(theheap.lock) {
+    cache_entry_t* chain = NULL;
+    for (uint i = 0; i < SMP_MAX_CPUS; i++) {
+        heap_cache_t* cache = &heap_caches[i];
+        spin_lock_saved_state_t state;
+        spin_lock_irqsave(&cache->lock, state);
+        for (int bucket = 0; bucket < CACHE_BUCKETS; bucket++) {
+            cache_detach_locked(cache, bucket, 0, &chain);
+        }
+        cache->frees = 0;
+        spin_unlock_irqrestore(&cache->lock, state);
+    }
+    if (chain == NULL) {
+        return false;
+    }
+    kcounter_add(heap_cache_flush, 1);
+    cache_return_locked(chain);
+    return true;
+}
+
+// Carves an area of at least |rounded_up| bytes (including the header) out of
+// the buckets, growing the heap if needed. Returns the payload, or NULL.
+static void* alloc_locked(size_t size, int start_bucket, size_t rounded_up)
+    TA_REQ(theheap.lock) {
+    int bucket = find_nonempty_bucket(start_bucket);
+    if (bucket == -1) {
+        // Grow heap by at least 12% if we can.
+        size_t growby = MIN(HEAP_LARGE_ALLOC_BYTES,
+                            MAX(theheap.size >> 3,
+                                MAX(HEAP_GROW_SIZE, rounded_up)));
+        // Try to add a new OS allocation to the heap, reducing the size until
+        // we succeed or get too small.
+        while (heap_grow(growby, NULL) < 0) {
+            if (growby <= rounded_up) {
+                // Last resort: whatever the cpu caches are sitting on.
+                if (!cache_drain_all_locked()) {
+                    return NULL;
+                }
+                break;
+            }
+            growby = MAX(growby >> 1, rounded_up);
+        }
+        bucket = find_nonempty_bucket(start_bucket);
+        if (bucket == -1) {
+            return NULL;
+        }
+    }
+    free_t* head = theheap.free_lists[bucket];
+    size_t left_over = head->header.size - rounded_up;
+    // We can't carve off the rest for a new free space if it's smaller than the
+    // free-list linked structure.  We also don't carve it off if it's less than
+    // 1.6% the size of the allocation.  This is to avoid small long-lived
+    // allocations being placed right next to large allocations, hindering
+    // coalescing and returning pages to the OS.
+    if (left_over >= sizeof(free_t) && left_over > (size >> 6)) {
+        header_t* right = right_header(&head->header);
+        unlink_free(head, bucket);
+        void* free = (char*)head + rounded_up;
+        create_free_area(free, head, left_over, NULL);
+        FixLeftPointer(right, (header_t*)free);
+        head->header.size -= left_over;
+    } else {
+        unlink_free(head, bucket);
+    }
+    return create_allocation_header(head, 0, head->header.size, head->header.left);
+}
+
+// Pops an area of size class |bucket| off the current cpu's cache. Returns the
+// payload, or NULL if the class is empty.
+static void* cache_alloc(int bucket) {
+    // We may migrate after picking the cache; that only costs us a remote
+    // (but still correctly locked) access.
+    heap_cache_t* cache = &heap_caches[arch_curr_cpu_num()];
+    spin_lock_saved_state_t state;
+    spin_lock_irqsave(&cache->lock, state);
+    cache_entry_t* entry = cache->lists[bucket];
+    if (entry != NULL) {
+        cache->lists[bucket] = entry->next;
+        cache->count[bucket]--;
+        cache->bytes -= ((header_t*)entry - 1)->size;
+        entry->tag = 0;
+    }
+    spin_unlock_irqrestore(&cache->lock, state);
+    return entry;
+}
+
+// Pushes the areas in |chain| onto the current cpu's cache in size class
+// |bucket|. Returns a chain of areas that the caller must return to the
+// buckets, or NULL. If the caches were disabled since the caller checked,
+// that is all of |chain|.
+static cache_entry_t* cache_push(cache_entry_t* chain, int bucket) {
+    cache_entry_t* flush = NULL;
+    heap_cache_t* cache = &heap_caches[arch_curr_cpu_num()];
+    spin_lock_saved_state_t state;
+    spin_lock_irqsave(&cache->lock, state);
+    if (!heap_cache_enabled) {
+        // cmpct_set_cache_enabled() drains every cache after clearing the
+        // flag, taking this lock, so nothing pushed from here on would be.
+        spin_unlock_irqrestore(&cache->lock, state);
+        return chain;
+    }
+    while (chain != NULL) {
+        cache_entry_t* next = chain->next;
+        chain->tag = cache_tag(chain);
+        chain->next = cache->lists[bucket];
+        cache->lists[bucket] = chain;
+        cache->count[bucket]++;
+        cache->bytes += ((header_t*)chain - 1)->size;
+        cache->frees++;
+        chain = next;
+    }
+    if (cache->frees >= CACHE_FLUSH_INTERVAL) {
+        for (int i = 0; i < CACHE_BUCKETS; i++) {
+            cache_detach_locked(cache, i, 0, &flush);
+        }
+        cache->frees = 0;
+    } else if (cache->count[bucket] > CACHE_DEPTH) {
+        // Keep the most recently freed (and most likely cache-hot) areas.
+        cache_detach_locked(cache, bucket, CACHE_DEPTH - CACHE_BATCH, &flush);
+    }
+    spin_unlock_irqrestore(&cache->lock, state);
+    return flush;
+}
+
+static cache_entry_t* cache_free(header_t* header, int bucket) {
+    cache_entry_t* entry = (cache_entry_t*)(header + 1);
+#ifdef CMPCT_DEBUG
+    memset(entry, FREE_FILL, header->size - sizeof(header_t));
+#endif
+    entry->next = NULL;
+    return cache_push(entry, bucket);
+}
+
+// Allocates an area for a request that missed the current cpu's cache, and
+// stocks the cache with up to CACHE_BATCH - 1 more areas of the same size
+// class while we hold the lock. Returns the payload, or NULL.
+static void* cache_refill(size_t size, int bucket, size_t rounded_up) {
+    cache_entry_t* chain = NULL;
+    lock();
+    void* result = alloc_locked(size, bucket, rounded_up);
+    // Only take areas that are already in the buckets; don't grow the heap just
+    // to fill a cache.
+    for (int i = 1; result != NULL && i < CACHE_BATCH; i++) {
+        if (find_nonempty_bucket(bucket) == -1) {
+            break;
+        }
+        cache_entry_t* entry = (cache_entry_t*)alloc_locked(
+            rounded_up - sizeof(header_t), bucket, rounded_up);
+        entry->next = chain;
+        chain = entry;
+    }
+    unlock();
+    if (chain != NULL) {
+        // Fresh areas come from the buckets, so they already carry FREE_FILL
+        // past the link word.
+        cache_entry_t* flush = cache_push(chain, bucket);
+        if (flush != NULL) {
+            kcounter_add(heap_cache_flush, 1);
+            lock();
+            cache_return_locked(flush);
+            unlock();
+        }
+    }
+    return result;
+}
+
+bool cmpct_set_cache_enabled(bool enabled) {
+    lock();
+    bool was_enabled = heap_cache_enabled;
+    heap_cache_enabled = enabled;
+    if (!enabled) {
+        cache_drain_all_locked();
+    }
+    unlock();
+    return was_enabled;
+}
+
+static void cmpct_cache_init(uint level) {
+    size_t rounded_up;
+    DEBUG_ASSERT(size_to_index_allocating(CACHE_MAX_SIZE, &rounded_up) ==
+                 CACHE_BUCKETS - 1);
+    DEBUG_ASSERT(size_to_index_freeing(CACHE_MAX_SIZE) == CACHE_BUCKETS - 1);
+
+    for (uint i = 0; i < SMP_MAX_CPUS; i++) {
+        spin_lock_init(&heap_caches[i].lock);
+    }
+    heap_cache_enabled = true;
+}
+
+// Not done in cmpct_init(): the heap comes up before the per-cpu state that
+// arch_curr_cpu_num() relies on is guaranteed to be.
+LK_INIT_HOOK(cmpct_cache, cmpct_cache_init, LK_INIT_LEVEL_KERNEL);
+
 void cmpct_trim(void) {
     // Look at free list entries that are at least as large as one page plus a
     // header. They might be at the start or the end of a block, so we can trim
-    // them and free the page(s).
+    // them and free the page(s). Flush the cpu caches first so their areas get
+    // a chance to coalesce into such entries.
     lock();
+    cache_drain_all_locked();
     for (int bucket = size_to_index_freeing(PAGE_SIZE);
          bucket < NUMBER_OF_BUCKETS;
          bucket++) {
@@ -962,50 +1325,31 @@ void* cmpct_alloc(size_t size) {
 
     rounded_up += sizeof(header_t);
 
-    lock();
-    int bucket = find_nonempty_bucket(start_bucket);
-    if (bucket == -1) {
-        // Grow heap by at least 12% if we can.
-        size_t growby = MIN(HEAP_LARGE_ALLOC_BYTES,
-                            MAX(theheap.size >> 3,
-                                MAX(HEAP_GROW_SIZE, rounded_up)));
-        // Try to add a new OS allocation to the heap, reducing the size until
-        // we succeed or get too small.
-        while (heap_grow(growby, NULL) < 0) {
-            if (growby <= rounded_up) {
-                unlock();
-                return NULL;
-            }
-            growby = MAX(growby >> 1, rounded_up);
+    const bool use_cache = heap_cache_enabled;
+    void* result;
+    if (start_bucket < CACHE_BUCKETS && use_cache) {
+        result = cache_alloc(start_bucket);
+        if (result != NULL) {
+            kcounter_add(heap_cache_alloc_hit, 1);
+        } else {
+            kcounter_add(heap_cache_alloc_miss, 1);
+            result = cache_refill(size, start_bucket, rounded_up);
         }
-        bucket = find_nonempty_bucket(start_bucket);
-    }
-    free_t* head = theheap.free_lists[bucket];
-    size_t left_over = head->header.size - rounded_up;
-    // We can't carve off the rest for a new free space if it's smaller than the
-    // free-list linked structure.  We also don't carve it off if it's less than
-    // 1.6% the size of the allocation.  This is to avoid small long-lived
-    // allocations being placed right next to large allocations, hindering
-    // coalescing and returning pages to the OS.
-    if (left_over >= sizeof(free_t) && left_over > (size >> 6)) {
-        header_t* right = right_header(&head->header);
-        unlink_free(head, bucket);
-        void* free = (char*)head + rounded_up;
-        create_free_area(free, head, left_over, NULL);
-        FixLeftPointer(right, (header_t*)free);
-        head->header.size -= left_over;
     } else {
-        unlink_free(head, bucket);
+        lock();
+        result = alloc_locked(size, start_bucket, rounded_up);
+        unlock();
+    }
+    if (result == NULL) {
+        return NULL;
     }
-    void* result =
-        create_allocation_header(head, 0, head->header.size, head->header.left);
 #ifdef CMPCT_DEBUG
+    header_t* header = (header_t*)result - 1;
     check_free_fill(result, size);
     memset(result, ALLOC_FILL, size);
     memset(((char*)result) + size, PADDING_FILL,
-           rounded_up - size - sizeof(header_t));
+           header->size - size - sizeof(header_t));
 #endif
-    unlock();
     return result;
 }
 
@@ -1045,36 +1389,21 @@ void cmpct_free(void* payload) {
     }
     header_t* header = (header_t*)payload - 1;
     DEBUG_ASSERT(!is_tagged_as_free(header)); // Double free!
-    size_t size = header->size;
-    lock();
-    header_t* left = header->left;
-    if (left != NULL && is_tagged_as_free(left)) {
-        // Coalesce with left free object.
-        unlink_free_unknown_bucket((free_t*)left);
-        header_t* right = right_header(header);
-        if (is_tagged_as_free(right)) {
-            // Coalesce both sides.
-            unlink_free_unknown_bucket((free_t*)right);
-            header_t* right_right = right_header(right);
-            FixLeftPointer(right_right, left);
-            free_memory(left, left->left, left->size + size + right->size);
-        } else {
-            // Coalesce only left.
-            FixLeftPointer(right, left);
-            free_memory(left, left->left, left->size + size);
-        }
-    } else {
-        header_t* right = right_header(header);
-        if (is_tagged_as_free(right)) {
-            // Coalesce only right.
-            header_t* right_right = right_header(right);
-            unlink_free_unknown_bucket((free_t*)right);
-            FixLeftPointer(right_right, header);
-            free_memory(header, left, size + right->size);
-        } else {
-            free_memory(header, left, size);
+    size_t size = header->size - sizeof(header_t);
+    DEBUG_ASSERT(size > CACHE_MAX_SIZE || !is_cached(header)); // Double free!
+    const bool use_cache = heap_cache_enabled;
+    if (size <= CACHE_MAX_SIZE && use_cache) {
+        cache_entry_t* flush = cache_free(header, size_to_index_freeing(size));
+        if (flush != NULL) {
+            kcounter_add(heap_cache_flush, 1);
+            lock();
+            cache_return_locked(flush);
+            unlock();
         }
+        return;
     }
+    lock();
+    free_locked(header);
     unlock();
 }
 
@@ -25,4 +25,8 @@ void cmpct_get_info(size_t* size_bytes, size_t* free_bytes);
 void cmpct_test(void);
 void cmpct_trim(void);
 
+// Turns the per-cpu small allocation caches on or off, flushing them when
+// turning them off. Returns the previous setting.
+bool cmpct_set_cache_enabled(bool enabled);
+
 __END_CDECLS
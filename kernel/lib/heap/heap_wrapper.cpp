@@ -135,6 +135,10 @@ void heap_get_info(size_t *size_bytes, size_t *free_bytes) {
     cmpct_get_info(size_bytes, free_bytes);
 }
 
+bool heap_set_cache_enabled(bool enabled) {
+    return cmpct_set_cache_enabled(enabled);
+}
+
 static void heap_test(void)
 {
     cmpct_test();
@@ -7,6 +7,7 @@
 
 #pragma once
 
+#include <stdbool.h>
 #include <stddef.h>
 #include <sys/types.h>
 #include <zircon/compiler.h>
@@ -34,4 +35,9 @@ void heap_page_free(void *ptr, size_t pages);
  */
 void heap_get_info(size_t *size_bytes, size_t *free_bytes);
 
+/* Turns the per-cpu small allocation caches on or off, returning the previous
+ * setting. Meant for tests and benchmarks comparing against the locked path.
+ */
+bool heap_set_cache_enabled(bool enabled);
+
 __END_CDECLS
@@ -11,13 +11,18 @@
 
 #include <arch/ops.h>
 #include <arch/user_copy.h>
+#include <kernel/align.h>
 #include <kernel/cmdline.h>
+#include <kernel/spinlock.h>
 #include <vm/vm_aspace.h>
 #include <lib/ktrace.h>
 #include <lk/init.h>
+#include <lib/counters.h>
 #include <zircon/thread_annotations.h>
 #include <object/thread_dispatcher.h>
 
+#include "ktrace_priv.h"
+
 #define ktrace_timestamp() current_ticks();
 #define ktrace_ticks_per_ms() (ticks_per_second() / 1000)
 
@@ -76,41 +81,176 @@ static void ktrace_report_probes(void) {
     }
 }
 
+// Event records are written into per-cpu buffers, so that cpus tracing at
+// the same time don't bounce a shared write offset between their caches. A
+// cpu reserves room in its own buffer with interrupts disabled, which is all
+// the synchronization the write path needs.
+//
+// Name records and the version and tick rate records are metadata rather
+// than events. They go into a separate shared buffer at the start of the
+// trace buffer, so circular mode never overwrites them.
+//
+// In circular mode a cpu whose buffer is full overwrites its oldest records.
+// Otherwise that cpu drops its new records, counted in
+// kernel.ktrace.dropped, while the other cpus carry on tracing.
+//
+// ktrace_read_user() shows the metadata followed by the events of every cpu,
+// merged in timestamp order. That view is only stable once tracing is
+// stopped.
+
+// Number of event records dropped because a cpu's buffer was full and the
+// trace was not circular.
+KCOUNTER(ktrace_dropped, "kernel.ktrace.dropped");
+
 typedef struct ktrace_state {
-    // where the next record will be written
-    int offset;
+    // where the next metadata record will be written
+    int meta_offset;
 
     // mask of groups we allow, 0 == tracing disabled
     int grpmask;
 
-    // total size of the trace buffer
-    uint32_t bufsize;
+    // whether a full cpu buffer overwrites its oldest records
+    int circular;
+
+    // size of the metadata buffer
+    uint32_t meta_size;
 
-    // offset where tracing was stopped, 0 if tracing active
-    uint32_t marker;
+    // number of per-cpu buffers in use
+    uint32_t num_cpus;
 
-    // raw trace buffer
+    // raw trace buffer: the metadata buffer, then the per-cpu buffers
     uint8_t* buffer;
 } ktrace_state_t;
 
 static ktrace_state_t KTRACE_STATE;
 
-int ktrace_read_user(void* ptr, uint32_t off, uint32_t len) {
+static ktrace_cpu_buffer cpu_buffers[SMP_MAX_CPUS];
+
+// Position of the merged view that the last ktrace_read_user() stopped at,
+// so that reading the trace from start to end takes linear time.
+static fbl::Mutex read_lock;
+static ktrace_read_cursor read_cursor TA_GUARDED(read_lock);
+
+static void ktrace_reset_cursor() TA_REQ(read_lock) {
+    read_cursor.off = 0;
+    memset(read_cursor.pos, 0, sizeof(read_cursor.pos));
+}
+
+uint32_t ktrace_record_len(const uint8_t* rec) {
+    const uint32_t* words = reinterpret_cast<const uint32_t*>(rec);
+    return words[0] == kKtracePadTag ? words[1] : KTRACE_LEN(words[0]);
+}
+
+ktrace_header_t* ktrace_cpu_buffer_reserve(ktrace_cpu_buffer* cb, uint32_t len, bool circular) {
+    // A record never straddles the end of the buffer.
+    uint32_t pad = (cb->head + len > cb->size) ? cb->size - cb->head : 0;
+    if (cb->used + pad + len > cb->size) {
+        if (!circular) {
+            return nullptr;
+        }
+        // Make room by dropping the oldest records.
+        while (cb->used + pad + len > cb->size) {
+            const uint8_t* oldest = cb->buffer + cb->tail;
+            uint32_t n = ktrace_record_len(oldest);
+            if (*reinterpret_cast<const uint32_t*>(oldest) == kKtracePadTag) {
+                cb->pad = 0;
+            }
+            cb->tail += n;
+            if (cb->tail == cb->size) {
+                cb->tail = 0;
+            }
+            cb->used -= n;
+        }
+    }
+    if (cb->head + len > cb->size) {
+        if (pad > 0) {
+            uint32_t* words = reinterpret_cast<uint32_t*>(cb->buffer + cb->head);
+            words[0] = kKtracePadTag;
+            words[1] = pad;
+            cb->used += pad;
+            cb->pad = pad;
+        }
+        cb->head = 0;
+    }
+
+    ktrace_header_t* hdr = reinterpret_cast<ktrace_header_t*>(cb->buffer + cb->head);
+    cb->head += len;
+    cb->used += len;
+    return hdr;
+}
+
+// Reserves room for a record tagged |tag| in the current cpu's buffer and
+// fills in its header. Returns nullptr if the buffer is full and the trace
+// is not circular, in which case the record is dropped.
+static ktrace_header_t* ktrace_reserve(uint32_t tag, uint32_t tid) {
     ktrace_state_t* ks = &KTRACE_STATE;
 
-    // Buffer size is limited by the marker if set,
-    // otherwise limited by offset (last written point).
-    // Offset can end up pointing past the end, so clip
-    // it to the actual buffer size to be safe.
-    uint32_t max;
-    if (ks->marker) {
-        max = ks->marker;
+    spin_lock_saved_state_t state;
+    arch_interrupt_save(&state, SPIN_LOCK_FLAG_INTERRUPTS);
+    ktrace_cpu_buffer* cb = &cpu_buffers[arch_curr_cpu_num()];
+    ktrace_header_t* hdr = ktrace_cpu_buffer_reserve(cb, KTRACE_LEN(tag),
+                                                     atomic_load(&ks->circular));
+    if (hdr) {
+        hdr->ts = ktrace_timestamp();
+        hdr->tag = tag;
+        hdr->tid = tid;
     } else {
-        max = ks->offset;
-        if (max > ks->bufsize) {
-            max = ks->bufsize;
+        kcounter_add(ktrace_dropped, 1u);
+    }
+    arch_interrupt_restore(state, SPIN_LOCK_FLAG_INTERRUPTS);
+    return hdr;
+}
+
+static uint32_t ktrace_meta_len(ktrace_state_t* ks) {
+    return atomic_load(&ks->meta_offset);
+}
+
+int ktrace_next_record(const ktrace_cpu_buffer* cbs, uint32_t num_cpus,
+                       ktrace_read_cursor* cursor, const uint8_t** rec_out, uint32_t* len_out) {
+    int best = -1;
+    uint64_t best_ts = 0;
+    for (uint32_t cpu = 0; cpu < num_cpus; cpu++) {
+        const ktrace_cpu_buffer* cb = &cbs[cpu];
+        for (;;) {
+            if (cursor->pos[cpu] >= cb->used) {
+                break;
+            }
+            uint32_t at = (cb->tail + cursor->pos[cpu]) % cb->size;
+            const uint8_t* rec = cb->buffer + at;
+            uint32_t n = ktrace_record_len(rec);
+            if (n == 0 || at + n > cb->size || cursor->pos[cpu] + n > cb->used) {
+                // Only possible if the buffer is being written while we
+                // read it; give up on this cpu.
+                cursor->pos[cpu] = cb->used;
+                break;
+            }
+            if (*reinterpret_cast<const uint32_t*>(rec) == kKtracePadTag) {
+                cursor->pos[cpu] += n;
+                continue;
+            }
+            uint64_t ts = reinterpret_cast<const ktrace_header_t*>(rec)->ts;
+            if (best < 0 || ts < best_ts) {
+                best = cpu;
+                best_ts = ts;
+                *rec_out = rec;
+                *len_out = n;
+            }
+            break;
         }
     }
+    return best;
+}
+
+int ktrace_read_user(void* ptr, uint32_t off, uint32_t len) {
+    ktrace_state_t* ks = &KTRACE_STATE;
+
+    // The readable size is the metadata plus every record still held in
+    // the cpu buffers, not counting padding.
+    uint32_t meta = ktrace_meta_len(ks);
+    uint32_t max = meta;
+    for (uint32_t cpu = 0; cpu < ks->num_cpus; cpu++) {
+        max += cpu_buffers[cpu].used - cpu_buffers[cpu].pad;
+    }
 
     // null read is a query for trace buffer size
     if (ptr == nullptr) {
@@ -125,35 +265,84 @@ int ktrace_read_user(void* ptr, uint32_t off, uint32_t len) {
         len = max - off;
     }
 
-    if (arch_copy_to_user(ptr, ks->buffer + off, len) != ZX_OK) {
-        return ZX_ERR_INVALID_ARGS;
+    uint8_t* out = static_cast<uint8_t*>(ptr);
+    uint32_t done = 0;
+    if (off < meta) {
+        done = len < meta - off ? len : meta - off;
+        if (arch_copy_to_user(out, ks->buffer + off, done) != ZX_OK) {
+            return ZX_ERR_INVALID_ARGS;
+        }
+        if (done == len) {
+            return len;
+        }
+    }
+
+    // Merge the cpu buffers, starting from where the last read left off
+    // if this read continues it.
+    fbl::AutoLock lock(&read_lock);
+    uint32_t event_off = off + done - meta;
+    if (event_off < read_cursor.off) {
+        ktrace_reset_cursor();
+    }
+    while (done < len) {
+        const uint8_t* rec;
+        uint32_t n;
+        int cpu = ktrace_next_record(cpu_buffers, ks->num_cpus, &read_cursor, &rec, &n);
+        if (cpu < 0) {
+            break;
+        }
+        if (read_cursor.off + n > event_off) {
+            // Copy this record, or as much of it as was asked for.
+            uint32_t skip = event_off - read_cursor.off;
+            uint32_t count = n - skip;
+            if (count > len - done) {
+                count = len - done;
+            }
+            if (arch_copy_to_user(out + done, rec + skip, count) != ZX_OK) {
+                return ZX_ERR_INVALID_ARGS;
+            }
+            done += count;
+            event_off += count;
+            if (skip + count < n) {
+                break;
+            }
+        }
+        read_cursor.off += n;
+        read_cursor.pos[cpu] += n;
     }
-    return len;
+    return done;
+}
+
+// Empties every cpu buffer and drops all metadata but the version and tick
+// rate records.
+static void ktrace_rewind(ktrace_state_t* ks) {
+    for (uint32_t cpu = 0; cpu < ks->num_cpus; cpu++) {
+        ktrace_cpu_buffer* cb = &cpu_buffers[cpu];
+        cb->head = cb->tail = cb->used = cb->pad = 0;
+    }
+    atomic_store(&ks->meta_offset, KTRACE_RECSIZE * 2);
+
+    fbl::AutoLock lock(&read_lock);
+    ktrace_reset_cursor();
 }
 
 zx_status_t ktrace_control(uint32_t action, uint32_t options, void* ptr) {
     ktrace_state_t* ks = &KTRACE_STATE;
     switch (action) {
     case KTRACE_ACTION_START:
+    case KTRACE_ACTION_START_CIRCULAR:
         options = KTRACE_GRP_TO_MASK(options);
-        ks->marker = 0;
+        atomic_store(&ks->circular, action == KTRACE_ACTION_START_CIRCULAR);
         atomic_store(&ks->grpmask, options ? options : KTRACE_GRP_TO_MASK(KTRACE_GRP_ALL));
         ktrace_report_live_processes();
         ktrace_report_live_threads();
         break;
-    case KTRACE_ACTION_STOP: {
+    case KTRACE_ACTION_STOP:
         atomic_store(&ks->grpmask, 0);
-        uint32_t n = ks->offset;
-        if (n > ks->bufsize) {
-            ks->marker = ks->bufsize;
-        } else {
-            ks->marker = n;
-        }
         break;
-    }
     case KTRACE_ACTION_REWIND:
         // roll back to just after the metadata
-        atomic_store(&ks->offset, KTRACE_RECSIZE * 2);
+        ktrace_rewind(ks);
         ktrace_report_syscalls(kt_syscall_info);
         ktrace_report_probes();
         break;
@@ -185,6 +374,7 @@ void ktrace_init(unsigned level) {
 
     uint32_t mb = cmdline_get_uint32("ktrace.bufsize", KTRACE_DEFAULT_BUFSIZE);
     uint32_t grpmask = cmdline_get_uint32("ktrace.grpmask", KTRACE_DEFAULT_GRPMASK);
+    bool circular = cmdline_get_bool("ktrace.circular", false);
 
     if (mb == 0) {
         dprintf(INFO, "ktrace: disabled\n");
@@ -201,11 +391,17 @@ void ktrace_init(unsigned level) {
         return;
     }
 
-    // The last packet written can overhang the end of the buffer,
-    // so we reduce the reported size by the max size of a record
-    ks->bufsize = mb - 256;
+    // Carve the buffer up into the metadata buffer and one buffer per cpu.
+    ks->meta_size = mb / 16;
+    ks->num_cpus = arch_max_num_cpus();
+    uint32_t cpu_size = ROUNDDOWN((mb - ks->meta_size) / ks->num_cpus, 8);
+    for (uint32_t cpu = 0; cpu < ks->num_cpus; cpu++) {
+        cpu_buffers[cpu].buffer = ks->buffer + ks->meta_size + cpu * cpu_size;
+        cpu_buffers[cpu].size = cpu_size;
+    }
 
-    dprintf(INFO, "ktrace: buffer at %p (%u bytes)\n", ks->buffer, mb);
+    dprintf(INFO, "ktrace: buffer at %p (%u bytes, %u per cpu%s)\n",
+            ks->buffer, mb, cpu_size, circular ? ", circular" : "");
 
     // register all static probes
     {
@@ -227,9 +423,10 @@ void ktrace_init(unsigned level) {
     rec[1].b = (uint32_t)(n >> 32);
 
     // enable tracing
-    atomic_store(&ks->offset, KTRACE_RECSIZE * 2);
+    atomic_store(&ks->meta_offset, KTRACE_RECSIZE * 2);
     ktrace_report_syscalls(kt_syscall_info);
     ktrace_report_probes();
+    atomic_store(&ks->circular, circular);
     atomic_store(&ks->grpmask, KTRACE_GRP_TO_MASK(grpmask));
 
     // report names of existing threads
@@ -246,16 +443,7 @@ void ktrace_tiny(uint32_t tag, uint32_t arg) {
     ktrace_state_t* ks = &KTRACE_STATE;
     if (tag & atomic_load(&ks->grpmask)) {
         tag = (tag & 0xFFFFFFF0) | 2;
-        int off;
-        if ((off = atomic_add(&ks->offset, KTRACE_HDRSIZE)) >= (int)ks->bufsize) {
-            // if we arrive at the end, stop
-            atomic_store(&ks->grpmask, 0);
-        } else {
-            ktrace_header_t* hdr = (ktrace_header_t*) (ks->buffer + off);
-            hdr->ts = ktrace_timestamp();
-            hdr->tag = tag;
-            hdr->tid = arg;
-        }
+        ktrace_reserve(tag, arg);
     }
 }
 
@@ -265,18 +453,8 @@ void* ktrace_open(uint32_t tag) {
         return nullptr;
     }
 
-    int off;
-    if ((off = atomic_add(&ks->offset, KTRACE_LEN(tag))) >= (int)ks->bufsize) {
-        // if we arrive at the end, stop
-        atomic_store(&ks->grpmask, 0);
-        return nullptr;
-    }
-
-    ktrace_header_t* hdr = (ktrace_header_t*) (ks->buffer + off);
-    hdr->ts = ktrace_timestamp();
-    hdr->tag = tag;
-    hdr->tid = (uint32_t)get_current_thread()->user_tid;
-    return hdr + 1;
+    ktrace_header_t* hdr = ktrace_reserve(tag, (uint32_t)get_current_thread()->user_tid);
+    return hdr ? hdr + 1 : nullptr;
 }
 
 static void ktrace_name_etc(uint32_t tag, uint32_t id, uint32_t arg, const char* name, bool always) {
@@ -287,18 +465,24 @@ static void ktrace_name_etc(uint32_t tag, uint32_t id, uint32_t arg, const char*
         // set size to: sizeof(hdr) + len + 1, round up to multiple of 8
         tag = (tag & 0xFFFFFFF0) | ((KTRACE_NAMESIZE + len + 1 + 7) >> 3);
 
-        int off;
-        if ((off = atomic_add(&ks->offset, KTRACE_LEN(tag))) >= (int)ks->bufsize) {
-            // if we arrive at the end, stop
-            atomic_store(&ks->grpmask, 0);
-        } else {
-            ktrace_rec_name_t* rec = (ktrace_rec_name_t*) (ks->buffer + off);
-            rec->tag = tag;
-            rec->id = id;
-            rec->arg = arg;
-            memcpy(rec->name, name, len);
-            rec->name[len] = 0;
-        }
+        // Names go into the metadata buffer. If it fills up, further
+        // names are dropped but tracing carries on. Only advance the
+        // offset past records that fit, so that it always marks the end
+        // of what readers may see.
+        const int rec_len = KTRACE_LEN(tag);
+        int off = atomic_load(&ks->meta_offset);
+        do {
+            if (static_cast<uint32_t>(off + rec_len) > ks->meta_size) {
+                return;
+            }
+        } while (!atomic_cmpxchg(&ks->meta_offset, &off, off + rec_len));
+
+        ktrace_rec_name_t* rec = (ktrace_rec_name_t*) (ks->buffer + off);
+        rec->tag = tag;
+        rec->id = id;
+        rec->arg = arg;
+        memcpy(rec->name, name, len);
+        rec->name[len] = 0;
     }
 }
 
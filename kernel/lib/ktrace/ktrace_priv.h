@@ -0,0 +1,53 @@
+// Copyright 2017 The Fuchsia Authors
+//
+// Use of this source code is governed by a MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT
+
+#pragma once
+
+#include <kernel/align.h>
+#include <lib/ktrace.h>
+#include <stdint.h>
+
+// Internals of the per-cpu trace buffers, shared with the unit tests.
+
+// Fills the unused end of a circular buffer when the next record doesn't
+// fit there. The second word holds its length. Never shown to readers.
+constexpr uint32_t kKtracePadTag = 0;
+
+struct ktrace_cpu_buffer {
+    uint8_t* buffer;
+    uint32_t size;
+
+    // Only modified by the owning cpu with interrupts disabled, or by
+    // ktrace_control() while tracing is stopped.
+    uint32_t head; // where the next record will be written
+    uint32_t tail; // where the oldest record starts
+    uint32_t used; // bytes from tail to head, including padding
+    uint32_t pad;  // bytes of padding from tail to head
+} __CPU_ALIGN;
+
+// Position of the merged view of a set of cpu buffers.
+struct ktrace_read_cursor {
+    // offset of the next record in the merged events, past the metadata
+    uint32_t off;
+
+    // bytes of each cpu buffer, counted from its tail, already merged
+    uint32_t pos[SMP_MAX_CPUS];
+};
+
+// Returns the length of the record or padding at |rec|.
+uint32_t ktrace_record_len(const uint8_t* rec);
+
+// Reserves |len| bytes for a record at the head of |cb|. If |cb| is full,
+// the oldest records are dropped to make room if |circular|, otherwise
+// nothing is reserved and nullptr is returned. The caller fills in the
+// record, starting with its header.
+ktrace_header_t* ktrace_cpu_buffer_reserve(ktrace_cpu_buffer* cb, uint32_t len, bool circular);
+
+// Finds the oldest record in |cbs| not yet merged by |cursor|. Returns the
+// index of the cpu buffer it belongs to, or -1 if every buffer has been
+// merged. The caller advances |cursor| past the record.
+int ktrace_next_record(const ktrace_cpu_buffer* cbs, uint32_t num_cpus,
+                       ktrace_read_cursor* cursor, const uint8_t** rec_out, uint32_t* len_out);
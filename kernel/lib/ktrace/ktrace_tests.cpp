@@ -0,0 +1,130 @@
+// Copyright 2017 The Fuchsia Authors
+//
+// Use of this source code is governed by a MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT
+
+#include <fbl/algorithm.h>
+#include <string.h>
+#include <unittest.h>
+
+#include "ktrace_priv.h"
+
+static const uint32_t kTestTag = KTRACE_TAG_32B(0x123, KTRACE_GRP_PROBE);
+
+static bool write_record(ktrace_cpu_buffer* cb, uint64_t ts, bool circular) {
+    ktrace_header_t* hdr = ktrace_cpu_buffer_reserve(cb, KTRACE_LEN(kTestTag), circular);
+    if (hdr == nullptr) {
+        return false;
+    }
+    hdr->tag = kTestTag;
+    hdr->tid = 0;
+    hdr->ts = ts;
+    return true;
+}
+
+// Reads every record of |cbs| the way ktrace_read_user() merges them, and
+// stores their timestamps in |ts|. Returns the number of records.
+static size_t merge_records(const ktrace_cpu_buffer* cbs, uint32_t num_cpus,
+                            uint64_t* ts, size_t max) {
+    ktrace_read_cursor cursor;
+    memset(&cursor, 0, sizeof(cursor));
+
+    size_t count = 0;
+    const uint8_t* rec;
+    uint32_t n;
+    int cpu;
+    while ((cpu = ktrace_next_record(cbs, num_cpus, &cursor, &rec, &n)) >= 0) {
+        if (count < max) {
+            ts[count] = reinterpret_cast<const ktrace_header_t*>(rec)->ts;
+        }
+        count++;
+        cursor.off += n;
+        cursor.pos[cpu] += n;
+    }
+    return count;
+}
+
+// Records written on several cpus come out in timestamp order.
+static bool merge_order_test(void* context) {
+    BEGIN_TEST;
+
+    static const uint64_t stamps[3][4] = {
+        {1, 5, 6, 11},
+        {2, 3, 9, 10},
+        {4, 7, 8, 12},
+    };
+    uint8_t storage[3][KTRACE_RECSIZE * 4];
+    ktrace_cpu_buffer cbs[3];
+    memset(cbs, 0, sizeof(cbs));
+    for (uint32_t cpu = 0; cpu < fbl::count_of(cbs); cpu++) {
+        cbs[cpu].buffer = storage[cpu];
+        cbs[cpu].size = sizeof(storage[cpu]);
+        for (uint64_t ts : stamps[cpu]) {
+            EXPECT_TRUE(write_record(&cbs[cpu], ts, false), "record fits");
+        }
+    }
+
+    uint64_t ts[12];
+    EXPECT_EQ(12u, merge_records(cbs, 3, ts, fbl::count_of(ts)), "every record is merged");
+    for (size_t i = 0; i < fbl::count_of(ts); i++) {
+        EXPECT_EQ(i + 1, ts[i], "records are in timestamp order");
+    }
+
+    END_TEST;
+}
+
+// A circular buffer that wraps drops its oldest records, including when the
+// end of the buffer has to be padded.
+static bool circular_wrap_test(void* context) {
+    BEGIN_TEST;
+
+    // Room for two and a half records, so every other wrap needs padding.
+    uint8_t storage[KTRACE_RECSIZE * 2 + KTRACE_RECSIZE / 2];
+    ktrace_cpu_buffer cb;
+    memset(&cb, 0, sizeof(cb));
+    cb.buffer = storage;
+    cb.size = sizeof(storage);
+
+    for (uint64_t i = 1; i <= 9; i++) {
+        EXPECT_TRUE(write_record(&cb, i, true), "circular buffer always has room");
+
+        uint64_t ts[2];
+        size_t count = merge_records(&cb, 1, ts, fbl::count_of(ts));
+        EXPECT_EQ(fbl::min<uint64_t>(i, 2), count, "buffer holds the newest records");
+        for (size_t j = 0; j < count; j++) {
+            EXPECT_EQ(i - count + 1 + j, ts[j], "oldest records were dropped");
+        }
+    }
+
+    END_TEST;
+}
+
+// A full buffer that is not circular keeps what it has and refuses the new
+// record.
+static bool full_buffer_test(void* context) {
+    BEGIN_TEST;
+
+    uint8_t storage[KTRACE_RECSIZE * 2];
+    ktrace_cpu_buffer cb;
+    memset(&cb, 0, sizeof(cb));
+    cb.buffer = storage;
+    cb.size = sizeof(storage);
+
+    EXPECT_TRUE(write_record(&cb, 1, false), "record fits");
+    EXPECT_TRUE(write_record(&cb, 2, false), "record fits");
+    EXPECT_FALSE(write_record(&cb, 3, false), "full buffer drops the record");
+
+    uint64_t ts[2];
+    EXPECT_EQ(2u, merge_records(&cb, 1, ts, fbl::count_of(ts)), "old records are kept");
+    EXPECT_EQ(1u, ts[0], "old records are kept");
+    EXPECT_EQ(2u, ts[1], "old records are kept");
+
+    END_TEST;
+}
+
+UNITTEST_START_TESTCASE(ktrace_tests)
+UNITTEST("merge order", merge_order_test)
+UNITTEST("circular wrap", circular_wrap_test)
+UNITTEST("full buffer", full_buffer_test)
+UNITTEST_END_TESTCASE(ktrace_tests, "ktrace", "ktrace buffer tests", nullptr, nullptr);
@@ -6,6 +6,7 @@
 
 #include <lib/oom.h>
 
+#include <kernel/event.h>
 #include <kernel/thread.h>
 #include <vm/pmm.h>
 #include <lib/console.h>
@@ -46,6 +47,10 @@ static bool oom_printing TA_GUARDED(oom_mutex);
 // True if the thread should simulate a low-memory condition on its next loop.
 static bool oom_simulate_lowmem TA_GUARDED(oom_mutex);
 
+// Signaled by the PMM when free memory drops below the redline, and to wake
+// the thread early when it should stop or simulate a low-memory condition.
+static event_t oom_event = EVENT_INITIAL_VALUE(oom_event, false, EVENT_FLAG_AUTOUNSIGNAL);
+
 static int oom_loop(void* arg) {
     const size_t total_bytes = pmm_count_total_bytes();
     char total_buf[MAX_FORMAT_SIZE_LEN];
@@ -109,7 +114,9 @@ static int oom_loop(void* arg) {
             lowmem_callback(shortfall_bytes);
         }
 
-        thread_sleep_relative(sleep_duration_ns);
+        // Keep polling, so that the callback runs again while memory stays
+        // low, and so that 'oom print' sees every change.
+        event_wait_deadline(&oom_event, current_time() + sleep_duration_ns, false);
     }
 
     return 0;
@@ -123,6 +130,9 @@ static void start_thread_locked() TA_REQ(oom_mutex) {
     if (t != nullptr) {
         oom_running = true;
         oom_thread = t;
+        if (pmm_add_low_watermark(oom_redline_bytes / PAGE_SIZE, &oom_event) != ZX_OK) {
+            printf("OOM: no low watermark available; polling only\n");
+        }
         thread_resume(t);
         printf("OOM: started thread\n");
     } else {
@@ -173,6 +183,8 @@ static int cmd_oom(int argc, const cmd_args* argv, uint32_t flags) {
         if (oom_running) {
             printf("Stopping OOM thread...\n");
             oom_running = false;
+            pmm_remove_low_watermark(&oom_event);
+            event_signal(&oom_event, false);
             thread_t* t = oom_thread;
             oom_thread = nullptr;
             zx_time_t deadline = current_time() + 4 * oom_sleep_duration_ns;
@@ -207,6 +219,7 @@ static int cmd_oom(int argc, const cmd_args* argv, uint32_t flags) {
         printf("OOM print is now %s\n", oom_printing ? "on" : "off");
     } else if (strcmp(argv[1].str, "lowmem") == 0) {
         oom_simulate_lowmem = true;
+        event_signal(&oom_event, false);
     } else {
         printf("Unrecognized subcommand '%s'\n", argv[1].str);
         goto usage;
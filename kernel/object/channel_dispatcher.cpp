@@ -163,6 +163,42 @@ zx_status_t ChannelDispatcher::Read(uint32_t* msg_size,
     return rv;
 }
 
+zx_status_t ChannelDispatcher::ReadBatch(zx_channel_msg_t* limits, size_t count,
+                                         fbl::unique_ptr<MessagePacket>* msgs, size_t* actual) {
+    canary_.Assert();
+
+    *actual = 0;
+
+    AutoLock lock(&lock_);
+
+    if (messages_.is_empty())
+        return other_ ? ZX_ERR_SHOULD_WAIT : ZX_ERR_PEER_CLOSED;
+
+    size_t n = 0;
+    while (n < count && !messages_.is_empty()) {
+        const MessagePacket& next = messages_.front();
+        if (next.data_size() > limits[n].num_bytes ||
+            next.num_handles() > limits[n].num_handles) {
+            if (n == 0) {
+                limits[0].num_bytes = next.data_size();
+                limits[0].num_handles = next.num_handles();
+                return ZX_ERR_BUFFER_TOO_SMALL;
+            }
+            break;
+        }
+        limits[n].num_bytes = next.data_size();
+        limits[n].num_handles = next.num_handles();
+        msgs[n++] = messages_.pop_front();
+    }
+    message_count_ -= n;
+    *actual = n;
+
+    if (messages_.is_empty())
+        UpdateState(ZX_CHANNEL_READABLE, 0u);
+
+    return ZX_OK;
+}
+
 zx_status_t ChannelDispatcher::Write(fbl::unique_ptr<MessagePacket> msg) {
     canary_.Assert();
 
@@ -184,6 +220,23 @@ zx_status_t ChannelDispatcher::Write(fbl::unique_ptr<MessagePacket> msg) {
     return ZX_OK;
 }
 
+zx_status_t ChannelDispatcher::WriteBatch(fbl::unique_ptr<MessagePacket>* msgs, size_t count) {
+    canary_.Assert();
+
+    fbl::RefPtr<ChannelDispatcher> other;
+    {
+        AutoLock lock(&lock_);
+        if (!other_)
+            return ZX_ERR_PEER_CLOSED;
+        other = other_;
+    }
+
+    if (other->WriteSelfBatch(msgs, count) > 0)
+        thread_reschedule();
+
+    return ZX_OK;
+}
+
 zx_status_t ChannelDispatcher::Call(fbl::unique_ptr<MessagePacket> msg,
                                     zx_time_t deadline, bool* return_handles,
                                     fbl::unique_ptr<MessagePacket>* reply) {
@@ -263,7 +316,21 @@ int ChannelDispatcher::WriteSelf(fbl::unique_ptr<MessagePacket> msg) {
     canary_.Assert();
 
     AutoLock lock(&lock_);
+    return WriteSelfLocked(fbl::move(msg));
+}
+
+int ChannelDispatcher::WriteSelfBatch(fbl::unique_ptr<MessagePacket>* msgs, size_t count) {
+    canary_.Assert();
+
+    AutoLock lock(&lock_);
+    int woken = 0;
+    for (size_t i = 0; i < count; i++) {
+        woken += WriteSelfLocked(fbl::move(msgs[i]));
+    }
+    return woken;
+}
 
+int ChannelDispatcher::WriteSelfLocked(fbl::unique_ptr<MessagePacket> msg) {
     if (!waiters_.is_empty()) {
         // If the far side is waiting for replies to messages
         // send via "call", see if this message has a matching
@@ -15,6 +15,7 @@
 #include <fbl/auto_lock.h>
 #include <object/handle.h>
 #include <object/job_dispatcher.h>
+#include <object/message_packet.h>
 #include <object/port_dispatcher.h>
 #include <object/process_dispatcher.h>
 #include <object/vm_object_dispatcher.h>
@@ -738,6 +739,13 @@ static void DumpPortPacketInfo() {
     printf("port packet allocation count: %zu\n", count);
 }
 
+static void DumpMessagePacketInfo() {
+    const size_t slab_pages = MessagePacket::DiagnosticSlabPageCount();
+    const size_t data_pages = MessagePacket::DiagnosticDataPageCount();
+    printf("message packet slab pages: %zu, data pages: %zu (%zu KiB total)\n",
+           slab_pages, data_pages, (slab_pages + data_pages) * PAGE_SIZE / 1024);
+}
+
 static int mwd_thread(void* arg) {
     for (;;) {
         thread_sleep_relative(ZX_SEC(1));
@@ -761,6 +769,7 @@ static int cmd_diagnostics(int argc, const cmd_args* argv, uint32_t flags) {
         printf("                 -u? : fix all sizes to the named unit\n");
         printf("                       where ? is one of [BkMGTPE]\n");
         printf("%s ppinfo            : port packet arena info\n", argv[0].str);
+        printf("%s msginfo           : channel message memory info\n", argv[0].str);
         printf("%s kill <pid>        : kill process\n", argv[0].str);
         printf("%s asd  <pid>|kernel : dump process/kernel address space\n",
                argv[0].str);
@@ -825,6 +834,10 @@ static int cmd_diagnostics(int argc, const cmd_args* argv, uint32_t flags) {
         if (argc != 2)
             goto usage;
         DumpPortPacketInfo();
+    } else if (strcmp(argv[1].str, "msginfo") == 0) {
+        if (argc != 2)
+            goto usage;
+        DumpMessagePacketInfo();
     } else if (strcmp(argv[1].str, "kill") == 0) {
         if (argc < 3)
             goto usage;
@@ -7,9 +7,12 @@
 #include <object/futex_context.h>
 
 #include <assert.h>
+#include <lib/counters.h>
 #include <lib/user_copy/user_ptr.h>
+#include <fbl/auto_call.h>
 #include <fbl/auto_lock.h>
 #include <object/thread_dispatcher.h>
+#include <platform.h>
 #include <trace.h>
 #include <zircon/types.h>
 
@@ -17,6 +20,16 @@ using fbl::AutoLock;
 
 #define LOCAL_TRACE 0
 
+// Number of futex operations and the total time spent in them.  For waits,
+// the time covers everything up to the point where the thread blocks, not
+// the time spent blocked.
+KCOUNTER(futex_wait_count, "kernel.futex.wait.count");
+KCOUNTER(futex_wait_ns, "kernel.futex.wait.ns");
+KCOUNTER(futex_wake_count, "kernel.futex.wake.count");
+KCOUNTER(futex_wake_ns, "kernel.futex.wake.ns");
+KCOUNTER(futex_requeue_count, "kernel.futex.requeue.count");
+KCOUNTER(futex_requeue_ns, "kernel.futex.requeue.ns");
+
 FutexContext::FutexContext() {
     LTRACE_ENTRY;
 }
@@ -26,7 +39,9 @@ FutexContext::~FutexContext() {
 
     // All of the threads should have removed themselves from wait queues
     // by the time the process has exited.
-    DEBUG_ASSERT(futex_table_.is_empty());
+    for (const Shard& shard : shards_) {
+        DEBUG_ASSERT(shard.futex_table.is_empty());
+    }
 }
 
 zx_status_t FutexContext::FutexWait(user_in_ptr<const int> value_ptr, int current_value, zx_time_t deadline) {
@@ -36,24 +51,29 @@ zx_status_t FutexContext::FutexWait(user_in_ptr<const int> value_ptr, int curren
     if (futex_key % sizeof(int))
         return ZX_ERR_INVALID_ARGS;
 
+    const zx_time_t start = current_time();
+    kcounter_add(futex_wait_count, 1u);
+
     FutexNode* node;
+    Shard* shard = ShardForKey(futex_key);
 
     // FutexWait() checks that the address value_ptr still contains
     // current_value, and if so it sleeps awaiting a FutexWake() on value_ptr.
     // Those two steps must together be atomic with respect to FutexWake().
     // If a FutexWake() operation could occur between them, a userland mutex
     // operation built on top of futexes would have a race condition that
-    // could miss wakeups.
-    lock_.Acquire();
+    // could miss wakeups.  Every operation on this futex takes the lock of
+    // its shard, so holding that lock is sufficient.
+    shard->lock.Acquire();
 
     int value;
     zx_status_t result = value_ptr.copy_from_user(&value);
     if (result != ZX_OK) {
-        lock_.Release();
+        shard->lock.Release();
         return result;
     }
     if (value != current_value) {
-        lock_.Release();
+        shard->lock.Release();
         return ZX_ERR_BAD_STATE;
     }
 
@@ -62,10 +82,13 @@ zx_status_t FutexContext::FutexWait(user_in_ptr<const int> value_ptr, int curren
     node->set_hash_key(futex_key);
     node->SetAsSingletonList();
 
-    QueueNodesLocked(node);
+    QueueNodesLocked(shard, node);
+
+    kcounter_add(futex_wait_ns, current_time() - start);
 
-    // Block current thread.  This releases lock_ and does not reacquire it.
-    result = node->BlockThread(&lock_, deadline);
+    // Block current thread.  This releases the shard lock and does not
+    // reacquire it.
+    result = node->BlockThread(&shard->lock, deadline);
     if (result == ZX_OK) {
         DEBUG_ASSERT(!node->IsInQueue());
         // All the work necessary for removing us from the hash table was done by FutexWake()
@@ -77,9 +100,12 @@ zx_status_t FutexContext::FutexWait(user_in_ptr<const int> value_ptr, int curren
     // (ZX_ERR_INTERNAL_INTR_RETRY).
     //
     // We need to ensure that the thread's node is removed from the wait
-    // queue, because FutexWake() probably didn't do that.
-    AutoLock lock(&lock_);
-    if (UnqueueNodeLocked(node)) {
+    // queue, because FutexWake() probably didn't do that.  FutexRequeue()
+    // may have moved it to a futex in another shard in the meantime.
+    shard = AcquireShardForNode(node);
+    const bool unqueued = UnqueueNodeLocked(shard, node);
+    shard->lock.Release();
+    if (unqueued) {
         return result;
     }
     // The current thread was not found on the wait queue.  This means
@@ -114,11 +140,16 @@ zx_status_t FutexContext::FutexWake(user_in_ptr<const int> value_ptr,
     if (futex_key % sizeof(int))
         return ZX_ERR_INVALID_ARGS;
 
-    AutoLock lock(&lock_);
+    const zx_time_t start = current_time();
+    kcounter_add(futex_wake_count, 1u);
 
-    FutexNode* node = futex_table_.erase(futex_key);
+    Shard* shard = ShardForKey(futex_key);
+    AutoLock lock(&shard->lock);
+
+    FutexNode* node = shard->futex_table.erase(futex_key);
     if (!node) {
         // nothing blocked on this futex if we can't find it
+        kcounter_add(futex_wake_ns, current_time() - start);
         return ZX_OK;
     }
     DEBUG_ASSERT(node->GetKey() == futex_key);
@@ -129,9 +160,11 @@ zx_status_t FutexContext::FutexWake(user_in_ptr<const int> value_ptr,
 
     if (remaining_waiters) {
         DEBUG_ASSERT(remaining_waiters->GetKey() == futex_key);
-        futex_table_.insert(remaining_waiters);
+        shard->futex_table.insert(remaining_waiters);
     }
 
+    kcounter_add(futex_wake_ns, current_time() - start);
+
     if (any_woken) {
         lock.release();
         thread_reschedule();
@@ -141,29 +174,48 @@ zx_status_t FutexContext::FutexWake(user_in_ptr<const int> value_ptr,
 }
 
 zx_status_t FutexContext::FutexRequeue(user_in_ptr<const int> wake_ptr, uint32_t wake_count, int current_value,
-                                       user_in_ptr<const int> requeue_ptr, uint32_t requeue_count) {
+                                       user_in_ptr<const int> requeue_ptr, uint32_t requeue_count)
+    TA_NO_THREAD_SAFETY_ANALYSIS {
     LTRACE_ENTRY;
 
     if ((requeue_ptr.get() == nullptr) && requeue_count)
         return ZX_ERR_INVALID_ARGS;
 
-    AutoLock lock(&lock_);
+    const zx_time_t start = current_time();
+    kcounter_add(futex_requeue_count, 1u);
+
+    uintptr_t wake_key = reinterpret_cast<uintptr_t>(wake_ptr.get());
+    uintptr_t requeue_key = reinterpret_cast<uintptr_t>(requeue_ptr.get());
+    Shard* wake_shard = ShardForKey(wake_key);
+    Shard* requeue_shard = ShardForKey(requeue_key);
+
+    // Hold the locks of both futexes' shards for the whole operation.  They
+    // are taken in address order so that requeues in opposite directions
+    // can't deadlock.
+    Shard* first = (wake_shard < requeue_shard) ? wake_shard : requeue_shard;
+    Shard* second = (wake_shard < requeue_shard) ? requeue_shard : wake_shard;
+    first->lock.Acquire();
+    if (second != first)
+        second->lock.Acquire();
+    auto unlock = fbl::MakeAutoCall([first, second]() TA_NO_THREAD_SAFETY_ANALYSIS {
+        if (second != first)
+            second->lock.Release();
+        first->lock.Release();
+    });
 
     int value;
     zx_status_t result = wake_ptr.copy_from_user(&value);
     if (result != ZX_OK) return result;
     if (value != current_value) return ZX_ERR_BAD_STATE;
 
-    uintptr_t wake_key = reinterpret_cast<uintptr_t>(wake_ptr.get());
-    uintptr_t requeue_key = reinterpret_cast<uintptr_t>(requeue_ptr.get());
     if (wake_key == requeue_key) return ZX_ERR_INVALID_ARGS;
     if (wake_key % sizeof(int) || requeue_key % sizeof(int))
         return ZX_ERR_INVALID_ARGS;
 
     // This must happen before RemoveFromHead() calls set_hash_key() on
-    // nodes below, because operations on futex_table_ look at the GetKey
+    // nodes below, because operations on futex_table look at the GetKey
     // field of the list head nodes for wake_key and requeue_key.
-    FutexNode* node = futex_table_.erase(wake_key);
+    FutexNode* node = wake_shard->futex_table.erase(wake_key);
     if (!node) {
         // nothing blocked on this futex if we can't find it
         return ZX_OK;
@@ -184,42 +236,56 @@ zx_status_t FutexContext::FutexRequeue(user_in_ptr<const int> wake_ptr, uint32_t
 
             // now requeue our nodes to requeue_ptr mutex
             DEBUG_ASSERT(requeue_head->GetKey() == requeue_key);
-            QueueNodesLocked(requeue_head);
+            QueueNodesLocked(requeue_shard, requeue_head);
         }
     }
 
     // add any remaining nodes back to wake_key futex
     if (node != nullptr) {
         DEBUG_ASSERT(node->GetKey() == wake_key);
-        futex_table_.insert(node);
+        wake_shard->futex_table.insert(node);
     }
 
+    kcounter_add(futex_requeue_ns, current_time() - start);
+
     if (any_woken) {
-        lock.release();
+        unlock.call();
         thread_reschedule();
     }
 
     return ZX_OK;
 }
 
-void FutexContext::QueueNodesLocked(FutexNode* head) {
-    DEBUG_ASSERT(lock_.IsHeld());
+FutexContext::Shard* FutexContext::AcquireShardForNode(FutexNode* node) {
+    for (;;) {
+        Shard* shard = ShardForKey(node->GetKey());
+        shard->lock.Acquire();
+        // The key only changes with the lock for its old shard held, so if
+        // it still maps to this shard it can't change until we release it.
+        if (ShardForKey(node->GetKey()) == shard)
+            return shard;
+        shard->lock.Release();
+    }
+}
+
+void FutexContext::QueueNodesLocked(Shard* shard, FutexNode* head) {
+    DEBUG_ASSERT(shard->lock.IsHeld());
 
-    FutexNode::HashTable::iterator iter;
+    HashTable::iterator iter;
 
     // Attempt to insert this FutexNode into the hash table.  If the insert
     // succeeds, then the current thread is first to block on this futex and we
     // are finished.  If the insert fails, then there is already a thread
     // waiting on this futex.  Add ourselves to that thread's list.
-    if (!futex_table_.insert_or_find(head, &iter))
+    if (!shard->futex_table.insert_or_find(head, &iter))
         iter->AppendList(head);
 }
 
 // This attempts to unqueue a thread (which may or may not be waiting on a
 // futex), given its FutexNode.  This returns whether the FutexNode was
 // found and removed from a futex wait queue.
-bool FutexContext::UnqueueNodeLocked(FutexNode* node) {
-    DEBUG_ASSERT(lock_.IsHeld());
+bool FutexContext::UnqueueNodeLocked(Shard* shard, FutexNode* node) {
+    DEBUG_ASSERT(shard->lock.IsHeld());
 
     if (!node->IsInQueue())
         return false;
@@ -229,11 +295,12 @@ bool FutexContext::UnqueueNodeLocked(FutexNode* node) {
     // However, that could be out of date if the thread was requeued by
     // FutexRequeue(), so we need to re-get the hash table key here.
     uintptr_t futex_key = node->GetKey();
+    DEBUG_ASSERT(ShardForKey(futex_key) == shard);
 
-    FutexNode* old_head = futex_table_.erase(futex_key);
+    FutexNode* old_head = shard->futex_table.erase(futex_key);
     DEBUG_ASSERT(old_head);
     FutexNode* new_head = FutexNode::RemoveNodeFromList(old_head, node);
     if (new_head)
-        futex_table_.insert(new_head);
+        shard->futex_table.insert(new_head);
     return true;
 }
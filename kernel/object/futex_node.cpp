@@ -85,8 +85,9 @@ FutexNode* FutexNode::WakeThreads(FutexNode* node, uint32_t count,
     FutexNode* const list_end = node->queue_prev_;
     for (uint32_t i = 0; i < count; i++) {
         DEBUG_ASSERT(node->GetKey() == old_hash_key);
-        // Clear this field to avoid any possible confusion.
-        node->set_hash_key(0);
+        // Leave the key in place: if the thread's wait times out at the
+        // same time, FutexWait() uses it to find the FutexContext shard lock
+        // that we are holding, and then sees that the node was dequeued.
 
         const bool is_last_node = (node == list_end);
         FutexNode* next = node->queue_next_;
@@ -175,20 +176,20 @@ bool FutexNode::WakeThread() {
     // cases to consider:
     //  1) The thread's wait times out, or the thread is killed or
     //     suspended.  In those cases, FutexWait() will reacquire the
-    //     FutexContext lock.  We are currently holding that lock, so
-    //     FutexWait() will not race with us.
+    //     lock of the FutexContext shard for this futex.  We are currently
+    //     holding that lock, so FutexWait() will not race with us.
     //  2) The thread is woken by our wait_queue_wake_one() call.  In
     //     this case, FutexWait() will *not* reacquire the FutexContext
-    //     lock.  To handle this correctly, we must not access |this|
+    //     shard lock.  To handle this correctly, we must not access |this|
     //     after wait_queue_wake_one().
 
     // We must do this before we wake the thread, to handle case 2.
     MarkAsNotInQueue();
 
     // Place the waiting thread in the runnable state, but do not
-    // reschedule yet.  Our caller is currently holding the main
-    // futex_lock, and any threads which get woken by this action are going
-    // to immediately attempt to obtain the main futex_lock.  If we
+    // reschedule yet.  Our caller is currently holding the futex's shard
+    // lock, and any threads which get woken by this action are going
+    // to immediately attempt to obtain that lock.  If we
     // indicate that the thread was woken during this process, our caller
     // will release the lock and then arrange for a reschedule operation
     // (which leads to a smoother transition).
@@ -6,10 +6,18 @@
 
 #include <object/handle.h>
 
+#include <arch/ops.h>
+#include <string.h>
+
 #include <object/dispatcher.h>
+#include <fbl/algorithm.h>
 #include <fbl/arena.h>
+#include <fbl/atomic.h>
 #include <fbl/auto_lock.h>
 #include <fbl/mutex.h>
+#include <kernel/align.h>
+#include <kernel/spinlock.h>
+#include <lib/counters.h>
 #include <pow2.h>
 
 using fbl::AutoLock;
@@ -46,6 +54,26 @@ static_assert(((3 << 30) ^ kHandleGenerationMask ^ kHandleIndexMask) ==
                   0xffffffffu,
               "Masks do not agree");
 
+// Each cpu keeps a magazine of free slots in front of the arena, so creating
+// and closing handles doesn't serialize on Handle::mutex_. An empty magazine
+// is refilled, and a full one is drained, half a magazine at a time.
+constexpr size_t kHandleMagazineSize = 32;
+
+struct CpuCache {
+    size_t count;
+    void* slots[kHandleMagazineSize];
+} __CPU_ALIGN;
+
+// Only ever touched by its own cpu, with interrupts disabled.
+CpuCache cpu_caches[SMP_MAX_CPUS];
+
+// The number of live handles. Slots sitting in the cpu caches are allocated
+// as far as the arena is concerned, but are not counted here.
+fbl::atomic<size_t> outstanding_handles;
+
+KCOUNTER(handle_cache_hit, "kernel.handle.cache_hit");
+KCOUNTER(handle_cache_miss, "kernel.handle.cache_miss");
+
 }  // namespace
 
 fbl::Mutex Handle::mutex_;
@@ -57,8 +85,9 @@ void Handle::Init() TA_NO_THREAD_SAFETY_ANALYSIS {
 
 // Returns a new |base_value| based on the value stored in the free
 // arena slot pointed to by |addr|. The new value will be different
-// from the last |base_value| used by this slot.
-uint32_t Handle::GetNewBaseValue(void* addr) TA_REQ(mutex_) {
+// from the last |base_value| used by this slot. The caller must own the
+// slot, so no lock is needed.
+uint32_t Handle::GetNewBaseValue(void* addr) {
     // Get the index of this slot within the arena.
     uint32_t handle_index = HandleToIndex(reinterpret_cast<Handle*>(addr));
     DEBUG_ASSERT((handle_index & ~kHandleIndexMask) == 0);
@@ -76,33 +105,113 @@ uint32_t Handle::GetNewBaseValue(void* addr) TA_REQ(mutex_) {
     return (handle_index | new_gen);
 }
 
-// Allocate space for a Handle from the arena, but don't instantiate the
-// object.  |base_value| gets the value for Handle::base_value_.  |what|
-// says whether this is allocation or duplication, for the error message.
+size_t Handle::ArenaAlloc(void** slots, size_t count) {
+    AutoLock lock(&mutex_);
+    size_t taken = 0;
+    while (taken < count) {
+        void* addr = arena_.Alloc();
+        if (addr == nullptr)
+            break;
+        slots[taken++] = addr;
+    }
+    return taken;
+}
+
+void Handle::ArenaFree(void* const* slots, size_t count) {
+    AutoLock lock(&mutex_);
+    for (size_t i = 0; i < count; i++) {
+        arena_.Free(slots[i]);
+    }
+}
+
+void* Handle::AllocSlot() {
+    void* addr = nullptr;
+
+    spin_lock_saved_state_t state;
+    arch_interrupt_save(&state, SPIN_LOCK_FLAG_INTERRUPTS);
+    CpuCache& cache = cpu_caches[arch_curr_cpu_num()];
+    if (cache.count > 0) {
+        addr = cache.slots[--cache.count];
+    }
+    arch_interrupt_restore(state, SPIN_LOCK_FLAG_INTERRUPTS);
+
+    if (addr != nullptr) {
+        kcounter_add(handle_cache_hit, 1u);
+        return addr;
+    }
+    kcounter_add(handle_cache_miss, 1u);
+
+    // Take half a magazine along with the slot we need.
+    void* slots[kHandleMagazineSize / 2 + 1];
+    size_t count = ArenaAlloc(slots, fbl::count_of(slots));
+    if (count == 0) {
+        // The arena is exhausted, but other cpus may still be holding free
+        // slots in their caches. Don't bother reclaiming them; a system
+        // this close to kMaxHandleCount is already in trouble.
+        return nullptr;
+    }
+    addr = slots[--count];
+
+    // We may be on another cpu by now, and its magazine may have filled up
+    // meanwhile; whatever doesn't fit goes back.
+    arch_interrupt_save(&state, SPIN_LOCK_FLAG_INTERRUPTS);
+    CpuCache& refill = cpu_caches[arch_curr_cpu_num()];
+    while (count > 0 && refill.count < kHandleMagazineSize) {
+        refill.slots[refill.count++] = slots[--count];
+    }
+    arch_interrupt_restore(state, SPIN_LOCK_FLAG_INTERRUPTS);
+
+    if (count > 0) {
+        ArenaFree(slots, count);
+    }
+    return addr;
+}
+
+void Handle::FreeSlot(void* addr) {
+    void* flush[kHandleMagazineSize / 2];
+    size_t count = 0;
+
+    spin_lock_saved_state_t state;
+    arch_interrupt_save(&state, SPIN_LOCK_FLAG_INTERRUPTS);
+    CpuCache& cache = cpu_caches[arch_curr_cpu_num()];
+    if (cache.count == kHandleMagazineSize) {
+        // Send the older half of the magazine back to the arena.
+        count = kHandleMagazineSize / 2;
+        memcpy(flush, cache.slots, count * sizeof(void*));
+        memmove(cache.slots, cache.slots + count,
+                (kHandleMagazineSize - count) * sizeof(void*));
+        cache.count -= count;
+    }
+    cache.slots[cache.count++] = addr;
+    arch_interrupt_restore(state, SPIN_LOCK_FLAG_INTERRUPTS);
+
+    if (count > 0) {
+        ArenaFree(flush, count);
+    }
+}
+
+// Allocate space for a Handle, but don't instantiate the object.
+// |base_value| gets the value for Handle::base_value_.  |what| says
+// whether this is allocation or duplication, for the error message.
 void* Handle::Alloc(const fbl::RefPtr<Dispatcher>& dispatcher,
                     const char* what, uint32_t* base_value) {
-    size_t outstanding_handles;
-    {
-        AutoLock lock(&mutex_);
-        void* addr = arena_.Alloc();
-        outstanding_handles = arena_.DiagnosticCount();
-        if (likely(addr)) {
-            if (outstanding_handles > kHighHandleCount) {
-                // TODO: Avoid calling this for every handle after
-                // kHighHandleCount; printfs are slow and we're
-                // holding the mutex.
-                printf("WARNING: High handle count: %zu handles\n",
-                       outstanding_handles);
-            }
-            dispatcher->increment_handle_count();
-            *base_value = GetNewBaseValue(addr);
-            return addr;
-        }
+    void* addr = AllocSlot();
+    if (unlikely(!addr)) {
+        printf("WARNING: Could not allocate %s handle (%zu outstanding)\n",
+               what, outstanding_handles.load(fbl::memory_order_relaxed));
+        return nullptr;
     }
 
-    printf("WARNING: Could not allocate %s handle (%zu outstanding)\n",
-           what, outstanding_handles);
-    return nullptr;
+    size_t outstanding =
+        outstanding_handles.fetch_add(1u, fbl::memory_order_relaxed) + 1;
+    if (outstanding > kHighHandleCount) {
+        // TODO: Avoid calling this for every handle after
+        // kHighHandleCount; printfs are slow.
+        printf("WARNING: High handle count: %zu handles\n", outstanding);
+    }
+    dispatcher->increment_handle_count();
+    *base_value = GetNewBaseValue(addr);
+    return addr;
 }
 
 HandleOwner Handle::Make(fbl::RefPtr<Dispatcher> dispatcher,
@@ -174,12 +283,9 @@ void Handle::Delete() {
 
     TearDown();
 
-    bool zero_handles = false;
-    {
-        AutoLock lock(&mutex_);
-        zero_handles = disp->decrement_handle_count();
-        arena_.Free(this);
-    }
+    bool zero_handles = disp->decrement_handle_count();
+    outstanding_handles.fetch_sub(1u, fbl::memory_order_relaxed);
+    FreeSlot(this);
 
     if (zero_handles)
         disp->on_zero_handles();
@@ -190,26 +296,28 @@ void Handle::Delete() {
 
 Handle* Handle::FromU32(uint32_t value) TA_NO_THREAD_SAFETY_ANALYSIS {
     Handle* handle = IndexToHandle(value & kHandleIndexMask);
-    {
-        AutoLock lock(&mutex_);
-        if (unlikely(!arena_.in_range(handle)))
-            return nullptr;
-    }
+    // The arena allows in_range() to be called without its lock. A slot that
+    // is in range may be sitting free in a cpu cache, but then its
+    // base_value is zero and can't match.
+    if (unlikely(!arena_.in_range(handle)))
+        return nullptr;
     return likely(handle->base_value() == value) ? handle : nullptr;
 }
 
 uint32_t Handle::Count(const fbl::RefPtr<const Dispatcher>& dispatcher) {
-    // Handle::mutex_ also guards Dispatcher::handle_count_.
-    AutoLock lock(&mutex_);
     return dispatcher->current_handle_count();
 }
 
 size_t Handle::diagnostics::OutstandingHandles() {
-    AutoLock lock(&mutex_);
-    return arena_.DiagnosticCount();
+    return outstanding_handles.load(fbl::memory_order_relaxed);
 }
 
 void Handle::diagnostics::DumpTableInfo() {
+    size_t outstanding = outstanding_handles.load(fbl::memory_order_relaxed);
     AutoLock lock(&mutex_);
     arena_.Dump();
+    // Approximate, since the caches are changing underneath us.
+    size_t allocated = arena_.DiagnosticCount();
+    printf("%zu handles outstanding, %zu free slots in cpu caches\n",
+           outstanding, allocated > outstanding ? allocated - outstanding : 0);
 }
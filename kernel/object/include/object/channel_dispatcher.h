@@ -45,8 +45,22 @@ public:
                      fbl::unique_ptr<MessagePacket>* msg,
                      bool may_disard);
 
+    // Read up to |count| messages from this endpoint's message queue, taking the lock once.
+    // Messages are dequeued in order for as long as the next one fits in the limits given by
+    // the |num_bytes| and |num_handles| of the next element of |limits|. The messages are
+    // returned in |msgs|, their count in |*actual|, and the elements of |limits| are updated
+    // with their actual size and handle count. If not even the first message fits, returns
+    // ZX_ERR_BUFFER_TOO_SMALL and its size and handle count in |limits[0]|.
+    zx_status_t ReadBatch(zx_channel_msg_t* limits, size_t count,
+                          fbl::unique_ptr<MessagePacket>* msgs, size_t* actual);
+
     // Write to the opposing endpoint's message queue.
     zx_status_t Write(fbl::unique_ptr<MessagePacket> msg);
+
+    // Write |count| messages to the opposing endpoint's message queue, taking its lock once.
+    // On success, all the messages have been moved out of |msgs|. On failure, none of them
+    // have been and they still own their handles.
+    zx_status_t WriteBatch(fbl::unique_ptr<MessagePacket>* msgs, size_t count);
     zx_status_t Call(fbl::unique_ptr<MessagePacket> msg,
                      zx_time_t deadline, bool* return_handles,
                      fbl::unique_ptr<MessagePacket>* reply);
@@ -101,6 +115,8 @@ private:
     ChannelDispatcher();
     void Init(fbl::RefPtr<ChannelDispatcher> other);
     int WriteSelf(fbl::unique_ptr<MessagePacket> msg);
+    int WriteSelfBatch(fbl::unique_ptr<MessagePacket>* msgs, size_t count);
+    int WriteSelfLocked(fbl::unique_ptr<MessagePacket> msg) TA_REQ(lock_);
     zx_status_t UserSignalSelf(uint32_t clear_mask, uint32_t set_mask);
     void OnPeerZeroHandles();
 
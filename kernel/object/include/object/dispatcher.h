@@ -10,6 +10,7 @@
 #include <stdint.h>
 #include <stdint.h>
 
+#include <fbl/atomic.h>
 #include <fbl/canary.h>
 #include <fbl/intrusive_double_list.h>
 #include <fbl/intrusive_single_list.h>
@@ -72,21 +73,18 @@ public:
 
     zx_koid_t get_koid() const { return koid_; }
 
-    // Must be called under the handle table lock.
+    // The handle count methods may be called concurrently without any lock.
     void increment_handle_count() {
-        ++handle_count_;
+        handle_count_.fetch_add(1u, fbl::memory_order_relaxed);
     }
 
-    // Must be called under the handle table lock.
     // Returns true exactly when the handle count goes to zero.
     bool decrement_handle_count() {
-        --handle_count_;
-        return handle_count_ == 0u;
+        return handle_count_.fetch_sub(1u, fbl::memory_order_acq_rel) == 1u;
     }
 
-    // Must be called under the handle table lock.
     uint32_t current_handle_count() const {
-        return handle_count_;
+        return handle_count_.load(fbl::memory_order_relaxed);
     }
 
     // The following are only to be called when |has_state_tracker| reports true.
@@ -181,7 +179,7 @@ private:
     StateObserver::Flags UpdateInternalLocked(ObserverList* obs_to_remove, zx_signals_t signals) TA_REQ(lock_);
 
     const zx_koid_t koid_;
-    uint32_t handle_count_;
+    fbl::atomic<uint32_t> handle_count_;
 
     // TODO(kulakowski) Make signals_ TA_GUARDED(lock_).
     // Right now, signals_ is almost entirely accessed under the
@@ -8,12 +8,16 @@
 
 #include <lib/user_copy/user_ptr.h>
 #include <zircon/types.h>
+#include <fbl/intrusive_hash_table.h>
+#include <fbl/intrusive_single_list.h>
 #include <fbl/mutex.h>
 #include <object/futex_node.h>
 
 // FutexContext is a class that encapsulates support for futex operations.
 // FutexContext uses a hash table keyed on the futex address (a pointer to integer in userspace)
 // to contain all active futexes.
+// The table is split into shards, each with its own lock, so that operations on unrelated
+// futexes do not contend with each other.  A futex address always maps to the same shard.
 // A futex is considered active if there is one or more threads blocked on the futex.
 // After no threads are left blocked on a futex it is removed from the hash table.
 // The value in the futex hash table is the FutexNode object associated with the head
@@ -51,14 +55,40 @@ private:
     FutexContext(const FutexContext&) = delete;
     FutexContext& operator=(const FutexContext&) = delete;
 
-    void QueueNodesLocked(FutexNode* head) TA_REQ(lock_);
+    static constexpr size_t kNumShardsShift = 4;
+    static constexpr size_t kNumShards = 1u << kNumShardsShift;
 
-    bool UnqueueNodeLocked(FutexNode* node) TA_REQ(lock_);
+    // Each shard is a small hash table, so spread its keys over a few buckets.
+    using HashTable = fbl::HashTable<uintptr_t, FutexNode*,
+                                     fbl::SinglyLinkedList<FutexNode*>, size_t, 7>;
 
-    // protects futex_table_
-    fbl::Mutex lock_;
+    struct Shard {
+        // protects futex_table
+        fbl::Mutex lock;
 
-    // Hash table for futexes in this context.
-    // Key is futex address, value is the FutexNode for the head of futex's blocked thread list.
-    FutexNode::HashTable futex_table_ TA_GUARDED(lock_);
+        // Hash table for the futexes in this shard.
+        // Key is futex address, value is the FutexNode for the head of futex's blocked
+        // thread list.
+        HashTable futex_table TA_GUARDED(lock);
+    };
+
+    // Futexes are often packed next to each other or spaced a cache line or a
+    // page apart, so no small group of address bits picks a shard well on its
+    // own. Mix the whole key with a multiplicative hash and use its top bits.
+    Shard* ShardForKey(uintptr_t futex_key) {
+        const uint64_t hash = static_cast<uint64_t>(futex_key) * 0x9e3779b97f4a7c15ull;
+        return &shards_[hash >> (64 - kNumShardsShift)];
+    }
+
+    // Acquires the lock of the shard holding the futex that |node| is queued
+    // on, or was last queued on, and returns that shard.  The node's key can
+    // be changed by a concurrent FutexRequeue(), so this retries until the
+    // key is stable under the lock.
+    Shard* AcquireShardForNode(FutexNode* node) TA_NO_THREAD_SAFETY_ANALYSIS;
+
+    void QueueNodesLocked(Shard* shard, FutexNode* head) TA_REQ(shard->lock);
+
+    bool UnqueueNodeLocked(Shard* shard, FutexNode* node) TA_REQ(shard->lock);
+
+    Shard shards_[kNumShards];
 };
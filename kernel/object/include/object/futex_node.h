@@ -10,15 +10,14 @@
 #include <kernel/wait.h>
 #include <list.h>
 #include <zircon/types.h>
-#include <fbl/intrusive_hash_table.h>
+#include <fbl/atomic.h>
+#include <fbl/intrusive_single_list.h>
 #include <fbl/mutex.h>
 
 // Node for linked list of threads blocked on a futex
 // Intended to be embedded within a ThreadDispatcher Instance
 class FutexNode : public fbl::SinglyLinkedListable<FutexNode*> {
 public:
-    using HashTable = fbl::HashTable<uintptr_t, FutexNode*>;
-
     FutexNode();
     ~FutexNode();
 
@@ -45,11 +44,11 @@ public:
     zx_status_t BlockThread(fbl::Mutex* mutex, zx_time_t deadline) TA_REL(mutex);
 
     void set_hash_key(uintptr_t key) {
-        hash_key_ = key;
+        hash_key_.store(key, fbl::memory_order_relaxed);
     }
 
     // Trait implementation for fbl::HashTable
-    uintptr_t GetKey() const { return hash_key_; }
+    uintptr_t GetKey() const { return hash_key_.load(fbl::memory_order_relaxed); }
     static size_t GetHash(uintptr_t key) { return (key >> 3); }
 
 private:
@@ -66,7 +65,10 @@ private:
     //  * Additionally, when this FutexNode is the head of a futex wait
     //    queue, this field is used by the HashTable (because it uses
     //    intrusive SinglyLinkedLists).
-    uintptr_t hash_key_;
+    // It is only changed with the lock of the FutexContext shard for the old
+    // key held, but it is read without a lock to find that shard, so it is
+    // atomic.
+    fbl::atomic<uintptr_t> hash_key_{0};
 
     // Used for waking the thread corresponding to the FutexNode.
     wait_queue_t wait_queue_;
@@ -147,6 +147,16 @@ private:
                        uint32_t* base_value);
     static uint32_t GetNewBaseValue(void* addr);
 
+    // Take a slot from, or return a slot to, the current cpu's cache of
+    // free slots, falling back to the arena when the cache is empty or full.
+    static void* AllocSlot();
+    static void FreeSlot(void* addr);
+
+    // Move up to |count| slots out of, or exactly |count| slots back into,
+    // the arena.
+    static size_t ArenaAlloc(void** slots, size_t count) TA_EXCL(mutex_);
+    static void ArenaFree(void* const* slots, size_t count) TA_EXCL(mutex_);
+
     // Handle should never be destroyed by anything other than Delete,
     // which uses TearDown to do the actual destruction.
     ~Handle() = default;
@@ -164,7 +174,8 @@ private:
     const zx_rights_t rights_;
     const uint32_t base_value_;
 
-    // The handle arena and its mutex; also guards Dispatcher::handle_count_.
+    // The handle arena and its mutex. Slots normally come from per-cpu
+    // caches, so the mutex is only taken to move batches of slots.
     static fbl::Mutex mutex_;
     static fbl::Arena TA_GUARDED(mutex_) arena_;
 
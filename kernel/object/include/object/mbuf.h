@@ -9,26 +9,45 @@
 #include <stdint.h>
 
 #include <lib/user_copy/user_ptr.h>
+#include <vm/vm_object.h>
 #include <zircon/types.h>
 #include <fbl/intrusive_single_list.h>
+#include <fbl/ref_ptr.h>
 
 class MBufChain {
 public:
+    // The largest limit on the number of bytes held.
+    static constexpr size_t kSizeMaxLimit = ZX_SOCKET_MAX_RX_BUF;
+
     MBufChain() = default;
     ~MBufChain();
 
-    zx_status_t WriteStream(user_in_ptr<const void> src, size_t len, size_t* written);
-    zx_status_t WriteDatagram(user_in_ptr<const void> src, size_t len, size_t* written);
-    size_t Read(user_out_ptr<void> dst, size_t len, bool datagram);
+    // The Write and Read methods copy from or to the |count| user buffers
+    // described by |vec|, in order.
+    zx_status_t WriteStream(const zx_iovec_t* vec, size_t count, size_t* written);
+    zx_status_t WriteDatagram(const zx_iovec_t* vec, size_t count, size_t len,
+                              size_t* written);
+    size_t Read(const zx_iovec_t* vec, size_t count, bool datagram);
+
+    // Appends up to |len| bytes of |vmo|, starting at |offset|, to a stream
+    // without copying them. The chain keeps a reference to |vmo|, so it must
+    // not change while its bytes are queued.
+    zx_status_t WriteVmo(fbl::RefPtr<VmObject> vmo, uint64_t offset, size_t len,
+                         size_t* written);
+
     bool is_full() const;
     bool is_empty() const;
     size_t size() const { return size_; }
 
+    size_t size_max() const { return size_max_; }
+    void set_size_max(size_t size_max) { size_max_ = size_max; }
+
 private:
     // An MBuf is a small fixed-size chainable memory buffer.
     struct MBuf : public fbl::SinglyLinkedListable<MBuf*> {
-        // 8 for the linked list and 4 for the explicit uint32_t fields.
-        static constexpr size_t kHeaderSize = 8 + (4 * 4);
+        // 8 for the linked list, 4 for the explicit uint32_t fields and 16
+        // for the VMO fields.
+        static constexpr size_t kHeaderSize = 8 + (4 * 4) + 16;
         // 16 is for the malloc header.
         static constexpr size_t kMallocSize = 2048 - 16;
         static constexpr size_t kPayloadSize = kMallocSize - kHeaderSize;
@@ -44,18 +63,23 @@ private:
         // Always 0 in ZX_SOCKET_STREAM mode.
         uint32_t pkt_len_ = 0u;
         uint32_t unused_;
+        // If set, the mbuf's bytes are not in data_ but in vmo_, starting
+        // at vmo_offset_ + off_.
+        fbl::RefPtr<VmObject> vmo_;
+        uint64_t vmo_offset_ = 0u;
         char data_[kPayloadSize] = {0};
-        // TODO: maybe union data_ with char* blocks for large messages
     };
     static_assert(sizeof(MBuf) == MBuf::kMallocSize, "");
 
-    static constexpr size_t kSizeMax = 128 * MBuf::kPayloadSize;
+    static constexpr size_t kDefaultSizeMax = 128 * MBuf::kPayloadSize;
 
     MBuf* AllocMBuf();
     void FreeMBuf(MBuf* buf);
+    void Append(MBuf* buf);
 
     fbl::SinglyLinkedList<MBuf*> freelist_;
     fbl::SinglyLinkedList<MBuf*> tail_;
     MBuf* head_ = nullptr;;
     size_t size_ = 0u;
+    size_t size_max_ = kDefaultSizeMax;
 };
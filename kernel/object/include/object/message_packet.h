@@ -9,16 +9,19 @@
 #include <stdint.h>
 
 #include <lib/user_copy/user_ptr.h>
+#include <vm/page.h>
 #include <zircon/types.h>
 #include <fbl/intrusive_double_list.h>
 #include <fbl/unique_ptr.h>
 
 constexpr uint32_t kMaxMessageSize = 65536u;
 constexpr uint32_t kMaxMessageHandles = 64u;
+constexpr uint32_t kMaxMessageBatch = 32u;
 
 // ensure public constants are aligned
 static_assert(ZX_CHANNEL_MAX_MSG_BYTES == kMaxMessageSize, "");
 static_assert(ZX_CHANNEL_MAX_MSG_HANDLES == kMaxMessageHandles, "");
+static_assert(ZX_CHANNEL_MAX_BATCH_MSGS == kMaxMessageBatch, "");
 
 class Handle;
 
@@ -38,9 +41,12 @@ public:
 
     // Copies the packet's |data_size()| bytes to |buf|.
     // Returns an error if |buf| points to a bad user address.
-    zx_status_t CopyDataTo(user_out_ptr<void> buf) const {
-        return buf.copy_array_to_user(data(), data_size_);
-    }
+    zx_status_t CopyDataTo(user_out_ptr<void> buf) const;
+
+    // Like CopyDataTo(), but may consume the data: whole pages of a large
+    // packet are moved into the VMOs mapped at a page-aligned, writable |buf|
+    // instead of being copied. The data must not be read again afterwards.
+    zx_status_t MoveDataTo(user_out_ptr<void> buf);
 
     uint32_t num_handles() const { return num_handles_; }
     Handle* const* handles() const { return handles_; }
@@ -54,12 +60,17 @@ public:
         if (data_size_ < sizeof(zx_txid_t)) {
             return 0;
         } else {
-            return *(reinterpret_cast<const zx_txid_t*>(data()));
+            return *(reinterpret_cast<const zx_txid_t*>(buffer(0u)));
         }
     }
 
+    // Number of pages currently holding packets and their payloads.
+    static size_t DiagnosticSlabPageCount();
+    static size_t DiagnosticDataPageCount();
+
 private:
-    MessagePacket(uint32_t data_size, uint32_t num_handles, Handle** handles);
+    MessagePacket(uint32_t data_size, uint32_t num_handles, Handle** handles,
+                  bool paged);
     ~MessagePacket();
 
     // Allocates a new packet that can hold the specified amount of
@@ -67,18 +78,24 @@ private:
     static zx_status_t NewPacket(uint32_t data_size, uint32_t num_handles,
                                  fbl::unique_ptr<MessagePacket>* msg);
 
-    // Create() uses malloc(), so we must delete using free().
-    static void operator delete(void* ptr) {
-        free(ptr);
-    }
+    // Packets come from the message slabs rather than the heap; see
+    // message_packet.cpp.
+    static void operator delete(void* ptr);
     friend class fbl::unique_ptr<MessagePacket>;
 
-    // Handles and data are stored in the same buffer: num_handles_ Handle*
-    // entries first, then the data buffer.
+    // Handles and data are stored in the same block: num_handles_ Handle*
+    // entries first, then either the data itself or, for a paged packet,
+    // an array of the vm_page_t* that hold the data in page-sized pieces.
     void* data() const { return static_cast<void*>(handles_ + num_handles_); }
+    vm_page_t** pages() const { return reinterpret_cast<vm_page_t**>(data()); }
+
+    // Returns a pointer to byte |offset| of the data. The data of a paged
+    // packet is only contiguous up to the next multiple of PAGE_SIZE.
+    void* buffer(size_t offset) const;
 
     Handle** const handles_;
     const uint32_t data_size_;
     const uint16_t num_handles_;
     bool owns_handles_;
+    const bool paged_;
 };
@@ -151,6 +151,11 @@ public:
     zx_status_t Queue(PortPacket* port_packet, zx_signals_t observed, uint64_t count);
     zx_status_t QueueUser(const zx_port_packet_t& packet);
     zx_status_t Dequeue(zx_time_t deadline, zx_port_packet_t* packet);
+    // Dequeues up to |count| packets into |packets| (which may be null to
+    // discard them), waiting until |deadline| if none are queued.  All of the
+    // packets are removed under a single acquisition of the port lock.
+    zx_status_t DequeueMany(zx_time_t deadline, zx_port_packet_t* packets, size_t count,
+                            size_t* actual);
 
     // Decides who is going to destroy the observer. If it returns |true| it
     // is the duty of the caller. If it is false it is the duty of the port.
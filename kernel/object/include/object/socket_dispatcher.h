@@ -36,7 +36,14 @@ public:
     zx_status_t user_signal(uint32_t clear_mask, uint32_t set_mask, bool peer) final;
 
     // Socket methods.
-    zx_status_t Write(user_in_ptr<const void> src, size_t len, size_t* written);
+    // Write and Read move bytes between the socket and the |count| user
+    // buffers described by |vec|. The array itself is in kernel memory.
+    zx_status_t Write(const zx_iovec_t* vec, size_t count, size_t* written);
+
+    // Queue up to |len| bytes of |vmo|, starting at |offset|, for the peer
+    // without copying them. Only supported by stream sockets.
+    zx_status_t WriteVmo(const fbl::RefPtr<VmObject>& vmo, uint64_t offset, size_t len,
+                         size_t* written);
 
     zx_status_t WriteControl(user_in_ptr<const void> src, size_t len);
 
@@ -45,7 +52,7 @@ public:
 
     zx_status_t HalfClose();
 
-    zx_status_t Read(user_out_ptr<void> dst, size_t len, size_t* nread);
+    zx_status_t Read(const zx_iovec_t* vec, size_t count, size_t* nread);
 
     zx_status_t ReadControl(user_out_ptr<void> dst, size_t len, size_t* nread);
 
@@ -59,13 +66,22 @@ public:
 
     zx_status_t CheckShareable(SocketDispatcher* to_send);
 
+    // The number of bytes this endpoint will hold before its peer stops
+    // being writable.
+    size_t GetReadBufferMax();
+    zx_status_t SetReadBufferMax(size_t size_max);
+
 private:
     // The control_msg must be either nullptr or an allocation of
     // size kControlMsgSize.
     SocketDispatcher(zx_signals_t starting_signals, uint32_t flags,
                      fbl::unique_ptr<char[]> control_msg);
     void Init(fbl::RefPtr<SocketDispatcher> other);
-    zx_status_t WriteSelf(user_in_ptr<const void> src, size_t len, size_t* nwritten);
+    zx_status_t WriteSelf(const zx_iovec_t* vec, size_t count, size_t len, size_t* nwritten);
+    zx_status_t WriteVmoSelf(fbl::RefPtr<VmObject> vmo, uint64_t offset, size_t len,
+                             size_t* nwritten);
+    // The number of bytes this endpoint can still take before it is full.
+    size_t ReadBufferRoom();
     zx_status_t WriteControlSelf(user_in_ptr<const void> src, size_t len);
     zx_status_t UserSignalSelf(uint32_t clear_mask, uint32_t set_mask);
     zx_status_t ShutdownOther(uint32_t how);
@@ -16,10 +16,49 @@
 constexpr size_t MBufChain::MBuf::kHeaderSize;
 constexpr size_t MBufChain::MBuf::kMallocSize;
 constexpr size_t MBufChain::MBuf::kPayloadSize;
-constexpr size_t MBufChain::kSizeMax;
+constexpr size_t MBufChain::kDefaultSizeMax;
+constexpr size_t MBufChain::kSizeMaxLimit;
+
+namespace {
+
+// Walks the bytes of a list of user buffers, skipping empty ones.
+class IovecCursor {
+public:
+    IovecCursor(const zx_iovec_t* vec, size_t count)
+        : vec_(vec), count_(count) {
+        SkipEmpty();
+    }
+
+    bool done() const { return count_ == 0; }
+
+    // The number of bytes left in the current buffer, and where they start.
+    size_t avail() const { return vec_->size - off_; }
+    char* ptr() const { return static_cast<char*>(vec_->buffer) + off_; }
+
+    void Advance(size_t len) {
+        off_ += len;
+        SkipEmpty();
+    }
+
+private:
+    void SkipEmpty() {
+        while (count_ > 0 && off_ == vec_->size) {
+            ++vec_;
+            --count_;
+            off_ = 0;
+        }
+    }
+
+    const zx_iovec_t* vec_;
+    size_t count_;
+    size_t off_ = 0;
+};
+
+} // namespace
 
 size_t MBufChain::MBuf::rem() const {
-    return kPayloadSize - (off_ + len_);
+    // VMO-backed mbufs can't be appended to.
+    return vmo_ ? 0 : kPayloadSize - (off_ + len_);
 }
 
 MBufChain::~MBufChain() {
@@ -30,38 +69,54 @@ MBufChain::~MBufChain() {
 }
 
 bool MBufChain::is_full() const {
-    return size_ >= kSizeMax;
+    return size_ >= size_max_;
 }
 
 bool MBufChain::is_empty() const {
     return size_ == 0;
 }
 
-size_t MBufChain::Read(user_out_ptr<void> dst, size_t len, bool datagram) {
+size_t MBufChain::Read(const zx_iovec_t* vec, size_t count, bool datagram) {
+    size_t len = 0;
+    for (size_t i = 0; i < count; i++)
+        len += vec[i].size;
     if (datagram && len > tail_.front().pkt_len_)
         len = tail_.front().pkt_len_;
 
+    // In datagram mode, the whole packet is discarded once it has been read.
+    MBuf* packet = &tail_.front();
+
+    IovecCursor dst(vec, count);
     size_t pos = 0;
     while (pos < len && !tail_.is_empty()) {
         MBuf& cur = tail_.front();
-        char* src = cur.data_ + cur.off_;
-        size_t copy_len = MIN(cur.len_, len - pos);
-        if (dst.byte_offset(pos).copy_array_to_user(src, copy_len) != ZX_OK)
-            return pos;
+        size_t copy_len = fbl::min(fbl::min(static_cast<size_t>(cur.len_), dst.avail()),
+                                   len - pos);
+        auto user_dst = make_user_out_ptr(static_cast<void*>(dst.ptr()));
+        if (cur.vmo_) {
+            size_t actual;
+            if (cur.vmo_->ReadUser(user_dst, cur.vmo_offset_ + cur.off_, copy_len,
+                                   &actual) != ZX_OK)
+                return pos;
+        } else {
+            if (user_dst.copy_array_to_user(cur.data_ + cur.off_, copy_len) != ZX_OK)
+                return pos;
+        }
         pos += copy_len;
+        dst.Advance(copy_len);
         cur.off_ += static_cast<uint32_t>(copy_len);
         cur.len_ -= static_cast<uint32_t>(copy_len);
         size_ -= copy_len;
-        if (cur.len_ == 0 || datagram) {
-            size_ -= cur.len_;
+        if (cur.len_ == 0) {
             if (head_ == &cur)
                 head_ = nullptr;
             FreeMBuf(tail_.pop_front());
         }
     }
-    if (datagram) {
+    if (datagram && len > 0) {
         // Drain any leftover mbufs in the datagram packet.
-        while (!tail_.is_empty() && tail_.front().pkt_len_ == 0) {
+        while (!tail_.is_empty() &&
+               (&tail_.front() == packet || tail_.front().pkt_len_ == 0)) {
             MBuf* cur = tail_.pop_front();
             size_ -= cur->len_;
             if (head_ == cur)
@@ -72,9 +127,9 @@ size_t MBufChain::Read(user_out_ptr<void> dst, size_t len, bool datagram) {
     return pos;
 }
 
-zx_status_t MBufChain::WriteDatagram(user_in_ptr<const void> src,
+zx_status_t MBufChain::WriteDatagram(const zx_iovec_t* vec, size_t count,
                                      size_t len, size_t* written) {
-    if (len + size_ > kSizeMax)
+    if (len + size_ > size_max_)
         return ZX_ERR_SHOULD_WAIT;
 
     fbl::SinglyLinkedList<MBuf*> bufs;
@@ -88,64 +143,51 @@ zx_status_t MBufChain::WriteDatagram(user_in_ptr<const void> src,
         bufs.push_front(buf);
     }
 
-    size_t pos = 0;
+    IovecCursor src(vec, count);
     for (auto& buf : bufs) {
-        size_t copy_len = fbl::min(MBuf::kPayloadSize, len - pos);
-        if (src.byte_offset(pos).copy_array_from_user(buf.data_, copy_len) != ZX_OK) {
-            while (!bufs.is_empty())
-                FreeMBuf(bufs.pop_front());
-            return ZX_ERR_INVALID_ARGS; // Bad user buffer.
+        while (buf.rem() > 0 && !src.done()) {
+            size_t copy_len = fbl::min(buf.rem(), src.avail());
+            auto user_src = make_user_in_ptr(static_cast<const void*>(src.ptr()));
+            if (user_src.copy_array_from_user(buf.data_ + buf.len_, copy_len) != ZX_OK) {
+                while (!bufs.is_empty())
+                    FreeMBuf(bufs.pop_front());
+                return ZX_ERR_INVALID_ARGS; // Bad user buffer.
+            }
+            src.Advance(copy_len);
+            buf.len_ += static_cast<uint32_t>(copy_len);
         }
-        pos += copy_len;
-        buf.len_ += static_cast<uint32_t>(copy_len);
     }
 
     bufs.front().pkt_len_ = static_cast<uint32_t>(len);
 
     // Successfully built the packet mbufs. Put it on the socket.
-    while (!bufs.is_empty()) {
-        auto next = bufs.pop_front();
-        if (head_ == nullptr) {
-            tail_.push_front(next);
-        } else {
-            tail_.insert_after(tail_.make_iterator(*head_), next);
-        }
-        head_ = next;
-    }
+    while (!bufs.is_empty())
+        Append(bufs.pop_front());
 
     *written = len;
     size_ += len;
     return ZX_OK;
 }
 
-zx_status_t MBufChain::WriteStream(user_in_ptr<const void> src,
-                                   size_t len, size_t* written) {
-    if (head_ == nullptr) {
-        head_ = AllocMBuf();
-        if (head_ == nullptr)
-            return ZX_ERR_SHOULD_WAIT;
-        tail_.push_front(head_);
-    }
-
+zx_status_t MBufChain::WriteStream(const zx_iovec_t* vec, size_t count,
+                                   size_t* written) {
+    IovecCursor src(vec, count);
     size_t pos = 0;
-    while (pos < len) {
-        if (head_->rem() == 0) {
+    while (!src.done() && size_ < size_max_) {
+        if (head_ == nullptr || head_->rem() == 0) {
             auto next = AllocMBuf();
             if (next == nullptr)
                 break;
-            tail_.insert_after(tail_.make_iterator(*head_), next);
-            head_ = next;
+            Append(next);
         }
         void* dst = head_->data_ + head_->off_ + head_->len_;
-        size_t copy_len = fbl::min(head_->rem(), len - pos);
-        if (size_ + copy_len > kSizeMax) {
-            copy_len = kSizeMax - size_;
-            if (copy_len == 0)
-                break;
-        }
-        if (src.byte_offset(pos).copy_array_from_user(dst, copy_len) != ZX_OK)
+        size_t copy_len = fbl::min(fbl::min(head_->rem(), src.avail()),
+                                   size_max_ - size_);
+        auto user_src = make_user_in_ptr(static_cast<const void*>(src.ptr()));
+        if (user_src.copy_array_from_user(dst, copy_len) != ZX_OK)
             break;
         pos += copy_len;
+        src.Advance(copy_len);
         head_->len_ += static_cast<uint32_t>(copy_len);
         size_ += copy_len;
     }
@@ -157,6 +199,36 @@ zx_status_t MBufChain::WriteStream(user_in_ptr<const void> src,
     return ZX_OK;
 }
 
+zx_status_t MBufChain::WriteVmo(fbl::RefPtr<VmObject> vmo, uint64_t offset,
+                                size_t len, size_t* written) {
+    if (size_ >= size_max_)
+        return ZX_ERR_SHOULD_WAIT;
+    len = fbl::min(len, size_max_ - size_);
+
+    // A single mbuf refers to the whole range, however long it is.
+    MBuf* buf = AllocMBuf();
+    if (buf == nullptr)
+        return ZX_ERR_SHOULD_WAIT;
+    buf->vmo_ = fbl::move(vmo);
+    buf->vmo_offset_ = offset;
+    buf->len_ = static_cast<uint32_t>(len);
+    Append(buf);
+
+    *written = len;
+    size_ += len;
+    return ZX_OK;
+}
+
+// Adds |buf| to the end of the chain.
+void MBufChain::Append(MBuf* buf) {
+    if (head_ == nullptr) {
+        tail_.push_front(buf);
+    } else {
+        tail_.insert_after(tail_.make_iterator(*head_), buf);
+    }
+    head_ = buf;
+}
+
 MBufChain::MBuf* MBufChain::AllocMBuf() {
     if (freelist_.is_empty()) {
         fbl::AllocChecker ac;
@@ -169,5 +241,8 @@ MBufChain::MBuf* MBufChain::AllocMBuf() {
 void MBufChain::FreeMBuf(MBuf* buf) {
     buf->off_ = 0u;
     buf->len_ = 0u;
+    buf->pkt_len_ = 0u;
+    buf->vmo_.reset();
+    buf->vmo_offset_ = 0u;
     freelist_.push_front(buf);
 }
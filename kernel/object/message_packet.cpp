@@ -6,13 +6,363 @@
 
 #include <object/message_packet.h>
 
+#include <arch/ops.h>
 #include <err.h>
 #include <stdint.h>
 #include <string.h>
 
+#include <fbl/algorithm.h>
+#include <fbl/atomic.h>
+#include <fbl/auto_lock.h>
+#include <fbl/intrusive_double_list.h>
+#include <fbl/mutex.h>
+#include <kernel/align.h>
+#include <kernel/spinlock.h>
+#include <lib/counters.h>
+#include <vm/physmap.h>
+#include <vm/pmm.h>
+#include <vm/vm_address_region.h>
+#include <vm/vm_aspace.h>
 #include <zxcpp/new.h>
 #include <object/handle.h>
 
+// Packets are not allocated from the heap. They come from page-sized slabs in
+// a handful of size classes, and every page holding channel messages is marked
+// VM_PAGE_STATE_IPC, so channel memory is accounted for separately and bursts
+// of channel traffic don't fragment the heap.
+//
+// A packet whose header, handles and data fit in the largest size class is
+// stored in a single block. Otherwise the data is stored in whole pages and
+// the block only holds the header, the handles and the array of data pages.
+//
+// When a large packet is read into a page-aligned buffer, its whole data pages
+// are moved into the reader's VMO rather than copied a second time.
+//
+// Each cpu keeps a small magazine of free blocks per size class in front of
+// the slabs, so a write/read pair on the same cpu doesn't take any locks.
+
+namespace {
+
+// Overlays a free block.
+struct FreeEntry {
+    FreeEntry* next;
+};
+
+// Lives at the start of each slab page, followed by the blocks.
+struct Slab : public fbl::DoublyLinkedListable<Slab*> {
+    FreeEntry* free = nullptr;
+    vm_page_t* page = nullptr;
+    uint16_t in_use = 0;
+    uint8_t size_class = 0;
+};
+
+constexpr size_t kSlabHeaderSize = 64;
+static_assert(sizeof(Slab) <= kSlabHeaderSize, "");
+
+constexpr size_t kNumSizeClasses = 5;
+
+// Number of blocks carved out of each slab, by size class.
+constexpr uint16_t kBlocksPerSlab[kNumSizeClasses] = {16, 8, 4, 2, 1};
+
+constexpr size_t BlockSize(size_t size_class) {
+    return ROUNDDOWN((PAGE_SIZE - kSlabHeaderSize) / kBlocksPerSlab[size_class], 16);
+}
+
+constexpr size_t kMaxBlockSize = BlockSize(kNumSizeClasses - 1);
+
+// A paged packet must always fit in a block.
+static_assert(sizeof(MessagePacket) + kMaxMessageHandles * sizeof(Handle*) +
+                      kMaxMessageSize / PAGE_SIZE * sizeof(vm_page_t*) <=
+                  kMaxBlockSize,
+              "");
+
+// Free blocks held per cpu, by size class: up to kMaxMagazineSize, and about
+// two pages' worth for the larger classes.
+constexpr size_t kMaxMagazineSize = 16;
+
+constexpr size_t MagazineSize(size_t size_class) {
+    return fbl::min(kMaxMagazineSize, 2 * PAGE_SIZE / BlockSize(size_class));
+}
+
+struct SizeClass {
+    fbl::Mutex lock;
+
+    // Slabs with at least one free block.
+    fbl::DoublyLinkedList<Slab*> partial TA_GUARDED(lock);
+
+    // A completely free slab held back to absorb alloc/free churn. May be
+    // null. Not in |partial|.
+    Slab* spare TA_GUARDED(lock) = nullptr;
+};
+
+SizeClass size_classes[kNumSizeClasses];
+
+struct CpuCache {
+    size_t count[kNumSizeClasses];
+    void* blocks[kNumSizeClasses][kMaxMagazineSize];
+} __CPU_ALIGN;
+
+// Only ever touched by its own cpu, with interrupts disabled.
+CpuCache cpu_caches[SMP_MAX_CPUS];
+
+fbl::atomic<size_t> slab_page_count;
+fbl::atomic<size_t> data_page_count;
+
+KCOUNTER(msg_cache_hit, "kernel.channel.msg.cache_hit");
+KCOUNTER(msg_cache_miss, "kernel.channel.msg.cache_miss");
+KCOUNTER(msg_pages_moved, "kernel.channel.msg.pages_moved");
+
+// Below this many whole pages of data, unmapping the reader's old pages
+// costs more than copying.
+constexpr size_t kMinMovePages = 4;
+
+size_t SizeClassFor(size_t size) {
+    for (size_t i = 0; i < kNumSizeClasses; i++) {
+        if (size <= BlockSize(i)) {
+            return i;
+        }
+    }
+    panic("message packet block of %zu bytes\n", size);
+}
+
+Slab* SlabOf(void* block) {
+    return reinterpret_cast<Slab*>(ROUNDDOWN(reinterpret_cast<uintptr_t>(block), PAGE_SIZE));
+}
+
+Slab* NewSlab(size_t size_class) {
+    paddr_t pa;
+    vm_page_t* page = pmm_alloc_page(PMM_ALLOC_FLAG_KMAP, &pa);
+    if (page == nullptr) {
+        return nullptr;
+    }
+    page->state = VM_PAGE_STATE_IPC;
+    slab_page_count.fetch_add(1);
+
+    char* base = static_cast<char*>(paddr_to_physmap(pa));
+    Slab* slab = new (base) Slab;
+    slab->page = page;
+    slab->size_class = static_cast<uint8_t>(size_class);
+
+    // Thread the free list so blocks are handed out in address order.
+    const size_t block_size = BlockSize(size_class);
+    for (size_t i = kBlocksPerSlab[size_class]; i > 0; i--) {
+        FreeEntry* entry = reinterpret_cast<FreeEntry*>(
+            base + kSlabHeaderSize + (i - 1) * block_size);
+        entry->next = slab->free;
+        slab->free = entry;
+    }
+    return slab;
+}
+
+void DeleteSlab(Slab* slab) {
+    vm_page_t* page = slab->page;
+    slab->~Slab();
+    pmm_free_page(page);
+    slab_page_count.fetch_sub(1);
+}
+
+// Takes up to |count| blocks of |size_class| out of the slabs. Returns the
+// number of blocks taken.
+size_t SlabAlloc(size_t size_class, void** blocks, size_t count) {
+    SizeClass& sc = size_classes[size_class];
+    fbl::AutoLock lock(&sc.lock);
+
+    size_t taken = 0;
+    while (taken < count) {
+        if (sc.partial.is_empty()) {
+            Slab* slab = sc.spare;
+            sc.spare = nullptr;
+            if (slab == nullptr) {
+                slab = NewSlab(size_class);
+                if (slab == nullptr) {
+                    break;
+                }
+            }
+            sc.partial.push_front(slab);
+        }
+
+        Slab& slab = sc.partial.front();
+        while (taken < count && slab.free != nullptr) {
+            blocks[taken++] = slab.free;
+            slab.free = slab.free->next;
+            slab.in_use++;
+        }
+        if (slab.free == nullptr) {
+            sc.partial.pop_front();
+        }
+    }
+    return taken;
+}
+
+// Returns |count| blocks of |size_class| to their slabs.
+void SlabFree(size_t size_class, void* const* blocks, size_t count) {
+    SizeClass& sc = size_classes[size_class];
+    fbl::AutoLock lock(&sc.lock);
+
+    for (size_t i = 0; i < count; i++) {
+        Slab* slab = SlabOf(blocks[i]);
+        DEBUG_ASSERT(slab->size_class == size_class);
+        DEBUG_ASSERT(slab->in_use > 0);
+
+        if (slab->free == nullptr) {
+            sc.partial.push_front(slab);
+        }
+        FreeEntry* entry = static_cast<FreeEntry*>(blocks[i]);
+        entry->next = slab->free;
+        slab->free = entry;
+
+        if (--slab->in_use == 0) {
+            sc.partial.erase(*slab);
+            if (sc.spare == nullptr) {
+                sc.spare = slab;
+            } else {
+                DeleteSlab(slab);
+            }
+        }
+    }
+}
+
+void* AllocBlock(size_t size_class) {
+    void* block = nullptr;
+
+    spin_lock_saved_state_t state;
+    arch_interrupt_save(&state, SPIN_LOCK_FLAG_INTERRUPTS);
+    CpuCache& cache = cpu_caches[arch_curr_cpu_num()];
+    if (cache.count[size_class] > 0) {
+        block = cache.blocks[size_class][--cache.count[size_class]];
+    }
+    arch_interrupt_restore(state, SPIN_LOCK_FLAG_INTERRUPTS);
+
+    if (block != nullptr) {
+        kcounter_add(msg_cache_hit, 1u);
+        return block;
+    }
+    kcounter_add(msg_cache_miss, 1u);
+
+    // Take half a magazine along with the block we need.
+    void* blocks[kMaxMagazineSize / 2 + 1];
+    size_t count = SlabAlloc(size_class, blocks, MagazineSize(size_class) / 2 + 1);
+    if (count == 0) {
+        return nullptr;
+    }
+    block = blocks[--count];
+
+    // We may be on another cpu by now, and its magazine may have filled up
+    // meanwhile; whatever doesn't fit goes back.
+    arch_interrupt_save(&state, SPIN_LOCK_FLAG_INTERRUPTS);
+    CpuCache& refill = cpu_caches[arch_curr_cpu_num()];
+    while (count > 0 && refill.count[size_class] < MagazineSize(size_class)) {
+        refill.blocks[size_class][refill.count[size_class]++] = blocks[--count];
+    }
+    arch_interrupt_restore(state, SPIN_LOCK_FLAG_INTERRUPTS);
+
+    if (count > 0) {
+        SlabFree(size_class, blocks, count);
+    }
+    return block;
+}
+
+void ReleaseBlock(void* block) {
+    // The size class of a slab never changes, so no lock is needed to read it.
+    const size_t size_class = SlabOf(block)->size_class;
+    const size_t magazine_size = MagazineSize(size_class);
+
+    void* flush[kMaxMagazineSize / 2];
+    size_t count = 0;
+
+    spin_lock_saved_state_t state;
+    arch_interrupt_save(&state, SPIN_LOCK_FLAG_INTERRUPTS);
+    CpuCache& cache = cpu_caches[arch_curr_cpu_num()];
+    if (cache.count[size_class] == magazine_size) {
+        // Send the older half of the magazine back to the slabs.
+        count = magazine_size / 2;
+        void** blocks = cache.blocks[size_class];
+        memcpy(flush, blocks, count * sizeof(void*));
+        memmove(blocks, blocks + count, (magazine_size - count) * sizeof(void*));
+        cache.count[size_class] -= count;
+    }
+    cache.blocks[size_class][cache.count[size_class]++] = block;
+    arch_interrupt_restore(state, SPIN_LOCK_FLAG_INTERRUPTS);
+
+    if (count > 0) {
+        SlabFree(size_class, flush, count);
+    }
+}
+
+bool AllocDataPages(size_t count, vm_page_t** pages) {
+    list_node list = LIST_INITIAL_VALUE(list);
+    if (pmm_alloc_pages(count, PMM_ALLOC_FLAG_KMAP, &list) != count) {
+        pmm_free(&list);
+        return false;
+    }
+    data_page_count.fetch_add(count);
+
+    size_t i = 0;
+    vm_page_t* page;
+    list_for_every_entry (&list, page, vm_page_t, free.node) {
+        page->state = VM_PAGE_STATE_IPC;
+        pages[i++] = page;
+    }
+    return true;
+}
+
+// Pages that were moved out of the packet are null.
+void FreeDataPages(size_t count, vm_page_t* const* pages) {
+    list_node list = LIST_INITIAL_VALUE(list);
+    size_t freed = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (pages[i] != nullptr) {
+            list_add_tail(&list, &pages[i]->free.node);
+            freed++;
+        }
+    }
+    pmm_free(&list);
+    data_page_count.fetch_sub(freed);
+}
+
+// Moves up to |count| pages into the writable mappings starting at the
+// page-aligned user address |va|, stopping at the first address that can't
+// take them. Moved entries of |pages| are set to null. Returns the number of
+// pages moved.
+size_t MovePagesToUser(vaddr_t va, vm_page_t** pages, size_t count) {
+    VmAspace* aspace = VmAspace::vaddr_to_aspace(va);
+    if (aspace == nullptr || !aspace->is_user()) {
+        return 0;
+    }
+
+    size_t moved = 0;
+    while (moved < count) {
+        fbl::RefPtr<VmAddressRegionOrMapping> region = aspace->FindRegion(va);
+        fbl::RefPtr<VmMapping> mapping = region ? region->as_vm_mapping() : nullptr;
+        if (!mapping) {
+            break;
+        }
+        const size_t offset = va - mapping->base();
+        const size_t n = fbl::min(count - moved, (mapping->size() - offset) / PAGE_SIZE);
+
+        size_t replaced;
+        zx_status_t status = mapping->ReplacePages(offset, pages + moved, n, &replaced);
+        for (size_t i = 0; i < replaced; i++) {
+            pages[moved + i] = nullptr;
+        }
+        moved += replaced;
+        va += replaced * PAGE_SIZE;
+        if (status != ZX_OK || replaced == 0) {
+            break;
+        }
+    }
+
+    data_page_count.fetch_sub(moved);
+    kcounter_add(msg_pages_moved, moved);
+    return moved;
+}
+
+size_t DataPageCount(uint32_t data_size) {
+    return ROUNDUP(data_size, PAGE_SIZE) / PAGE_SIZE;
+}
+
+} // namespace
+
 // static
 zx_status_t MessagePacket::NewPacket(uint32_t data_size, uint32_t num_handles,
                                      fbl::unique_ptr<MessagePacket>* msg) {
@@ -24,16 +374,22 @@ zx_status_t MessagePacket::NewPacket(uint32_t data_size, uint32_t num_handles,
     }
 
     // Allocate space for the MessagePacket object followed by num_handles
-    // Handle*s followed by data_size bytes.
-    // TODO(dbort): Use mbuf-style memory for data_size, ideally allocating from
-    // somewhere other than the heap. Lets us better track and isolate channel
-    // memory usage.
-    char* ptr = static_cast<char*>(malloc(sizeof(MessagePacket) +
-                                          num_handles * sizeof(Handle*) +
-                                          data_size));
+    // Handle*s followed by either data_size bytes or, if that doesn't fit in
+    // a block, the vm_page_t*s of the pages holding the data.
+    const size_t header_size = sizeof(MessagePacket) + num_handles * sizeof(Handle*);
+    const bool paged = header_size + data_size > kMaxBlockSize;
+    const size_t num_pages = paged ? DataPageCount(data_size) : 0u;
+    const size_t block_size =
+        header_size + (paged ? num_pages * sizeof(vm_page_t*) : data_size);
+
+    char* ptr = static_cast<char*>(AllocBlock(SizeClassFor(block_size)));
     if (ptr == nullptr) {
         return ZX_ERR_NO_MEMORY;
     }
+    if (paged && !AllocDataPages(num_pages, reinterpret_cast<vm_page_t**>(ptr + header_size))) {
+        ReleaseBlock(ptr);
+        return ZX_ERR_NO_MEMORY;
+    }
 
     // The storage space for the Handle*s is not initialized because
     // the only creators of MessagePackets (sys_channel_write and
@@ -41,7 +397,7 @@ zx_status_t MessagePacket::NewPacket(uint32_t data_size, uint32_t num_handles,
     // of the object.
     msg->reset(new (ptr) MessagePacket(
         data_size, num_handles,
-        reinterpret_cast<Handle**>(ptr + sizeof(MessagePacket))));
+        reinterpret_cast<Handle**>(ptr + sizeof(MessagePacket)), paged));
     return ZX_OK;
 }
 
@@ -53,8 +409,9 @@ zx_status_t MessagePacket::Create(user_in_ptr<const void> data, uint32_t data_si
     if (status != ZX_OK) {
         return status;
     }
-    if (data_size > 0u) {
-        if (data.copy_array_from_user((*msg)->data(), data_size) != ZX_OK) {
+    for (size_t offset = 0; offset < data_size; offset += PAGE_SIZE) {
+        const size_t len = fbl::min<size_t>(data_size - offset, PAGE_SIZE);
+        if (data.byte_offset(offset).copy_array_from_user((*msg)->buffer(offset), len) != ZX_OK) {
             msg->reset();
             return ZX_ERR_INVALID_ARGS;
         }
@@ -70,12 +427,65 @@ zx_status_t MessagePacket::Create(const void* data, uint32_t data_size,
     if (status != ZX_OK) {
         return status;
     }
-    if (data_size > 0u) {
-        memcpy((*msg)->data(), data, data_size);
+    for (size_t offset = 0; offset < data_size; offset += PAGE_SIZE) {
+        const size_t len = fbl::min<size_t>(data_size - offset, PAGE_SIZE);
+        memcpy((*msg)->buffer(offset), static_cast<const char*>(data) + offset, len);
     }
     return ZX_OK;
 }
 
+// static
+void MessagePacket::operator delete(void* ptr) {
+    ReleaseBlock(ptr);
+}
+
+// static
+size_t MessagePacket::DiagnosticSlabPageCount() {
+    return slab_page_count.load();
+}
+
+// static
+size_t MessagePacket::DiagnosticDataPageCount() {
+    return data_page_count.load();
+}
+
+zx_status_t MessagePacket::CopyDataTo(user_out_ptr<void> buf) const {
+    for (size_t offset = 0; offset < data_size_; offset += PAGE_SIZE) {
+        const size_t len = fbl::min<size_t>(data_size_ - offset, PAGE_SIZE);
+        zx_status_t status = buf.byte_offset(offset).copy_array_to_user(buffer(offset), len);
+        if (status != ZX_OK) {
+            return status;
+        }
+    }
+    return ZX_OK;
+}
+
+zx_status_t MessagePacket::MoveDataTo(user_out_ptr<void> buf) {
+    size_t offset = 0;
+    const vaddr_t va = reinterpret_cast<vaddr_t>(buf.get());
+    const size_t whole_pages = data_size_ / PAGE_SIZE;
+    if (paged_ && whole_pages >= kMinMovePages && IS_PAGE_ALIGNED(va)) {
+        offset = MovePagesToUser(va, pages(), whole_pages) * PAGE_SIZE;
+    }
+
+    for (; offset < data_size_; offset += PAGE_SIZE) {
+        const size_t len = fbl::min<size_t>(data_size_ - offset, PAGE_SIZE);
+        zx_status_t status = buf.byte_offset(offset).copy_array_to_user(buffer(offset), len);
+        if (status != ZX_OK) {
+            return status;
+        }
+    }
+    return ZX_OK;
+}
+
+void* MessagePacket::buffer(size_t offset) const {
+    if (!paged_) {
+        return static_cast<char*>(data()) + offset;
+    }
+    const vm_page_t* page = pages()[offset / PAGE_SIZE];
+    return static_cast<char*>(paddr_to_physmap(vm_page_to_paddr(page))) + offset % PAGE_SIZE;
+}
+
 MessagePacket::~MessagePacket() {
     if (owns_handles_) {
         for (size_t ix = 0; ix != num_handles_; ++ix) {
@@ -83,11 +493,15 @@ MessagePacket::~MessagePacket() {
             HandleOwner ho(handles_[ix]);
         }
     }
+    if (paged_) {
+        FreeDataPages(DataPageCount(data_size_), pages());
+    }
 }
 
 MessagePacket::MessagePacket(uint32_t data_size,
-                             uint32_t num_handles, Handle** handles)
+                             uint32_t num_handles, Handle** handles, bool paged)
     : handles_(handles), data_size_(data_size),
       // NewPacket ensures that num_handles fits in 16 bits.
-      num_handles_(static_cast<uint16_t>(num_handles)), owns_handles_(false) {
+      num_handles_(static_cast<uint16_t>(num_handles)), owns_handles_(false),
+      paged_(paged) {
 }
@@ -251,30 +251,45 @@ zx_status_t PortDispatcher::Queue(PortPacket* port_packet, zx_signals_t observed
 }
 
 zx_status_t PortDispatcher::Dequeue(zx_time_t deadline, zx_port_packet_t* out_packet) {
+    size_t actual;
+    return DequeueMany(deadline, out_packet, 1u, &actual);
+}
+
+zx_status_t PortDispatcher::DequeueMany(zx_time_t deadline, zx_port_packet_t* out_packets,
+                                        size_t count, size_t* actual) {
     canary_.Assert();
+    DEBUG_ASSERT(count > 0u);
 
     while (true) {
         {
             AutoLock al(&lock_);
 
-            PortPacket* port_packet = packets_.pop_front();
-            if (port_packet == nullptr)
-                goto wait;
-
-            if (out_packet != nullptr)
-                *out_packet = port_packet->packet;
+            size_t n = 0u;
+            for (; n < count; ++n) {
+                PortPacket* port_packet = packets_.pop_front();
+                if (port_packet == nullptr)
+                    break;
+
+                if (out_packets != nullptr)
+                    out_packets[n] = port_packet->packet;
+
+                PortObserver* observer = port_packet->observer;
+
+                if (observer) {
+                    // Deleting the observer under the lock is fine because
+                    // the reference that holds to this PortDispatcher is by
+                    // construction not the last one. We need to do this under
+                    // the lock because another thread can call CanReap().
+                    delete observer;
+                } else if (port_packet->is_ephemeral()) {
+                    port_packet->Free();
+                }
+            }
 
-            PortObserver* observer = port_packet->observer;
+            if (n == 0u)
+                goto wait;
 
-            if (observer) {
-                // Deleting the observer under the lock is fine because
-                // the reference that holds to this PortDispatcher is by
-                // construction not the last one. We need to do this under
-                // the lock because another thread can call CanReap().
-                delete observer;
-            } else if (port_packet->is_ephemeral()) {
-                port_packet->Free();
-            }
+            *actual = n;
         }
 
         return ZX_OK;
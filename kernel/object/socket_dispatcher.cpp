@@ -21,6 +21,7 @@
 #include <object/handle.h>
 
 #include <zircon/rights.h>
+#include <fbl/algorithm.h>
 #include <fbl/alloc_checker.h>
 #include <fbl/auto_lock.h>
 
@@ -218,7 +219,7 @@ zx_status_t SocketDispatcher::ShutdownOther(uint32_t how) {
     return ZX_OK;
 }
 
-zx_status_t SocketDispatcher::Write(user_in_ptr<const void> src, size_t len,
+zx_status_t SocketDispatcher::Write(const zx_iovec_t* vec, size_t count,
                                     size_t* nwritten) {
     canary_.Assert();
 
@@ -235,14 +236,70 @@ zx_status_t SocketDispatcher::Write(user_in_ptr<const void> src, size_t len,
         other = other_;
     }
 
+    // The total length must fit in 32 bits.
+    size_t len = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (vec[i].size > UINT32_MAX - len)
+            return ZX_ERR_INVALID_ARGS;
+        len += vec[i].size;
+    }
+
     if (len == 0) {
         *nwritten = 0;
         return ZX_OK;
     }
-    if (len != static_cast<size_t>(static_cast<uint32_t>(len)))
-        return ZX_ERR_INVALID_ARGS;
 
-    return other->WriteSelf(src, len, nwritten);
+    return other->WriteSelf(vec, count, len, nwritten);
+}
+
+zx_status_t SocketDispatcher::WriteVmo(const fbl::RefPtr<VmObject>& vmo, uint64_t offset,
+                                       size_t len, size_t* nwritten) {
+    canary_.Assert();
+
+    LTRACE_ENTRY;
+
+    if (flags_ & ZX_SOCKET_DATAGRAM)
+        return ZX_ERR_NOT_SUPPORTED;
+
+    fbl::RefPtr<SocketDispatcher> other;
+    {
+        AutoLock lock(&lock_);
+        if (!other_)
+            return ZX_ERR_PEER_CLOSED;
+        zx_signals_t signals = GetSignalsState();
+        if (signals & ZX_SOCKET_WRITE_DISABLED)
+            return ZX_ERR_BAD_STATE;
+        other = other_;
+    }
+
+    uint64_t vmo_size = vmo->size();
+    if (offset > vmo_size || len > vmo_size - offset)
+        return ZX_ERR_OUT_OF_RANGE;
+
+    if (len == 0) {
+        *nwritten = 0;
+        return ZX_OK;
+    }
+
+    // Don't take a clone the peer has no room for. WriteVmoSelf() checks
+    // again under the peer's lock, since a reader or writer may get there
+    // first; this only keeps a full socket from cloning on every attempt.
+    size_t room = other->ReadBufferRoom();
+    if (room == 0)
+        return ZX_ERR_SHOULD_WAIT;
+    len = fbl::min(len, room);
+
+    // Snapshot the range in a copy-on-write clone, so later writes to |vmo|
+    // don't show up in bytes that are already queued. Pages are only copied
+    // if the sender writes to them before the reader is done.
+    uint64_t clone_offset = ROUNDDOWN(offset, PAGE_SIZE);
+    uint64_t clone_size = ROUNDUP(offset + len, PAGE_SIZE) - clone_offset;
+    fbl::RefPtr<VmObject> clone;
+    zx_status_t status = vmo->CloneCOW(clone_offset, clone_size, false, &clone);
+    if (status != ZX_OK)
+        return status;
+
+    return other->WriteVmoSelf(fbl::move(clone), offset - clone_offset, len, nwritten);
 }
 
 zx_status_t SocketDispatcher::WriteControl(user_in_ptr<const void> src, size_t len) {
@@ -289,7 +346,7 @@ zx_status_t SocketDispatcher::WriteControlSelf(user_in_ptr<const void> src,
     return ZX_OK;
 }
 
-zx_status_t SocketDispatcher::WriteSelf(user_in_ptr<const void> src, size_t len,
+zx_status_t SocketDispatcher::WriteSelf(const zx_iovec_t* vec, size_t count, size_t len,
                                         size_t* written) {
     canary_.Assert();
 
@@ -303,9 +360,9 @@ zx_status_t SocketDispatcher::WriteSelf(user_in_ptr<const void> src, size_t len,
     size_t st = 0u;
     zx_status_t status;
     if (flags_ & ZX_SOCKET_DATAGRAM) {
-        status = data_.WriteDatagram(src, len, &st);
+        status = data_.WriteDatagram(vec, count, len, &st);
     } else {
-        status = data_.WriteStream(src, len, &st);
+        status = data_.WriteStream(vec, count, &st);
     }
     if (status)
         return status;
@@ -322,7 +379,33 @@ zx_status_t SocketDispatcher::WriteSelf(user_in_ptr<const void> src, size_t len,
     return status;
 }
 
-zx_status_t SocketDispatcher::Read(user_out_ptr<void> dst, size_t len,
+zx_status_t SocketDispatcher::WriteVmoSelf(fbl::RefPtr<VmObject> vmo, uint64_t offset,
+                                           size_t len, size_t* written) {
+    canary_.Assert();
+
+    AutoLock lock(&lock_);
+
+    if (is_full())
+        return ZX_ERR_SHOULD_WAIT;
+
+    bool was_empty = is_empty();
+
+    size_t st = 0u;
+    zx_status_t status = data_.WriteVmo(fbl::move(vmo), offset, len, &st);
+    if (status)
+        return status;
+
+    if (was_empty)
+        UpdateState(0u, ZX_SOCKET_READABLE);
+
+    if (other_ && is_full())
+        other_->UpdateState(ZX_SOCKET_WRITABLE, 0u);
+
+    *written = st;
+    return status;
+}
+
+zx_status_t SocketDispatcher::Read(const zx_iovec_t* vec, size_t count,
                                    size_t* nread) {
     canary_.Assert();
 
@@ -331,13 +414,17 @@ zx_status_t SocketDispatcher::Read(user_out_ptr<void> dst, size_t len,
     AutoLock lock(&lock_);
 
     // Just query for bytes outstanding.
-    if (!dst && len == 0) {
+    if (count == 1 && !vec[0].buffer && vec[0].size == 0) {
         *nread = data_.size();
         return ZX_OK;
     }
 
-    if (len != (size_t)((uint32_t)len))
-        return ZX_ERR_INVALID_ARGS;
+    size_t len = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (vec[i].size > UINT32_MAX - len)
+            return ZX_ERR_INVALID_ARGS;
+        len += vec[i].size;
+    }
 
     if (is_empty()) {
         if (!other_)
@@ -351,7 +438,7 @@ zx_status_t SocketDispatcher::Read(user_out_ptr<void> dst, size_t len,
 
     bool was_full = is_full();
 
-    auto st = data_.Read(dst, len, flags_ & ZX_SOCKET_DATAGRAM);
+    auto st = data_.Read(vec, count, flags_ & ZX_SOCKET_DATAGRAM);
 
     if (is_empty()) {
         uint32_t set_mask = 0u;
@@ -404,6 +491,44 @@ zx_status_t SocketDispatcher::CheckShareable(SocketDispatcher* to_send) {
     return ZX_OK;
 }
 
+size_t SocketDispatcher::GetReadBufferMax() {
+    canary_.Assert();
+
+    AutoLock lock(&lock_);
+    return data_.size_max();
+}
+
+size_t SocketDispatcher::ReadBufferRoom() {
+    canary_.Assert();
+
+    AutoLock lock(&lock_);
+    return is_full() ? 0u : data_.size_max() - data_.size();
+}
+
+zx_status_t SocketDispatcher::SetReadBufferMax(size_t size_max) {
+    canary_.Assert();
+
+    if (size_max == 0 || size_max > MBufChain::kSizeMaxLimit)
+        return ZX_ERR_OUT_OF_RANGE;
+
+    AutoLock lock(&lock_);
+
+    // Bytes already queued stay put even if they exceed the new limit; the
+    // peer just can't write again until they are read.
+    bool was_full = is_full();
+    data_.set_size_max(size_max);
+    bool now_full = is_full();
+
+    if (other_ && was_full != now_full) {
+        if (now_full) {
+            other_->UpdateState(ZX_SOCKET_WRITABLE, 0u);
+        } else if (!(other_->GetSignalsState() & ZX_SOCKET_WRITE_DISABLED)) {
+            other_->UpdateState(0u, ZX_SOCKET_WRITABLE);
+        }
+    }
+    return ZX_OK;
+}
+
 zx_status_t SocketDispatcher::Share(Handle* h) {
     canary_.Assert();
 
@@ -125,6 +125,15 @@ zx_status_t VmObjectDispatcher::RangeOp(uint32_t op, uint64_t offset, uint64_t s
             return vmo_->CleanCache(offset, size);
         case ZX_VMO_OP_CACHE_CLEAN_INVALIDATE:
             return vmo_->CleanInvalidateCache(offset, size);
+        case ZX_VMO_OP_ACCESS_DEFAULT:
+            vmo_->SetAccessHint(VmObject::AccessHint::DEFAULT);
+            return ZX_OK;
+        case ZX_VMO_OP_ACCESS_RANDOM:
+            vmo_->SetAccessHint(VmObject::AccessHint::RANDOM);
+            return ZX_OK;
+        case ZX_VMO_OP_ACCESS_SEQUENTIAL:
+            vmo_->SetAccessHint(VmObject::AccessHint::SEQUENTIAL);
+            return ZX_OK;
         default:
             return ZX_ERR_INVALID_ARGS;
     }
@@ -115,7 +115,7 @@ zx_status_t sys_channel_read(zx_handle_t handle_value, uint32_t options,
         return result;
 
     if (num_bytes > 0u) {
-        if (msg->CopyDataTo(bytes) != ZX_OK)
+        if (msg->MoveDataTo(bytes) != ZX_OK)
             return ZX_ERR_INVALID_ARGS;
     }
 
@@ -129,6 +129,67 @@ zx_status_t sys_channel_read(zx_handle_t handle_value, uint32_t options,
     return result;
 }
 
+zx_status_t sys_channel_read_batch(zx_handle_t handle_value, uint32_t options,
+                                   user_inout_ptr<zx_channel_msg_t> user_msgs, uint32_t num_msgs,
+                                   user_out_ptr<uint32_t> actual_msgs) {
+    LTRACEF("handle %x msgs %p num_msgs %u\n", handle_value, user_msgs.get(), num_msgs);
+
+    if (options)
+        return ZX_ERR_INVALID_ARGS;
+    if (num_msgs == 0u || num_msgs > kMaxMessageBatch)
+        return ZX_ERR_OUT_OF_RANGE;
+
+    zx_channel_msg_t msgs[kMaxMessageBatch];
+    if (user_msgs.copy_array_from_user(msgs, num_msgs) != ZX_OK)
+        return ZX_ERR_INVALID_ARGS;
+
+    auto up = ProcessDispatcher::GetCurrent();
+
+    fbl::RefPtr<ChannelDispatcher> channel;
+    zx_status_t result = up->GetDispatcherWithRights(handle_value, ZX_RIGHT_READ, &channel);
+    if (result != ZX_OK)
+        return result;
+
+    fbl::unique_ptr<MessagePacket> packets[kMaxMessageBatch];
+    size_t count;
+    result = channel->ReadBatch(msgs, num_msgs, packets, &count);
+    if (result == ZX_ERR_BUFFER_TOO_SMALL) {
+        // Like zx_channel_read(), report the size of the message that didn't fit.
+        if (user_msgs.copy_array_to_user(msgs, 1u) != ZX_OK)
+            return ZX_ERR_INVALID_ARGS;
+        return result;
+    }
+    if (result != ZX_OK)
+        return result;
+
+    // Deliver the messages in order. If a buffer turns out to be bad, the
+    // messages before it have been delivered and the rest are discarded.
+    size_t delivered = 0;
+    for (; delivered < count; ++delivered) {
+        MessagePacket* msg = packets[delivered].get();
+        const zx_channel_msg_t& m = msgs[delivered];
+        if (m.num_bytes > 0u) {
+            if (msg->MoveDataTo(make_user_out_ptr(m.bytes)) != ZX_OK) {
+                result = ZX_ERR_INVALID_ARGS;
+                break;
+            }
+        }
+        if (m.num_handles > 0u) {
+            msg_get_handles(up, msg, make_user_out_ptr(m.handles), m.num_handles);
+        }
+        ktrace(TAG_CHANNEL_READ, (uint32_t)channel->get_koid(), m.num_bytes, m.num_handles, 0);
+    }
+
+    if (delivered > 0u && user_msgs.copy_array_to_user(msgs, delivered) != ZX_OK)
+        return ZX_ERR_INVALID_ARGS;
+    if (actual_msgs) {
+        zx_status_t status = actual_msgs.copy_to_user(static_cast<uint32_t>(delivered));
+        if (status != ZX_OK)
+            return status;
+    }
+    return result;
+}
+
 static zx_status_t channel_read_out(ProcessDispatcher* up,
                                     fbl::unique_ptr<MessagePacket> reply,
                                     zx_channel_call_args_t* args,
@@ -149,7 +210,7 @@ static zx_status_t channel_read_out(ProcessDispatcher* up,
         return status;
 
     if (num_bytes > 0u) {
-        if (reply->CopyDataTo(make_user_out_ptr(args->rd_bytes)) != ZX_OK) {
+        if (reply->MoveDataTo(make_user_out_ptr(args->rd_bytes)) != ZX_OK) {
             return ZX_ERR_INVALID_ARGS;
         }
     }
@@ -280,6 +341,75 @@ zx_status_t sys_channel_write(zx_handle_t handle_value, uint32_t options,
     return ZX_OK;
 }
 
+// Gives the handles attached to |msg| back to the process they were taken from.
+static void msg_undo_handles(ProcessDispatcher* up, MessagePacket* msg) {
+    AutoLock lock(up->handle_table_lock());
+    Handle* const* handle_list = msg->handles();
+    msg->set_owns_handles(false);
+    for (size_t ix = 0; ix != msg->num_handles(); ++ix) {
+        up->AddHandleLocked(HandleOwner(handle_list[ix]));
+    }
+}
+
+zx_status_t sys_channel_write_batch(zx_handle_t handle_value, uint32_t options,
+                                    user_in_ptr<const zx_channel_msg_t> user_msgs,
+                                    uint32_t num_msgs) {
+    LTRACEF("handle %x msgs %p num_msgs %u\n", handle_value, user_msgs.get(), num_msgs);
+
+    if (options)
+        return ZX_ERR_INVALID_ARGS;
+    if (num_msgs == 0u || num_msgs > kMaxMessageBatch)
+        return ZX_ERR_OUT_OF_RANGE;
+
+    zx_channel_msg_t msgs[kMaxMessageBatch];
+    if (user_msgs.copy_array_from_user(msgs, num_msgs) != ZX_OK)
+        return ZX_ERR_INVALID_ARGS;
+
+    auto up = ProcessDispatcher::GetCurrent();
+
+    fbl::RefPtr<ChannelDispatcher> channel;
+    zx_status_t result = up->GetDispatcherWithRights(handle_value, ZX_RIGHT_WRITE, &channel);
+    if (result != ZX_OK)
+        return result;
+
+    // Build every packet before writing any of them, so that the batch is
+    // either written as a whole or not at all.
+    fbl::unique_ptr<MessagePacket> packets[kMaxMessageBatch];
+    zx_handle_t handles[kMaxMessageHandles];
+    size_t ready = 0;
+    for (; ready < num_msgs; ++ready) {
+        const zx_channel_msg_t& m = msgs[ready];
+        result = MessagePacket::Create(make_user_in_ptr(static_cast<const void*>(m.bytes)),
+                                       m.num_bytes, m.num_handles, &packets[ready]);
+        if (result != ZX_OK)
+            break;
+        if (m.num_handles > 0u) {
+            result = msg_put_handles(up, packets[ready].get(), handles,
+                                     make_user_in_ptr(static_cast<const zx_handle_t*>(m.handles)),
+                                     m.num_handles, static_cast<Dispatcher*>(channel.get()));
+            if (result != ZX_OK)
+                break;
+        }
+    }
+
+    if (result == ZX_OK)
+        result = channel->WriteBatch(packets, num_msgs);
+
+    if (result != ZX_OK) {
+        // Put back the handles of the packets that were built.
+        for (size_t ix = 0; ix != ready; ++ix) {
+            msg_undo_handles(up, packets[ix].get());
+        }
+        return result;
+    }
+
+    for (size_t ix = 0; ix != num_msgs; ++ix) {
+        ktrace(TAG_CHANNEL_WRITE, (uint32_t)channel->get_koid(),
+               msgs[ix].num_bytes, msgs[ix].num_handles, 0);
+    }
+    return ZX_OK;
+}
+
 zx_status_t sys_channel_call_noretry(zx_handle_t handle_value, uint32_t options,
                                      zx_time_t deadline,
                                      user_in_ptr<const zx_channel_call_args_t> user_args,
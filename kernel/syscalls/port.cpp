@@ -13,6 +13,7 @@
 #include <object/port_dispatcher.h>
 #include <object/process_dispatcher.h>
 
+#include <fbl/algorithm.h>
 #include <fbl/alloc_checker.h>
 #include <fbl/auto_lock.h>
 #include <fbl/ref_ptr.h>
@@ -105,6 +106,58 @@ zx_status_t sys_port_wait(zx_handle_t handle, zx_time_t deadline,
     return ZX_OK;
 }
 
+// Packets gathered on the stack by each step of sys_port_wait_many().
+static constexpr size_t kPortWaitManyBatch = 8u;
+
+zx_status_t sys_port_wait_many(zx_handle_t handle, zx_time_t deadline,
+                               user_out_ptr<zx_port_packet_t> packets_out, size_t count,
+                               user_out_ptr<size_t> actual_out) {
+    LTRACEF("handle %x count %zu\n", handle, count);
+
+    if (count == 0u)
+        return ZX_ERR_INVALID_ARGS;
+
+    auto up = ProcessDispatcher::GetCurrent();
+
+    fbl::RefPtr<PortDispatcher> port;
+    zx_status_t status = up->GetDispatcherWithRights(handle, ZX_RIGHT_READ, &port);
+    if (status != ZX_OK)
+        return status;
+
+    ktrace(TAG_PORT_WAIT, (uint32_t)port->get_koid(), 0, 0, 0);
+
+    // Only the first step may block.  After that, keep going for as long as
+    // the port has packets and the caller has room for them.
+    zx_port_packet_t pp[kPortWaitManyBatch];
+    size_t total = 0u;
+    zx_status_t st = ZX_OK;
+    while (total < count) {
+        const size_t want = fbl::min(count - total, kPortWaitManyBatch);
+        size_t got;
+        st = port->DequeueMany(total == 0u ? deadline : 0ull, pp, want, &got);
+        if (st != ZX_OK)
+            break;
+
+        // Like sys_port_wait(), a batch that can't be copied out is lost.
+        // Packets already delivered by earlier steps are still reported, so
+        // the error is only returned if there are none.
+        st = packets_out.copy_array_to_user(pp, got, total);
+        if (st != ZX_OK)
+            break;
+
+        total += got;
+        if (got < want)
+            break;
+    }
+
+    ktrace(TAG_PORT_WAIT_DONE, (uint32_t)port->get_koid(), st, 0, 0);
+
+    if (total == 0u)
+        return st;
+
+    return actual_out.copy_to_user(total);
+}
+
 zx_status_t sys_port_cancel(zx_handle_t handle, zx_handle_t source, uint64_t key) {
     auto up = ProcessDispatcher::GetCurrent();
 
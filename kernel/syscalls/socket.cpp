@@ -17,6 +17,7 @@
 #include <object/handle.h>
 #include <object/process_dispatcher.h>
 #include <object/socket_dispatcher.h>
+#include <object/vm_object_dispatcher.h>
 
 #include <zircon/syscalls/policy.h>
 #include <fbl/auto_lock.h>
@@ -64,9 +65,11 @@ zx_status_t sys_socket_write(zx_handle_t handle, uint32_t options,
 
     size_t nwritten;
     switch (options) {
-    case 0:
-        status = socket->Write(buffer, size, &nwritten);
+    case 0: {
+        zx_iovec_t vec = {const_cast<void*>(buffer.get()), size};
+        status = socket->Write(&vec, 1u, &nwritten);
         break;
+    }
     case ZX_SOCKET_CONTROL:
         status = socket->WriteControl(buffer, size);
         if (status == ZX_OK)
@@ -107,9 +110,11 @@ zx_status_t sys_socket_read(zx_handle_t handle, uint32_t options,
     size_t nread;
 
     switch (options) {
-    case 0:
-        status = socket->Read(buffer, size, &nread);
+    case 0: {
+        zx_iovec_t vec = {buffer.get(), size};
+        status = socket->Read(&vec, 1u, &nread);
         break;
+    }
     case ZX_SOCKET_CONTROL:
         status = socket->ReadControl(buffer, size, &nread);
         break;
@@ -124,6 +129,112 @@ zx_status_t sys_socket_read(zx_handle_t handle, uint32_t options,
     return status;
 }
 
+// Copies in the array of user buffers for socket_writev and socket_readv.
+static zx_status_t copy_iovecs_from_user(user_in_ptr<const zx_iovec_t> vec, size_t count,
+                                         zx_iovec_t* out) {
+    if (!vec)
+        return ZX_ERR_INVALID_ARGS;
+    if (count == 0 || count > ZX_SOCKET_MAX_IOVECS)
+        return ZX_ERR_OUT_OF_RANGE;
+    if (vec.copy_array_from_user(out, count) != ZX_OK)
+        return ZX_ERR_INVALID_ARGS;
+    for (size_t i = 0; i < count; i++) {
+        if (!out[i].buffer && out[i].size > 0)
+            return ZX_ERR_INVALID_ARGS;
+    }
+    return ZX_OK;
+}
+
+zx_status_t sys_socket_writev(zx_handle_t handle, uint32_t options,
+                              user_in_ptr<const zx_iovec_t> vec, size_t count,
+                              user_out_ptr<size_t> actual) {
+    LTRACEF("handle %x\n", handle);
+
+    if (options != 0u)
+        return ZX_ERR_INVALID_ARGS;
+
+    zx_iovec_t kvec[ZX_SOCKET_MAX_IOVECS];
+    zx_status_t status = copy_iovecs_from_user(vec, count, kvec);
+    if (status != ZX_OK)
+        return status;
+
+    auto up = ProcessDispatcher::GetCurrent();
+
+    fbl::RefPtr<SocketDispatcher> socket;
+    status = up->GetDispatcherWithRights(handle, ZX_RIGHT_WRITE, &socket);
+    if (status != ZX_OK)
+        return status;
+
+    size_t nwritten;
+    status = socket->Write(kvec, count, &nwritten);
+
+    // Caller may ignore results if desired.
+    if (status == ZX_OK && actual)
+        status = actual.copy_to_user(nwritten);
+
+    return status;
+}
+
+zx_status_t sys_socket_readv(zx_handle_t handle, uint32_t options,
+                             user_in_ptr<const zx_iovec_t> vec, size_t count,
+                             user_out_ptr<size_t> actual) {
+    LTRACEF("handle %x\n", handle);
+
+    if (options != 0u)
+        return ZX_ERR_INVALID_ARGS;
+
+    zx_iovec_t kvec[ZX_SOCKET_MAX_IOVECS];
+    zx_status_t status = copy_iovecs_from_user(vec, count, kvec);
+    if (status != ZX_OK)
+        return status;
+
+    auto up = ProcessDispatcher::GetCurrent();
+
+    fbl::RefPtr<SocketDispatcher> socket;
+    status = up->GetDispatcherWithRights(handle, ZX_RIGHT_READ, &socket);
+    if (status != ZX_OK)
+        return status;
+
+    size_t nread;
+    status = socket->Read(kvec, count, &nread);
+
+    // Caller may ignore results if desired.
+    if (status == ZX_OK && actual)
+        status = actual.copy_to_user(nread);
+
+    return status;
+}
+
+zx_status_t sys_socket_write_vmo(zx_handle_t handle, uint32_t options,
+                                 zx_handle_t vmo_handle, uint64_t offset, size_t size,
+                                 user_out_ptr<size_t> actual) {
+    LTRACEF("handle %x vmo %x\n", handle, vmo_handle);
+
+    if (options != 0u)
+        return ZX_ERR_INVALID_ARGS;
+
+    auto up = ProcessDispatcher::GetCurrent();
+
+    fbl::RefPtr<SocketDispatcher> socket;
+    zx_status_t status = up->GetDispatcherWithRights(handle, ZX_RIGHT_WRITE, &socket);
+    if (status != ZX_OK)
+        return status;
+
+    fbl::RefPtr<VmObjectDispatcher> vmo;
+    status = up->GetDispatcherWithRights(vmo_handle, ZX_RIGHT_READ, &vmo);
+    if (status != ZX_OK)
+        return status;
+
+    size_t nwritten;
+    status = socket->WriteVmo(vmo->vmo(), offset, size, &nwritten);
+
+    // Caller may ignore results if desired.
+    if (status == ZX_OK && actual)
+        status = actual.copy_to_user(nwritten);
+
+    return status;
+}
+
 zx_status_t sys_socket_share(zx_handle_t handle, zx_handle_t other) {
     auto up = ProcessDispatcher::GetCurrent();
 
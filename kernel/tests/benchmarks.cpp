@@ -14,6 +14,7 @@
 #include <kernel/mutex.h>
 #include <kernel/spinlock.h>
 #include <kernel/thread.h>
+#include <lib/heap.h>
 #include <platform.h>
 #include <rand.h>
 #include <stdio.h>
@@ -235,6 +236,92 @@ __NO_INLINE static void bench_mutex() {
     printf("%" PRIu64 " cycles to acquire/release uncontended mutex %u times (%" PRIu64 " cycles per)\n", c, count, c / count);
 }
 
+// Number of small allocations each thread keeps live at once, and the number
+// of times each thread allocates and frees its whole set.
+static const size_t kMallocBatch = 32;
+static const size_t kMallocRounds = 64 * 1024;
+
+static int bench_malloc_thread(void* arg) {
+    static const size_t sizes[] = {24, 48, 64, 96, 128, 200, 256, 400};
+    const uint8_t tag = (uint8_t)(uintptr_t)arg;
+    void* ptrs[kMallocBatch];
+    int errors = 0;
+
+    for (size_t round = 0; round < kMallocRounds; round++) {
+        for (size_t i = 0; i < kMallocBatch; i++) {
+            size_t size = sizes[(round + i) % countof(sizes)];
+            ptrs[i] = malloc(size);
+            if (ptrs[i] == nullptr) {
+                return -1;
+            }
+            memset(ptrs[i], tag, sizeof(uint64_t));
+        }
+        for (size_t i = 0; i < kMallocBatch; i++) {
+            // Another thread scribbling on our block means the same memory
+            // was handed out twice.
+            if (*(uint8_t*)ptrs[i] != tag) {
+                errors++;
+            }
+            free(ptrs[i]);
+        }
+    }
+    return errors;
+}
+
+// Runs a thread per online cpu doing small malloc/free pairs and reports the
+// aggregate throughput, first through the heap lock and then through the
+// per-cpu caches.
+__NO_INLINE static void bench_malloc_mp() {
+    const cpu_mask_t online = mp_get_online_mask();
+    const uint num_cpus = arch_max_num_cpus();
+
+    for (int pass = 0; pass < 2; pass++) {
+        const bool cached = (pass == 1);
+        const bool was_enabled = heap_set_cache_enabled(cached);
+
+        thread_t* threads[SMP_MAX_CPUS] = {};
+        uint num_threads = 0;
+        for (uint cpu = 0; cpu < num_cpus; cpu++) {
+            if (!(online & cpu_num_to_mask(cpu))) {
+                continue;
+            }
+            threads[cpu] = thread_create("malloc bench", &bench_malloc_thread,
+                                         (void*)(uintptr_t)(cpu + 1),
+                                         DEFAULT_PRIORITY, DEFAULT_STACK_SIZE);
+            if (threads[cpu] == nullptr) {
+                continue;
+            }
+            thread_set_cpu_affinity(threads[cpu], cpu_num_to_mask(cpu));
+            num_threads++;
+        }
+
+        zx_time_t t = current_time();
+        for (uint cpu = 0; cpu < num_cpus; cpu++) {
+            if (threads[cpu] != nullptr) {
+                thread_resume(threads[cpu]);
+            }
+        }
+        int errors = 0;
+        for (uint cpu = 0; cpu < num_cpus; cpu++) {
+            if (threads[cpu] != nullptr) {
+                int ret;
+                thread_join(threads[cpu], &ret, ZX_TIME_INFINITE);
+                errors += ret;
+            }
+        }
+        t = current_time() - t;
+
+        heap_set_cache_enabled(was_enabled);
+
+        uint64_t ops = 2ULL * kMallocBatch * kMallocRounds * num_threads;
+        uint64_t usecs = MAX(t / ZX_USEC(1), 1u);
+        printf("%" PRIu64 " malloc/free ops on %u cpus (%s) took %" PRIu64
+               " usecs, %" PRIu64 " ops/sec%s\n",
+               ops, num_threads, cached ? "cpu caches" : "heap lock", usecs,
+               ops * 1000000 / usecs, errors ? ", ERRORS" : "");
+    }
+}
+
 void benchmarks() {
     bench_set_overhead();
     bench_memcpy();
@@ -251,4 +338,6 @@ void benchmarks() {
 
     bench_spinlock();
     bench_mutex();
+
+    bench_malloc_mp();
 }
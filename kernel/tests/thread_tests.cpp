@@ -15,6 +15,7 @@
 #include <kernel/event.h>
 #include <kernel/mp.h>
 #include <kernel/mutex.h>
+#include <kernel/percpu.h>
 #include <kernel/thread.h>
 #include <platform.h>
 #include <pow2.h>
@@ -663,6 +664,74 @@ __NO_INLINE static void affinity_test() {
     printf("done with affinity test\n");
 }
 
+struct steal_test_state {
+    volatile bool shutdown = false;
+    volatile int ran_on = 0;
+};
+
+static int steal_test_thread(void* arg) {
+    steal_test_state* state = static_cast<steal_test_state*>(arg);
+
+    while (!state->shutdown) {
+        atomic_or(&state->ran_on, (int)cpu_num_to_mask(arch_curr_cpu_num()));
+    }
+
+    return 0;
+}
+
+static ulong total_steals() {
+    ulong steals = 0;
+    for (cpu_num_t i = 0; i < SMP_MAX_CPUS; i++) {
+        steals += percpu[i].stats.steals;
+    }
+    return steals;
+}
+
+// pile several spinning threads onto one cpu, then allow them on a second one as well.
+// changing the affinity leaves them queued where they are, so they only reach the second
+// cpu by being stolen: when it goes idle, after it is woken because the first cpu's queue
+// is deep, or by its periodic balancing if it is busy.
+__NO_INLINE static void steal_test() {
+    printf("starting work stealing test\n");
+
+    cpu_mask_t online = mp_get_online_mask() & mp_get_active_mask();
+    if (!online || ispow2(online)) {
+        printf("aborting test, not enough online cpus\n");
+        return;
+    }
+
+    const cpu_mask_t home = cpu_num_to_mask(lowest_cpu_set(online));
+    const cpu_mask_t other = cpu_num_to_mask(lowest_cpu_set(online & ~home));
+
+    steal_test_state state;
+    thread_t* threads[4];
+    for (auto& t : threads) {
+        t = thread_create("steal tester", &steal_test_thread, &state,
+                          LOW_PRIORITY, DEFAULT_STACK_SIZE);
+        thread_set_cpu_affinity(t, home);
+        thread_resume(t);
+    }
+
+    thread_sleep_relative(ZX_MSEC(100));
+    ASSERT((cpu_mask_t)state.ran_on == home);
+
+    ulong steals = total_steals();
+    for (auto& t : threads) {
+        thread_set_cpu_affinity(t, home | other);
+    }
+    thread_sleep_relative(ZX_MSEC(500));
+
+    state.shutdown = true;
+    for (auto& t : threads) {
+        thread_join(t, nullptr, ZX_TIME_INFINITE);
+    }
+
+    ASSERT((cpu_mask_t)state.ran_on & other);
+    ASSERT(total_steals() > steals);
+
+    printf("done with work stealing test\n");
+}
+
 #define TLS_TEST_TAGV   ((void*)0x666)
 
 static void tls_test_callback(void *tls) {
@@ -711,6 +780,8 @@ int thread_tests(void) {
 
     affinity_test();
 
+    steal_test();
+
     tls_tests();
 
     return 0;
@@ -188,10 +188,65 @@ static void timer_far_deadline(void) {
     event_destroy(&event);
 }
 
+struct wheel_test_state {
+    zx_time_t last;
+    int fired;
+    int out_of_order;
+};
+
+static void timer_cb3(timer_t* timer, zx_time_t now, void* arg) {
+    wheel_test_state* state = reinterpret_cast<wheel_test_state*>(arg);
+    if (timer->scheduled_time < state->last)
+        state->out_of_order++;
+    state->last = timer->scheduled_time;
+    state->fired++;
+}
+
+// Timers spread across several levels of the timer wheel, fire in deadline order and
+// can be canceled wherever they are filed.
+static void timer_test_wheel(void) {
+    static const int kTimers = 64;
+    timer_t timer[kTimers];
+    wheel_test_state state = {};
+
+    printf("testing timer wheel ordering\n");
+
+    thread_set_cpu_affinity(get_current_thread(), cpu_num_to_mask(0));
+
+    zx_time_t now = current_time();
+    for (int ix = 0; ix < kTimers; ++ix) {
+        timer_init(&timer[ix]);
+        // Deadlines from 0.25ms to ~2.5s out, interleaved so insertion order differs from
+        // firing order.
+        zx_duration_t delta = ZX_USEC(250) << ((ix * 7) % 14);
+        timer_set(&timer[ix], now + delta + ix, TIMER_SLACK_CENTER, 0, timer_cb3, &state);
+    }
+
+    // Cancel every fourth timer before it has a chance to fire.
+    int canceled = 0;
+    for (int ix = 0; ix < kTimers; ix += 4) {
+        if (timer_cancel(&timer[ix]))
+            canceled++;
+    }
+
+    thread_sleep_relative(ZX_SEC(3));
+
+    for (int ix = 0; ix < kTimers; ++ix)
+        timer_cancel(&timer[ix]);
+
+    thread_set_cpu_affinity(get_current_thread(), CPU_MASK_ALL);
+
+    printf("%d timers fired, %d canceled, %d out of order\n",
+           state.fired, canceled, state.out_of_order);
+    if (state.fired + canceled != kTimers || state.out_of_order != 0)
+        printf("\n!! timer wheel test failed\n");
+}
+
 void timer_tests(void) {
     timer_test_coalescing_center();
     timer_test_coalescing_late();
     timer_test_coalescing_early();
     timer_test_all_cpus();
     timer_far_deadline();
+    timer_test_wheel();
 }
@@ -62,6 +62,22 @@ public:
                              vaddr_t end, uint next_region_mmu_flags,
                              vaddr_t align, size_t size, uint mmu_flags) = 0;
 
+    // Smallest page size above PAGE_SIZE that MapContiguous() will install as
+    // a single entry when |vaddr| and |paddr| are both aligned to it, and that
+    // Unmap() and Protect() will split back into smaller pages when only part
+    // of it is affected.  Returns 0 if large pages must not be used.
+    virtual size_t LargePageSize() const { return 0; }
+
+    // Size of the single entry that maps |vaddr|: PAGE_SIZE, or a large page
+    // installed by MapContiguous().  Returns ZX_ERR_NOT_FOUND if |vaddr| is not
+    // mapped.  Only needs overriding where LargePageSize() is nonzero.
+    virtual zx_status_t QueryPageSize(vaddr_t vaddr, size_t* page_size) {
+        zx_status_t status = Query(vaddr, nullptr, nullptr);
+        if (status == ZX_OK)
+            *page_size = PAGE_SIZE;
+        return status;
+    }
+
     // Physical address of the backing data structure used for translation.
     //
     // This should be treated as an opaque value outside of
@@ -17,6 +17,8 @@ class VmObject;
 #define VM_PAGE_OBJECT_PIN_COUNT_BITS 5
 #define VM_PAGE_OBJECT_MAX_PIN_COUNT ((1ul << VM_PAGE_OBJECT_PIN_COUNT_BITS) - 1)
 
+#define VM_PAGE_BUDDY_ORDER_NONE (0xff)
+
 // core per page structure
 typedef struct vm_page {
     struct {
@@ -29,6 +31,9 @@ typedef struct vm_page {
         struct {
             // in allocated/just freed state, use a linked list to hold the page in a queue
             struct list_node node;
+            // in free state, the order of the pmm buddy block this page is the
+            // head of, or VM_PAGE_BUDDY_ORDER_NONE if it is not a block head
+            uint8_t order;
         } free;
         struct {
             // attached to a vm object
@@ -56,10 +61,15 @@ enum vm_page_state {
     VM_PAGE_STATE_HEAP,
     VM_PAGE_STATE_OBJECT,
     VM_PAGE_STATE_MMU, /* allocated to serve arch-specific mmu purposes */
+    VM_PAGE_STATE_CACHED, /* free, but held in a pmm per-cpu page cache */
+    VM_PAGE_STATE_IPC, /* holding channel messages */
 
     _VM_PAGE_STATE_COUNT
 };
 
+// make sure the state bitfield is wide enough to hold every state
+static_assert(_VM_PAGE_STATE_COUNT <= (1 << 3), "");
+
 // helpers
 static inline bool page_is_free(const vm_page_t* page) {
     return page->state == VM_PAGE_STATE_FREE;
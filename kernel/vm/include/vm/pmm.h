@@ -31,6 +31,7 @@ zx_status_t pmm_add_arena(const pmm_arena_info_t* arena) __NONNULL((1));
 // flags for allocation routines below
 #define PMM_ALLOC_FLAG_ANY (0x0)  // no restrictions on which arena to allocate from
 #define PMM_ALLOC_FLAG_KMAP (0x1) // allocate only from arenas marked KMAP
+#define PMM_ALLOC_FLAG_ZERO (0x2) // returned pages are filled with zeros (pmm_alloc_page(s) only)
 
 // Allocate count pages of physical memory, adding to the tail of the passed list.
 // The list must be initialized.
@@ -57,12 +58,24 @@ size_t pmm_free(struct list_node* list) __NONNULL((1));
 // Helper routine for the above.
 size_t pmm_free_page(vm_page_t* page) __NONNULL((1));
 
-// Return count of unallocated physical pages in system
+// Return count of unallocated physical pages in system.
+// Does not take the pmm lock, so it is cheap enough to poll; the result is a snapshot.
 size_t pmm_count_free_pages(void);
 
 // Return amount of physical memory in system, in bytes.
 size_t pmm_count_total_bytes(void);
 
+// Signal |event| when the count of unallocated physical pages drops below
+// |watermark_pages|. The event is signaled once per crossing; it is re-armed when
+// the count climbs back above the watermark. Up to PMM_MAX_LOW_WATERMARKS
+// watermarks may be registered at once; returns ZX_ERR_NO_RESOURCES beyond that.
+// |event| must stay valid until it is passed to pmm_remove_low_watermark().
+#define PMM_MAX_LOW_WATERMARKS 4
+zx_status_t pmm_add_low_watermark(size_t watermark_pages, struct event* event);
+
+// Stop signaling |event| for the watermark it was registered with.
+void pmm_remove_low_watermark(struct event* event);
+
 // Counts the number of pages in every state. For every page in every arena,
 // increments the corresponding VM_PAGE_STATE_*-indexed entry of
 // |state_count|. Does not zero out the entries first.
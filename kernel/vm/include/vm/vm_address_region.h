@@ -414,6 +414,11 @@ public:
     // offset modification and locking.
     zx_status_t DecommitRange(size_t offset, size_t len, size_t* decommitted);
 
+    // Convenience wrapper for vmo()->ReplacePages() with the necessary
+    // offset modification and locking. Fails unless the mapping is writable.
+    zx_status_t ReplacePages(size_t offset, vm_page_t* const* pages, size_t count,
+                             size_t* replaced);
+
     // Map in pages from the underlying vm object, optionally committing pages as it goes
     zx_status_t MapRange(size_t offset, size_t len, bool commit);
 
@@ -477,6 +482,12 @@ private:
     // in Clang around capability aliasing, we need to relax the analysis.
     void ActivateLocked();
 
+    // Maps the page |pa| that was just faulted in at |va|, together with
+    // neighbouring pages according to the object's access hint. Called from
+    // PageFault with the object lock held.
+    zx_status_t FaultAroundLocked(vaddr_t va, uint64_t vmo_offset, uint pf_flags,
+                                  paddr_t pa, uint mmu_flags);
+
     // pointer and region of the object we are mapping
     fbl::RefPtr<VmObject> object_;
     uint64_t object_offset_ = 0;
@@ -486,4 +497,8 @@ private:
 
     // used to detect recursions through the vmo fault path
     bool currently_faulting_ = false;
+
+    // object offset just past the pages mapped by the last page fault; a fault
+    // here is treated as sequential access
+    uint64_t next_fault_offset_ = UINT64_MAX;
 };
@@ -71,6 +71,14 @@ public:
         return ZX_ERR_NOT_SUPPORTED;
     }
 
+    // replace the pages backing the |count| pages of the vmo starting at |offset| with |pages|,
+    // freeing whatever was committed there. |*replaced| is set to the number of leading
+    // entries of |pages| the vmo has taken ownership of, even on failure.
+    virtual zx_status_t ReplacePages(uint64_t offset, vm_page_t* const* pages, size_t count,
+                                     size_t* replaced) {
+        return ZX_ERR_NOT_SUPPORTED;
+    }
+
     // Pin the given range of the vmo.  If any pages are not committed, this
     // returns a ZX_ERR_NO_MEMORY.
     virtual zx_status_t Pin(uint64_t offset, uint64_t len) {
@@ -167,6 +175,21 @@ public:
     // TODO: If more types of clones appear, replace this with a method that
     // returns an enum rather than adding a new method for each clone type.
     bool is_cow_clone() const;
+    bool is_cow_clone_locked() const TA_REQ(lock_) { return parent_ != nullptr; }
+
+    // How mappings of this object are expected to be touched, used by
+    // VmMapping::PageFault to decide how much to map per fault.
+    enum class AccessHint : uint32_t {
+        // Map resident neighbours of a faulting page, and fault in a window
+        // ahead once faults look sequential.
+        DEFAULT,
+        // Map only the faulting page.
+        RANDOM,
+        // Always fault in a window ahead of the faulting page.
+        SEQUENTIAL,
+    };
+    void SetAccessHint(AccessHint hint);
+    AccessHint access_hint_locked() const TA_REQ(lock_) { return access_hint_; }
 
     // get a pointer to the page structure and/or physical address at the specified offset.
     // valid flags are VMM_PF_FLAG_*
@@ -257,6 +280,8 @@ protected:
 
     uint64_t user_id_ TA_GUARDED(lock_) = 0;
 
+    AccessHint access_hint_ TA_GUARDED(lock_) = AccessHint::DEFAULT;
+
     // The user-friendly VMO name. For debug purposes only. That
     // is, there is no mechanism to get access to a VMO via this name.
     fbl::Name<ZX_MAX_NAME_LEN> name_;
@@ -45,6 +45,8 @@ public:
     zx_status_t CommitRangeContiguous(uint64_t offset, uint64_t len, uint64_t* committed,
                                       uint8_t alignment_log2) override;
     zx_status_t DecommitRange(uint64_t offset, uint64_t len, uint64_t* decommitted) override;
+    zx_status_t ReplacePages(uint64_t offset, vm_page_t* const* pages, size_t count,
+                             size_t* replaced) override;
 
     zx_status_t Pin(uint64_t offset, uint64_t len) override;
     void Unpin(uint64_t offset, uint64_t len) override;
@@ -10,15 +10,21 @@
 #include <assert.h>
 #include <err.h>
 #include <inttypes.h>
+#include <kernel/align.h>
+#include <kernel/event.h>
 #include <kernel/mp.h>
+#include <kernel/spinlock.h>
+#include <kernel/thread.h>
 #include <kernel/timer.h>
 #include <lib/console.h>
+#include <lib/counters.h>
 #include <lk/init.h>
 #include <platform.h>
 #include <pow2.h>
 #include <stdlib.h>
 #include <string.h>
 #include <trace.h>
+#include <arch/ops.h>
 #include <vm/bootalloc.h>
 #include <vm/physmap.h>
 #include <vm/vm.h>
@@ -26,6 +32,7 @@
 #include "pmm_arena.h"
 #include "vm_priv.h"
 
+#include <fbl/atomic.h>
 #include <fbl/auto_lock.h>
 #include <fbl/intrusive_double_list.h>
 #include <fbl/mutex.h>
@@ -40,7 +47,110 @@ using fbl::AutoLock;
 // the main arena list
 static fbl::Mutex arena_lock;
 static fbl::DoublyLinkedList<PmmArena*> arena_list TA_GUARDED(arena_lock);
-static size_t arena_cumulative_size TA_GUARDED(arena_lock);
+// Only written while arenas are added during early boot, so it may be read
+// without holding arena_lock.
+static size_t arena_cumulative_size;
+
+// Per-cpu page caches.
+//
+// Single page allocations and frees are satisfied out of a small per-cpu list
+// of free pages so that the common page fault path does not need to take the
+// global arena_lock. A cache that runs dry is refilled from the arenas with a
+// batch of pages, and a cache that grows past its capacity hands a batch back,
+// so arena_lock is taken roughly once per kPageCacheBatch operations.
+//
+// Only pages belonging to KMAP arenas are cached, which lets a cached page
+// satisfy any allocation request regardless of its flags. Pages sitting in a
+// cache are in the VM_PAGE_STATE_CACHED state so that the arena routines that
+// scan the page array (AllocSpecific, AllocContiguous) never pick them up.
+static constexpr size_t kPageCacheCapacity = 128;
+static constexpr size_t kPageCacheBatch = 32;
+static_assert(kPageCacheBatch <= kPageCacheCapacity, "");
+
+namespace {
+struct PageCache {
+    SpinLock lock;
+    list_node free_list TA_GUARDED(lock) = LIST_INITIAL_VALUE(free_list);
+
+    // The number of pages on free_list. Only modified with |lock| held, but
+    // read without it by pmm_count_free_pages().
+    size_t count() const { return count_.load(fbl::memory_order_relaxed); }
+    void set_count(size_t count) TA_REQ(lock) {
+        count_.store(count, fbl::memory_order_relaxed);
+    }
+
+private:
+    fbl::atomic<size_t> count_ = {0};
+} __CPU_ALIGN;
+} // namespace
+
+static PageCache page_cache[SMP_MAX_CPUS];
+
+// Set once the per-cpu structures are usable; until then every allocation
+// goes straight to the arenas.
+static bool page_cache_enabled;
+
+// Number of single page allocations satisfied out of a per-cpu cache.
+KCOUNTER(pmm_cache_alloc_hit, "kernel.pmm.cache.alloc_hit");
+// Number of single page allocations that had to refill the cache from the arenas.
+KCOUNTER(pmm_cache_alloc_miss, "kernel.pmm.cache.alloc_miss");
+// Number of pages freed into a per-cpu cache.
+KCOUNTER(pmm_cache_free_hit, "kernel.pmm.cache.free_hit");
+// Number of times a full cache handed a batch of pages back to the arenas.
+KCOUNTER(pmm_cache_free_flush, "kernel.pmm.cache.free_flush");
+// Number of times every cache was drained to satisfy an allocation.
+KCOUNTER(pmm_cache_drain_all, "kernel.pmm.cache.drain_all");
+
+// Pool of pre-zeroed pages.
+//
+// A low priority thread pulls free pages out of the KMAP arenas, zeroes them
+// and parks them here, so that PMM_ALLOC_FLAG_ZERO allocations (mostly
+// anonymous page faults) can skip clearing the page. Like cached pages, pooled
+// pages are in the VM_PAGE_STATE_CACHED state and count as free. The pool is
+// topped up to kZeroPoolTarget pages whenever it falls below half of that, but
+// never while fewer than kZeroPoolMinFreePages pages are free. Once free memory
+// drops below that floor the pool is handed back to the arenas, and it is also
+// emptied along with the per-cpu caches when an allocation comes up short.
+static constexpr size_t kZeroPoolTarget = 1024;
+static constexpr size_t kZeroPoolBatch = 32;
+static constexpr size_t kZeroPoolMinFreePages = 4096;
+
+static SpinLock zero_pool_lock;
+static list_node zero_pool_list TA_GUARDED(zero_pool_lock) = LIST_INITIAL_VALUE(zero_pool_list);
+// Only modified with zero_pool_lock held, but read without it.
+static fbl::atomic<size_t> zero_pool_count(0);
+static event_t zero_pool_event =
+    EVENT_INITIAL_VALUE(zero_pool_event, false, EVENT_FLAG_AUTOUNSIGNAL);
+
+// Set once the zeroing thread is running.
+static bool zero_pool_enabled;
+
+// Number of zeroed page allocations satisfied out of the pool.
+KCOUNTER(pmm_zero_pool_hit, "kernel.pmm.zero_pool.hit");
+// Number of zeroed page allocations that had to zero the page themselves.
+KCOUNTER(pmm_zero_pool_miss, "kernel.pmm.zero_pool.miss");
+// Number of pages zeroed in the background by the pool thread.
+KCOUNTER(pmm_zero_pool_zeroed, "kernel.pmm.zero_pool.zeroed");
+// Number of times the pool was handed back because free memory ran low.
+KCOUNTER(pmm_zero_pool_released, "kernel.pmm.zero_pool.released");
+
+// Low free memory watermarks. The first time the number of free pages is seen
+// below a watermark's |pages|, its |event| is signaled. It is not signaled
+// again until the free count has climbed back above the watermark, at which
+// point it is also signaled if |recovery| is set. |pages| and |tripped| are
+// read without the lock, so that allocations only take it to signal; |event|
+// and |recovery| are only touched with low_watermark_lock held.
+struct LowWatermark {
+    fbl::atomic<size_t> pages;
+    fbl::atomic<bool> tripped;
+    event_t* event;
+    bool recovery;
+};
+static fbl::Mutex low_watermark_lock;
+static LowWatermark low_watermarks[PMM_MAX_LOW_WATERMARKS];
+
+// Number of times the free page count dropped below the low watermark.
+KCOUNTER(pmm_low_watermark_count, "kernel.pmm.low_watermark");
 
 #if PMM_ENABLE_FREE_FILL
 static void pmm_enforce_fill(uint level) {
@@ -51,6 +161,101 @@ static void pmm_enforce_fill(uint level) {
 LK_INIT_HOOK(pmm_fill, &pmm_enforce_fill, LK_INIT_LEVEL_VM);
 #endif
 
+static void clear_page(vm_page_t* page) {
+    void* ptr = paddr_to_physmap(vm_page_to_paddr(page));
+    DEBUG_ASSERT(ptr);
+    arch_zero_page(ptr);
+}
+
+static void zero_pool_release();
+static zx_status_t add_low_watermark(size_t watermark_pages, event_t* event, bool recovery);
+
+// Keeps the zero pool topped up. Runs at low priority so that the zeroing
+// only soaks up otherwise idle cpu time.
+static int zero_pool_thread(void*) {
+    for (;;) {
+        // Below the floor, give the pooled pages back rather than make ordinary
+        // allocations fail into page_cache_drain_all(), and sleep until the
+        // watermark registered in pmm_zero_pool_init() reports that free
+        // memory has climbed back above it.
+        if (pmm_count_free_pages() < kZeroPoolMinFreePages) {
+            zero_pool_release();
+            event_wait(&zero_pool_event);
+            continue;
+        }
+
+        while (zero_pool_count.load(fbl::memory_order_relaxed) < kZeroPoolTarget &&
+               pmm_count_free_pages() >= kZeroPoolMinFreePages) {
+            list_node list = LIST_INITIAL_VALUE(list);
+            {
+                AutoLock al(&arena_lock);
+                size_t allocated = 0;
+                for (auto& a : arena_list) {
+                    if ((a.flags() & PMM_ARENA_FLAG_KMAP) == 0)
+                        continue;
+                    allocated += a.AllocPages(kZeroPoolBatch - allocated, &list);
+                    if (allocated == kZeroPoolBatch)
+                        break;
+                }
+            }
+            if (list_is_empty(&list))
+                break;
+
+            size_t count = 0;
+            vm_page_t* page;
+            list_for_every_entry (&list, page, vm_page_t, free.node) {
+                clear_page(page);
+                page->state = VM_PAGE_STATE_CACHED;
+                count++;
+            }
+            kcounter_add(pmm_zero_pool_zeroed, count);
+
+            spin_lock_saved_state_t state;
+            zero_pool_lock.AcquireIrqSave(state);
+            while ((page = list_remove_head_type(&list, vm_page_t, free.node)) != nullptr) {
+                list_add_head(&zero_pool_list, &page->free.node);
+            }
+            zero_pool_count.store(zero_pool_count.load(fbl::memory_order_relaxed) + count,
+                                  fbl::memory_order_relaxed);
+            zero_pool_lock.ReleaseIrqRestore(state);
+        }
+
+        // Wait for the pool to drain, or for the low watermark registered in
+        // pmm_zero_pool_init() to report that free memory is below the floor.
+        if (pmm_count_free_pages() >= kZeroPoolMinFreePages)
+            event_wait(&zero_pool_event);
+    }
+    return 0;
+}
+
+static void pmm_zero_pool_init(uint level) {
+#if !PMM_ENABLE_FREE_FILL
+    // Like the page caches, pooled pages would bypass the free fill checks.
+    // The thread relies on the watermark to wake it both when free memory
+    // drops below the floor and when it recovers.
+    if (add_low_watermark(kZeroPoolMinFreePages, &zero_pool_event, true) != ZX_OK)
+        return;
+    thread_t* t = thread_create("pmm-zero", zero_pool_thread, nullptr,
+                                LOW_PRIORITY, DEFAULT_STACK_SIZE);
+    if (!t) {
+        pmm_remove_low_watermark(&zero_pool_event);
+        return;
+    }
+    zero_pool_enabled = true;
+    thread_detach_and_resume(t);
+#endif
+}
+LK_INIT_HOOK(pmm_zero_pool, &pmm_zero_pool_init, LK_INIT_LEVEL_THREADING);
+
+static void pmm_page_cache_init(uint level) {
+#if !PMM_ENABLE_FREE_FILL
+    // Cached pages bypass the arena free fill checks, so leave the caches off
+    // when those are being enforced.
+    page_cache_enabled = true;
+#endif
+}
+LK_INIT_HOOK(pmm_page_cache, &pmm_page_cache_init, LK_INIT_LEVEL_VM);
+
 // We don't need to hold the arena lock while executing this, since it is
 // only accesses values that are set once during system initialization.
 paddr_t vm_page_to_paddr(const vm_page_t* page) TA_NO_THREAD_SAFETY_ANALYSIS {
@@ -119,7 +324,288 @@ done_add:
     return ZX_OK;
 }
 
-vm_page_t* pmm_alloc_page(uint alloc_flags, paddr_t* pa) {
+// Signals the event of every low watermark the free page count has just dropped
+// below, and re-arms those it has climbed back above, signaling the ones that
+// asked for it. Must be called without arena_lock held, after pages have moved
+// in or out of the arenas.
+static void pmm_check_low_watermark() {
+    size_t free_pages = 0;
+    bool counted = false;
+    for (auto& w : low_watermarks) {
+        size_t watermark = w.pages.load(fbl::memory_order_relaxed);
+        if (watermark == 0)
+            continue;
+        if (!counted) {
+            free_pages = pmm_count_free_pages();
+            counted = true;
+        }
+
+        if (free_pages < watermark) {
+            if (!w.tripped.exchange(true)) {
+                kcounter_add(pmm_low_watermark_count, 1u);
+
+                AutoLock al(&low_watermark_lock);
+                if (w.event)
+                    event_signal(w.event, false);
+            }
+        } else if (w.tripped.load(fbl::memory_order_relaxed) && w.tripped.exchange(false)) {
+            AutoLock al(&low_watermark_lock);
+            if (w.event && w.recovery)
+                event_signal(w.event, false);
+        }
+    }
+}
+
+// Returns whether |page| belongs to an arena whose pages may be cached.
+// The arena list is only modified during early boot, so no lock is needed.
+static bool page_is_cacheable(const vm_page_t* page) TA_NO_THREAD_SAFETY_ANALYSIS {
+    for (const auto& a : arena_list) {
+        if (a.page_belongs_to_arena(page)) {
+            return (a.flags() & PMM_ARENA_FLAG_KMAP) != 0;
+        }
+    }
+    return false;
+}
+
+// Returns every page on |list| to the arena it belongs to.
+static size_t free_pages_locked(list_node* list) TA_REQ(arena_lock) {
+    size_t count = 0;
+    while (!list_is_empty(list)) {
+        vm_page_t* page = list_remove_head_type(list, vm_page_t, free.node);
+
+        DEBUG_ASSERT_MSG(!page_is_free(page), "page %p state %u\n", page, page->state);
+
+        /* see which arena this page belongs to and add it */
+        for (auto& a : arena_list) {
+            if (a.FreePage(page) >= 0) {
+                count++;
+                break;
+            }
+        }
+    }
+    return count;
+}
+
+// Removes up to |count| pages from |cache| and appends them to |list|.
+static void page_cache_take_locked(PageCache* cache, size_t count, list_node* list)
+    TA_REQ(cache->lock) {
+    while (count-- > 0) {
+        vm_page_t* page = list_remove_head_type(&cache->free_list, vm_page_t, free.node);
+        if (!page)
+            break;
+        DEBUG_ASSERT(page->state == VM_PAGE_STATE_CACHED);
+        DEBUG_ASSERT(cache->count() > 0);
+        cache->set_count(cache->count() - 1);
+        page->state = VM_PAGE_STATE_ALLOC;
+        list_add_tail(list, &page->free.node);
+    }
+}
+
+// Tries to pop a page off the current cpu's cache.
+static vm_page_t* page_cache_alloc(paddr_t* pa) {
+    spin_lock_saved_state_t state;
+    arch_interrupt_save(&state, SPIN_LOCK_FLAG_INTERRUPTS);
+
+    PageCache* cache = &page_cache[arch_curr_cpu_num()];
+    cache->lock.Acquire();
+    vm_page_t* page = list_remove_head_type(&cache->free_list, vm_page_t, free.node);
+    if (page) {
+        DEBUG_ASSERT(page->state == VM_PAGE_STATE_CACHED);
+        DEBUG_ASSERT(cache->count() > 0);
+        cache->set_count(cache->count() - 1);
+        page->state = VM_PAGE_STATE_ALLOC;
+        kcounter_add(pmm_cache_alloc_hit, 1u);
+    }
+    cache->lock.Release();
+
+    arch_interrupt_restore(state, SPIN_LOCK_FLAG_INTERRUPTS);
+
+    if (page && pa) {
+        *pa = vm_page_to_paddr(page);
+    }
+    return page;
+}
+
+// Moves cacheable pages from |list| into the current cpu's cache, up to the
+// cache's capacity. Pages that cannot be cached, and any pages flushed out of a
+// full cache, are left on |list| for the caller to return to the arenas. The
+// amount of work done with interrupts disabled is bounded by the cache size,
+// regardless of the length of |list|. Returns the number of pages cached.
+static size_t page_cache_free(list_node* list) {
+    list_node uncached = LIST_INITIAL_VALUE(uncached);
+    size_t cached = 0;
+
+    spin_lock_saved_state_t state;
+    arch_interrupt_save(&state, SPIN_LOCK_FLAG_INTERRUPTS);
+
+    PageCache* cache = &page_cache[arch_curr_cpu_num()];
+    cache->lock.Acquire();
+    if (cache->count() == kPageCacheCapacity) {
+        // Make room so that the next few frees on this cpu stay local.
+        page_cache_take_locked(cache, kPageCacheBatch, &uncached);
+        kcounter_add(pmm_cache_free_flush, 1u);
+    }
+    while (cache->count() < kPageCacheCapacity) {
+        vm_page_t* page = list_remove_head_type(list, vm_page_t, free.node);
+        if (!page)
+            break;
+
+        DEBUG_ASSERT_MSG(!page_is_free(page), "page %p state %u\n", page, page->state);
+        DEBUG_ASSERT(page->state != VM_PAGE_STATE_OBJECT || page->object.pin_count == 0);
+
+        if (!page_is_cacheable(page)) {
+            list_add_tail(&uncached, &page->free.node);
+            continue;
+        }
+        page->state = VM_PAGE_STATE_CACHED;
+        list_add_head(&cache->free_list, &page->free.node);
+        cache->set_count(cache->count() + 1);
+        cached++;
+    }
+    kcounter_add(pmm_cache_free_hit, cached);
+    cache->lock.Release();
+
+    arch_interrupt_restore(state, SPIN_LOCK_FLAG_INTERRUPTS);
+
+    vm_page_t* page;
+    while ((page = list_remove_head_type(&uncached, vm_page_t, free.node)) != nullptr) {
+        list_add_tail(list, &page->free.node);
+    }
+    return cached;
+}
+
+// Moves pages from |list|, which must all come from KMAP arenas, into the
+// current cpu's cache. Pages that do not fit are left on |list|.
+static void page_cache_fill(list_node* list) {
+    spin_lock_saved_state_t state;
+    arch_interrupt_save(&state, SPIN_LOCK_FLAG_INTERRUPTS);
+
+    PageCache* cache = &page_cache[arch_curr_cpu_num()];
+    cache->lock.Acquire();
+    while (cache->count() < kPageCacheCapacity) {
+        vm_page_t* page = list_remove_head_type(list, vm_page_t, free.node);
+        if (!page)
+            break;
+        page->state = VM_PAGE_STATE_CACHED;
+        list_add_tail(&cache->free_list, &page->free.node);
+        cache->set_count(cache->count() + 1);
+    }
+    cache->lock.Release();
+
+    arch_interrupt_restore(state, SPIN_LOCK_FLAG_INTERRUPTS);
+}
+
+// Removes up to |count| pages from the zero pool and appends them to |list|.
+// Returns the number of pages taken.
+static size_t zero_pool_take(size_t count, list_node* list) {
+    size_t taken = 0;
+    size_t remaining;
+
+    spin_lock_saved_state_t state;
+    zero_pool_lock.AcquireIrqSave(state);
+    while (taken < count) {
+        vm_page_t* page = list_remove_head_type(&zero_pool_list, vm_page_t, free.node);
+        if (!page)
+            break;
+        DEBUG_ASSERT(page->state == VM_PAGE_STATE_CACHED);
+        page->state = VM_PAGE_STATE_ALLOC;
+        list_add_tail(list, &page->free.node);
+        taken++;
+    }
+    remaining = zero_pool_count.load(fbl::memory_order_relaxed) - taken;
+    zero_pool_count.store(remaining, fbl::memory_order_relaxed);
+    zero_pool_lock.ReleaseIrqRestore(state);
+
+    // Wake the zeroing thread as the pool crosses the refill threshold.
+    if (taken > 0 && remaining < kZeroPoolTarget / 2 &&
+        remaining + taken >= kZeroPoolTarget / 2) {
+        event_signal(&zero_pool_event, false);
+    }
+
+    return taken;
+}
+
+// Hands every page in the zero pool back to the arenas.
+static void zero_pool_release() {
+    list_node list = LIST_INITIAL_VALUE(list);
+    if (zero_pool_take(SIZE_MAX, &list) == 0)
+        return;
+
+    kcounter_add(pmm_zero_pool_released, 1u);
+
+    AutoLock al(&arena_lock);
+    free_pages_locked(&list);
+}
+
+// Empties every cpu's cache and the zero pool back into the arenas. Used when
+// an allocation the caches cannot help with (multiple, contiguous or specific
+// pages) comes up short. Returns the number of pages handed back.
+static size_t page_cache_drain_all() {
+    list_node list = LIST_INITIAL_VALUE(list);
+    if (page_cache_enabled) {
+        for (auto& cache : page_cache) {
+            spin_lock_saved_state_t state;
+            cache.lock.AcquireIrqSave(state);
+            page_cache_take_locked(&cache, cache.count(), &list);
+            cache.lock.ReleaseIrqRestore(state);
+        }
+    }
+    zero_pool_take(SIZE_MAX, &list);
+    if (list_is_empty(&list))
+        return 0;
+
+    kcounter_add(pmm_cache_drain_all, 1u);
+
+    AutoLock al(&arena_lock);
+    return free_pages_locked(&list);
+}
+
+// Returns the number of pages currently sitting in the per-cpu caches. The
+// result is only a snapshot, as the caches keep changing underneath us.
+static size_t page_cache_count() {
+    size_t count = zero_pool_count.load(fbl::memory_order_relaxed);
+    for (const auto& cache : page_cache) {
+        count += cache.count();
+    }
+    return count;
+}
+
+// Slow path of pmm_alloc_page for when the local cache is empty: grab a batch
+// of pages from the KMAP arenas, return one and cache the rest.
+static vm_page_t* page_cache_refill(paddr_t* pa) {
+    kcounter_add(pmm_cache_alloc_miss, 1u);
+
+    list_node list = LIST_INITIAL_VALUE(list);
+    {
+        AutoLock al(&arena_lock);
+        size_t allocated = 0;
+        for (auto& a : arena_list) {
+            if ((a.flags() & PMM_ARENA_FLAG_KMAP) == 0)
+                continue;
+            allocated += a.AllocPages(kPageCacheBatch - allocated, &list);
+            if (allocated == kPageCacheBatch)
+                break;
+        }
+    }
+
+    vm_page_t* page = list_remove_head_type(&list, vm_page_t, free.node);
+    if (!page)
+        return nullptr;
+
+    page_cache_fill(&list);
+    if (!list_is_empty(&list)) {
+        // The cache was filled behind our back while we were in the arenas.
+        AutoLock al(&arena_lock);
+        free_pages_locked(&list);
+    }
+
+    if (pa) {
+        *pa = vm_page_to_paddr(page);
+    }
+    return page;
+}
+
+static vm_page_t* alloc_page_from_arenas(uint alloc_flags, paddr_t* pa) {
     AutoLock al(&arena_lock);
 
     /* walk the arenas in order until we find one with a free page */
@@ -136,19 +622,58 @@ vm_page_t* pmm_alloc_page(uint alloc_flags, paddr_t* pa) {
             return page;
     }
 
-    LTRACEF("failed to allocate page\n");
     return nullptr;
 }
 
-size_t pmm_alloc_pages(size_t count, uint alloc_flags, struct list_node* list) {
-    LTRACEF("count %zu\n", count);
+static vm_page_t* alloc_page(uint alloc_flags, paddr_t* pa) {
+    if (page_cache_enabled) {
+        vm_page_t* page = page_cache_alloc(pa);
+        if (!page)
+            page = page_cache_refill(pa);
+        if (page) {
+            pmm_check_low_watermark();
+            return page;
+        }
+    }
 
-    /* list must be initialized prior to calling this */
-    DEBUG_ASSERT(list);
+    vm_page_t* page = alloc_page_from_arenas(alloc_flags, pa);
+    if (!page && page_cache_drain_all() > 0) {
+        // The last free pages may have been stuck in other cpus' caches.
+        page = alloc_page_from_arenas(alloc_flags, pa);
+    }
 
-    if (count == 0)
-        return 0;
+    pmm_check_low_watermark();
+
+    if (!page)
+        LTRACEF("failed to allocate page\n");
+    return page;
+}
+
+vm_page_t* pmm_alloc_page(uint alloc_flags, paddr_t* pa) {
+    if (!(alloc_flags & PMM_ALLOC_FLAG_ZERO))
+        return alloc_page(alloc_flags, pa);
+
+    // Pooled pages come from KMAP arenas, so they satisfy any flags.
+    list_node list = LIST_INITIAL_VALUE(list);
+    if (zero_pool_take(1, &list) == 1) {
+        kcounter_add(pmm_zero_pool_hit, 1u);
+        vm_page_t* page = list_remove_head_type(&list, vm_page_t, free.node);
+        if (pa) {
+            *pa = vm_page_to_paddr(page);
+        }
+        pmm_check_low_watermark();
+        return page;
+    }
+
+    if (zero_pool_enabled)
+        kcounter_add(pmm_zero_pool_miss, 1u);
+    vm_page_t* page = alloc_page(alloc_flags & ~PMM_ALLOC_FLAG_ZERO, pa);
+    if (page)
+        clear_page(page);
+    return page;
+}
 
+static size_t alloc_pages_from_arenas(size_t count, uint alloc_flags, struct list_node* list) {
     AutoLock al(&arena_lock);
 
     /* walk the arenas in order, allocating as many pages as we can from each */
@@ -172,14 +697,48 @@ size_t pmm_alloc_pages(size_t count, uint alloc_flags, struct list_node* list) {
     return allocated;
 }
 
-size_t pmm_alloc_range(paddr_t address, size_t count, struct list_node* list) {
-    LTRACEF("address %#" PRIxPTR ", count %zu\n", address, count);
+size_t pmm_alloc_pages(size_t count, uint alloc_flags, struct list_node* list) {
+    LTRACEF("count %zu\n", count);
+
+    /* list must be initialized prior to calling this */
+    DEBUG_ASSERT(list);
 
-    uint allocated = 0;
     if (count == 0)
         return 0;
 
-    address = ROUNDDOWN(address, PAGE_SIZE);
+    size_t allocated = 0;
+    list_node unzeroed = LIST_INITIAL_VALUE(unzeroed);
+    list_node* dest = list;
+    if (alloc_flags & PMM_ALLOC_FLAG_ZERO) {
+        allocated = zero_pool_take(count, list);
+        kcounter_add(pmm_zero_pool_hit, allocated);
+        if (allocated == count) {
+            pmm_check_low_watermark();
+            return allocated;
+        }
+        if (zero_pool_enabled)
+            kcounter_add(pmm_zero_pool_miss, count - allocated);
+        dest = &unzeroed;
+    }
+
+    allocated += alloc_pages_from_arenas(count - allocated, alloc_flags, dest);
+    if (allocated < count && page_cache_drain_all() > 0) {
+        allocated += alloc_pages_from_arenas(count - allocated, alloc_flags, dest);
+    }
+
+    vm_page_t* page;
+    while ((page = list_remove_head_type(&unzeroed, vm_page_t, free.node)) != nullptr) {
+        clear_page(page);
+        list_add_tail(list, &page->free.node);
+    }
+
+    pmm_check_low_watermark();
+
+    return allocated;
+}
+
+static size_t alloc_range_from_arenas(paddr_t address, size_t count, struct list_node* list) {
+    size_t allocated = 0;
 
     AutoLock al(&arena_lock);
 
@@ -204,25 +763,28 @@ size_t pmm_alloc_range(paddr_t address, size_t count, struct list_node* list) {
     return allocated;
 }
 
-size_t pmm_alloc_contiguous(size_t count, uint alloc_flags, uint8_t alignment_log2, paddr_t* pa,
-                            struct list_node* list) {
-    LTRACEF("count %zu, align %u\n", count, alignment_log2);
+size_t pmm_alloc_range(paddr_t address, size_t count, struct list_node* list) {
+    LTRACEF("address %#" PRIxPTR ", count %zu\n", address, count);
 
     if (count == 0)
         return 0;
-    if (alignment_log2 < PAGE_SIZE_SHIFT)
-        alignment_log2 = PAGE_SIZE_SHIFT;
 
-    /* if we're called with a single page, just fall through to the regular allocation routine */
-    if (unlikely(count == 1 && alignment_log2 == PAGE_SIZE_SHIFT)) {
-        auto page = pmm_alloc_page(alloc_flags, pa);
-        if (!page)
-            return 0;
-        if (list)
-            list_add_tail(list, &page->free.node);
-        return 1;
+    address = ROUNDDOWN(address, PAGE_SIZE);
+
+    size_t allocated = alloc_range_from_arenas(address, count, list);
+    if (allocated < count && page_cache_drain_all() > 0) {
+        // The page we stopped at may have been sitting in a cpu's cache.
+        allocated += alloc_range_from_arenas(address + allocated * PAGE_SIZE,
+                                             count - allocated, list);
     }
 
+    pmm_check_low_watermark();
+
+    return allocated;
+}
+
+static size_t alloc_contiguous_from_arenas(size_t count, uint alloc_flags, uint8_t alignment_log2,
+                                           paddr_t* pa, struct list_node* list) {
     AutoLock al(&arena_lock);
 
     for (auto& a : arena_list) {
@@ -239,10 +801,41 @@ size_t pmm_alloc_contiguous(size_t count, uint alloc_flags, uint8_t alignment_lo
         }
     }
 
-    LTRACEF("couldn't find run\n");
     return 0;
 }
 
+size_t pmm_alloc_contiguous(size_t count, uint alloc_flags, uint8_t alignment_log2, paddr_t* pa,
+                            struct list_node* list) {
+    LTRACEF("count %zu, align %u\n", count, alignment_log2);
+
+    if (count == 0)
+        return 0;
+    if (alignment_log2 < PAGE_SIZE_SHIFT)
+        alignment_log2 = PAGE_SIZE_SHIFT;
+
+    /* if we're called with a single page, just fall through to the regular allocation routine */
+    if (unlikely(count == 1 && alignment_log2 == PAGE_SIZE_SHIFT)) {
+        auto page = pmm_alloc_page(alloc_flags, pa);
+        if (!page)
+            return 0;
+        if (list)
+            list_add_tail(list, &page->free.node);
+        return 1;
+    }
+
+    size_t allocated = alloc_contiguous_from_arenas(count, alloc_flags, alignment_log2, pa, list);
+    if (allocated == 0 && page_cache_drain_all() > 0) {
+        // Cached pages may have been breaking up an otherwise usable run.
+        allocated = alloc_contiguous_from_arenas(count, alloc_flags, alignment_log2, pa, list);
+    }
+
+    pmm_check_low_watermark();
+
+    if (allocated == 0)
+        LTRACEF("couldn't find run\n");
+    return allocated;
+}
+
 /* physically allocate a run from arenas marked as KMAP */
 void* pmm_alloc_kpages(size_t count, struct list_node* list, paddr_t* _pa) {
     LTRACEF("count %zu\n", count);
@@ -317,24 +910,20 @@ size_t pmm_free(struct list_node* list) {
 
     DEBUG_ASSERT(list);
 
-    AutoLock al(&arena_lock);
-
-    uint count = 0;
-    while (!list_is_empty(list)) {
-        vm_page_t* page = list_remove_head_type(list, vm_page_t, free.node);
-
-        DEBUG_ASSERT_MSG(!page_is_free(page), "page %p state %u\n", page, page->state);
+    size_t count = 0;
+    if (page_cache_enabled) {
+        count += page_cache_free(list);
+    }
 
-        /* see which arena this page belongs to and add it */
-        for (auto& a : arena_list) {
-            if (a.FreePage(page) >= 0) {
-                count++;
-                break;
-            }
+    if (!list_is_empty(list)) {
+        {
+            AutoLock al(&arena_lock);
+            count += free_pages_locked(list);
         }
+        pmm_check_low_watermark();
     }
 
-    LTRACEF("returning count %u\n", count);
+    LTRACEF("returning count %zu\n", count);
 
     return count;
 }
@@ -348,31 +937,66 @@ size_t pmm_free_page(vm_page_t* page) {
     return pmm_free(&list);
 }
 
-static size_t pmm_count_free_pages_locked() TA_REQ(arena_lock) {
-    size_t free = 0u;
+// We don't need to hold the arena lock while executing this, since the arena
+// list is only modified during early boot and the per-arena and per-cpu free
+// counts may be read locklessly. The result is a snapshot.
+size_t pmm_count_free_pages() TA_NO_THREAD_SAFETY_ANALYSIS {
+    size_t free = page_cache_count();
     for (const auto& a : arena_list) {
         free += a.free_count();
     }
     return free;
 }
 
-size_t pmm_count_free_pages() {
-    AutoLock al(&arena_lock);
-    return pmm_count_free_pages_locked();
-}
-
-static void pmm_dump_free() TA_REQ(arena_lock) {
-    auto megabytes_free = pmm_count_free_pages_locked() / 256u;
+static void pmm_dump_free() {
+    auto megabytes_free = pmm_count_free_pages() / 256u;
     printf(" %zu free MBs\n", megabytes_free);
 }
 
-static size_t pmm_count_total_bytes_locked() TA_REQ(arena_lock) {
+size_t pmm_count_total_bytes() {
     return arena_cumulative_size;
 }
 
-size_t pmm_count_total_bytes() {
-    AutoLock al(&arena_lock);
-    return pmm_count_total_bytes_locked();
+static zx_status_t add_low_watermark(size_t watermark_pages, event_t* event, bool recovery) {
+    DEBUG_ASSERT(watermark_pages > 0);
+    DEBUG_ASSERT(event != nullptr);
+
+    {
+        AutoLock al(&low_watermark_lock);
+        LowWatermark* slot = nullptr;
+        for (auto& w : low_watermarks) {
+            if (w.event == nullptr) {
+                slot = &w;
+                break;
+            }
+        }
+        if (slot == nullptr)
+            return ZX_ERR_NO_RESOURCES;
+
+        slot->event = event;
+        slot->recovery = recovery;
+        slot->tripped.store(false);
+        slot->pages.store(watermark_pages);
+    }
+
+    // The free count may already be below the new watermark.
+    pmm_check_low_watermark();
+    return ZX_OK;
+}
+
+zx_status_t pmm_add_low_watermark(size_t watermark_pages, event_t* event) {
+    return add_low_watermark(watermark_pages, event, false);
+}
+
+void pmm_remove_low_watermark(event_t* event) {
+    AutoLock al(&low_watermark_lock);
+    for (auto& w : low_watermarks) {
+        if (w.event == event) {
+            w.pages.store(0);
+            w.event = nullptr;
+            break;
+        }
+    }
 }
 
 void pmm_count_total_states(size_t state_count[_VM_PAGE_STATE_COUNT]) {
@@ -384,7 +1008,7 @@ void pmm_count_total_states(size_t state_count[_VM_PAGE_STATE_COUNT]) {
     }
 }
 
-static void pmm_dump_timer(timer_t* t, zx_time_t now, void*) TA_REQ(arena_lock) {
+static void pmm_dump_timer(timer_t* t, zx_time_t now, void*) {
     timer_set(t, now + ZX_SEC(1), TIMER_SLACK_CENTER, ZX_MSEC(20), &pmm_dump_timer, nullptr);
     pmm_dump_free();
 }
@@ -419,6 +1043,7 @@ static int cmd_pmm(int argc, const cmd_args* argv, uint32_t flags) {
             printf("%s dump_alloced\n", argv[0].str);
             printf("%s free_alloced\n", argv[0].str);
             printf("%s free\n", argv[0].str);
+            printf("%s frag\n", argv[0].str);
         }
         return ZX_ERR_INTERNAL;
     }
@@ -445,6 +1070,11 @@ static int cmd_pmm(int argc, const cmd_args* argv, uint32_t flags) {
             timer_cancel(&timer);
             show_mem = false;
         }
+    } else if (!strcmp(argv[1].str, "frag")) {
+        AutoLock al(&arena_lock);
+        for (const auto& a : arena_list) {
+            a.DumpBuddy();
+        }
     } else if (!strcmp(argv[1].str, "alloc")) {
         if (argc < 3)
             goto notenoughargs;
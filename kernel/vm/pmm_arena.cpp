@@ -9,6 +9,7 @@
 
 #include <err.h>
 #include <inttypes.h>
+#include <pow2.h>
 #include <pretty/sizes.h>
 #include <string.h>
 #include <trace.h>
@@ -23,9 +24,10 @@
 void PmmArena::EnforceFill() {
     DEBUG_ASSERT(!enforce_fill_);
 
-    vm_page_t* page;
-    list_for_every_entry (&free_list_, page, vm_page_t, free.node) {
-        FreeFill(page);
+    for (size_t i = 0; i < page_count(); i++) {
+        if (page_is_free(&page_array_[i])) {
+            FreeFill(&page_array_[i]);
+        }
     }
 
     enforce_fill_ = true;
@@ -87,48 +89,187 @@ zx_status_t PmmArena::Init(const pmm_arena_info_t* info) {
 
     DEBUG_ASSERT(array_start_index < page_count && array_end_index <= page_count);
 
-    /* add all pages that aren't part of the page array to the free list */
-    /* pages part of the free array go to the WIRED state */
+    for (auto& list : free_lists_) {
+        list_initialize(&list);
+    }
+
+    /* pages part of the free array go to the WIRED state, the rest are free */
+    /* no page is a block head until it has been handed to the buddy allocator */
     for (size_t i = 0; i < page_count; i++) {
         auto& p = page_array_[i];
 
-        if (i >= array_start_index && i < array_end_index) {
-            p.state = VM_PAGE_STATE_WIRED;
-        } else {
-            p.state = VM_PAGE_STATE_FREE;
-            list_add_tail(&free_list_, &p.free.node);
-            free_count_++;
+        p.state = (i >= array_start_index && i < array_end_index) ? VM_PAGE_STATE_WIRED
+                                                                  : VM_PAGE_STATE_FREE;
+        p.free.order = VM_PAGE_BUDDY_ORDER_NONE;
+    }
+
+    /* hand all the free pages to the buddy allocator, merging as we go */
+    for (size_t i = 0; i < page_count; i++) {
+        if (page_is_free(&page_array_[i])) {
+            FreeBlock(i, 0);
+            free_count_.fetch_add(1, fbl::memory_order_relaxed);
         }
     }
 
     return ZX_OK;
 }
 
-vm_page_t* PmmArena::AllocPage(paddr_t* pa) {
-    vm_page_t* page = list_remove_head_type(&free_list_, vm_page_t, free.node);
-    if (!page)
-        return nullptr;
+void PmmArena::AddFreeBlock(size_t index, uint8_t order) {
+    DEBUG_ASSERT(order < kNumOrders);
+    DEBUG_ASSERT(index + (1UL << order) <= page_count());
+
+    vm_page_t* page = &page_array_[index];
+    DEBUG_ASSERT(page_is_free(page));
+
+    page->free.order = order;
+    list_add_head(&free_lists_[order], &page->free.node);
+    free_block_count_[order]++;
+}
+
+void PmmArena::RemoveFreeBlock(size_t index, uint8_t order) {
+    vm_page_t* page = &page_array_[index];
+    DEBUG_ASSERT(page_is_free(page));
+    DEBUG_ASSERT(page->free.order == order);
+    DEBUG_ASSERT(list_in_list(&page->free.node));
+
+    list_delete(&page->free.node);
+    page->free.order = VM_PAGE_BUDDY_ORDER_NONE;
+    DEBUG_ASSERT(free_block_count_[order] > 0);
+    free_block_count_[order]--;
+}
+
+// Adds the free block of 2^|order| pages at |index|, merging it with its buddy
+// for as long as the buddy is also a free block of the same order.
+void PmmArena::FreeBlock(size_t index, uint8_t order) {
+    const size_t base_pfn = base() / PAGE_SIZE;
+    size_t pfn = base_pfn + index;
+
+    while (order + 1 < kNumOrders) {
+        size_t buddy_pfn = pfn ^ (1UL << order);
+        if (buddy_pfn < base_pfn || buddy_pfn + (1UL << order) > base_pfn + page_count())
+            break;
+
+        size_t buddy_index = buddy_pfn - base_pfn;
+        const vm_page_t* buddy = &page_array_[buddy_index];
+        if (!page_is_free(buddy) || buddy->free.order != order)
+            break;
+
+        RemoveFreeBlock(buddy_index, order);
+        pfn = MIN(pfn, buddy_pfn);
+        order++;
+    }
+
+    AddFreeBlock(pfn - base_pfn, order);
+}
+
+// Returns the |count| free pages starting at |index| to the free lists as the
+// largest naturally aligned blocks that fit. The caller guarantees that none of
+// the resulting blocks can be merged with a neighbour.
+void PmmArena::FreeRange(size_t index, size_t count) {
+    const size_t base_pfn = base() / PAGE_SIZE;
+
+    while (count > 0) {
+        size_t pfn = base_pfn + index;
+        uint8_t order = static_cast<uint8_t>(log2_ulong_floor(count));
+        if (pfn != 0) {
+            order = MIN(order, static_cast<uint8_t>(__builtin_ctzl(pfn)));
+        }
+        order = MIN(order, static_cast<uint8_t>(kNumOrders - 1));
+
+        AddFreeBlock(index, order);
+        index += 1UL << order;
+        count -= 1UL << order;
+    }
+}
+
+// Looks for the free block containing the free page at |index|.
+bool PmmArena::FindFreeBlock(size_t index, size_t* head, uint8_t* order) const {
+    const size_t base_pfn = base() / PAGE_SIZE;
+    const size_t pfn = base_pfn + index;
+
+    for (uint8_t o = 0; o < kNumOrders; o++) {
+        size_t head_pfn = ROUNDDOWN(pfn, 1UL << o);
+        if (head_pfn < base_pfn)
+            break;
+
+        const vm_page_t* page = &page_array_[head_pfn - base_pfn];
+        if (!page_is_free(page))
+            break;
+        if (page->free.order == o) {
+            *head = head_pfn - base_pfn;
+            *order = o;
+            return true;
+        }
+    }
 
-    DEBUG_ASSERT(free_count_ > 0);
+    return false;
+}
 
-    free_count_--;
+// Removes the free block of 2^|order| pages at |head| and splits it until only
+// the single page at |target| is left out of the free lists.
+void PmmArena::SplitBlock(size_t head, uint8_t order, size_t target) {
+    DEBUG_ASSERT(target >= head && target < head + (1UL << order));
+
+    RemoveFreeBlock(head, order);
+    while (order > 0) {
+        order--;
+        size_t half = 1UL << order;
+        if (target < head + half) {
+            AddFreeBlock(head + half, order);
+        } else {
+            AddFreeBlock(head, order);
+            head += half;
+        }
+    }
+    DEBUG_ASSERT(head == target);
+}
 
+// Pulls the specific free page at |index| out of the buddy allocator.
+vm_page_t* PmmArena::TakeFreePage(size_t index) {
+    size_t head;
+    uint8_t order;
+    bool found = FindFreeBlock(index, &head, &order);
+    ASSERT_MSG(found, "free page %zu of arena %s is not in any free block\n", index, name());
+
+    SplitBlock(head, order, index);
+    return &page_array_[index];
+}
+
+void PmmArena::MarkAllocated(vm_page_t* page) {
     DEBUG_ASSERT(page_is_free(page));
+    DEBUG_ASSERT(free_count() > 0);
+
+    free_count_.fetch_sub(1, fbl::memory_order_relaxed);
 
     page->state = VM_PAGE_STATE_ALLOC;
 #if PMM_ENABLE_FREE_FILL
     CheckFreeFill(page);
 #endif
 
-    if (pa) {
-        /* compute the physical address of the page based on its offset into the arena */
-        *pa = page_address_from_arena(page);
-        LTRACEF("pa %#" PRIxPTR ", page %p\n", *pa, page);
-    }
-
     LTRACEF("allocating page %p, pa %#" PRIxPTR "\n", page, page_address_from_arena(page));
+}
 
-    return page;
+vm_page_t* PmmArena::AllocPage(paddr_t* pa) {
+    /* take the smallest free block there is and split it down to a single page */
+    for (uint8_t order = 0; order < kNumOrders; order++) {
+        vm_page_t* page = list_peek_head_type(&free_lists_[order], vm_page_t, free.node);
+        if (!page)
+            continue;
+
+        size_t index = page_index(page);
+        SplitBlock(index, order, index);
+        MarkAllocated(page);
+
+        if (pa) {
+            /* compute the physical address of the page based on its offset into the arena */
+            *pa = page_address_from_arena(page);
+            LTRACEF("pa %#" PRIxPTR ", page %p\n", *pa, page);
+        }
+
+        return page;
+    }
+
+    return nullptr;
 }
 
 vm_page_t* PmmArena::AllocSpecific(paddr_t pa) {
@@ -137,7 +278,7 @@ vm_page_t* PmmArena::AllocSpecific(paddr_t pa) {
 
     size_t index = (pa - base()) / PAGE_SIZE;
 
-    DEBUG_ASSERT(index < size() / PAGE_SIZE);
+    DEBUG_ASSERT(index < page_count());
 
     vm_page_t* page = get_page(index);
     if (!page_is_free(page)) {
@@ -145,13 +286,8 @@ vm_page_t* PmmArena::AllocSpecific(paddr_t pa) {
         return nullptr;
     }
 
-    list_delete(&page->free.node);
-
-    page->state = VM_PAGE_STATE_ALLOC;
-
-    DEBUG_ASSERT(free_count_ > 0);
-
-    free_count_--;
+    TakeFreePage(index);
+    MarkAllocated(page);
 
     return page;
 }
@@ -160,22 +296,10 @@ size_t PmmArena::AllocPages(size_t count, list_node* list) {
     size_t allocated = 0;
 
     while (allocated < count) {
-        vm_page_t* page = list_remove_head_type(&free_list_, vm_page_t, free.node);
+        vm_page_t* page = AllocPage(nullptr);
         if (!page)
             return allocated;
 
-        LTRACEF("allocating page %p, pa %#" PRIxPTR "\n", page, page_address_from_arena(page));
-
-        DEBUG_ASSERT(free_count_ > 0);
-
-        free_count_--;
-
-        DEBUG_ASSERT(page_is_free(page));
-#if PMM_ENABLE_FREE_FILL
-        CheckFreeFill(page);
-#endif
-
-        page->state = VM_PAGE_STATE_ALLOC;
         list_add_tail(list, &page->free.node);
 
         allocated++;
@@ -185,6 +309,56 @@ size_t PmmArena::AllocPages(size_t count, list_node* list) {
 }
 
 size_t PmmArena::AllocContiguous(size_t count, uint8_t alignment_log2, paddr_t* pa, struct list_node* list) {
+    DEBUG_ASSERT(count > 0);
+    DEBUG_ASSERT(alignment_log2 >= PAGE_SIZE_SHIFT);
+
+    /* a block of this order is both large enough and suitably aligned */
+    uint order = MAX(log2_ulong_ceil(count), alignment_log2 - PAGE_SIZE_SHIFT);
+
+    uint8_t found = kNumOrders;
+    for (uint o = order; o < kNumOrders; o++) {
+        if (!list_is_empty(&free_lists_[o])) {
+            found = static_cast<uint8_t>(o);
+            break;
+        }
+    }
+    if (found == kNumOrders) {
+        /* no block is big enough, but there may still be a suitable run
+         * straddling several smaller blocks */
+        return AllocContiguousScan(count, alignment_log2, pa, list);
+    }
+
+    vm_page_t* head_page = list_peek_head_type(&free_lists_[found], vm_page_t, free.node);
+    size_t head = page_index(head_page);
+    LTRACEF("found order %u block at pn %zu for run of %zu pages\n", found, head, count);
+
+    /* split the block down to the order we need, keeping the front half */
+    RemoveFreeBlock(head, found);
+    while (found > order) {
+        found--;
+        AddFreeBlock(head + (1UL << found), found);
+    }
+
+    /* give back whatever we do not need off the end of the block */
+    FreeRange(head + count, (1UL << order) - count);
+
+    for (size_t i = head; i < head + count; i++) {
+        vm_page_t* p = &page_array_[i];
+        MarkAllocated(p);
+        if (list)
+            list_add_tail(list, &p->free.node);
+    }
+
+    if (pa)
+        *pa = base() + head * PAGE_SIZE;
+
+    return count;
+}
+
+// Slow path for AllocContiguous: a linear search of the page array for a free
+// run that is not contained in a single buddy block.
+size_t PmmArena::AllocContiguousScan(size_t count, uint8_t alignment_log2, paddr_t* pa,
+                                     struct list_node* list) {
     /* walk the list starting at alignment boundaries.
      * calculate the starting offset into this arena, based on the
      * base address of the arena to handle the case where the arena
@@ -219,22 +393,10 @@ retry:
         /* we found a run */
         LTRACEF("found run from pn %" PRIuPTR " to %" PRIuPTR "\n", start, start + count);
 
-        /* remove the pages from the run out of the free list */
+        /* pull the pages of the run out of the buddy allocator */
         for (paddr_t i = start; i < start + count; i++) {
-            p = &page_array_[i];
-            DEBUG_ASSERT(page_is_free(p));
-            DEBUG_ASSERT(list_in_list(&p->free.node));
-
-            list_delete(&p->free.node);
-            p->state = VM_PAGE_STATE_ALLOC;
-
-            DEBUG_ASSERT(free_count_ > 0);
-
-            free_count_--;
-
-#if PMM_ENABLE_FREE_FILL
-            CheckFreeFill(p);
-#endif
+            p = TakeFreePage(i);
+            MarkAllocated(p);
 
             if (list)
                 list_add_tail(list, &p->free.node);
@@ -261,12 +423,42 @@ zx_status_t PmmArena::FreePage(vm_page_t* page) {
 #endif
 
     page->state = VM_PAGE_STATE_FREE;
+    page->free.order = VM_PAGE_BUDDY_ORDER_NONE;
 
-    list_add_head(&free_list_, &page->free.node);
-    free_count_++;
+    FreeBlock(page_index(page), 0);
+    free_count_.fetch_add(1, fbl::memory_order_relaxed);
     return ZX_OK;
 }
 
+uint PmmArena::FragmentationIndex(uint8_t order) const {
+    DEBUG_ASSERT(order < kNumOrders);
+
+    size_t free_pages = 0;
+    size_t usable_pages = 0;
+    for (uint8_t o = 0; o < kNumOrders; o++) {
+        size_t pages = free_block_count_[o] << o;
+        free_pages += pages;
+        if (o >= order)
+            usable_pages += pages;
+    }
+    if (free_pages == 0)
+        return 0;
+
+    return static_cast<uint>(((free_pages - usable_pages) * 1000) / free_pages);
+}
+
+void PmmArena::DumpBuddy() const {
+    printf("arena %p: name '%s' free_count %zu\n", this, name(), free_count());
+    printf("\t%5s %10s %10s %8s\n", "order", "size", "blocks", "frag");
+    for (uint8_t o = 0; o < kNumOrders; o++) {
+        char pbuf[16];
+        uint frag = FragmentationIndex(o);
+        printf("\t%5u %10s %10zu %4u.%u%%\n", o,
+               format_size(pbuf, sizeof(pbuf), static_cast<size_t>(PAGE_SIZE) << o), free_block_count_[o],
+               frag / 10, frag % 10);
+    }
+}
+
 void PmmArena::CountStates(size_t state_count[_VM_PAGE_STATE_COUNT]) const {
     for (size_t i = 0; i < size() / PAGE_SIZE; i++) {
         state_count[page_array_[i].state]++;
@@ -277,7 +469,7 @@ void PmmArena::Dump(bool dump_pages, bool dump_free_ranges) {
     char pbuf[16];
     printf("arena %p: name '%s' base %#" PRIxPTR " size %s (0x%zx) priority %u flags 0x%x\n", this, name(), base(),
            format_size(pbuf, sizeof(pbuf), size()), size(), priority(), flags());
-    printf("\tpage_array %p, free_count %zu\n", page_array_, free_count_);
+    printf("\tpage_array %p, free_count %zu\n", page_array_, free_count());
 
     /* dump all of the pages */
     if (dump_pages) {
@@ -5,6 +5,7 @@
 // https://opensource.org/licenses/MIT
 #pragma once
 
+#include <fbl/atomic.h>
 #include <fbl/intrusive_double_list.h>
 #include <fbl/macros.h>
 
@@ -15,8 +16,17 @@
 #define PMM_ENABLE_FREE_FILL 0
 #define PMM_FREE_FILL_BYTE 0x42
 
+// Free pages are kept in a binary buddy allocator: every free page belongs to
+// exactly one free block of 2^order pages whose physical address is aligned to
+// the block size. Only the first page of a block (its head) is on a free list;
+// the others are marked free with no order. Freed pages are merged with their
+// buddy whenever it is also free, which keeps large aligned runs available for
+// contiguous allocations.
 class PmmArena : public fbl::DoublyLinkedListable<PmmArena*> {
 public:
+    // Blocks are at most 2^(kNumOrders - 1) pages (2GB) in size.
+    static constexpr uint8_t kNumOrders = 20;
+
     constexpr PmmArena() = default;
     ~PmmArena() = default;
 
@@ -31,6 +41,10 @@ public:
 
     void Dump(bool dump_pages, bool dump_free_ranges);
 
+    // Prints the number of free blocks of each order along with the arena's
+    // fragmentation index for allocations of that order.
+    void DumpBuddy() const;
+
     // accessors
     const pmm_arena_info_t& info() const { return info_; }
     const char* name() const { return info_.name; }
@@ -38,7 +52,8 @@ public:
     size_t size() const { return info_.size; }
     unsigned int flags() const { return info_.flags; }
     unsigned int priority() const { return info_.priority; }
-    size_t free_count() const { return free_count_; };
+    // May be called without holding the pmm lock; the result is a snapshot.
+    size_t free_count() const { return free_count_.load(fbl::memory_order_relaxed); };
 
     // Counts the number of pages in every state. For each page in the arena,
     // increments the corresponding VM_PAGE_STATE_*-indexed entry of
@@ -54,6 +69,15 @@ public:
     size_t AllocContiguous(size_t count, uint8_t alignment_log2, paddr_t* pa, struct list_node* list);
     zx_status_t FreePage(vm_page_t* page);
 
+    // Returns the number of free blocks of the given order.
+    size_t free_block_count(uint8_t order) const { return free_block_count_[order]; }
+
+    // Returns the unusable free space index for allocations of 2^|order|
+    // pages, in tenths of a percent: the share of free memory that sits in
+    // blocks too small to satisfy such an allocation. 0 means no
+    // fragmentation, 1000 means none of the free memory is usable.
+    uint FragmentationIndex(uint8_t order) const;
+
     // helpers
     bool page_belongs_to_arena(const vm_page* page) const {
         uintptr_t page_addr = reinterpret_cast<uintptr_t>(page);
@@ -80,11 +104,31 @@ private:
     void CheckFreeFill(vm_page_t* page);
 #endif
 
+    size_t page_count() const { return info_.size / PAGE_SIZE; }
+    size_t page_index(const vm_page_t* page) const { return page - page_array_; }
+
+    // Buddy helpers. Blocks are identified by the page_array_ index of their
+    // head, but their alignment is computed from the physical page number.
+    void AddFreeBlock(size_t index, uint8_t order);
+    void RemoveFreeBlock(size_t index, uint8_t order);
+    void FreeBlock(size_t index, uint8_t order);
+    void FreeRange(size_t index, size_t count);
+    bool FindFreeBlock(size_t index, size_t* head, uint8_t* order) const;
+    void SplitBlock(size_t head, uint8_t order, size_t target);
+    vm_page_t* TakeFreePage(size_t index);
+    void MarkAllocated(vm_page_t* page);
+    size_t AllocContiguousScan(size_t count, uint8_t alignment_log2, paddr_t* pa,
+                               struct list_node* list);
+
     pmm_arena_info_t info_ = {};
     vm_page_t* page_array_ = nullptr;
 
-    size_t free_count_ = 0;
-    list_node free_list_ = LIST_INITIAL_VALUE(free_list_);
+    // Only modified with the pmm lock held, but read locklessly.
+    fbl::atomic<size_t> free_count_ = {0};
+
+    // One list of free block heads per order. Initialized by Init().
+    list_node free_lists_[kNumOrders] = {};
+    size_t free_block_count_[kNumOrders] = {};
 
 #if PMM_ENABLE_FREE_FILL
     bool enforce_fill_ = false;
@@ -157,7 +157,27 @@ zx_status_t VmAddressRegion::CreateSubVmarInternal(size_t offset, size_t size, u
         }
     } else {
         // If we're not mapping to a specific place, search for an opening.
-        zx_status_t status = AllocSpotLocked(size, align_pow2, arch_mmu_flags, &new_base);
+        // Mappings of physical objects, or of paged objects with at least a
+        // large page worth of memory already committed in range, are placed so
+        // that their virtual and object offsets line up with a large page,
+        // giving the arch layer a chance to map contiguous runs of the object
+        // with large pages. Demand paged mappings are faulted in a few small
+        // pages at a time, so aligning them would only fragment the VMAR.
+        zx_status_t status = ZX_ERR_NO_MEMORY;
+        const size_t large_page_size = aspace_->arch_aspace().LargePageSize();
+        if (vmo && large_page_size != 0 && size >= large_page_size &&
+            (vmo_offset & (large_page_size - 1)) == 0 &&
+            (!vmo->is_paged() ||
+             vmo->AllocatedPagesInRange(vmo_offset, size) * PAGE_SIZE >= large_page_size)) {
+            const uint8_t large_align_pow2 =
+                static_cast<uint8_t>(log2_ulong_floor(large_page_size));
+            if (large_align_pow2 > align_pow2) {
+                status = AllocSpotLocked(size, large_align_pow2, arch_mmu_flags, &new_base);
+            }
+        }
+        if (status != ZX_OK) {
+            status = AllocSpotLocked(size, align_pow2, arch_mmu_flags, &new_base);
+        }
         if (status != ZX_OK) {
             return status;
         }
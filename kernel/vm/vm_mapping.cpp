@@ -9,10 +9,12 @@
 #include "vm_priv.h"
 #include <assert.h>
 #include <err.h>
+#include <fbl/algorithm.h>
 #include <fbl/alloc_checker.h>
 #include <fbl/auto_call.h>
 #include <fbl/auto_lock.h>
 #include <inttypes.h>
+#include <lib/counters.h>
 #include <safeint/safe_math.h>
 #include <trace.h>
 #include <vm/fault.h>
@@ -25,6 +27,15 @@ using fbl::AutoLock;
 
 #define LOCAL_TRACE MAX(VM_GLOBAL_TRACE, 0)
 
+// Size of the window of neighbouring pages considered on each page fault.
+static const size_t kFaultAroundPages = 16;
+
+// Number of already resident pages mapped alongside a faulting page, each
+// one a page fault that will not happen.
+KCOUNTER(vm_fault_around_pages, "kernel.vm.fault.around_pages");
+// Number of pages faulted in ahead of a sequential page fault.
+KCOUNTER(vm_fault_read_ahead_pages, "kernel.vm.fault.read_ahead_pages");
+
 VmMapping::VmMapping(VmAddressRegion& parent, vaddr_t base, size_t size, uint32_t vmar_flags,
                      fbl::RefPtr<VmObject> vmo, uint64_t vmo_offset, uint arch_mmu_flags)
     : VmAddressRegionOrMapping(base, size, vmar_flags,
@@ -397,16 +408,31 @@ public:
     // no longer valid.
     zx_status_t Append(vaddr_t vaddr, paddr_t paddr) {
         DEBUG_ASSERT(!aborted_);
-        // If this isn't the expected vaddr, flush the run we have first.
-        if (count_ >= fbl::count_of(phys_) || vaddr != base_ + count_ * PAGE_SIZE) {
-            zx_status_t status = Flush();
-            if (status != ZX_OK) {
-                return status;
+        if (count_ != 0 && vaddr == base_ + count_ * PAGE_SIZE) {
+            // While the run stays physically contiguous, keep growing it past
+            // the size of |phys_| so that it can be mapped with large pages.
+            if (contiguous_ && paddr == phys_[0] + count_ * PAGE_SIZE) {
+                if (count_ < fbl::count_of(phys_)) {
+                    phys_[count_] = paddr;
+                }
+                ++count_;
+                return ZX_OK;
+            }
+            if (count_ < fbl::count_of(phys_)) {
+                contiguous_ = false;
+                phys_[count_] = paddr;
+                ++count_;
+                return ZX_OK;
             }
-            base_ = vaddr;
         }
-        phys_[count_] = paddr;
-        ++count_;
+        // This page can't extend the current run, so flush it and start anew.
+        zx_status_t status = Flush();
+        if (status != ZX_OK) {
+            return status;
+        }
+        base_ = vaddr;
+        phys_[0] = paddr;
+        count_ = 1;
         return ZX_OK;
     }
 
@@ -426,11 +452,19 @@ private:
     vaddr_t base_;
     paddr_t phys_[16];
     size_t count_;
+    // Whether the current run may be passed to MapContiguous().  Only runs
+    // that fit in |phys_| are allowed to become discontiguous.
+    bool contiguous_;
+    // Whether the arch layer can map and later split large pages for us.
+    const bool large_pages_;
     bool aborted_;
 };
 
 VmMappingCoalescer::VmMappingCoalescer(VmMapping* mapping, vaddr_t base)
-    : mapping_(mapping), base_(base), count_(0), aborted_(false) { }
+    : mapping_(mapping), base_(base), count_(0),
+      large_pages_(mapping->aspace()->arch_aspace().LargePageSize() != 0), aborted_(false) {
+    contiguous_ = large_pages_;
+}
 
 VmMappingCoalescer::~VmMappingCoalescer() {
     // Make sure we've flushed or aborted
@@ -444,9 +478,14 @@ zx_status_t VmMappingCoalescer::Flush() {
 
     uint flags = mapping_->arch_mmu_flags();
     if (flags & ARCH_MMU_FLAG_PERM_RWX_MASK) {
+        ArchVmAspace& arch_aspace = mapping_->aspace()->arch_aspace();
         size_t mapped;
-        zx_status_t ret = mapping_->aspace()->arch_aspace().Map(base_, phys_, count_, flags,
-                                                                &mapped);
+        zx_status_t ret;
+        if (contiguous_ && count_ > 1) {
+            ret = arch_aspace.MapContiguous(base_, phys_[0], count_, flags, &mapped);
+        } else {
+            ret = arch_aspace.Map(base_, phys_, count_, flags, &mapped);
+        }
         if (ret != ZX_OK) {
             TRACEF("error %d mapping %zu pages starting at va %#" PRIxPTR "\n", ret, count_, base_);
             aborted_ = true;
@@ -456,6 +495,7 @@ zx_status_t VmMappingCoalescer::Flush() {
     }
     base_ += count_ * PAGE_SIZE;
     count_ = 0;
+    contiguous_ = large_pages_;
     return ZX_OK;
 }
 
@@ -545,6 +585,31 @@ zx_status_t VmMapping::DecommitRange(size_t offset, size_t len,
     return object_->DecommitRange(object_offset_ + offset, len, decommitted);
 }
 
+zx_status_t VmMapping::ReplacePages(size_t offset, vm_page_t* const* pages, size_t count,
+                                    size_t* replaced) {
+    canary_.Assert();
+    LTRACEF("%p [%#zx+%#zx], offset %#zx, count %zu\n",
+            this, base_, size_, offset, count);
+
+    *replaced = 0;
+
+    AutoLock guard(aspace_->lock());
+    if (state_ != LifeCycleState::ALIVE) {
+        return ZX_ERR_BAD_STATE;
+    }
+    const size_t len = count * PAGE_SIZE;
+    if (!IS_PAGE_ALIGNED(offset) || offset + len < offset || offset + len > size_) {
+        return ZX_ERR_OUT_OF_RANGE;
+    }
+    // Replacing pages is a write through this mapping.
+    if (!(arch_mmu_flags_ & ARCH_MMU_FLAG_PERM_WRITE)) {
+        return ZX_ERR_ACCESS_DENIED;
+    }
+    // VmObject::ReplacePages will typically call back into our instance's
+    // VmMapping::UnmapVmoRangeLocked.
+    return object_->ReplacePages(object_offset_ + offset, pages, count, replaced);
+}
+
 zx_status_t VmMapping::DestroyLocked() {
     canary_.Assert();
     DEBUG_ASSERT(is_mutex_held(aspace_->lock()));
@@ -719,13 +784,7 @@ zx_status_t VmMapping::PageFault(vaddr_t va, const uint pf_flags) {
         // assert that we're not accidentally mapping the zero page writable
         DEBUG_ASSERT((new_pa != vm_get_zero_page_paddr()) || !(mmu_flags & ARCH_MMU_FLAG_PERM_WRITE));
 
-        size_t mapped;
-        status = aspace_->arch_aspace().MapContiguous(va, new_pa, 1, mmu_flags, &mapped);
-        if (status < 0) {
-            TRACEF("failed to map page\n");
-            return ZX_ERR_NO_MEMORY;
-        }
-        DEBUG_ASSERT(mapped == 1);
+        return FaultAroundLocked(va, vmo_offset, pf_flags, new_pa, mmu_flags);
     }
 
 // TODO: figure out what to do with this
@@ -739,6 +798,123 @@ zx_status_t VmMapping::PageFault(vaddr_t va, const uint pf_flags) {
     return ZX_OK;
 }
 
+zx_status_t VmMapping::FaultAroundLocked(vaddr_t va, uint64_t vmo_offset, uint pf_flags,
+                                         paddr_t pa, uint mmu_flags) TA_NO_THREAD_SAFETY_ANALYSIS {
+    DEBUG_ASSERT(object_->lock()->IsHeld());
+
+    // Pick the window of pages to look at. Sequential access reads ahead of
+    // the fault, faulting pages in as needed. Otherwise look at an aligned
+    // window around the fault and only take pages that are already resident.
+    VmObject::AccessHint hint = object_->access_hint_locked();
+    bool read_ahead = (hint == VmObject::AccessHint::SEQUENTIAL) ||
+                      (hint == VmObject::AccessHint::DEFAULT && vmo_offset == next_fault_offset_);
+    vaddr_t start = va;
+    vaddr_t end = va + PAGE_SIZE;
+    if (hint != VmObject::AccessHint::RANDOM) {
+        const size_t window = kFaultAroundPages * PAGE_SIZE;
+        if (!read_ahead)
+            start = fbl::max(base_, ROUNDDOWN(va, window));
+        end = (base_ + size_ - start > window) ? start + window : base_ + size_;
+    }
+    DEBUG_ASSERT(start <= va && va < end);
+
+    // Neighbours only looked up (not faulted in) may belong to a parent of a
+    // copy-on-write clone, so they must not be writable.
+    const uint neighbour_flags = (read_ahead || !object_->is_cow_clone_locked())
+                                     ? mmu_flags
+                                     : (mmu_flags & ~ARCH_MMU_FLAG_PERM_WRITE);
+    const uint neighbour_pf_flags = read_ahead ? pf_flags : 0;
+
+    // Map runs of consecutive pages that are not yet mapped and that we have
+    // a page for, one Map() call per run.
+    paddr_t run_pa[kFaultAroundPages];
+    size_t run_len = 0;
+    vaddr_t run_va = 0;
+    uint run_flags = 0;
+    vaddr_t last_mapped = 0;
+
+    auto flush_run = [&]() -> zx_status_t {
+        if (run_len == 0)
+            return ZX_OK;
+        size_t mapped;
+        zx_status_t status = aspace_->arch_aspace().Map(run_va, run_pa, run_len, run_flags,
+                                                        &mapped);
+        if (status < 0) {
+            TRACEF("failed to map page\n");
+            return ZX_ERR_NO_MEMORY;
+        }
+        DEBUG_ASSERT(mapped == run_len);
+#if ARCH_ARM64
+        if (!(pf_flags & VMM_PF_FLAG_GUEST) && (arch_mmu_flags_ & ARCH_MMU_FLAG_PERM_EXECUTE)) {
+            arch_sync_cache_range(run_va, run_len * PAGE_SIZE);
+        }
+#endif
+        last_mapped = run_va + (run_len - 1) * PAGE_SIZE;
+        run_len = 0;
+        return ZX_OK;
+    };
+
+    size_t around = 0;
+    size_t ahead = 0;
+    for (vaddr_t addr = start; addr < end; addr += PAGE_SIZE) {
+        paddr_t page_pa;
+        uint page_flags;
+        if (addr == va) {
+            page_pa = pa;
+            page_flags = mmu_flags;
+        } else {
+            paddr_t mapped_pa;
+            uint mapped_flags;
+            zx_status_t status = ZX_ERR_NOT_FOUND;
+            if (aspace_->arch_aspace().Query(addr, &mapped_pa, &mapped_flags) < 0) {
+                // not mapped yet, see if the object has something for it
+                vm_page_t* page;
+                status = object_->GetPageLocked(addr - base_ + object_offset_,
+                                                neighbour_pf_flags, nullptr, &page, &page_pa);
+            }
+            if (status != ZX_OK) {
+                // ahead of a sequential fault there is no point in skipping holes
+                if (read_ahead && addr > va)
+                    break;
+                zx_status_t map_status = flush_run();
+                if (map_status != ZX_OK)
+                    return map_status;
+                continue;
+            }
+            page_flags = neighbour_flags;
+            if (page_pa == vm_get_zero_page_paddr())
+                page_flags &= ~ARCH_MMU_FLAG_PERM_WRITE;
+            if (read_ahead)
+                ahead++;
+            else
+                around++;
+        }
+
+        if (run_len > 0 && page_flags != run_flags) {
+            zx_status_t map_status = flush_run();
+            if (map_status != ZX_OK)
+                return map_status;
+        }
+        if (run_len == 0) {
+            run_va = addr;
+            run_flags = page_flags;
+        }
+        run_pa[run_len++] = page_pa;
+    }
+    zx_status_t status = flush_run();
+    if (status != ZX_OK)
+        return status;
+
+    kcounter_add(vm_fault_around_pages, around);
+    kcounter_add(vm_fault_read_ahead_pages, ahead);
+
+    // the next fault is sequential if it lands right after what we just mapped
+    DEBUG_ASSERT(last_mapped >= va);
+    next_fault_offset_ = last_mapped + PAGE_SIZE - base_ + object_offset_;
+
+    return ZX_OK;
+}
+
 // We disable thread safety analysis here because one of the common uses of this
 // function is for splitting one mapping object into several that will be backed
 // by the same VmObject.  In that case, object_->lock() gets aliased across all
@@ -116,6 +116,12 @@ bool VmObject::is_cow_clone() const {
     return parent_ != nullptr;
 }
 
+void VmObject::SetAccessHint(AccessHint hint) {
+    canary_.Assert();
+    AutoLock a(&lock_);
+    access_hint_ = hint;
+}
+
 void VmObject::AddMappingLocked(VmMapping* r) {
     canary_.Assert();
     DEBUG_ASSERT(lock_.IsHeld());
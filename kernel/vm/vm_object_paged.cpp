@@ -370,7 +370,7 @@ zx_status_t VmObjectPaged::GetPageLocked(uint64_t offset, uint pf_flags, list_no
         return ZX_OK;
     }
 
-    // allocate a page
+    // allocate a zeroed page; pages on |free_list| were allocated zeroed by the caller
     if (free_list) {
         p = list_remove_head_type(free_list, vm_page_t, free.node);
         if (p) {
@@ -378,7 +378,7 @@ zx_status_t VmObjectPaged::GetPageLocked(uint64_t offset, uint pf_flags, list_no
         }
     }
     if (!p) {
-        p = pmm_alloc_page(pmm_alloc_flags_, &pa);
+        p = pmm_alloc_page(pmm_alloc_flags_ | PMM_ALLOC_FLAG_ZERO, &pa);
     }
     if (!p) {
         return ZX_ERR_NO_MEMORY;
@@ -386,9 +386,6 @@ zx_status_t VmObjectPaged::GetPageLocked(uint64_t offset, uint pf_flags, list_no
 
     InitializeVmPage(p);
 
-    // TODO: remove once pmm returns zeroed pages
-    ZeroPage(pa);
-
     zx_status_t status = AddPageLocked(p, offset);
     DEBUG_ASSERT(status == ZX_OK);
 
@@ -451,7 +448,7 @@ zx_status_t VmObjectPaged::CommitRange(uint64_t offset, uint64_t len, uint64_t*
     list_node page_list;
     list_initialize(&page_list);
 
-    size_t allocated = pmm_alloc_pages(count, pmm_alloc_flags_, &page_list);
+    size_t allocated = pmm_alloc_pages(count, pmm_alloc_flags_ | PMM_ALLOC_FLAG_ZERO, &page_list);
     if (allocated < count) {
         LTRACEF("failed to allocate enough pages (asked for %zu, got %zu)\n", count, allocated);
         pmm_free(&page_list);
@@ -623,6 +620,43 @@ zx_status_t VmObjectPaged::DecommitRange(uint64_t offset, uint64_t len, uint64_t
     return ZX_OK;
 }
 
+zx_status_t VmObjectPaged::ReplacePages(uint64_t offset, vm_page_t* const* pages, size_t count,
+                                        size_t* replaced) {
+    canary_.Assert();
+    LTRACEF("offset %#" PRIx64 ", count %zu\n", offset, count);
+
+    *replaced = 0;
+
+    AutoLock a(&lock_);
+
+    const uint64_t len = count * PAGE_SIZE;
+    if (!IS_PAGE_ALIGNED(offset) || !InRange(offset, len, size_)) {
+        return ZX_ERR_OUT_OF_RANGE;
+    }
+    if (AnyPagesPinnedLocked(offset, len)) {
+        return ZX_ERR_BAD_STATE;
+    }
+
+    // unmap the old pages from all the mapping regions before they are freed; faults on the
+    // range wait on our lock and will find the new pages
+    RangeChangeUpdateLocked(offset, len);
+
+    for (size_t i = 0; i < count; i++) {
+        const uint64_t o = offset + i * PAGE_SIZE;
+        page_list_.FreePage(o);
+
+        zx_status_t status = page_list_.AddPage(pages[i], o);
+        if (status != ZX_OK) {
+            return status;
+        }
+        pages[i]->state = VM_PAGE_STATE_ALLOC;
+        InitializeVmPage(pages[i]);
+        ++*replaced;
+    }
+
+    return ZX_OK;
+}
+
 zx_status_t VmObjectPaged::Pin(uint64_t offset, uint64_t len) {
     canary_.Assert();
 
@@ -6,9 +6,15 @@
 
 #include <assert.h>
 #include <err.h>
+#include <fbl/algorithm.h>
 #include <fbl/alloc_checker.h>
 #include <fbl/array.h>
+#include <kernel/event.h>
+#include <pow2.h>
 #include <unittest.h>
+#include <string.h>
+#include <vm/physmap.h>
+#include <vm/pmm.h>
 #include <vm/vm.h>
 #include <vm/vm_address_region.h>
 #include <vm/vm_aspace.h>
@@ -72,6 +78,134 @@ static bool pmm_oversized_alloc_test(void* context) {
     END_TEST;
 }
 
+// Allocates and frees enough single pages to cycle through the per-cpu page
+// caches several times, checking that no page is handed out twice.
+static bool pmm_single_page_churn_test(void* context) {
+    BEGIN_TEST;
+    list_node list = LIST_INITIAL_VALUE(list);
+
+    static const size_t alloc_count = 1024;
+
+    for (size_t pass = 0; pass < 4; pass++) {
+        for (size_t i = 0; i < alloc_count; i++) {
+            vm_page_t* page = pmm_alloc_page(0, nullptr);
+            REQUIRE_NONNULL(page, "pmm_alloc_page");
+            EXPECT_EQ(VM_PAGE_STATE_ALLOC, page->state, "page state after alloc");
+            EXPECT_FALSE(list_in_list(&page->free.node), "page handed out twice");
+            list_add_tail(&list, &page->free.node);
+        }
+        EXPECT_EQ(alloc_count, list_length(&list), "single page allocations");
+
+        auto ret = pmm_free(&list);
+        EXPECT_EQ(alloc_count, ret, "pmm_free on a list of single pages");
+    }
+    END_TEST;
+}
+
+static bool page_is_zero(vm_page_t* page) {
+    const uint64_t* ptr =
+        static_cast<const uint64_t*>(paddr_to_physmap(vm_page_to_paddr(page)));
+    for (size_t i = 0; i < PAGE_SIZE / sizeof(uint64_t); i++) {
+        if (ptr[i] != 0)
+            return false;
+    }
+    return true;
+}
+
+// Dirties and frees a batch of pages, then checks that single and multiple
+// page allocations asking for zeroed pages get them, from the pool or not.
+static bool pmm_alloc_zeroed_test(void* context) {
+    BEGIN_TEST;
+    list_node list = LIST_INITIAL_VALUE(list);
+
+    static const size_t alloc_count = 256;
+
+    REQUIRE_EQ(alloc_count, pmm_alloc_pages(alloc_count, PMM_ALLOC_FLAG_KMAP, &list),
+               "pmm_alloc_pages");
+    vm_page_t* page;
+    list_for_every_entry (&list, page, vm_page_t, free.node) {
+        memset(paddr_to_physmap(vm_page_to_paddr(page)), 0xa5, PAGE_SIZE);
+    }
+    EXPECT_EQ(alloc_count, pmm_free(&list), "pmm_free dirty pages");
+
+    for (size_t i = 0; i < alloc_count; i++) {
+        page = pmm_alloc_page(PMM_ALLOC_FLAG_ZERO, nullptr);
+        REQUIRE_NONNULL(page, "pmm_alloc_page zeroed");
+        EXPECT_TRUE(page_is_zero(page), "single zeroed page");
+        list_add_tail(&list, &page->free.node);
+    }
+    EXPECT_EQ(alloc_count, pmm_free(&list), "pmm_free zeroed pages");
+
+    REQUIRE_EQ(alloc_count, pmm_alloc_pages(alloc_count, PMM_ALLOC_FLAG_ZERO, &list),
+               "pmm_alloc_pages zeroed");
+    list_for_every_entry (&list, page, vm_page_t, free.node) {
+        EXPECT_EQ(VM_PAGE_STATE_ALLOC, page->state, "page state after alloc");
+        EXPECT_TRUE(page_is_zero(page), "zeroed page in list");
+    }
+    EXPECT_EQ(alloc_count, pmm_free(&list), "pmm_free zeroed pages");
+
+    END_TEST;
+}
+
+// Registers a low watermark just below the current free page count, allocates
+// past it and checks that the event was signaled.
+static bool pmm_low_watermark_test(void* context) {
+    BEGIN_TEST;
+    list_node list = LIST_INITIAL_VALUE(list);
+
+    static const size_t alloc_count = 256;
+
+    size_t free_pages = pmm_count_free_pages();
+    REQUIRE_GT(free_pages, 2 * alloc_count, "free pages");
+
+    event_t event;
+    event_init(&event, false, 0);
+    REQUIRE_EQ(ZX_OK, pmm_add_low_watermark(free_pages - alloc_count / 2, &event),
+               "pmm_add_low_watermark");
+
+    EXPECT_EQ(alloc_count, pmm_alloc_pages(alloc_count, 0, &list), "pmm_alloc_pages");
+    // The watermark is checked as part of the allocation, so there is no need
+    // to wait.
+    EXPECT_EQ(ZX_OK, event_wait_deadline(&event, current_time(), false),
+              "low watermark event signaled");
+
+    EXPECT_EQ(alloc_count, pmm_free(&list), "pmm_free");
+    pmm_remove_low_watermark(&event);
+    event_destroy(&event);
+
+    END_TEST;
+}
+
+// Allocates odd sized, aligned runs of pages and checks that they come back
+// aligned and physically contiguous.
+static bool pmm_alloc_contiguous_aligned_test(void* context) {
+    BEGIN_TEST;
+
+    static const size_t counts[] = {2, 3, 5, 17, 100};
+    static const uint8_t alignments[] = {PAGE_SIZE_SHIFT, 16, 21};
+
+    for (size_t count : counts) {
+        for (uint8_t alignment_log2 : alignments) {
+            list_node list = LIST_INITIAL_VALUE(list);
+            paddr_t pa = 0;
+
+            auto ret = pmm_alloc_contiguous(count, 0, alignment_log2, &pa, &list);
+            REQUIRE_EQ(count, ret, "pmm_alloc_contiguous count");
+            EXPECT_EQ(0u, pa & ((1UL << alignment_log2) - 1), "pmm_alloc_contiguous alignment");
+
+            paddr_t expected = pa;
+            vm_page_t* page;
+            list_for_every_entry (&list, page, vm_page_t, free.node) {
+                EXPECT_EQ(expected, vm_page_to_paddr(page), "pmm_alloc_contiguous run");
+                expected += PAGE_SIZE;
+            }
+
+            EXPECT_EQ(count, pmm_free(&list), "pmm_free on a contiguous run");
+        }
+    }
+    END_TEST;
+}
+
 static uint32_t test_rand(uint32_t seed) {
     return (seed = seed * 1664525 + 1013904223);
 }
@@ -513,6 +647,81 @@ static bool vmo_precommitted_map_test(void* context) {
     END_TEST;
 }
 
+// Maps a physically contiguous VMO that can be covered by large pages, then
+// punches a hole in it to make sure the large pages get split.
+static bool vmo_large_page_map_test(void* context) {
+    BEGIN_TEST;
+    auto ka = VmAspace::kernel_aspace();
+    const size_t large_page_size = ka->arch_aspace().LargePageSize();
+    const size_t alloc_size = fbl::max(large_page_size * 2, PAGE_SIZE * 16ul);
+    const uint8_t align_pow2 =
+        large_page_size ? static_cast<uint8_t>(log2_ulong_floor(large_page_size)) : 0;
+
+    fbl::RefPtr<VmObject> vmo;
+    zx_status_t status = VmObjectPaged::Create(PMM_ALLOC_FLAG_ANY, alloc_size, &vmo);
+    REQUIRE_EQ(status, ZX_OK, "vmobject creation\n");
+    REQUIRE_TRUE(vmo, "vmobject creation\n");
+
+    uint64_t committed;
+    status = vmo->CommitRangeContiguous(0, alloc_size, &committed, align_pow2);
+    REQUIRE_EQ(ZX_OK, status, "committing object\n");
+    REQUIRE_EQ(alloc_size, committed, "committing object\n");
+
+    void* ptr;
+    auto ret = ka->MapObjectInternal(vmo, "test", 0, alloc_size, &ptr,
+                                     0, VmAspace::VMM_FLAG_COMMIT, kArchRwFlags);
+    REQUIRE_EQ(ZX_OK, ret, "mapping object");
+    const vaddr_t base = reinterpret_cast<vaddr_t>(ptr);
+    if (large_page_size) {
+        EXPECT_EQ(0u, base & (large_page_size - 1), "mapping is large page aligned\n");
+    }
+
+    // fill with known pattern and test
+    if (!fill_and_test(ptr, alloc_size))
+        all_ok = false;
+
+    paddr_t base_pa;
+    status = ka->arch_aspace().Query(base, &base_pa, nullptr);
+    EXPECT_EQ(ZX_OK, status, "query\n");
+
+    // Every large page sized chunk of the range should be a single entry.
+    size_t page_size;
+    for (size_t off = 0; large_page_size && off < alloc_size; off += large_page_size) {
+        status = ka->arch_aspace().QueryPageSize(base + off, &page_size);
+        EXPECT_EQ(ZX_OK, status, "query page size\n");
+        EXPECT_EQ(large_page_size, page_size, "mapped with a large page\n");
+    }
+
+    // Unmap a single page from the middle of the range; its neighbours must
+    // stay mapped to the same physical pages.
+    const size_t hole = alloc_size / 2 + PAGE_SIZE;
+    status = ka->RootVmar()->Unmap(base + hole, PAGE_SIZE);
+    EXPECT_EQ(ZX_OK, status, "unmapping hole\n");
+    for (size_t off = 0; off < alloc_size; off += PAGE_SIZE) {
+        paddr_t pa;
+        status = ka->arch_aspace().Query(base + off, &pa, nullptr);
+        if (off == hole) {
+            EXPECT_EQ(ZX_ERR_NOT_FOUND, status, "hole is unmapped\n");
+        } else {
+            EXPECT_EQ(ZX_OK, status, "page is still mapped\n");
+            EXPECT_EQ(base_pa + off, pa, "page is still mapped\n");
+        }
+    }
+    if (large_page_size) {
+        // Only the large page around the hole is split.
+        status = ka->arch_aspace().QueryPageSize(base + hole - PAGE_SIZE, &page_size);
+        EXPECT_EQ(ZX_OK, status, "query page size\n");
+        EXPECT_EQ(PAGE_SIZE, page_size, "large page was split\n");
+        status = ka->arch_aspace().QueryPageSize(base, &page_size);
+        EXPECT_EQ(ZX_OK, status, "query page size\n");
+        EXPECT_EQ(large_page_size, page_size, "other large page was left alone\n");
+    }
+
+    status = ka->RootVmar()->Unmap(base, alloc_size);
+    EXPECT_EQ(ZX_OK, status, "unmapping object");
+    END_TEST;
+}
+
 // Creates a vm object, maps it, demand paged.
 static bool vmo_demand_paged_map_test(void* context) {
     BEGIN_TEST;
@@ -537,6 +746,62 @@ static bool vmo_demand_paged_map_test(void* context) {
     END_TEST;
 }
 
+// Commits a vm object, maps it on demand and touches a single page. That one
+// fault must also map the resident pages in the aligned window around it,
+// unless the object asks for random access.
+static bool vmo_fault_around_test(void* context) {
+    BEGIN_TEST;
+    // kFaultAroundPages in vm_mapping.cpp
+    static const size_t window = PAGE_SIZE * 16;
+    static const size_t alloc_size = window * 2;
+    static const VmObject::AccessHint hints[] = {
+        VmObject::AccessHint::DEFAULT,
+        VmObject::AccessHint::RANDOM,
+    };
+
+    auto ka = VmAspace::kernel_aspace();
+    for (auto hint : hints) {
+        fbl::RefPtr<VmObject> vmo;
+        zx_status_t status = VmObjectPaged::Create(PMM_ALLOC_FLAG_ANY, alloc_size, &vmo);
+        REQUIRE_EQ(status, ZX_OK, "vmobject creation\n");
+        REQUIRE_TRUE(vmo, "vmobject creation\n");
+
+        uint64_t committed;
+        status = vmo->CommitRange(0, alloc_size, &committed);
+        REQUIRE_EQ(ZX_OK, status, "committing object\n");
+        REQUIRE_EQ(alloc_size, committed, "committing object\n");
+        vmo->SetAccessHint(hint);
+
+        void* ptr;
+        auto ret = ka->MapObjectInternal(vmo, "test", 0, alloc_size, &ptr,
+                                         0, 0, kArchRwFlags);
+        REQUIRE_EQ(ZX_OK, ret, "mapping object");
+        const vaddr_t base = reinterpret_cast<vaddr_t>(ptr);
+
+        const vaddr_t va = base + window + 3 * PAGE_SIZE;
+        __UNUSED uint8_t val = *reinterpret_cast<volatile uint8_t*>(va);
+
+        vaddr_t start = va;
+        vaddr_t end = va + PAGE_SIZE;
+        if (hint != VmObject::AccessHint::RANDOM) {
+            start = fbl::max(base, ROUNDDOWN(va, window));
+            end = fbl::min(start + window, base + alloc_size);
+        }
+        for (vaddr_t addr = base; addr < base + alloc_size; addr += PAGE_SIZE) {
+            status = ka->arch_aspace().Query(addr, nullptr, nullptr);
+            if (addr >= start && addr < end) {
+                EXPECT_EQ(ZX_OK, status, "mapped by the fault\n");
+            } else {
+                EXPECT_EQ(ZX_ERR_NOT_FOUND, status, "outside the window\n");
+            }
+        }
+
+        auto err = ka->FreeRegion(base);
+        EXPECT_EQ(ZX_OK, err, "unmapping object");
+    }
+    END_TEST;
+}
+
 // Creates a vm object, maps it, drops ref before unmapping.
 static bool vmo_dropped_ref_test(void* context) {
     BEGIN_TEST;
@@ -971,6 +1236,10 @@ UNITTEST_START_TESTCASE(vm_tests)
 VM_UNITTEST(pmm_smoke_test)
 VM_UNITTEST(pmm_large_alloc_test)
 VM_UNITTEST(pmm_oversized_alloc_test)
+VM_UNITTEST(pmm_single_page_churn_test)
+VM_UNITTEST(pmm_alloc_contiguous_aligned_test)
+VM_UNITTEST(pmm_low_watermark_test)
+VM_UNITTEST(pmm_alloc_zeroed_test)
 VM_UNITTEST(vmm_alloc_smoke_test)
 VM_UNITTEST(vmm_alloc_contiguous_smoke_test)
 VM_UNITTEST(multiple_regions_test)
@@ -987,7 +1256,9 @@ VM_UNITTEST(vmo_commit_test)
 VM_UNITTEST(vmo_odd_size_commit_test)
 VM_UNITTEST(vmo_contiguous_commit_test)
 VM_UNITTEST(vmo_precommitted_map_test)
+VM_UNITTEST(vmo_large_page_map_test)
 VM_UNITTEST(vmo_demand_paged_map_test)
+VM_UNITTEST(vmo_fault_around_test)
 VM_UNITTEST(vmo_dropped_ref_test)
 VM_UNITTEST(vmo_remap_test)
 VM_UNITTEST(vmo_double_remap_test)
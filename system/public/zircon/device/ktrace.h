@@ -32,10 +32,16 @@ IOCTL_WRAPPER_OUT(ioctl_ktrace_get_handle, IOCTL_KTRACE_GET_HANDLE, zx_handle_t)
 #define IOCTL_KTRACE_STOP \
     IOCTL(IOCTL_KIND_DEFAULT, IOCTL_FAMILY_KTRACE, 4)
 
+// Start tracing, overwriting the oldest records once the buffer is full.
+// input: The group_mask
+#define IOCTL_KTRACE_START_CIRCULAR \
+    IOCTL(IOCTL_KIND_DEFAULT, IOCTL_FAMILY_KTRACE, 5)
+
 static inline zx_status_t ioctl_ktrace_add_probe(int fd, const char* name, uint32_t* probe_id) {
     return fdio_ioctl(fd, IOCTL_KTRACE_ADD_PROBE,
                       name, strlen(name), probe_id, sizeof(uint32_t));
 }
 
 IOCTL_WRAPPER_IN(ioctl_ktrace_start, IOCTL_KTRACE_START, uint32_t);
+IOCTL_WRAPPER_IN(ioctl_ktrace_start_circular, IOCTL_KTRACE_START_CIRCULAR, uint32_t);
 IOCTL_WRAPPER(ioctl_ktrace_stop, IOCTL_KTRACE_STOP);
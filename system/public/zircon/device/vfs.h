@@ -88,6 +88,21 @@
 #define IOCTL_VFS_GET_DEVICE_PATH \
     IOCTL(IOCTL_KIND_DEFAULT, IOCTL_FAMILY_VFS, 9)
 
+// Query the statistics of the cache of closed blobs kept in memory.
+// out: vfs_blob_cache_info_t
+//
+// This ioctl is currently only supported by Blobstore.
+#define IOCTL_VFS_GET_BLOB_CACHE_INFO \
+    IOCTL(IOCTL_KIND_DEFAULT, IOCTL_FAMILY_VFS, 10)
+
+// Set the number of bytes of closed blobs which may be kept in memory,
+// evicting the least recently used blobs until the cache fits.
+// in: uint64_t
+//
+// This ioctl is currently only supported by Blobstore.
+#define IOCTL_VFS_SET_BLOB_CACHE_BUDGET \
+    IOCTL(IOCTL_KIND_DEFAULT, IOCTL_FAMILY_VFS, 11)
+
 typedef struct {
     zx_handle_t channel; // Channel to which watch events will be sent
     uint32_t mask;       // Bitmask of desired events (1 << WATCH_EVT_*)
@@ -173,6 +188,22 @@ IOCTL_WRAPPER_IN(ioctl_vfs_watch_dir, IOCTL_VFS_WATCH_DIR, vfs_watch_dir_t);
 // ssize_t ioctl_vfs_get_device_path(int fd, char* out, size_t out_len);
 IOCTL_WRAPPER_VAROUT(ioctl_vfs_get_device_path, IOCTL_VFS_GET_DEVICE_PATH, char);
 
+typedef struct vfs_blob_cache_info {
+    uint64_t budget_bytes;   // Most bytes of closed blobs kept in memory.
+    uint64_t resident_bytes; // Memory committed to the closed blobs kept in memory.
+    uint64_t blob_count;     // Number of closed blobs currently kept in memory.
+    uint64_t hits;           // Closed blobs reopened while still kept in memory.
+    uint64_t misses;         // Closed blobs reopened after leaving memory.
+    uint64_t evictions;      // Closed blobs dropped to stay within the budget.
+} vfs_blob_cache_info_t;
+
+// ssize_t ioctl_vfs_get_blob_cache_info(int fd, vfs_blob_cache_info_t* out);
+IOCTL_WRAPPER_OUT(ioctl_vfs_get_blob_cache_info, IOCTL_VFS_GET_BLOB_CACHE_INFO,
+                  vfs_blob_cache_info_t);
+
+// ssize_t ioctl_vfs_set_blob_cache_budget(int fd, const uint64_t* in);
+IOCTL_WRAPPER_IN(ioctl_vfs_set_blob_cache_budget, IOCTL_VFS_SET_BLOB_CACHE_BUDGET, uint64_t);
+
 typedef struct {
     zx_handle_t vmo;
     char name[]; // Null-terminator required
@@ -56,6 +56,8 @@ KTRACE_DEF(0x160,32B,KWAIT_BLOCK,SCHEDULER) // queue_hi, queue_hi
 KTRACE_DEF(0x161,32B,KWAIT_WAKE,SCHEDULER) // queue_hi, queue_hi, is_mutex
 KTRACE_DEF(0x162,32B,KWAIT_UNBLOCK,SCHEDULER) // queue_hi, queue_hi, blocked_status
 
+KTRACE_DEF(0x170,32B,SCHED_STEAL,SCHEDULER) // stolen-tid, (from-cpu<<16|to-cpu), priority, reason
+
 // events from 0x200-0x2ff are for arch-specific needs
 
 #ifdef __x86_64__
@@ -56,7 +56,8 @@
     (ZX_RIGHTS_BASIC | ZX_RIGHTS_IO | ZX_RIGHT_SIGNAL)
 
 #define ZX_DEFAULT_SOCKET_RIGHTS \
-    (ZX_RIGHTS_BASIC | ZX_RIGHTS_IO | ZX_RIGHT_SIGNAL | ZX_RIGHT_SIGNAL_PEER)
+    (ZX_RIGHTS_BASIC | ZX_RIGHTS_IO | ZX_RIGHTS_PROPERTY |\
+     ZX_RIGHT_SIGNAL | ZX_RIGHT_SIGNAL_PEER)
 
 #define ZX_DEFAULT_THREAD_RIGHTS \
     (ZX_RIGHTS_BASIC | ZX_RIGHTS_IO | ZX_RIGHTS_PROPERTY |\
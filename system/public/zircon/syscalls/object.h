@@ -377,6 +377,9 @@ typedef struct zx_info_resource {
 // Argument is an zx_job_importance_t value.
 #define ZX_PROP_JOB_IMPORTANCE             7u
 
+// Argument is a size_t: the most bytes a socket endpoint holds for reading.
+#define ZX_PROP_SOCKET_RX_BUF_MAX          8u
+
 // Describes how important a job is.
 typedef int32_t zx_job_importance_t;
 
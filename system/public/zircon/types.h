@@ -170,6 +170,16 @@ typedef struct {
     uint32_t rd_num_handles;
 } zx_channel_call_args_t;
 
+// Message descriptor for zx_channel_read_batch() and zx_channel_write_batch().
+// When reading, |num_bytes| and |num_handles| give the size of the buffers on
+// input and the size of the message read on output.
+typedef struct {
+    void* bytes;
+    zx_handle_t* handles;
+    uint32_t num_bytes;
+    uint32_t num_handles;
+} zx_channel_msg_t;
+
 // Maximum number of wait items allowed for zx_object_wait_many()
 // TODO(ZX-1349) Re-lower this.
 #define ZX_WAIT_MANY_MAX_ITEMS 16
@@ -225,6 +235,9 @@ typedef uint32_t zx_rights_t;
 #define ZX_VMO_OP_CACHE_INVALIDATE       7u
 #define ZX_VMO_OP_CACHE_CLEAN            8u
 #define ZX_VMO_OP_CACHE_CLEAN_INVALIDATE 9u
+#define ZX_VMO_OP_ACCESS_DEFAULT         10u
+#define ZX_VMO_OP_ACCESS_RANDOM          11u
+#define ZX_VMO_OP_ACCESS_SEQUENTIAL      12u
 
 // VM Object clone flags
 #define ZX_VMO_CLONE_COPY_ON_WRITE       1u
@@ -286,6 +299,7 @@ typedef uint64_t zx_off_t;
 
 #define ZX_CHANNEL_MAX_MSG_BYTES            65536u
 #define ZX_CHANNEL_MAX_MSG_HANDLES          64u
+#define ZX_CHANNEL_MAX_BATCH_MSGS           32u
 
 // Socket options and limits.
 // These options can be passed to zx_socket_write()
@@ -303,6 +317,18 @@ typedef uint64_t zx_off_t;
 // These can be passed to zx_socket_read() and zx_socket_write().
 #define ZX_SOCKET_CONTROL                   (1u << 2)
 
+// Maximum number of buffers passed to zx_socket_readv() or zx_socket_writev().
+#define ZX_SOCKET_MAX_IOVECS                16u
+
+// Maximum value of a socket's ZX_PROP_SOCKET_RX_BUF_MAX property.
+#define ZX_SOCKET_MAX_RX_BUF                (16u * 1024u * 1024u)
+
+// Buffer descriptor for zx_socket_readv() and zx_socket_writev().
+typedef struct {
+    void* buffer;
+    size_t size;
+} zx_iovec_t;
+
 // Flags which can be used to to control cache policy for APIs which map memory.
 typedef enum {
     ZX_CACHE_POLICY_CACHED          = 0,
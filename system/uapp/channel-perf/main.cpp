@@ -6,6 +6,7 @@
 #include <errno.h>
 #include <getopt.h>
 #include <inttypes.h>
+#include <limits.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -32,6 +33,7 @@ struct TestArgs {
     uint32_t size;
     uint32_t handles;
     uint32_t queue;
+    uint32_t batch;
 };
 
 void do_test(uint32_t duration, const TestArgs& test_args) {
@@ -48,45 +50,76 @@ void do_test(uint32_t duration, const TestArgs& test_args) {
     zx_handle_t event;
     assert(zx_event_create(0u, &event) == ZX_OK);
 
-    // Storage space for our messages' stuff.
-    fbl::unique_ptr<uint8_t[]> data;
+    // Storage space for our messages' stuff. The data buffer is page-aligned
+    // so that large messages can have their pages moved rather than copied
+    // on read.
+    uint8_t* data = nullptr;
     if (test_args.size) {
-        data.reset(new uint8_t[test_args.size]);
+        data = static_cast<uint8_t*>(
+            aligned_alloc(PAGE_SIZE, fbl::round_up(test_args.size, PAGE_SIZE)));
+        assert(data);
         for (uint32_t i = 0; i < test_args.size; i++)
             data[i] = static_cast<uint8_t>(i);
     }
+    // Each message of a batch gets its own handles.
+    const uint32_t batch = test_args.batch;
+    const uint32_t total_handles = test_args.handles * batch;
     fbl::unique_ptr<zx_handle_t[]> handles;
-    if (test_args.handles)
-        handles.reset(new zx_handle_t[test_args.handles]);
+    if (total_handles)
+        handles.reset(new zx_handle_t[total_handles]);
+
+    // Batches write from and read into the same data buffer.
+    fbl::unique_ptr<zx_channel_msg_t[]> msgs(new zx_channel_msg_t[batch]);
+    for (uint32_t i = 0; i < batch; i++) {
+        msgs[i].bytes = data;
+        msgs[i].handles = handles.get() + i * test_args.handles;
+    }
 
     // Pre-queue |test_args.queue| messages (there'll always be this many messages in the queue).
     for (uint32_t i = 0; i < test_args.queue; i++) {
         duplicate_handles(test_args.handles, event, handles.get());
-        status = zx_channel_write(mp[0], 0u, data.get(), test_args.size,
+        status = zx_channel_write(mp[0], 0u, data, test_args.size,
                                   handles.get(), test_args.handles);
         assert(status == ZX_OK);
     }
 
-    duplicate_handles(test_args.handles, event, handles.get());
+    duplicate_handles(total_handles, event, handles.get());
 
     static constexpr uint32_t big_it_size = 10000;
+    const uint32_t batches_per_big_it = big_it_size / batch;
     uint64_t big_its = 0;
     uint64_t start_ns = zx_clock_get(ZX_CLOCK_MONOTONIC);
     uint64_t end_ns;
     for (;;) {
         big_its++;
-        for (uint32_t i = 0; i < big_it_size; i++) {
-            status = zx_channel_write(mp[0], 0, data.get(), test_args.size,
-                                      handles.get(), test_args.handles);
-            assert(status == ZX_OK);
-
-            uint32_t r_size = test_args.size;
-            uint32_t r_handles = test_args.handles;
-            status = zx_channel_read(mp[1], 0u, data.get(), handles.get(), r_size,
-                                     r_handles, &r_size, &r_handles);
-            assert(status == ZX_OK);
-            assert(r_size == test_args.size);
-            assert(r_handles == test_args.handles);
+        if (batch > 1u) {
+            for (uint32_t i = 0; i < batches_per_big_it; i++) {
+                for (uint32_t j = 0; j < batch; j++) {
+                    msgs[j].num_bytes = test_args.size;
+                    msgs[j].num_handles = test_args.handles;
+                }
+                status = zx_channel_write_batch(mp[0], 0u, msgs.get(), batch);
+                assert(status == ZX_OK);
+
+                uint32_t r_msgs = 0;
+                status = zx_channel_read_batch(mp[1], 0u, msgs.get(), batch, &r_msgs);
+                assert(status == ZX_OK);
+                assert(r_msgs == batch);
+            }
+        } else {
+            for (uint32_t i = 0; i < big_it_size; i++) {
+                status = zx_channel_write(mp[0], 0, data, test_args.size,
+                                          handles.get(), test_args.handles);
+                assert(status == ZX_OK);
+
+                uint32_t r_size = test_args.size;
+                uint32_t r_handles = test_args.handles;
+                status = zx_channel_read(mp[1], 0u, data, handles.get(), r_size,
+                                         r_handles, &r_size, &r_handles);
+                assert(status == ZX_OK);
+                assert(r_size == test_args.size);
+                assert(r_handles == test_args.handles);
+            }
         }
 
         end_ns = zx_clock_get(ZX_CLOCK_MONOTONIC);
@@ -94,7 +127,7 @@ void do_test(uint32_t duration, const TestArgs& test_args) {
             break;
     }
 
-    for (uint32_t i = 0; i < test_args.handles; i++) {
+    for (uint32_t i = 0; i < total_handles; i++) {
         status = zx_handle_close(handles[i]);
         assert(status == ZX_OK);
     }
@@ -104,12 +137,16 @@ void do_test(uint32_t duration, const TestArgs& test_args) {
     assert(status == ZX_OK);
     status = zx_handle_close(mp[1]);
     assert(status == ZX_OK);
+    free(data);
 
     double real_duration = static_cast<double>(end_ns - start_ns) / 1000000000.0;
-    double its_per_second = static_cast<double>(big_its) * big_it_size / real_duration;
-    printf("write/read %" PRIu32 " bytes, %" PRIu32 " handles (%" PRIu32 " pre-queued): "
-               "%.0f iterations/second\n",
-           test_args.size, test_args.handles, test_args.queue, its_per_second);
+    double its_per_second =
+        static_cast<double>(big_its) * batches_per_big_it * batch / real_duration;
+    double mbytes_per_second = its_per_second * test_args.size / (1024.0 * 1024.0);
+    printf("write/read %" PRIu32 " bytes, %" PRIu32 " handles (%" PRIu32 " pre-queued, "
+               "batches of %" PRIu32 "): %.0f iterations/second, %.1f MiB/second\n",
+           test_args.size, test_args.handles, test_args.queue, batch, its_per_second,
+           mbytes_per_second);
 }
 
 }  // namespace
@@ -121,12 +158,13 @@ int main(int argc, char** argv) {
         "Options:\n"
         "  -h    show help (this)\n"
         "  -o    run single test (default)\n"
-        "  -s    run suite (ignores -S/-H/-Q)\n"
+        "  -s    run suite (ignores -S/-H/-Q/-B)\n"
         "  -n N  set test repetition count to N (default: 1)\n"
         "  -d N  set test duration to N seconds (default: 5)\n"
         "  -S N  set message size to N bytes (default: 10)\n"
         "  -H N  set message handle count to N handles (default: 0)\n"
-        "  -Q N  set message pre-queue count to N messages (default: 0)\n";
+        "  -Q N  set message pre-queue count to N messages (default: 0)\n"
+        "  -B N  write and read messages in batches of N (default: 1)\n";
 
     bool run_suite = false;  // -o/-s
     uint32_t duration = 5;   // -d
@@ -135,11 +173,12 @@ int main(int argc, char** argv) {
     TestArgs test_args = {
         10,                  // -S (size)
         0,                   // -H (handles)
-        0                    // -Q (queue)
+        0,                   // -Q (queue)
+        1                    // -B (batch)
     };
 
     int opt;
-    while ((opt = getopt(argc, argv, "+hosn:d:S:H:Q:")) != -1) {
+    while ((opt = getopt(argc, argv, "+hosn:d:S:H:Q:B:")) != -1) {
         // Our option values are always unsigned numbers.
         uint32_t value = 0;
         if (optarg) {
@@ -181,6 +220,12 @@ int main(int argc, char** argv) {
                 assert(optarg);
                 test_args.queue = value;
                 break;
+            case 'B':
+                assert(optarg);
+                if (value < 1u || value > ZX_CHANNEL_MAX_BATCH_MSGS)
+                    argument_error(argv[0], "invalid batch size");
+                test_args.batch = value;
+                break;
             default:  // '?'
                 argument_error(argv[0], "invalid option");
                 break;
@@ -199,21 +244,30 @@ int main(int argc, char** argv) {
 
         if (run_suite) {
             static constexpr TestArgs suite[] = {
-                {10, 0, 0},
-                {100, 0, 0},
-                {1000, 0, 0},
-                {10, 1, 0},
-                {100, 1, 0},
-                {1000, 1, 0},
-                {10, 2, 0},
-                {100, 2, 0},
-                {1000, 2, 0},
-                {10, 5, 0},
-                {100, 5, 0},
-                {1000, 5, 0},
-                {10, 0, 1},
-                {100, 0, 1},
-                {1000, 0, 1},
+                {10, 0, 0, 1},
+                {100, 0, 0, 1},
+                {1000, 0, 0, 1},
+                {10, 1, 0, 1},
+                {100, 1, 0, 1},
+                {1000, 1, 0, 1},
+                {10, 2, 0, 1},
+                {100, 2, 0, 1},
+                {1000, 2, 0, 1},
+                {10, 5, 0, 1},
+                {100, 5, 0, 1},
+                {1000, 5, 0, 1},
+                {10, 0, 1, 1},
+                {100, 0, 1, 1},
+                {1000, 0, 1, 1},
+                {4096, 0, 0, 1},
+                {16384, 0, 0, 1},
+                {32768, 0, 0, 1},
+                {65536, 0, 0, 1},
+                {10, 0, 0, 8},
+                {1000, 0, 0, 8},
+                {10, 1, 0, 8},
+                {10, 0, 0, 32},
+                {1000, 0, 0, 32},
             };
             for (size_t i = 0; i < fbl::count_of(suite); i++)
                 do_test(duration, suite[i]);
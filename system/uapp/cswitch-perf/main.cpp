@@ -0,0 +1,206 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+// Measures context switch throughput as the number of busy cores grows.
+//
+// Each pair of threads hands a token back and forth through a futex, so every
+// hand-off blocks one thread and wakes the other. Running more pairs at once
+// exercises the scheduler's block/unblock paths on more cores concurrently.
+
+#include <assert.h>
+#include <errno.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <threads.h>
+
+#include <zircon/compiler.h>
+#include <zircon/syscalls.h>
+#include <fbl/atomic.h>
+#include <fbl/unique_ptr.h>
+
+namespace {
+
+void argument_error(const char* argv0, const char* message) {
+    fprintf(stderr, "%s: error: %s\nRun with -h for help.\n", argv0, message);
+    exit(EXIT_FAILURE);
+}
+
+// State shared by the two threads of a pair. |turn| says which side may run next.
+struct Pair {
+    zx_futex_t turn;
+    fbl::atomic<bool>* stop;
+    uint64_t handoffs;
+    // Keep neighbouring pairs off each other's cache lines.
+    char padding[64];
+};
+
+struct Side {
+    Pair* pair;
+    int self;
+};
+
+int side_thread(void* arg) {
+    Side* side = static_cast<Side*>(arg);
+    Pair* pair = side->pair;
+    const int self = side->self;
+    const int other = 1 - self;
+    uint64_t handoffs = 0;
+
+    for (;;) {
+        int turn;
+        while ((turn = __atomic_load_n(&pair->turn, __ATOMIC_ACQUIRE)) != self) {
+            if (turn < 0)
+                goto done;
+            zx_status_t status = zx_futex_wait(&pair->turn, turn, ZX_TIME_INFINITE);
+            assert(status == ZX_OK || status == ZX_ERR_BAD_STATE);
+        }
+
+        // Once asked to stop, pass a terminal value so the other side exits as well.
+        int next = pair->stop->load() ? -1 : other;
+        __atomic_store_n(&pair->turn, next, __ATOMIC_RELEASE);
+        __UNUSED zx_status_t status = zx_futex_wake(&pair->turn, 1u);
+        assert(status == ZX_OK);
+        handoffs++;
+        if (next < 0)
+            break;
+    }
+
+done:
+    if (self == 0)
+        pair->handoffs = handoffs;
+    return 0;
+}
+
+void do_test(uint32_t duration, uint32_t pairs) {
+    fbl::atomic<bool> stop(false);
+    fbl::unique_ptr<Pair[]> pair_state(new Pair[pairs]);
+    fbl::unique_ptr<Side[]> sides(new Side[pairs * 2]);
+    fbl::unique_ptr<thrd_t[]> threads(new thrd_t[pairs * 2]);
+
+    for (uint32_t i = 0; i < pairs; i++) {
+        pair_state[i].turn = 0;
+        pair_state[i].stop = &stop;
+        pair_state[i].handoffs = 0;
+        for (int j = 0; j < 2; j++) {
+            sides[i * 2 + j].pair = &pair_state[i];
+            sides[i * 2 + j].self = j;
+        }
+    }
+
+    uint64_t start_ns = zx_clock_get(ZX_CLOCK_MONOTONIC);
+    for (uint32_t i = 0; i < pairs * 2; i++) {
+        __UNUSED int ret = thrd_create_with_name(&threads[i], side_thread, &sides[i],
+                                                 "cswitch-perf");
+        assert(ret == thrd_success);
+    }
+
+    zx_nanosleep(zx_deadline_after(ZX_SEC(duration)));
+    stop.store(true);
+
+    for (uint32_t i = 0; i < pairs * 2; i++) {
+        __UNUSED int ret = thrd_join(threads[i], nullptr);
+        assert(ret == thrd_success);
+    }
+    uint64_t end_ns = zx_clock_get(ZX_CLOCK_MONOTONIC);
+
+    // Each side counts the hand-offs it made; side 0 made half of them.
+    uint64_t total = 0;
+    for (uint32_t i = 0; i < pairs; i++)
+        total += pair_state[i].handoffs * 2;
+
+    double real_duration = static_cast<double>(end_ns - start_ns) / 1000000000.0;
+    double per_second = static_cast<double>(total) / real_duration;
+    printf("%" PRIu32 " pairs: %.0f hand-offs/second (%.0f per pair)\n",
+           pairs, per_second, per_second / pairs);
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    static constexpr char help[] =
+        "Usage: %s [options ...]\n"
+        "\n"
+        "Options:\n"
+        "  -h    show help (this)\n"
+        "  -o    run single test (default)\n"
+        "  -s    run suite: 1, 2, 4, ... pairs up to twice the number of cpus\n"
+        "        (ignores -p)\n"
+        "  -n N  set test repetition count to N (default: 1)\n"
+        "  -d N  set test duration to N seconds (default: 5)\n"
+        "  -p N  set the number of thread pairs to N (default: 1)\n";
+
+    bool run_suite = false;  // -o/-s
+    uint32_t duration = 5;   // -d
+    uint32_t repeats = 1;    // -n
+    uint32_t pairs = 1;      // -p
+
+    int opt;
+    while ((opt = getopt(argc, argv, "+hosn:d:p:")) != -1) {
+        // Our option values are always unsigned numbers.
+        uint32_t value = 0;
+        if (optarg) {
+            errno = 0;
+            char* endptr = nullptr;
+            unsigned long long v = strtoull(optarg, &endptr, 10);
+            if (errno != 0 || *endptr != '\0' || v > UINT32_MAX)
+                argument_error(argv[0], "invalid numeric optional value");
+            value = static_cast<uint32_t>(v);
+        }
+
+        switch (opt) {
+            case 'h':
+                printf(help, argv[0]);
+                return EXIT_SUCCESS;
+            case 'o':
+                run_suite = false;
+                break;
+            case 's':
+                run_suite = true;
+                break;
+            case 'n':
+                assert(optarg);
+                repeats = value;
+                break;
+            case 'd':
+                assert(optarg);
+                duration = value;
+                break;
+            case 'p':
+                assert(optarg);
+                if (value < 1u)
+                    argument_error(argv[0], "invalid pair count");
+                pairs = value;
+                break;
+            default:  // '?'
+                argument_error(argv[0], "invalid option");
+                break;
+        }
+    }
+    if (optind < argc)
+        argument_error(argv[0], "unexpected positional argument");
+
+    const uint32_t num_cpus = zx_system_get_num_cpus();
+    for (uint32_t i = 0; i < repeats; i++) {
+        if (repeats > 1u) {
+            if (i > 0u)
+                printf("\n");
+            printf("Test iteration #%" PRIu32 " (of %" PRIu32 "):\n", i + 1,
+                   repeats);
+        }
+
+        if (run_suite) {
+            // Each pair keeps roughly one cpu busy; go a step past the cpu count to
+            // show the oversubscribed case too.
+            for (uint32_t n = 1; n <= num_cpus * 2; n *= 2)
+                do_test(duration, n);
+        } else {
+            do_test(duration, pairs);
+        }
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,305 @@
+// Copyright 2018 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <assert.h>
+#include <errno.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <zircon/compiler.h>
+#include <zircon/syscalls.h>
+#include <zircon/syscalls/object.h>
+#include <fbl/algorithm.h>
+
+namespace {
+
+void argument_error(const char* argv0, const char* message) {
+    fprintf(stderr, "%s: error: %s\nRun with -h for help.\n", argv0, message);
+    exit(EXIT_FAILURE);
+}
+
+enum class Mode {
+    // One zx_socket_write() and zx_socket_read() of the whole buffer.
+    kWrite,
+    // The buffer split into |iovecs| pieces for zx_socket_writev() and
+    // zx_socket_readv().
+    kWritev,
+    // zx_socket_write_vmo() of a VMO holding the buffer, then
+    // zx_socket_read().
+    kWriteVmo,
+};
+
+const char* mode_name(Mode mode) {
+    switch (mode) {
+    case Mode::kWrite:
+        return "write/read";
+    case Mode::kWritev:
+        return "writev/readv";
+    case Mode::kWriteVmo:
+        return "write_vmo/read";
+    }
+    return "?";
+}
+
+struct TestArgs {
+    Mode mode;
+    uint32_t size;
+    uint32_t iovecs;
+    uint32_t rx_buf;
+};
+
+// Splits |size| bytes at |data| into |count| pieces in |vec|.
+void fill_iovecs(uint8_t* data, size_t size, uint32_t count, zx_iovec_t* vec) {
+    size_t piece = size / count;
+    for (uint32_t i = 0; i < count; i++) {
+        vec[i].buffer = data + i * piece;
+        vec[i].size = (i == count - 1) ? size - i * piece : piece;
+    }
+}
+
+// Moves |size| bytes through the socket, in as many writes and reads as the
+// socket's buffer needs.
+void transfer(const TestArgs& test_args, zx_handle_t out, zx_handle_t in,
+              zx_handle_t vmo, uint8_t* src, uint8_t* dst) {
+    __UNUSED zx_status_t status;
+    zx_iovec_t vec[ZX_SOCKET_MAX_IOVECS];
+
+    size_t written = 0;
+    size_t read = 0;
+    while (read < test_args.size) {
+        size_t left = test_args.size - written;
+        if (left > 0) {
+            size_t actual = 0;
+            switch (test_args.mode) {
+            case Mode::kWrite:
+                status = zx_socket_write(out, 0u, src + written, left, &actual);
+                break;
+            case Mode::kWritev:
+                fill_iovecs(src + written, left, test_args.iovecs, vec);
+                status = zx_socket_writev(out, 0u, vec, test_args.iovecs, &actual);
+                break;
+            case Mode::kWriteVmo:
+                status = zx_socket_write_vmo(out, 0u, vmo, written, left, &actual);
+                break;
+            }
+            assert(status == ZX_OK || status == ZX_ERR_SHOULD_WAIT);
+            written += actual;
+        }
+
+        size_t actual = 0;
+        left = test_args.size - read;
+        if (test_args.mode == Mode::kWritev) {
+            fill_iovecs(dst + read, left, test_args.iovecs, vec);
+            status = zx_socket_readv(in, 0u, vec, test_args.iovecs, &actual);
+        } else {
+            status = zx_socket_read(in, 0u, dst + read, left, &actual);
+        }
+        assert(status == ZX_OK);
+        read += actual;
+    }
+}
+
+void do_test(uint32_t duration, const TestArgs& test_args) {
+    __UNUSED zx_status_t status;
+
+    uint64_t duration_ns = duration * 1000000000ull;
+
+    // We'll write to s[0] (and read from s[1]).
+    zx_handle_t s[2] = {ZX_HANDLE_INVALID, ZX_HANDLE_INVALID};
+    status = zx_socket_create(0u, &s[0], &s[1]);
+    assert(status == ZX_OK);
+
+    if (test_args.rx_buf) {
+        size_t rx_buf = test_args.rx_buf;
+        status = zx_object_set_property(s[1], ZX_PROP_SOCKET_RX_BUF_MAX,
+                                        &rx_buf, sizeof(rx_buf));
+        assert(status == ZX_OK);
+    }
+
+    size_t alloc_size = fbl::round_up(test_args.size, PAGE_SIZE);
+    uint8_t* src = static_cast<uint8_t*>(aligned_alloc(PAGE_SIZE, alloc_size));
+    uint8_t* dst = static_cast<uint8_t*>(aligned_alloc(PAGE_SIZE, alloc_size));
+    assert(src && dst);
+    for (uint32_t i = 0; i < test_args.size; i++)
+        src[i] = static_cast<uint8_t>(i);
+
+    zx_handle_t vmo = ZX_HANDLE_INVALID;
+    if (test_args.mode == Mode::kWriteVmo) {
+        status = zx_vmo_create(alloc_size, 0u, &vmo);
+        assert(status == ZX_OK);
+        size_t actual;
+        status = zx_vmo_write(vmo, src, 0u, test_args.size, &actual);
+        assert(status == ZX_OK);
+    }
+
+    static constexpr uint32_t big_it_size = 100;
+    uint64_t big_its = 0;
+    uint64_t start_ns = zx_clock_get(ZX_CLOCK_MONOTONIC);
+    uint64_t end_ns;
+    for (;;) {
+        big_its++;
+        for (uint32_t i = 0; i < big_it_size; i++)
+            transfer(test_args, s[0], s[1], vmo, src, dst);
+
+        end_ns = zx_clock_get(ZX_CLOCK_MONOTONIC);
+        if ((end_ns - start_ns) >= duration_ns)
+            break;
+    }
+    assert(memcmp(src, dst, test_args.size) == 0);
+
+    if (vmo != ZX_HANDLE_INVALID) {
+        status = zx_handle_close(vmo);
+        assert(status == ZX_OK);
+    }
+    status = zx_handle_close(s[0]);
+    assert(status == ZX_OK);
+    status = zx_handle_close(s[1]);
+    assert(status == ZX_OK);
+    free(src);
+    free(dst);
+
+    double real_duration = static_cast<double>(end_ns - start_ns) / 1000000000.0;
+    double its_per_second = static_cast<double>(big_its) * big_it_size / real_duration;
+    double mbytes_per_second = its_per_second * test_args.size / (1024.0 * 1024.0);
+    printf("%s %" PRIu32 " bytes (%" PRIu32 " iovecs, rx buffer %" PRIu32 "): "
+               "%.0f iterations/second, %.1f MiB/second\n",
+           mode_name(test_args.mode), test_args.size,
+           test_args.mode == Mode::kWritev ? test_args.iovecs : 1u,
+           test_args.rx_buf, its_per_second, mbytes_per_second);
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    static constexpr char help[] =
+        "Usage: %s [options ...]\n"
+        "\n"
+        "Options:\n"
+        "  -h    show help (this)\n"
+        "  -o    run single test (default)\n"
+        "  -s    run suite (ignores -m/-S/-V/-R)\n"
+        "  -n N  set test repetition count to N (default: 1)\n"
+        "  -d N  set test duration to N seconds (default: 5)\n"
+        "  -m M  transfer with M: write, writev or vmo (default: write)\n"
+        "  -S N  set transfer size to N bytes (default: 65536)\n"
+        "  -V N  split writev/readv transfers into N buffers (default: 4)\n"
+        "  -R N  set the reader's buffer limit to N bytes (default: unchanged)\n";
+
+    bool run_suite = false;  // -o/-s
+    uint32_t duration = 5;   // -d
+    uint32_t repeats = 1;    // -n
+    // Ignored when running a suite:
+    TestArgs test_args = {
+        Mode::kWrite,        // -m (mode)
+        65536,               // -S (size)
+        4,                   // -V (iovecs)
+        0                    // -R (rx_buf)
+    };
+
+    int opt;
+    while ((opt = getopt(argc, argv, "+hosn:d:m:S:V:R:")) != -1) {
+        // Apart from -m, our option values are always unsigned numbers.
+        uint32_t value = 0;
+        if (optarg && opt != 'm') {
+            errno = 0;
+            char* endptr = nullptr;
+            unsigned long long v = strtoull(optarg, &endptr, 10);
+            if (errno != 0 || *endptr != '\0' || v > UINT32_MAX)
+                argument_error(argv[0], "invalid numeric optional value");
+            value = static_cast<uint32_t>(v);
+        }
+
+        switch (opt) {
+            case 'h':
+                printf(help, argv[0]);
+                return EXIT_SUCCESS;
+            case 'o':
+                run_suite = false;
+                break;
+            case 's':
+                run_suite = true;
+                break;
+            case 'n':
+                assert(optarg);
+                repeats = value;
+                break;
+            case 'd':
+                assert(optarg);
+                duration = value;
+                break;
+            case 'm':
+                assert(optarg);
+                if (!strcmp(optarg, "write")) {
+                    test_args.mode = Mode::kWrite;
+                } else if (!strcmp(optarg, "writev")) {
+                    test_args.mode = Mode::kWritev;
+                } else if (!strcmp(optarg, "vmo")) {
+                    test_args.mode = Mode::kWriteVmo;
+                } else {
+                    argument_error(argv[0], "invalid mode");
+                }
+                break;
+            case 'S':
+                assert(optarg);
+                if (value < 1u)
+                    argument_error(argv[0], "invalid transfer size");
+                test_args.size = value;
+                break;
+            case 'V':
+                assert(optarg);
+                if (value < 1u || value > ZX_SOCKET_MAX_IOVECS)
+                    argument_error(argv[0], "invalid iovec count");
+                test_args.iovecs = value;
+                break;
+            case 'R':
+                assert(optarg);
+                if (value > ZX_SOCKET_MAX_RX_BUF)
+                    argument_error(argv[0], "invalid buffer limit");
+                test_args.rx_buf = value;
+                break;
+            default:  // '?'
+                argument_error(argv[0], "invalid option");
+                break;
+        }
+    }
+    if (optind < argc)
+        argument_error(argv[0], "unexpected positional argument");
+
+    for (uint32_t i = 0; i < repeats; i++) {
+        if (repeats > 1u) {
+            if (i > 0u)
+                printf("\n");
+            printf("Test iteration #%" PRIu32 " (of %" PRIu32 "):\n", i + 1,
+                   repeats);
+        }
+
+        if (run_suite) {
+            static constexpr TestArgs suite[] = {
+                {Mode::kWrite, 1024, 1, 0},
+                {Mode::kWritev, 1024, 4, 0},
+                {Mode::kWrite, 65536, 1, 0},
+                {Mode::kWritev, 65536, 4, 0},
+                {Mode::kWritev, 65536, 16, 0},
+                {Mode::kWriteVmo, 65536, 1, 0},
+                {Mode::kWrite, 1048576, 1, 0},
+                {Mode::kWriteVmo, 1048576, 1, 0},
+                {Mode::kWrite, 1048576, 1, 1048576},
+                {Mode::kWriteVmo, 1048576, 1, 1048576},
+                {Mode::kWrite, 4194304, 1, 4194304},
+                {Mode::kWriteVmo, 4194304, 1, 4194304},
+            };
+            for (size_t i = 0; i < fbl::count_of(suite); i++)
+                do_test(duration, suite[i]);
+        } else {
+            do_test(duration, test_args);
+        }
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -7,6 +7,7 @@
 #include <assert.h>
 #include <stdatomic.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include <zircon/assert.h>
 #include <zircon/listnode.h>
@@ -19,6 +20,9 @@
 // The port wait key associated with the dispatcher's control messages.
 #define KEY_CONTROL (0u)
 
+// The maximum number of packets to dequeue from the port at once.
+#define MAX_BATCH_PACKETS (16u)
+
 static zx_status_t async_loop_begin_wait(async_t* async, async_wait_t* wait);
 static zx_status_t async_loop_cancel_wait(async_t* async, async_wait_t* wait);
 static zx_status_t async_loop_post_task(async_t* async, async_task_t* task);
@@ -53,9 +57,15 @@ typedef struct async_loop {
     list_node_t task_list; // pending tasks, earliest deadline first
     list_node_t due_list; // due tasks, earliest deadline first
     list_node_t thread_list; // earliest created thread first
+    zx_port_packet_t* batch; // packets dequeued together, pending dispatch
+    size_t batch_next; // index of the next packet in |batch| to dispatch
+    size_t batch_count; // number of packets in |batch|
 } async_loop_t;
 
-static zx_status_t async_loop_run_once(async_loop_t* loop, zx_time_t deadline);
+static zx_status_t async_loop_run_once(async_loop_t* loop, zx_time_t deadline, bool once);
+static zx_status_t async_loop_dispatch_port_packet(async_loop_t* loop,
+                                                   const zx_port_packet_t* packet);
+static bool async_loop_remove_batched_wait_locked(async_loop_t* loop, async_wait_t* wait);
 static zx_status_t async_loop_dispatch_wait(async_loop_t* loop, async_wait_t* wait,
                                             zx_status_t status, const zx_packet_signal_t* signal);
 static zx_status_t async_loop_dispatch_tasks(async_loop_t* loop);
@@ -198,7 +208,7 @@ zx_status_t async_loop_run(async_t* async, zx_time_t deadline, bool once) {
     zx_status_t status;
     atomic_fetch_add_explicit(&loop->active_threads, 1u, memory_order_acq_rel);
     do {
-        status = async_loop_run_once(loop, deadline);
+        status = async_loop_run_once(loop, deadline, once);
     } while (status == ZX_OK && !once);
     atomic_fetch_sub_explicit(&loop->active_threads, 1u, memory_order_acq_rel);
     return status;
@@ -212,39 +222,101 @@ zx_status_t async_loop_run_until_idle(async_t* async) {
     return status;
 }
 
-static zx_status_t async_loop_run_once(async_loop_t* loop, zx_time_t deadline) {
+static zx_status_t async_loop_run_once(async_loop_t* loop, zx_time_t deadline, bool once) {
     async_loop_state_t state = atomic_load_explicit(&loop->state, memory_order_acquire);
     if (state == ASYNC_LOOP_SHUTDOWN)
         return ZX_ERR_BAD_STATE;
     if (state != ASYNC_LOOP_RUNNABLE)
         return ZX_ERR_CANCELED;
 
-    zx_port_packet_t packet;
-    zx_status_t status = zx_port_wait(loop->port, deadline, &packet, 0);
+    // When this is the only thread servicing the loop, take several packets
+    // per system call and dispatch them in order.  Loops with several threads
+    // take one packet at a time so that the work is spread across them.
+    size_t max_packets = 1u;
+    if (!once && atomic_load_explicit(&loop->active_threads, memory_order_acquire) == 1u)
+        max_packets = MAX_BATCH_PACKETS;
+
+    zx_port_packet_t packets[MAX_BATCH_PACKETS];
+    size_t count;
+    zx_status_t status = zx_port_wait_many(loop->port, deadline, packets, max_packets, &count);
     if (status != ZX_OK)
         return status;
 
-    if (packet.key == KEY_CONTROL) {
+    // The packets have left the port, so they must all be dispatched even if
+    // the loop quits part way through.  While they wait their turn, they are
+    // published in |batch| so that canceling a wait can still withdraw its
+    // packet.
+    if (count > 1u) {
+        mtx_lock(&loop->lock);
+        ZX_DEBUG_ASSERT(loop->batch == NULL);
+        loop->batch = packets;
+        loop->batch_next = 0u;
+        loop->batch_count = count;
+        mtx_unlock(&loop->lock);
+    }
+    uint32_t wake_ups = 0u;
+    for (size_t i = 0u;; i++) {
+        zx_port_packet_t packet;
+        if (count > 1u) {
+            mtx_lock(&loop->lock);
+            if (loop->batch_next == loop->batch_count) {
+                loop->batch = NULL;
+                loop->batch_next = 0u;
+                loop->batch_count = 0u;
+                mtx_unlock(&loop->lock);
+                break;
+            }
+            packet = loop->batch[loop->batch_next++];
+            mtx_unlock(&loop->lock);
+        } else {
+            if (i == count)
+                break;
+            packet = packets[i];
+        }
+
+        if (packet.key == KEY_CONTROL && packet.type == ZX_PKT_TYPE_USER)
+            wake_ups++;
+        zx_status_t dispatch_status = async_loop_dispatch_port_packet(loop, &packet);
+        if (status == ZX_OK)
+            status = dispatch_status;
+    }
+
+    // A thread may have joined the loop since we checked, so put back any
+    // extra wake-up packets that we took for it to find.
+    for (; wake_ups > 1u; wake_ups--) {
+        zx_port_packet_t packet = {
+            .key = KEY_CONTROL,
+            .type = ZX_PKT_TYPE_USER,
+            .status = ZX_OK};
+        zx_status_t queue_status = zx_port_queue(loop->port, &packet, 0u);
+        ZX_DEBUG_ASSERT_MSG(queue_status == ZX_OK, "status=%d", queue_status);
+    }
+    return status;
+}
+
+static zx_status_t async_loop_dispatch_port_packet(async_loop_t* loop,
+                                                   const zx_port_packet_t* packet) {
+    if (packet->key == KEY_CONTROL) {
         // Handle wake-up packets.
-        if (packet.type == ZX_PKT_TYPE_USER)
+        if (packet->type == ZX_PKT_TYPE_USER)
             return ZX_OK;
 
         // Handle task timer expirations.
-        if (packet.type == ZX_PKT_TYPE_SIGNAL_REP &&
-            packet.signal.observed & ZX_TIMER_SIGNALED) {
+        if (packet->type == ZX_PKT_TYPE_SIGNAL_REP &&
+            packet->signal.observed & ZX_TIMER_SIGNALED) {
             return async_loop_dispatch_tasks(loop);
         }
     } else {
         // Handle wait completion packets.
-        if (packet.type == ZX_PKT_TYPE_SIGNAL_ONE) {
-            async_wait_t* wait = (void*)(uintptr_t)packet.key;
-            return async_loop_dispatch_wait(loop, wait, packet.status, &packet.signal);
+        if (packet->type == ZX_PKT_TYPE_SIGNAL_ONE) {
+            async_wait_t* wait = (void*)(uintptr_t)packet->key;
+            return async_loop_dispatch_wait(loop, wait, packet->status, &packet->signal);
         }
 
         // Handle queued user packets.
-        if (packet.type == ZX_PKT_TYPE_USER) {
-            async_receiver_t* receiver = (void*)(uintptr_t)packet.key;
-            return async_loop_dispatch_packet(loop, receiver, packet.status, &packet.user);
+        if (packet->type == ZX_PKT_TYPE_USER) {
+            async_receiver_t* receiver = (void*)(uintptr_t)packet->key;
+            return async_loop_dispatch_packet(loop, receiver, packet->status, &packet->user);
         }
     }
 
@@ -458,6 +530,14 @@ static zx_status_t async_loop_cancel_wait(async_t* async, async_wait_t* wait) {
     // invoked again past this point.
     zx_status_t status = zx_port_cancel(loop->port, wait->object,
                                         (uintptr_t)wait);
+    if (status == ZX_ERR_NOT_FOUND) {
+        // The completion packet may already have been dequeued as part of a
+        // batch which is still being dispatched.
+        mtx_lock(&loop->lock);
+        if (async_loop_remove_batched_wait_locked(loop, wait))
+            status = ZX_OK;
+        mtx_unlock(&loop->lock);
+    }
     if (status == ZX_OK && (wait->flags & ASYNC_FLAG_HANDLE_SHUTDOWN)) {
         mtx_lock(&loop->lock);
         list_delete(wait_to_node(wait));
@@ -466,6 +546,18 @@ static zx_status_t async_loop_cancel_wait(async_t* async, async_wait_t* wait) {
     return status;
 }
 
+static bool async_loop_remove_batched_wait_locked(async_loop_t* loop, async_wait_t* wait) {
+    for (size_t i = loop->batch_next; i < loop->batch_count; i++) {
+        zx_port_packet_t* packet = &loop->batch[i];
+        if (packet->key == (uintptr_t)wait && packet->type == ZX_PKT_TYPE_SIGNAL_ONE) {
+            memmove(packet, packet + 1, (loop->batch_count - i - 1u) * sizeof(*packet));
+            loop->batch_count--;
+            return true;
+        }
+    }
+    return false;
+}
+
 static zx_status_t async_loop_post_task(async_t* async, async_task_t* task) {
     async_loop_t* loop = (async_loop_t*)async;
     ZX_DEBUG_ASSERT(loop);
@@ -3,6 +3,7 @@
 // found in the LICENSE file.
 
 #include <fcntl.h>
+#include <inttypes.h>
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -24,6 +25,7 @@
 #define MXDEBUG 0
 
 #include <blobstore/blobstore.h>
+#include <blobstore/compression.h>
 
 using digest::Digest;
 using digest::MerkleTree;
@@ -31,6 +33,12 @@ using digest::MerkleTree;
 namespace blobstore {
 namespace {
 
+// The fewest data blocks LoadAndVerify() reads at once, so that small
+// sequential reads don't each cost a round trip to the block device.
+constexpr uint64_t kReadAheadBlocks = 16;
+
+constexpr uint64_t kBlocksPerChunk = kCompressionChunkSize / kBlobstoreBlockSize;
+
 zx_status_t vmo_read_exact(zx_handle_t h, void* data, uint64_t offset, size_t len) {
     size_t actual;
     zx_status_t status = zx_vmo_read(h, data, offset, len, &actual);
@@ -113,20 +121,25 @@ blobstore_inode_t* Blobstore::GetNode(size_t index) const {
     return &reinterpret_cast<blobstore_inode_t*>(node_map_->GetData())[index];
 }
 
-zx_status_t VnodeBlob::Verify() const {
-    TRACE_DURATION("blobstore", "Blobstore::Verify");
+zx_status_t VnodeBlob::Verify(uint64_t offset, uint64_t length) const {
+    TRACE_DURATION("blobstore", "Blobstore::Verify", "offset", offset, "length", length);
     ZX_DEBUG_ASSERT(blob_ != nullptr);
 
     const blobstore_inode_t* inode = blobstore_->GetNode(map_index_);
-    // TODO(smklein): We could lazily verify more of the VMO if
-    // we could fault in pages on-demand.
-    //
-    // For now, we aggressively verify the entire VMO up front.
     Digest d;
     d = reinterpret_cast<const uint8_t*>(&digest_[0]);
-    return MerkleTree::Verify(GetData(), inode->blob_size, GetMerkle(),
-                              MerkleTree::GetTreeLength(inode->blob_size), 0,
-                              inode->blob_size, d);
+    return MerkleTree::VerifyParallel(GetData(), inode->blob_size, GetMerkle(),
+                                      MerkleTree::GetTreeLength(inode->blob_size), offset,
+                                      length, d, zx_system_get_num_cpus());
+}
+
+zx_status_t VnodeBlob::SetAllVerified() {
+    const blobstore_inode_t* inode = blobstore_->GetNode(map_index_);
+    zx_status_t status;
+    if ((status = verified_.Reset(BlobDataBlocks(*inode))) != ZX_OK) {
+        return status;
+    }
+    return verified_.Set(0, BlobDataBlocks(*inode));
 }
 
 zx_status_t VnodeBlob::InitVmos() {
@@ -140,7 +153,12 @@ zx_status_t VnodeBlob::InitVmos() {
     const blobstore_inode_t* inode = blobstore_->GetNode(map_index_);
 
     uint64_t num_blocks = BlobDataBlocks(*inode) + MerkleTreeBlocks(*inode);
-    if ((status = MappedVmo::Create(num_blocks * kBlobstoreBlockSize, "blob", &blob_)) != ZX_OK) {
+    status = MappedVmo::Create(num_blocks * kBlobstoreBlockSize, "blob", &blob_);
+    if (status == ZX_ERR_NO_MEMORY && blobstore_->EvictBlobs(0) > 0) {
+        // Memory is tight: give up every cached blob before giving up on this one.
+        status = MappedVmo::Create(num_blocks * kBlobstoreBlockSize, "blob", &blob_);
+    }
+    if (status != ZX_OK) {
         FS_TRACE_ERROR("Failed to initialize vmo; error: %d\n", status);
         BlobCloseHandles();
         return status;
@@ -150,15 +168,136 @@ zx_status_t VnodeBlob::InitVmos() {
         BlobCloseHandles();
         return status;
     }
+    if ((status = verified_.Reset(BlobDataBlocks(*inode))) != ZX_OK) {
+        BlobCloseHandles();
+        return status;
+    }
 
+    // The Merkle tree is small relative to the data, and every verification
+    // walks part of it, so read it all now.
     ReadTxn txn(blobstore_.get());
-    txn.Enqueue(vmoid_, 0, inode->start_block + DataStartBlock(blobstore_->info_),
-                BlobDataBlocks(*inode) + MerkleTreeBlocks(*inode));
+    const uint64_t merkle_blocks = MerkleTreeBlocks(*inode);
+    const uint64_t dev_start = inode->start_block + DataStartBlock(blobstore_->info_);
+    if (merkle_blocks > 0) {
+        txn.Enqueue(vmoid_, 0, dev_start, merkle_blocks);
+    }
+
+    // Likewise the chunk offset table of a compressed blob, which every read
+    // needs to find its chunks.
+    if (inode->flags & kBlobInodeFlagLZ4Compressed) {
+        uint64_t header_blocks = fbl::round_up(CompressedHeaderSize(inode->blob_size),
+                                               kBlobstoreBlockSize) / kBlobstoreBlockSize;
+        if (inode->num_blocks < merkle_blocks + header_blocks) {
+            FS_TRACE_ERROR("blobstore: Compressed blob too small for its chunk table\n");
+            BlobCloseHandles();
+            return ZX_ERR_IO_DATA_INTEGRITY;
+        }
+        uint64_t stored_blocks = inode->num_blocks - merkle_blocks;
+        if ((status = MappedVmo::Create(stored_blocks * kBlobstoreBlockSize, "blob-compressed",
+                                        &compressed_)) != ZX_OK) {
+            FS_TRACE_ERROR("Failed to initialize compressed vmo; error: %d\n", status);
+            BlobCloseHandles();
+            return status;
+        }
+        if ((status = blobstore_->AttachVmo(compressed_->GetVmo(), &compressed_vmoid_)) != ZX_OK) {
+            FS_TRACE_ERROR("Failed to attach compressed VMO to block device; error: %d\n",
+                           status);
+            BlobCloseHandles();
+            return status;
+        }
+        txn.Enqueue(compressed_vmoid_, 0, dev_start + merkle_blocks, header_blocks);
+        compressed_blocks_read_ = header_blocks;
+    }
+
     if ((status = txn.Flush()) != ZX_OK) {
+        BlobCloseHandles();
         return status;
     }
+    return ZX_OK;
+}
 
-    return Verify();
+zx_status_t VnodeBlob::LoadAndVerify(uint64_t offset, uint64_t length) {
+    TRACE_DURATION("blobstore", "Blobstore::LoadAndVerify", "offset", offset, "length", length);
+    ZX_DEBUG_ASSERT(blob_ != nullptr);
+
+    const blobstore_inode_t* inode = blobstore_->GetNode(map_index_);
+    const bool compressed = inode->flags & kBlobInodeFlagLZ4Compressed;
+    const uint64_t data_blocks = BlobDataBlocks(*inode);
+    uint64_t first = offset / kBlobstoreBlockSize;
+    uint64_t last = fbl::round_up(offset + length, kBlobstoreBlockSize) / kBlobstoreBlockSize;
+    last = fbl::max(last, first + kReadAheadBlocks);
+    if (compressed) {
+        // Chunks are decompressed whole, so they are verified whole too.
+        first = fbl::round_down(first, kBlocksPerChunk);
+        last = fbl::round_up(last, kBlocksPerChunk);
+    }
+    last = fbl::min(last, data_blocks);
+
+    size_t unverified;
+    if (verified_.Get(first, last, &unverified)) {
+        return ZX_OK;
+    }
+
+    // Read each run of blocks which haven't been verified yet. For a
+    // compressed blob, these are whole chunks, and what is read is the blocks
+    // holding their compressed form.
+    const uint64_t merkle_blocks = MerkleTreeBlocks(*inode);
+    const uint64_t dev_start = inode->start_block + DataStartBlock(blobstore_->info_) +
+                               merkle_blocks;
+    const uint64_t stored_size = (inode->num_blocks - merkle_blocks) * kBlobstoreBlockSize;
+    zx_status_t status;
+    ReadTxn txn(blobstore_.get());
+    size_t run_start = unverified;
+    while (run_start < last) {
+        size_t run_end = verified_.Scan(run_start, last, false);
+        if (compressed) {
+            uint64_t start, end;
+            if ((status = CompressedChunkRange(compressed_->GetData(), stored_size,
+                                               inode->blob_size, run_start / kBlocksPerChunk,
+                                               fbl::round_up(run_end, kBlocksPerChunk) /
+                                               kBlocksPerChunk, &start, &end)) != ZX_OK) {
+                return status;
+            }
+            start /= kBlobstoreBlockSize;
+            end = fbl::round_up(end, kBlobstoreBlockSize) / kBlobstoreBlockSize;
+            txn.Enqueue(compressed_vmoid_, start, dev_start + start, end - start);
+            compressed_blocks_read_ += end - start;
+        } else {
+            txn.Enqueue(vmoid_, merkle_blocks + run_start, dev_start + run_start,
+                        run_end - run_start);
+        }
+        run_start = verified_.Scan(run_end, last, true);
+    }
+    if ((status = txn.Flush()) != ZX_OK) {
+        return status;
+    }
+
+    if (compressed) {
+        run_start = unverified;
+        while (run_start < last) {
+            size_t run_end = verified_.Scan(run_start, last, false);
+            if ((status = DecompressBlobChunks(compressed_->GetData(), stored_size,
+                                               inode->blob_size, run_start / kBlocksPerChunk,
+                                               fbl::round_up(run_end, kBlocksPerChunk) /
+                                               kBlocksPerChunk, GetData())) != ZX_OK) {
+                FS_TRACE_ERROR("blobstore: Blob failed decompression at blocks [%zu, %zu)\n",
+                               run_start, run_end);
+                return status;
+            }
+            run_start = verified_.Scan(run_end, last, true);
+        }
+    }
+
+    // Verifying the whole span only rehashes blocks already verified in the
+    // middle of it, and lets the Merkle tree be walked once.
+    uint64_t start = unverified * kBlobstoreBlockSize;
+    uint64_t end = fbl::min(last * kBlobstoreBlockSize, inode->blob_size);
+    if ((status = Verify(start, end - start)) != ZX_OK) {
+        FS_TRACE_ERROR("blobstore: Blob failed verification at blocks [%zu, %" PRIu64 ")\n",
+                       unverified, last);
+        return status;
+    }
+    return verified_.Set(unverified, last);
 }
 
 uint64_t VnodeBlob::SizeData() const {
@@ -169,6 +308,30 @@ uint64_t VnodeBlob::SizeData() const {
     return 0;
 }
 
+uint64_t VnodeBlob::SizeResident() const {
+    if (blob_ == nullptr) {
+        return 0;
+    }
+    if (GetState() != kBlobStateReadable) {
+        // Still being written: all of blob_ is filled in.
+        return blob_->GetSize();
+    }
+
+    // Pages are only committed as blocks are read into the VMOs: the Merkle
+    // tree, the data blocks verified so far and, for a compressed blob, the
+    // stored blocks read so far.
+    const blobstore_inode_t* inode = blobstore_->GetNode(map_index_);
+    uint64_t blocks = MerkleTreeBlocks(*inode) + compressed_blocks_read_;
+    const size_t data_blocks = verified_.size();
+    size_t start = verified_.Scan(0, data_blocks, false);
+    while (start < data_blocks) {
+        size_t end = verified_.Scan(start, data_blocks, true);
+        blocks += end - start;
+        start = verified_.Scan(end, data_blocks, false);
+    }
+    return blocks * kBlobstoreBlockSize;
+}
+
 VnodeBlob::VnodeBlob(fbl::RefPtr<Blobstore> bs, const Digest& digest)
     : blobstore_(fbl::move(bs)),
       flags_(kBlobStateEmpty) {
@@ -181,6 +344,8 @@ VnodeBlob::VnodeBlob(fbl::RefPtr<Blobstore> bs)
 
 void VnodeBlob::BlobCloseHandles() {
     blob_ = nullptr;
+    compressed_ = nullptr;
+    compressed_blocks_read_ = 0;
     readable_event_.reset();
 }
 
@@ -204,6 +369,7 @@ zx_status_t VnodeBlob::SpaceAllocate(uint64_t size_data) {
     blobstore_inode_t* inode = blobstore_->GetNode(map_index_);
     memset(inode->merkle_root_hash, 0, Digest::kLength);
     inode->blob_size = size_data;
+    inode->flags = 0;
     inode->num_blocks = MerkleTreeBlocks(*inode) + BlobDataBlocks(*inode);
 
     // Open VMOs, so we can begin writing after allocate succeeds.
@@ -241,6 +407,50 @@ zx_status_t VnodeBlob::WriteShared(WriteTxn* txn, size_t start, size_t len, uint
     return txn->Flush();
 }
 
+zx_status_t VnodeBlob::WriteData(WriteTxn* txn) {
+    TRACE_DURATION("blobstore", "Blobstore::WriteData");
+
+    auto inode = blobstore_->GetNode(map_index_);
+    const uint64_t merkle_blocks = MerkleTreeBlocks(*inode);
+    const uint64_t data_blocks = BlobDataBlocks(*inode);
+    const uint64_t dev_start = inode->start_block + DataStartBlock(blobstore_->info_) +
+                               merkle_blocks;
+
+    // A blob which fits in one block can't get any smaller. Otherwise,
+    // compression is best effort: if it fails, store the data as-is.
+    if (data_blocks > 1) {
+        fbl::unique_ptr<MappedVmo> compressed;
+        vmoid_t compressed_vmoid;
+        uint64_t bound = fbl::round_up(CompressedBlobBound(inode->blob_size),
+                                       kBlobstoreBlockSize);
+        if (MappedVmo::Create(bound, "blob-compressed", &compressed) == ZX_OK &&
+            blobstore_->AttachVmo(compressed->GetVmo(), &compressed_vmoid) == ZX_OK) {
+            uint64_t size = CompressBlob(GetData(), inode->blob_size, compressed->GetData());
+            uint64_t stored_blocks = fbl::round_up(size, kBlobstoreBlockSize) /
+                                     kBlobstoreBlockSize;
+            if (stored_blocks < data_blocks) {
+                txn->Enqueue(compressed_vmoid, 0, dev_start, stored_blocks);
+                zx_status_t status = txn->Flush();
+                blobstore_->DetachVmo(compressed_vmoid);
+                if (status != ZX_OK) {
+                    return status;
+                }
+
+                // Give back the blocks reserved for the uncompressed data.
+                blobstore_->FreeBlocks(data_blocks - stored_blocks,
+                                       inode->start_block + merkle_blocks + stored_blocks);
+                inode->num_blocks = merkle_blocks + stored_blocks;
+                inode->flags |= kBlobInodeFlagLZ4Compressed;
+                return ZX_OK;
+            }
+            blobstore_->DetachVmo(compressed_vmoid);
+        }
+    }
+
+    txn->Enqueue(vmoid_, merkle_blocks, dev_start, data_blocks);
+    return txn->Flush();
+}
+
 void* VnodeBlob::GetData() const {
     auto inode = blobstore_->GetNode(map_index_);
     return fs::GetBlock<kBlobstoreBlockSize>(blob_->GetData(),
@@ -317,12 +527,8 @@ zx_status_t VnodeBlob::WriteInternal(const void* data, size_t len, size_t* actua
             return status;
         }
 
-        status = WriteShared(&txn, offset, len, inode->start_block);
-        if (status != ZX_OK) {
-            SetState(kBlobStateError);
-            return status;
-        }
-
+        // The data goes to disk once all of it has arrived, since whether it
+        // is compressed depends on all of it.
         *actual = to_write;
         bytes_written_ += to_write;
 
@@ -339,8 +545,9 @@ zx_status_t VnodeBlob::WriteInternal(const void* data, size_t len, size_t* actua
             Digest digest;
             void* merkle_data = GetMerkle();
             const void* blob_data = GetData();
-            if (MerkleTree::Create(blob_data, inode->blob_size, merkle_data,
-                                   merkle_size, &digest) != ZX_OK) {
+            if (MerkleTree::CreateParallel(blob_data, inode->blob_size, merkle_data,
+                                           merkle_size, &digest,
+                                           zx_system_get_num_cpus()) != ZX_OK) {
                 SetState(kBlobStateError);
                 return status;
             } else if (digest != digest_) {
@@ -354,7 +561,7 @@ zx_status_t VnodeBlob::WriteInternal(const void* data, size_t len, size_t* actua
                 SetState(kBlobStateError);
                 return status;
             }
-        } else if ((status = Verify()) != ZX_OK) {
+        } else if ((status = Verify(0, inode->blob_size)) != ZX_OK) {
             // Small blobs may not have associated Merkle Trees, and will
             // require validation, since we are not regenerating and checking
             // the digest.
@@ -362,6 +569,17 @@ zx_status_t VnodeBlob::WriteInternal(const void* data, size_t len, size_t* actua
             return status;
         }
 
+        // All of the data is in memory and matches the digest.
+        if ((status = SetAllVerified()) != ZX_OK) {
+            SetState(kBlobStateError);
+            return status;
+        }
+
+        if ((status = WriteData(&txn)) != ZX_OK) {
+            SetState(kBlobStateError);
+            return status;
+        }
+
         // No more data to write. Flush to disk.
         if ((status = WriteMetadata()) != ZX_OK) {
             SetState(kBlobStateError);
@@ -402,9 +620,12 @@ zx_status_t VnodeBlob::CopyVmo(zx_rights_t rights, zx_handle_t* out) {
         return status;
     }
 
-    auto inode = blobstore_->GetNode(map_index_);
     // TODO(smklein): Only clone / verify the part of the vmo that
     // was requested.
+    auto inode = blobstore_->GetNode(map_index_);
+    if ((status = LoadAndVerify(0, inode->blob_size)) != ZX_OK) {
+        return status;
+    }
     const size_t data_start = MerkleTreeBlocks(*inode) * kBlobstoreBlockSize;
     zx_handle_t clone;
     if ((status = zx_vmo_clone(blob_->GetVmo(), ZX_VMO_CLONE_COPY_ON_WRITE,
@@ -442,6 +663,10 @@ zx_status_t VnodeBlob::ReadInternal(void* data, size_t len, size_t off, size_t*
         len = inode->blob_size - off;
     }
 
+    if ((status = LoadAndVerify(off, len)) != ZX_OK) {
+        return status;
+    }
+
     const size_t data_start = MerkleTreeBlocks(*inode) * kBlobstoreBlockSize;
     return zx_vmo_read(blob_->GetVmo(), data, data_start + off, len, actual);
 }
@@ -520,6 +745,8 @@ void Blobstore::FreeNode(size_t node_index) {
 
 zx_status_t Blobstore::Unmount() {
     TRACE_DURATION("blobstore", "Blobstore::Unmount");
+    // Cached blobs hold references to the blobstore; release them first.
+    cache_.clear();
     // Explicitly delete this (rather than just letting the memory release when
     // the process exits) to ensure that the block device's fifo has been
     // closed.
@@ -614,6 +841,66 @@ zx_status_t Blobstore::ReleaseBlob(VnodeBlob* vn) {
     return ZX_ERR_NOT_SUPPORTED;
 }
 
+void Blobstore::CacheBlob(VnodeBlob* vn) {
+    TRACE_DURATION("blobstore", "Blobstore::CacheBlob");
+    ZX_DEBUG_ASSERT(!vn->type_lru_state_.InContainer());
+    vn->cache_bytes_ = vn->SizeResident();
+    cache_resident_ += vn->cache_bytes_;
+    cache_count_++;
+    cache_.push_back(fbl::RefPtr<VnodeBlob>(vn));
+    EvictBlobs(cache_budget_);
+}
+
+void Blobstore::UncacheBlob(VnodeBlob* vn, bool reopened) {
+    if (!vn->type_lru_state_.InContainer()) {
+        // A closed blob which isn't in memory any more has to be read back
+        // from disk.
+        if (reopened && vn->GetState() == kBlobStateReadable && vn->SizeResident() == 0) {
+            cache_misses_++;
+        }
+        return;
+    }
+    if (reopened) {
+        cache_hits_++;
+    }
+    // The caller holds its own reference, so this can't be the last one.
+    cache_.erase(*vn);
+    cache_resident_ -= vn->cache_bytes_;
+    cache_count_--;
+    vn->cache_bytes_ = 0;
+}
+
+uint64_t Blobstore::EvictBlobs(uint64_t budget) {
+    TRACE_DURATION("blobstore", "Blobstore::EvictBlobs", "budget", budget);
+    uint64_t released = 0;
+    while (cache_resident_ > budget && !cache_.is_empty()) {
+        // Dropping the cache's reference to a closed blob destroys its vnode,
+        // along with its VMOs.
+        fbl::RefPtr<VnodeBlob> vn = cache_.pop_front();
+        cache_resident_ -= vn->cache_bytes_;
+        released += vn->cache_bytes_;
+        cache_count_--;
+        cache_evictions_++;
+        vn->cache_bytes_ = 0;
+    }
+    return released;
+}
+
+void Blobstore::SetCacheBudget(uint64_t budget) {
+    cache_budget_ = budget;
+    EvictBlobs(cache_budget_);
+}
+
+void Blobstore::GetCacheInfo(vfs_blob_cache_info_t* info) const {
+    memset(info, 0, sizeof(*info));
+    info->budget_bytes = cache_budget_;
+    info->resident_bytes = cache_resident_;
+    info->blob_count = cache_count_;
+    info->hits = cache_hits_;
+    info->misses = cache_misses_;
+    info->evictions = cache_evictions_;
+}
+
 zx_status_t Blobstore::CountUpdate(WriteTxn* txn) {
     zx_status_t status = ZX_OK;
     void* infodata = info_vmo_->GetData();
@@ -724,6 +1011,14 @@ zx_status_t Blobstore::AttachVmo(zx_handle_t vmo, vmoid_t* out) {
     return ZX_OK;
 }
 
+zx_status_t Blobstore::DetachVmo(vmoid_t vmoid) {
+    block_fifo_request_t request;
+    request.txnid = TxnId();
+    request.vmoid = vmoid;
+    request.opcode = BLOCKIO_CLOSE_VMO;
+    return Txn(&request, 1);
+}
+
 zx_status_t Blobstore::AddInodes() {
     TRACE_DURATION("blobstore", "Blobstore::AddInodes");
 
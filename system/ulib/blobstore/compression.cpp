@@ -0,0 +1,112 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <string.h>
+
+#include <fbl/algorithm.h>
+#include <lz4/lz4.h>
+
+#include <blobstore/compression.h>
+#include <blobstore/format.h>
+
+namespace blobstore {
+namespace {
+
+uint64_t ChunkLength(uint64_t blob_size, uint64_t n) {
+    return fbl::min(kCompressionChunkSize, blob_size - n * kCompressionChunkSize);
+}
+
+// Checks that the stored bytes of chunks [first, last) lie after the offset
+// table and within the compressed blob.
+zx_status_t CheckChunkRange(const uint64_t* offsets, uint64_t compressed_size,
+                            uint64_t blob_size, uint64_t first, uint64_t last) {
+    if (first >= last || last > CompressedChunkCount(blob_size)) {
+        return ZX_ERR_INVALID_ARGS;
+    } else if (CompressedHeaderSize(blob_size) > compressed_size) {
+        return ZX_ERR_IO_DATA_INTEGRITY;
+    } else if (offsets[first] < CompressedHeaderSize(blob_size) ||
+               offsets[last] < offsets[first] || offsets[last] > compressed_size) {
+        return ZX_ERR_IO_DATA_INTEGRITY;
+    }
+    return ZX_OK;
+}
+
+} // namespace
+
+uint64_t CompressedBlobBound(uint64_t blob_size) {
+    return CompressedHeaderSize(blob_size) + blob_size;
+}
+
+uint64_t CompressBlob(const void* data, uint64_t blob_size, void* out) {
+    const uint8_t* src = static_cast<const uint8_t*>(data);
+    uint8_t* dst = static_cast<uint8_t*>(out);
+    uint64_t* offsets = static_cast<uint64_t*>(out);
+
+    const uint64_t chunks = CompressedChunkCount(blob_size);
+    uint64_t pos = CompressedHeaderSize(blob_size);
+    for (uint64_t n = 0; n < chunks; n++) {
+        offsets[n] = pos;
+        const uint64_t start = n * kCompressionChunkSize;
+        const int len = static_cast<int>(ChunkLength(blob_size, n));
+
+        // Only keep the compressed form if it is smaller: given one byte less
+        // than the input, LZ4 gives up as soon as it can't fit.
+        int actual = LZ4_compress_default(reinterpret_cast<const char*>(src + start),
+                                          reinterpret_cast<char*>(dst + pos), len, len - 1);
+        if (actual <= 0) {
+            memcpy(dst + pos, src + start, len);
+            actual = len;
+        }
+        pos += actual;
+    }
+    offsets[chunks] = pos;
+    return pos;
+}
+
+zx_status_t CompressedChunkRange(const void* compressed, uint64_t compressed_size,
+                                 uint64_t blob_size, uint64_t first, uint64_t last,
+                                 uint64_t* start, uint64_t* end) {
+    const uint64_t* offsets = static_cast<const uint64_t*>(compressed);
+    zx_status_t status;
+    if ((status = CheckChunkRange(offsets, compressed_size, blob_size, first, last)) != ZX_OK) {
+        return status;
+    }
+    *start = offsets[first];
+    *end = offsets[last];
+    return ZX_OK;
+}
+
+zx_status_t DecompressBlobChunks(const void* compressed, uint64_t compressed_size,
+                                 uint64_t blob_size, uint64_t first, uint64_t last,
+                                 void* data) {
+    const uint8_t* src = static_cast<const uint8_t*>(compressed);
+    const uint64_t* offsets = static_cast<const uint64_t*>(compressed);
+    uint8_t* dst = static_cast<uint8_t*>(data);
+
+    zx_status_t status;
+    if ((status = CheckChunkRange(offsets, compressed_size, blob_size, first, last)) != ZX_OK) {
+        return status;
+    }
+
+    for (uint64_t n = first; n < last; n++) {
+        if (offsets[n + 1] < offsets[n]) {
+            return ZX_ERR_IO_DATA_INTEGRITY;
+        }
+        const uint64_t stored = offsets[n + 1] - offsets[n];
+        const uint64_t len = ChunkLength(blob_size, n);
+        uint8_t* chunk = dst + n * kCompressionChunkSize;
+        if (stored == len) {
+            memcpy(chunk, src + offsets[n], len);
+        } else if (stored > len ||
+                   LZ4_decompress_safe(reinterpret_cast<const char*>(src + offsets[n]),
+                                       reinterpret_cast<char*>(chunk),
+                                       static_cast<int>(stored),
+                                       static_cast<int>(len)) != static_cast<int>(len)) {
+            return ZX_ERR_IO_DATA_INTEGRITY;
+        }
+    }
+    return ZX_OK;
+}
+
+} // namespace blobstore
@@ -23,6 +23,7 @@
 
 #define MXDEBUG 0
 
+#include <blobstore/compression.h>
 #include <blobstore/format.h>
 #include <blobstore/fsck.h>
 #include <blobstore/host.h>
@@ -189,11 +190,31 @@ zx_status_t blobstore_add_blob(Blobstore* bs, int data_fd) {
     inode_block->SetSize(s.st_size);
     blobstore_inode_t* inode = inode_block->GetInode();
 
+    // Store the data compressed if that takes fewer blocks. The buffer is
+    // zeroed up to a whole block, since it is written out a block at a time.
+    const void* stored_data = blob_data;
+    fbl::unique_ptr<uint8_t[]> compressed;
+    if (BlobDataBlocks(*inode) > 1) {
+        size_t bound = fbl::round_up(CompressedBlobBound(s.st_size), kBlobstoreBlockSize);
+        compressed.reset(new (&ac) uint8_t[bound]);
+        if (!ac.check()) {
+            return ZX_ERR_NO_MEMORY;
+        }
+        memset(compressed.get(), 0, bound);
+        uint64_t size = CompressBlob(blob_data, s.st_size, compressed.get());
+        uint64_t stored_blocks = fbl::round_up(size, kBlobstoreBlockSize) / kBlobstoreBlockSize;
+        if (stored_blocks < BlobDataBlocks(*inode)) {
+            inode->num_blocks = MerkleTreeBlocks(*inode) + stored_blocks;
+            inode->flags |= kBlobInodeFlagLZ4Compressed;
+            stored_data = compressed.get();
+        }
+    }
+
     if ((status = bs->AllocateBlocks(inode->num_blocks,
                                      reinterpret_cast<size_t*>(&inode->start_block))) != ZX_OK) {
         fprintf(stderr, "error: No blocks available\n");
         return status;
-    } else if ((status = bs->WriteData(inode, merkle_tree.get(), blob_data)) != ZX_OK) {
+    } else if ((status = bs->WriteData(inode, merkle_tree.get(), stored_data)) != ZX_OK) {
         return status;
     } else if ((status = bs->WriteBitmap(inode->num_blocks, inode->start_block)) != ZX_OK) {
         return status;
@@ -221,6 +242,7 @@ zx_status_t blobstore_fsck(fbl::unique_fd fd, off_t start, off_t end,
 
 void InodeBlock::SetSize(size_t size) {
     inode_->blob_size = size;
+    inode_->flags = 0;
     inode_->num_blocks = MerkleTreeBlocks(*inode_) + BlobDataBlocks(*inode_);
 }
 
@@ -384,7 +406,8 @@ zx_status_t Blobstore::WriteNode(fbl::unique_ptr<InodeBlock> ino_block) {
     return WriteBlock(cache_.bno, cache_.blk);
 }
 
-zx_status_t Blobstore::WriteData(blobstore_inode_t* inode, void* merkle_data, void* blob_data) {
+zx_status_t Blobstore::WriteData(blobstore_inode_t* inode, const void* merkle_data,
+                                 const void* blob_data) {
     for (size_t n = 0; n < MerkleTreeBlocks(*inode); n++) {
         const void* data = fs::GetBlock<kBlobstoreBlockSize>(merkle_data, n);
         uint64_t bno = data_start_block_ + inode->start_block + n;
@@ -394,7 +417,8 @@ zx_status_t Blobstore::WriteData(blobstore_inode_t* inode, void* merkle_data, vo
         }
     }
 
-    for (size_t n = 0; n < BlobDataBlocks(*inode); n++) {
+    // Compressed blobs store fewer blocks than BlobDataBlocks().
+    for (size_t n = 0; n < inode->num_blocks - MerkleTreeBlocks(*inode); n++) {
         const void* data = fs::GetBlock<kBlobstoreBlockSize>(blob_data, n);
 
         // If we try to write a block, will it be reaching beyond the end of the
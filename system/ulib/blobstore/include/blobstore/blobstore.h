@@ -12,6 +12,7 @@
 #endif
 
 #include <bitmap/raw-bitmap.h>
+#include <bitmap/storage.h>
 #include <digest/digest.h>
 #include <fbl/algorithm.h>
 #include <fbl/intrusive_double_list.h>
@@ -31,6 +32,7 @@
 #include <block-client/client.h>
 #include <fs/mapped-vmo.h>
 #include <trace/event.h>
+#include <zircon/device/vfs.h>
 #include <zx/event.h>
 #include <zx/vmo.h>
 
@@ -69,6 +71,10 @@ constexpr BlobFlags kBlobOtherMask        = 0x0000FF00;
 
 // clang-format on
 
+// The default number of bytes of closed blobs which are kept in memory, so
+// that reopening them doesn't read them from disk again.
+constexpr uint64_t kBlobCacheDefaultBudget = 64 * (1 << 20);
+
 class VnodeBlob final : public fs::Vnode {
 public:
     // Intrusive methods and structures
@@ -76,6 +82,10 @@ public:
     struct TypeWavlTraits {
         static WAVLTreeNodeState& node_state(VnodeBlob& b) { return b.type_wavl_state_; }
     };
+    using LruNodeState = fbl::DoublyLinkedListNodeState<fbl::RefPtr<VnodeBlob>>;
+    struct TypeLruTraits {
+        static LruNodeState& node_state(VnodeBlob& b) { return b.type_lru_state_; }
+    };
     const uint8_t* GetKey() const {
         return &digest_[0];
     };
@@ -107,6 +117,9 @@ public:
 
     uint64_t SizeData() const;
 
+    // The number of bytes of memory committed to the blob's VMOs.
+    uint64_t SizeResident() const;
+
     // Constructs the "directory" blob
     VnodeBlob(fbl::RefPtr<Blobstore> bs);
     // Constructs actual blobs
@@ -114,7 +127,9 @@ public:
     virtual ~VnodeBlob();
 
 private:
+    friend class Blobstore;
     friend struct TypeWavlTraits;
+    friend struct TypeLruTraits;
 
     DISALLOW_COPY_ASSIGN_AND_MOVE(VnodeBlob);
 
@@ -147,6 +162,8 @@ private:
     zx_status_t GetHandles(uint32_t flags, zx_handle_t* hnd, uint32_t* type,
                            zxrio_object_info_t* extra) final;
     zx_status_t ValidateFlags(uint32_t flags) final;
+    zx_status_t Open(uint32_t flags, fbl::RefPtr<Vnode>* out_redirect) final;
+    zx_status_t Close() final;
     zx_status_t Readdir(fs::vdircookie_t* cookie, void* dirents, size_t len,
                         size_t* out_actual) final;
     zx_status_t Read(void* data, size_t len, size_t off, size_t* out_actual) final;
@@ -163,19 +180,31 @@ private:
     zx_status_t Mmap(int flags, size_t len, size_t* off, zx_handle_t* out) final;
     zx_status_t Sync() final;
 
-    // Read both VMOs into memory, if we haven't already.
+    // Create the blob's VMO and read the Merkle tree into it, if we haven't
+    // already. Data blocks are left for LoadAndVerify() to read on demand.
     //
     // TODO(ZX-1481): When we have can register the Blob Store as a pager
     // service, and it can properly handle pages faults on a vnode's contents,
-    // then we can avoid reading the entire blob up-front. Until then, read
-    // the contents of a VMO into memory when it is opened.
+    // then mapped blobs can be loaded on demand too. Until then, CopyVmo()
+    // loads the whole blob.
     zx_status_t InitVmos();
 
-    // Verify the integrity of the in-memory Blob.
-    // InitVmos() must have already been called for this blob.
-    zx_status_t Verify() const;
+    // Read the data blocks covering [offset, offset + length) which have not
+    // yet been verified, decompressing them if needed, and verify them against
+    // the Merkle tree. InitVmos() must have already been called for this blob.
+    zx_status_t LoadAndVerify(uint64_t offset, uint64_t length);
+
+    // Verify the integrity of [offset, offset + length) of the in-memory Blob.
+    // The data and Merkle tree covering the range must be in memory.
+    zx_status_t Verify(uint64_t offset, uint64_t length) const;
+
+    // Mark every data block of the blob as loaded and verified.
+    zx_status_t SetAllVerified();
 
     zx_status_t WriteShared(WriteTxn* txn, size_t start, size_t len, uint64_t start_block);
+    // Write the blob's data to disk once it has all arrived, compressed if
+    // that takes fewer blocks. Frees any blocks which end up unused.
+    zx_status_t WriteData(WriteTxn* txn);
     // Called by Blob once the last write has completed, updating the
     // on-disk metadata.
     zx_status_t WriteMetadata();
@@ -185,6 +214,8 @@ private:
     void* GetMerkle() const;
 
     WAVLTreeNodeState type_wavl_state_{};
+    // Set while the blob is closed and kept in the blob cache.
+    LruNodeState type_lru_state_{};
 
     const fbl::RefPtr<Blobstore> blobstore_;
     BlobFlags flags_{};
@@ -194,12 +225,25 @@ private:
     // 2) The Blob itself, aligned to the nearest kBlobstoreBlockSize
     fbl::unique_ptr<MappedVmo> blob_{};
     vmoid_t vmoid_{};
+    // For compressed blobs, the data blocks as stored on disk. Only the chunk
+    // offset table and the chunks which have been read are valid.
+    fbl::unique_ptr<MappedVmo> compressed_{};
+    vmoid_t compressed_vmoid_{};
+    // Blocks of compressed_ read from disk so far, including the chunk table.
+    uint64_t compressed_blocks_read_{};
+    // One bit per data block: set once the block is in blob_ and has been
+    // checked against the Merkle tree.
+    bitmap::RawBitmapGeneric<bitmap::DefaultStorage> verified_{};
 
     zx::event readable_event_{};
     uint64_t bytes_written_{};
     uint8_t digest_[Digest::kLength]{};
 
     size_t map_index_{};
+    // The number of open connections to the blob.
+    uint32_t fd_count_{};
+    // The number of bytes charged to the blob cache while the blob is in it.
+    uint64_t cache_bytes_{};
 };
 
 // We need to define this structure to allow the Blob to be indexable by a key
@@ -250,9 +294,26 @@ public:
     // Removes blob from 'active' hashmap.
     zx_status_t ReleaseBlob(VnodeBlob* blob);
 
+    // Keeps a closed, readable blob in memory, evicting the least recently
+    // closed blobs until the cache fits within its budget.
+    void CacheBlob(VnodeBlob* blob);
+
+    // Removes a blob from the cache, if it is there, because it has been
+    // reopened or unlinked. Reopening a blob counts as a cache hit if it was
+    // there, or a miss if its data has to be read from disk again.
+    void UncacheBlob(VnodeBlob* blob, bool reopened);
+
+    // Evicts the least recently closed blobs until at most |budget| bytes of
+    // them remain in memory. Returns the number of bytes released.
+    uint64_t EvictBlobs(uint64_t budget);
+
+    void SetCacheBudget(uint64_t budget);
+    void GetCacheInfo(vfs_blob_cache_info_t* info) const;
+
     zx_status_t Readdir(fs::vdircookie_t* cookie, void* dirents, size_t len, size_t* out_actual);
 
     zx_status_t AttachVmo(zx_handle_t vmo, vmoid_t* out);
+    zx_status_t DetachVmo(vmoid_t vmoid);
     zx_status_t Txn(block_fifo_request_t* requests, size_t count) {
         TRACE_DURATION("blobstore", "Blobstore::Txn", "count", count);
         return block_fifo_txn(fifo_client_, requests, count);
@@ -315,6 +376,17 @@ private:
                                             VnodeBlob::TypeWavlTraits>;
     WAVLTreeByMerkle hash_{}; // Map of all 'in use' blobs
 
+    // Closed blobs which are kept in memory, least recently closed first. The
+    // list holds a reference to each blob, which keeps it in |hash_|.
+    using BlobCache = fbl::DoublyLinkedList<fbl::RefPtr<VnodeBlob>, VnodeBlob::TypeLruTraits>;
+    BlobCache cache_{};
+    uint64_t cache_budget_ = kBlobCacheDefaultBudget;
+    uint64_t cache_resident_{};
+    uint64_t cache_count_{};
+    uint64_t cache_hits_{};
+    uint64_t cache_misses_{};
+    uint64_t cache_evictions_{};
+
     fbl::unique_fd blockfd_;
     block_info_t block_info_{};
     fifo_client_t* fifo_client_{};
@@ -0,0 +1,41 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+// This file contains the LZ4 chunk compression shared between host
+// and target implementations of Blobstore. See format.h for the layout.
+
+#pragma once
+
+#include <zircon/types.h>
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace blobstore {
+
+// The largest compressed form of |blob_size| bytes: the chunk offset table
+// followed by every chunk stored as-is.
+uint64_t CompressedBlobBound(uint64_t blob_size);
+
+// Compresses |blob_size| bytes of |data| into |out|, which must hold at least
+// CompressedBlobBound(blob_size) bytes. Returns the number of bytes of |out|
+// used.
+uint64_t CompressBlob(const void* data, uint64_t blob_size, void* out);
+
+// Finds the bytes [*start, *end) of a compressed blob which hold chunks
+// [first, last). Only the offset table of |compressed| need be present.
+zx_status_t CompressedChunkRange(const void* compressed, uint64_t compressed_size,
+                                 uint64_t blob_size, uint64_t first, uint64_t last,
+                                 uint64_t* start, uint64_t* end);
+
+// Decompresses chunks [first, last) of a compressed blob into |data|, which
+// holds the whole uncompressed blob. Only the offset table and the bytes
+// reported by CompressedChunkRange() need be present in |compressed|.
+//
+// Returns ZX_ERR_IO_DATA_INTEGRITY if the compressed blob is malformed.
+zx_status_t DecompressBlobChunks(const void* compressed, uint64_t compressed_size,
+                                 uint64_t blob_size, uint64_t first, uint64_t last,
+                                 void* data);
+
+} // namespace blobstore
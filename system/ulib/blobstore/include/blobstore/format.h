@@ -23,7 +23,7 @@ namespace blobstore {
 
 constexpr uint64_t kBlobstoreMagic0  = (0xac2153479e694d21ULL);
 constexpr uint64_t kBlobstoreMagic1  = (0x985000d4d4d3d314ULL);
-constexpr uint32_t kBlobstoreVersion = 0x00000004;
+constexpr uint32_t kBlobstoreVersion = 0x00000005;
 
 constexpr uint32_t kBlobstoreFlagClean      = 1;
 constexpr uint32_t kBlobstoreFlagDirty      = 2;
@@ -114,9 +114,13 @@ typedef struct {
     uint64_t start_block;
     uint64_t num_blocks;
     uint64_t blob_size;
-    uint64_t reserved;
+    uint32_t flags;
+    uint32_t reserved;
 } blobstore_inode_t;
 
+// Inode flags
+constexpr uint32_t kBlobInodeFlagLZ4Compressed = 1; // Data blocks hold LZ4 chunks
+
 static_assert(sizeof(blobstore_inode_t) == kBlobstoreInodeSize,
               "Blobstore Inode size is wrong");
 static_assert(kBlobstoreBlockSize % kBlobstoreInodeSize == 0,
@@ -127,4 +131,29 @@ constexpr uint64_t BlobDataBlocks(const blobstore_inode_t& blobNode) {
     return fbl::round_up(blobNode.blob_size, kBlobstoreBlockSize) / kBlobstoreBlockSize;
 }
 
+// A compressed blob splits its data into chunks of kCompressionChunkSize bytes
+// (the last may be shorter), each compressed independently with LZ4 so that a
+// read only has to decompress the chunks it touches. Its data blocks hold:
+//
+//   uint64_t offsets[chunk count + 1];
+//   chunk data...
+//
+// where chunk n lives at bytes [offsets[n], offsets[n + 1]) of the data
+// blocks. A chunk which LZ4 can't shrink is stored as-is, and is recognized
+// by its stored size matching its uncompressed size. The Merkle tree always
+// covers the uncompressed data.
+constexpr uint64_t kCompressionChunkSize = 8 * kBlobstoreBlockSize;
+
+static_assert(kCompressionChunkSize % kBlobstoreBlockSize == 0,
+              "Compression chunks should cover whole blocks");
+
+constexpr uint64_t CompressedChunkCount(uint64_t blob_size) {
+    return fbl::round_up(blob_size, kCompressionChunkSize) / kCompressionChunkSize;
+}
+
+// Size of the chunk offset table at the start of a compressed blob
+constexpr uint64_t CompressedHeaderSize(uint64_t blob_size) {
+    return (CompressedChunkCount(blob_size) + 1) * sizeof(uint64_t);
+}
+
 } // namespace blobstore
@@ -80,7 +80,10 @@ public:
     // Allocate |nblocks| starting at |*blkno_out| in memory
     zx_status_t AllocateBlocks(size_t nblocks, size_t* blkno_out);
 
-    zx_status_t WriteData(blobstore_inode_t* inode, void* merkle_data, void* blob_data);
+    // Writes the Merkle tree and the data as stored, which is compressed if
+    // the inode is flagged as such.
+    zx_status_t WriteData(blobstore_inode_t* inode, const void* merkle_data,
+                          const void* blob_data);
     zx_status_t WriteBitmap(size_t nblocks, size_t start_block);
     zx_status_t WriteNode(fbl::unique_ptr<InodeBlock> ino_block);
     zx_status_t WriteInfo();
@@ -12,6 +12,7 @@ MODULE_NAME := blobstore
 
 COMMON_SRCS := \
     $(LOCAL_DIR)/common.cpp \
+    $(LOCAL_DIR)/compression.cpp \
     $(LOCAL_DIR)/fsck.cpp \
 
 # app main
@@ -27,6 +28,7 @@ MODULE_STATIC_LIBS := \
     system/ulib/async.loop \
     system/ulib/block-client \
     system/ulib/digest \
+    third_party/ulib/lz4 \
     third_party/ulib/uboringssl \
     system/ulib/trace \
     system/ulib/zx \
@@ -53,6 +55,7 @@ MODULE_TYPE := hostlib
 MODULE_SRCS := \
     $(COMMON_SRCS) \
     $(LOCAL_DIR)/host.cpp \
+    third_party/ulib/lz4/lz4.c \
 
 MODULE_COMPILEFLAGS := \
     -Werror-implicit-function-declaration \
@@ -63,6 +66,8 @@ MODULE_COMPILEFLAGS := \
     -Isystem/ulib/fs/include \
     -Isystem/ulib/fdio/include \
     -Isystem/ulib/bitmap/include \
+    -Ithird_party/ulib/lz4/include \
+    -Ithird_party/ulib/lz4/include/lz4 \
 
 MODULE_DEFINES := DISABLE_THREAD_ANNOTATIONS
 
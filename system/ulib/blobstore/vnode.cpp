@@ -31,11 +31,10 @@ namespace blobstore {
 VnodeBlob::~VnodeBlob() {
     blobstore_->ReleaseBlob(this);
     if (blob_ != nullptr) {
-        block_fifo_request_t request;
-        request.txnid = blobstore_->TxnId();
-        request.vmoid = vmoid_;
-        request.opcode = BLOCKIO_CLOSE_VMO;
-        blobstore_->Txn(&request, 1);
+        blobstore_->DetachVmo(vmoid_);
+    }
+    if (compressed_ != nullptr) {
+        blobstore_->DetachVmo(compressed_vmoid_);
     }
 }
 
@@ -54,6 +53,24 @@ zx_status_t VnodeBlob::ValidateFlags(uint32_t flags) {
     return ZX_OK;
 }
 
+zx_status_t VnodeBlob::Open(uint32_t flags, fbl::RefPtr<Vnode>* out_redirect) {
+    if (fd_count_++ == 0) {
+        blobstore_->UncacheBlob(this, true);
+    }
+    return ZX_OK;
+}
+
+zx_status_t VnodeBlob::Close() {
+    ZX_DEBUG_ASSERT(fd_count_ > 0);
+    // Keep the last closed blobs which have been read in memory, in case they
+    // are opened again soon.
+    if (--fd_count_ == 0 && !IsDirectory() && GetState() == kBlobStateReadable &&
+        !DeletionQueued() && blob_ != nullptr) {
+        blobstore_->CacheBlob(this);
+    }
+    return ZX_OK;
+}
+
 zx_status_t VnodeBlob::Readdir(fs::vdircookie_t* cookie, void* dirents, size_t len,
                                size_t* out_actual) {
     if (!IsDirectory()) {
@@ -147,6 +164,8 @@ zx_status_t VnodeBlob::Create(fbl::RefPtr<fs::Vnode>* out, fbl::StringPiece name
     if ((status = blobstore_->NewBlob(digest, &vn)) != ZX_OK) {
         return status;
     }
+    // The VFS doesn't Open() a newly created vnode, but will Close() it.
+    vn->fd_count_ = 1;
     *out = fbl::move(vn);
     return ZX_OK;
 }
@@ -174,6 +193,22 @@ zx_status_t VnodeBlob::Ioctl(uint32_t op, const void* in_buf, size_t in_len, voi
         *out_actual = sizeof(vfs_query_info_t) + strlen(kFsName);
         return ZX_OK;
     }
+    case IOCTL_VFS_GET_BLOB_CACHE_INFO: {
+        if (out_len < sizeof(vfs_blob_cache_info_t)) {
+            return ZX_ERR_INVALID_ARGS;
+        }
+        blobstore_->GetCacheInfo(static_cast<vfs_blob_cache_info_t*>(out_buf));
+        *out_actual = sizeof(vfs_blob_cache_info_t);
+        return ZX_OK;
+    }
+    case IOCTL_VFS_SET_BLOB_CACHE_BUDGET: {
+        if (in_len != sizeof(uint64_t)) {
+            return ZX_ERR_INVALID_ARGS;
+        }
+        blobstore_->SetCacheBudget(*static_cast<const uint64_t*>(in_buf));
+        *out_actual = 0;
+        return ZX_OK;
+    }
     case IOCTL_VFS_UNMOUNT_FS: {
         zx_status_t status = Sync();
         if (status != ZX_OK) {
@@ -229,6 +264,8 @@ zx_status_t VnodeBlob::Unlink(fbl::StringPiece name, bool must_be_dir) {
         return status;
     }
     out->QueueUnlink();
+    // A closed blob kept in memory can be released as soon as it is unlinked.
+    blobstore_->UncacheBlob(out.get(), false);
     return ZX_OK;
 }
 
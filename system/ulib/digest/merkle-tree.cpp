@@ -4,6 +4,7 @@
 
 #include <digest/merkle-tree.h>
 
+#include <pthread.h>
 #include <stdint.h>
 #include <string.h>
 
@@ -94,6 +95,104 @@ size_t NextAligned(size_t length) {
     return fbl::round_up(NextLength(length), MerkleTree::kNodeSize);
 }
 
+////////
+// Helper functions for hashing many nodes of a level at once.
+
+// The fewest nodes worth giving a thread of their own.  Below this, starting
+// the thread costs more than hashing the nodes on the calling thread.
+const size_t kMinNodesPerThread = 64;
+
+// A level of the tree, and what to do with its nodes' digests: either write
+// them to |out|, or compare them to those already in |tree|.
+struct Level {
+    const uint8_t* data;
+    size_t data_len;
+    uint64_t level;
+    uint8_t* out;
+    const uint8_t* tree;
+};
+
+// Hashes nodes [first, last) of |level|.
+zx_status_t HashNodes(const Level& level, size_t first, size_t last) {
+    zx_status_t rc;
+    Digest digest;
+    for (size_t i = first; i < last; ++i) {
+        size_t offset = i * MerkleTree::kNodeSize;
+        size_t length = level.data_len - offset;
+        if ((rc = DigestInit(&digest, offset | level.level, length)) != ZX_OK) {
+            return rc;
+        }
+        offset += DigestUpdate(&digest, level.data + offset, offset, length);
+        DigestFinal(&digest, offset);
+        if (level.out) {
+            digest.CopyTo(level.out + (i * Digest::kLength), Digest::kLength);
+        } else if (digest != level.tree + (i * Digest::kLength)) {
+            return ZX_ERR_IO_DATA_INTEGRITY;
+        }
+    }
+    return ZX_OK;
+}
+
+// The share of a level hashed by one thread.
+struct NodeRange {
+    const Level* level;
+    size_t first;
+    size_t last;
+    zx_status_t rc;
+};
+
+void* HashNodeRange(void* arg) {
+    NodeRange* range = static_cast<NodeRange*>(arg);
+    range->rc = HashNodes(*range->level, range->first, range->last);
+    return nullptr;
+}
+
+// Hashes nodes [first, last) of |level|, splitting them evenly across up to
+// |num_threads| threads, the calling thread included.  Ranges which can't get a
+// thread of their own are hashed on the calling thread.
+zx_status_t HashNodesParallel(const Level& level, size_t first, size_t last,
+                              size_t num_threads) {
+    size_t nodes = last - first;
+    num_threads = fbl::min(num_threads, nodes / kMinNodesPerThread);
+    if (num_threads <= 1) {
+        return HashNodes(level, first, last);
+    }
+    fbl::AllocChecker ac;
+    fbl::unique_ptr<NodeRange[]> ranges(new (&ac) NodeRange[num_threads]);
+    if (!ac.check()) {
+        return ZX_ERR_NO_MEMORY;
+    }
+    fbl::unique_ptr<pthread_t[]> threads(new (&ac) pthread_t[num_threads]);
+    if (!ac.check()) {
+        return ZX_ERR_NO_MEMORY;
+    }
+    for (size_t i = 0; i < num_threads; ++i) {
+        ranges[i].level = &level;
+        ranges[i].first = first + (nodes * i) / num_threads;
+        ranges[i].last = first + (nodes * (i + 1)) / num_threads;
+        ranges[i].rc = ZX_OK;
+    }
+    // The first range is left for this thread.
+    size_t started = 1;
+    while (started < num_threads &&
+           pthread_create(&threads[started], nullptr, HashNodeRange, &ranges[started]) == 0) {
+        ++started;
+    }
+    HashNodeRange(&ranges[0]);
+    for (size_t i = started; i < num_threads; ++i) {
+        HashNodeRange(&ranges[i]);
+    }
+    for (size_t i = 1; i < started; ++i) {
+        pthread_join(threads[i], nullptr);
+    }
+    for (size_t i = 0; i < num_threads; ++i) {
+        if (ranges[i].rc != ZX_OK) {
+            return ranges[i].rc;
+        }
+    }
+    return ZX_OK;
+}
+
 } // namespace
 
 ////////
@@ -116,6 +215,49 @@ zx_status_t MerkleTree::Create(const void* data, size_t data_len, void* tree, si
     return ZX_OK;
 }
 
+zx_status_t MerkleTree::CreateParallel(const void* data, size_t data_len, void* tree,
+                                       size_t tree_len, Digest* digest, size_t num_threads) {
+    // With a single node or a single thread, there's nothing to split.
+    if (data_len <= kNodeSize || num_threads <= 1) {
+        return Create(data, data_len, tree, tree_len, digest);
+    }
+    if (tree_len < GetTreeLength(data_len)) {
+        return ZX_ERR_BUFFER_TOO_SMALL;
+    }
+    if (!data || !tree || !digest) {
+        return ZX_ERR_INVALID_ARGS;
+    }
+    // Each level must be complete before the next one up can be hashed, so
+    // the levels are done one at a time, starting from the data.
+    zx_status_t rc;
+    Level level = {static_cast<const uint8_t*>(data), data_len, 0,
+                   static_cast<uint8_t*>(tree), nullptr};
+    while (level.data_len > kNodeSize) {
+        size_t nodes = fbl::round_up(level.data_len, kNodeSize) / kNodeSize;
+        size_t next_len = NextAligned(level.data_len);
+        // Pad the last node of the next level up with zeros, as Create() does.
+        memset(level.out + (nodes * Digest::kLength), 0, next_len - (nodes * Digest::kLength));
+        if ((rc = HashNodesParallel(level, 0, nodes, num_threads)) != ZX_OK) {
+            return rc;
+        }
+        // Ascend the tree.
+        level.data = level.out;
+        level.data_len = next_len;
+        level.out += next_len;
+        ++level.level;
+    }
+    // The top level is a single node, whose digest is the root.
+    Digest root;
+    if ((rc = DigestInit(&root, level.level, level.data_len)) != ZX_OK) {
+        return rc;
+    }
+    DigestUpdate(&root, level.data, 0, level.data_len);
+    DigestFinal(&root, level.data_len);
+    *digest = root.AcquireBytes();
+    root.ReleaseBytes();
+    return ZX_OK;
+}
+
 MerkleTree::MerkleTree() : initialized_(false), next_(nullptr), level_(0), offset_(0), length_(0) {}
 
 MerkleTree::~MerkleTree() {}
@@ -246,12 +388,19 @@ zx_status_t MerkleTree::CreateFinalInternal(const void* data, void* tree, Digest
 
 zx_status_t MerkleTree::Verify(const void* data, size_t data_len, const void* tree, size_t tree_len,
                                size_t offset, size_t length, const Digest& root) {
+    return VerifyParallel(data, data_len, tree, tree_len, offset, length, root, 1);
+}
+
+zx_status_t MerkleTree::VerifyParallel(const void* data, size_t data_len, const void* tree,
+                                       size_t tree_len, size_t offset, size_t length,
+                                       const Digest& root, size_t num_threads) {
     uint64_t level = 0;
     size_t root_len = data_len;
     while (data_len > kNodeSize) {
         zx_status_t rc;
         // Verify the data in this level.
-        if ((rc = VerifyLevel(data, data_len, tree, offset, length, level)) != ZX_OK) {
+        if ((rc = VerifyLevel(data, data_len, tree, offset, length, level, num_threads)) !=
+            ZX_OK) {
             return rc;
         }
         // Ascend to the next level up.
@@ -263,8 +412,13 @@ zx_status_t MerkleTree::Verify(const void* data, size_t data_len, const void* tr
             return ZX_ERR_BUFFER_TOO_SMALL;
         }
         tree_len -= data_len;
+        // Ascend to the digests of the nodes just checked.  Align to node
+        // boundaries first, so that a range smaller than a node still covers
+        // its node's digest in the level above.
+        size_t finish = fbl::round_up(offset + length, kNodeSize);
+        offset -= offset % kNodeSize;
+        length = (finish - offset) / kDigestsPerNode;
         offset /= kDigestsPerNode;
-        length /= kDigestsPerNode;
         ++level;
     }
     return VerifyRoot(data, root_len, level, root);
@@ -289,8 +443,8 @@ zx_status_t MerkleTree::VerifyRoot(const void* data, size_t root_len, uint64_t l
 }
 
 zx_status_t MerkleTree::VerifyLevel(const void* data, size_t data_len, const void* tree,
-                                    size_t offset, size_t length, uint64_t level) {
-    zx_status_t rc;
+                                    size_t offset, size_t length, uint64_t level,
+                                    size_t num_threads) {
     ZX_DEBUG_ASSERT(offset + length >= offset);
     // Must have more than one node of data and digests to check against.
     if (!data || data_len <= kNodeSize || !tree) {
@@ -301,29 +455,12 @@ zx_status_t MerkleTree::VerifyLevel(const void* data, size_t data_len, const voi
         return ZX_ERR_OUT_OF_RANGE;
     }
     // Align parameters to node boundaries, but don't exceed data_len
-    offset -= offset % kNodeSize;
-    size_t finish = fbl::round_up(offset + length, kNodeSize);
-    length = fbl::min(finish, data_len) - offset;
-    const uint8_t* in = static_cast<const uint8_t*>(data) + offset;
-    // The digests are in the next level up.
-    Digest actual;
-    const uint8_t* expected = static_cast<const uint8_t*>(tree) + (offset / kDigestsPerNode);
-    // Check the data of this level against the digests.
-    while (length > 0) {
-        if ((rc = DigestInit(&actual, offset | level, data_len - offset)) != ZX_OK) {
-            return rc;
-        }
-        size_t chunk = DigestUpdate(&actual, in, offset, length);
-        in += chunk;
-        offset += chunk;
-        length -= chunk;
-        DigestFinal(&actual, offset);
-        if (actual != expected) {
-            return ZX_ERR_IO_DATA_INTEGRITY;
-        }
-        expected += Digest::kLength;
-    }
-    return ZX_OK;
+    size_t first = offset / kNodeSize;
+    size_t last = fbl::round_up(fbl::min(offset + length, data_len), kNodeSize) / kNodeSize;
+    // Check the data of this level against the digests in the next level up.
+    Level check = {static_cast<const uint8_t*>(data), data_len, level, nullptr,
+                   static_cast<const uint8_t*>(tree)};
+    return HashNodesParallel(check, first, last, num_threads);
 }
 
 } // namespace digest
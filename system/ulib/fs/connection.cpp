@@ -490,7 +490,8 @@ zx_status_t Connection::HandleMessage(zxrio_msg_t* msg) {
         case IOCTL_VFS_UNMOUNT_NODE:
         case IOCTL_VFS_UNMOUNT_FS:
         case IOCTL_VFS_GET_DEVICE_PATH:
-            // Unmounting ioctls require Connection privileges
+        case IOCTL_VFS_SET_BLOB_CACHE_BUDGET:
+            // Unmounting and configuration ioctls require Connection privileges
             if (!(flags_ & ZX_FS_RIGHT_ADMIN)) {
                 return ZX_ERR_ACCESS_DENIED;
             }
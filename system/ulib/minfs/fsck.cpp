@@ -257,6 +257,12 @@ zx_status_t MinfsChecker::CheckDirectory(minfs_inode_t* inode, ino_t ino,
                     FS_TRACE_ERROR("check: ino#%u: de[%u]: '..' ino=%u (not parent!)\n", ino, eno, de->ino);
                 }
             }
+            uint32_t slot;
+            if (!dot_or_dotdot && vn->HasDirIndex() &&
+                (vn->FindDirIndexSlot(fbl::StringPiece(de->name, de->namelen), off,
+                                      &slot) != ZX_OK)) {
+                FS_TRACE_ERROR("check: ino#%u: de[%u]: missing from directory index\n", ino, eno);
+            }
             //TODO: check for cycles (non-dot/dotdot dir ref already in checked bitmap)
             if (flags & CD_DUMP) {
                 xprintf("ino#%u: de[%u]: ino=%u type=%u '%.*s' %s\n", ino, eno, de->ino, de->type,
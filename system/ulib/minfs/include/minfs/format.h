@@ -122,7 +122,11 @@ typedef struct {
     uint32_t seq_num;               // bumped when modified
     uint32_t gen_num;               // bumped when deleted
     uint32_t dirent_count;          // for directories
-    uint32_t rsvd[5];
+    uint32_t dir_index_seq;         // seq_num the hash index matches
+    uint32_t dir_index_slots;       // hash index size, zero if none
+    uint32_t dir_index_used;        // live + removed hash index slots
+    uint32_t dir_index_tail;        // offset of the last dirent record
+    uint32_t dir_index_live;        // bytes of the live dirents
     blk_t dnum[kMinfsDirect];    // direct blocks
     blk_t inum[kMinfsIndirect];  // indirect blocks
     blk_t dinum[kMinfsDoublyIndirect]; // doubly indirect blocks
@@ -176,6 +180,37 @@ static_assert(kMinfsMaxDirectorySize <= kMinfsReclenMask,
 //   record starts. If the MAX_DIR_SIZE is increased, this 'last' record will
 //   also increase in size.
 
+// Large directories carry a hash index of their names, which lives in the
+// directory file itself, starting at kMinfsDirIndexStart (past any dirent).
+// It is an open-addressed table of inode.dir_index_slots slots, probed
+// linearly from (hash & (slots - 1)); every named dirent other than "." and
+// ".." has a slot. Live dirents only move when the index is rebuilt, which
+// packs them at the front of the directory while no one is reading it, so a
+// slot stays valid until its dirent is unlinked or the index is rebuilt.
+//
+// The index is only trusted while inode.dir_index_seq equals inode.seq_num.
+// Any directory change that does not also update the index (e.g. one made by
+// an older driver, which knows nothing of it) leaves the two out of step, and
+// lookups fall back to scanning the dirents until the index is rebuilt.
+typedef struct {
+    uint32_t hash;                  // fnv1a32 of the name
+    uint32_t off;                   // dirent offset, or kMinfsDirIndex{Free,Removed}
+} minfs_dir_slot_t;
+
+constexpr uint32_t kMinfsDirIndexStart      = (1 << 20);
+constexpr uint32_t kMinfsDirIndexMinEntries = 128;
+constexpr uint32_t kMinfsDirIndexMinSlots   = kMinfsBlockSize / sizeof(minfs_dir_slot_t);
+constexpr uint32_t kMinfsDirIndexMaxSlots   = (1 << 18);
+constexpr uint32_t kMinfsDirIndexFree       = 0;          // "." is never indexed
+constexpr uint32_t kMinfsDirIndexRemoved    = 0xFFFFFFFF;
+
+static_assert(kMinfsMaxDirectorySize <= kMinfsDirIndexStart,
+              "MinFS directory index must follow the dirents");
+static_assert(kMinfsDirIndexStart % kMinfsBlockSize == 0,
+              "MinFS directory index must be block aligned");
+static_assert(kMinfsDirIndexMaxSlots >= 4 * (kMinfsMaxDirectorySize / DirentSize(1)),
+              "MinFS directory index must be able to hold every dirent");
+
 
 // blocksize   8K    16K    32K
 // 16 dir =  128K   256K   512K
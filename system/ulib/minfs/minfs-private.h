@@ -324,12 +324,40 @@ private:
 
     // Enumerates directories.
     zx_status_t ForEachDirent(DirArgs* args, const DirentCallback func);
+    // Calls |func| on the dirent named |args->name| only, found through the directory's
+    // hash index when it has one. Otherwise, behaves like |ForEachDirent|.
+    zx_status_t ForNamedDirent(DirArgs* args, const DirentCallback func);
+    // Adds a dirent for |args|, at the end of the directory when it has a hash index.
+    zx_status_t AppendDirent(DirArgs* args);
+    // Commits a dirent modified by a callback, bumping the directory's sequence number.
+    zx_status_t SyncDirent(DirArgs* args);
+
+    // Directory hash index, described in format.h.
+    bool HasDirIndex() const;
+    zx_status_t ReadDirIndexSlot(uint32_t n, minfs_dir_slot_t* slot);
+    // Finds the slot which refers to the dirent |name| at |off|.
+    zx_status_t FindDirIndexSlot(fbl::StringPiece name, size_t off, uint32_t* out);
+    // Adds or removes the slot for the dirent |de| at |off|. If the index cannot be
+    // updated, it is dropped, and lookups scan the directory until it is rebuilt.
+    void DirIndexInsert(WriteTxn* txn, const minfs_dirent_t* de, size_t off);
+    void DirIndexRemove(WriteTxn* txn, const minfs_dirent_t* de, size_t off);
+    // Rebuilds the index from the dirents, sized for the current dirent count.
+    // If the directory isn't open, the dirents are compacted first.
+    zx_status_t BuildDirIndex();
+    // True if at least half of the dirent space before the tail is free, and
+    // compacting it would be worth rebuilding the index.
+    bool DirentsFragmented() const;
+    // Moves every live dirent down over the free space before it, leaving all
+    // of the free space in the last record. Offsets change, so the index
+    // must already have been dropped.
+    zx_status_t CompactDirents();
 
     // Directory callback functions.
     //
     // The following functions are passable to |ForEachDirent|, which reads the parent directory,
     // one dirent at a time, and passes each entry to the callback function, along with the DirArgs
-    // information passed to the initial call of |ForEachDirent|.
+    // information passed to the initial call of |ForEachDirent|. All but |DirentCallbackAppend|
+    // act on the single dirent named by |DirArgs::name|, and may be passed to |ForNamedDirent|.
     static zx_status_t DirentCallbackFind(fbl::RefPtr<VnodeMinfs>, minfs_dirent_t*, DirArgs*,
                                           DirectoryOffset*);
     static zx_status_t DirentCallbackUnlink(fbl::RefPtr<VnodeMinfs>, minfs_dirent_t*, DirArgs*,
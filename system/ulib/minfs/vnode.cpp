@@ -825,11 +825,18 @@ zx_status_t VnodeMinfs::UnlinkChild(WritebackWork* wb,
     if ((status = WriteExactInternal(wb->txn(), de, MINFS_DIRENT_SIZE, off)) != ZX_OK) {
         return status;
     }
+    DirIndexRemove(wb->txn(), de, offs->off);
 
     if (de->reclen & kMinfsReclenLast) {
-        // Truncating the directory merely removed unused space; if it fails,
-        // the directory contents are still valid.
-        TruncateInternal(wb->txn(), off + MINFS_DIRENT_SIZE);
+        if (HasDirIndex()) {
+            // The hash index lives past the dirents, so keep the space, and
+            // append into it next.
+            inode_.dir_index_tail = static_cast<uint32_t>(off);
+        } else {
+            // Truncating the directory merely removed unused space; if it fails,
+            // the directory contents are still valid.
+            TruncateInternal(wb->txn(), off + MINFS_DIRENT_SIZE);
+        }
     }
 
     inode_.dirent_count--;
@@ -980,6 +987,7 @@ zx_status_t VnodeMinfs::DirentCallbackAppend(fbl::RefPtr<VnodeMinfs> vndir, minf
         if (status != ZX_OK) {
             return status;
         }
+        vndir->DirIndexInsert(args->wb->txn(), de, off);
         vndir->inode_.dirent_count++;
         if (args->type == kMinfsTypeDir) {
             // Child directory has '..' which will point to parent directory
@@ -1058,10 +1066,7 @@ zx_status_t VnodeMinfs::ForEachDirent(DirArgs* args, const DirentCallback func)
         case DIR_CB_NEXT:
             break;
         case DIR_CB_SAVE_SYNC:
-            inode_.seq_num++;
-            InodeSync(args->wb->txn(), kMxFsSyncMtime);
-            args->wb->PinVnode(fbl::move(fbl::WrapRefPtr(this)));
-            return ZX_OK;
+            return SyncDirent(args);
         case DIR_CB_DONE:
         default:
             return status;
@@ -1070,6 +1075,410 @@ zx_status_t VnodeMinfs::ForEachDirent(DirArgs* args, const DirentCallback func)
     return ZX_ERR_NOT_FOUND;
 }
 
+zx_status_t VnodeMinfs::ForNamedDirent(DirArgs* args, const DirentCallback func) {
+    if (!HasDirIndex() || args->name == "." || args->name == "..") {
+        return ForEachDirent(args, func);
+    }
+
+    char data[kMinfsMaxDirentSize];
+    minfs_dirent_t* de = (minfs_dirent_t*) data;
+    const uint32_t hash = fnv1a32(args->name.data(), args->name.length());
+    const uint32_t mask = inode_.dir_index_slots - 1;
+    for (uint32_t i = 0; i <= mask; i++) {
+        minfs_dir_slot_t slot;
+        zx_status_t status;
+        if ((status = ReadDirIndexSlot((hash + i) & mask, &slot)) != ZX_OK) {
+            return status;
+        } else if (slot.off == kMinfsDirIndexFree) {
+            return ZX_ERR_NOT_FOUND;
+        } else if (slot.off == kMinfsDirIndexRemoved || slot.hash != hash) {
+            continue;
+        }
+
+        size_t r;
+        if ((status = ReadInternal(data, kMinfsMaxDirentSize, slot.off, &r)) != ZX_OK) {
+            return status;
+        } else if ((status = validate_dirent(de, r, slot.off)) != ZX_OK) {
+            return status;
+        } else if ((de->ino == 0) || fbl::StringPiece(de->name, de->namelen) != args->name) {
+            // Another name with the same hash.
+            continue;
+        }
+
+        // The previous dirent is unknown, so an unlink only coalesces forwards.
+        DirectoryOffset offs = {
+            .off = slot.off,
+            .off_prev = slot.off,
+        };
+        switch ((status = func(fbl::RefPtr<VnodeMinfs>(this), de, args, &offs))) {
+        case DIR_CB_NEXT:
+            return ZX_ERR_NOT_FOUND;
+        case DIR_CB_SAVE_SYNC:
+            return SyncDirent(args);
+        case DIR_CB_DONE:
+        default:
+            return status;
+        }
+    }
+    // Every slot is in use, which the index never allows; don't trust it.
+    return ForEachDirent(args, func);
+}
+
+zx_status_t VnodeMinfs::AppendDirent(DirArgs* args) {
+    // Unlinks through the index leave free records behind which appends at
+    // the tail never reuse, so a directory under churn is compacted along
+    // with the rebuild once most of its dirent space is free.
+    if (HasDirIndex() ? ((inode_.dir_index_used + 1) * 2 > inode_.dir_index_slots) ||
+                        DirentsFragmented() :
+                        inode_.dirent_count >= kMinfsDirIndexMinEntries) {
+        // Without an index, lookups are merely slower; carry on regardless.
+        zx_status_t status = BuildDirIndex();
+        if (status != ZX_OK) {
+            FS_TRACE_WARN("minfs: ino#%u: cannot build directory index: %d\n", ino_, status);
+        }
+    }
+
+    if (HasDirIndex()) {
+        char data[kMinfsMaxDirentSize];
+        minfs_dirent_t* de = (minfs_dirent_t*) data;
+        DirectoryOffset offs = {
+            .off = inode_.dir_index_tail,
+            .off_prev = inode_.dir_index_tail,
+        };
+        size_t r;
+        zx_status_t status = ReadInternal(data, kMinfsMaxDirentSize, offs.off, &r);
+        if (status != ZX_OK) {
+            return status;
+        } else if ((status = validate_dirent(de, r, offs.off)) != ZX_OK) {
+            return status;
+        }
+        if (de->reclen & kMinfsReclenLast) {
+            status = DirentCallbackAppend(fbl::RefPtr<VnodeMinfs>(this), de, args, &offs);
+            if (status == DIR_CB_SAVE_SYNC) {
+                return SyncDirent(args);
+            } else if (status != DIR_CB_NEXT) {
+                return status;
+            }
+        }
+        // The end of the directory is full; look for space freed by unlinks.
+    }
+    return ForEachDirent(args, DirentCallbackAppend);
+}
+
+zx_status_t VnodeMinfs::SyncDirent(DirArgs* args) {
+    // A change which left the index behind has dropped it, so this only
+    // carries forward an index which is still up to date.
+    bool indexed = HasDirIndex();
+    inode_.seq_num++;
+    if (indexed) {
+        inode_.dir_index_seq = inode_.seq_num;
+    }
+    InodeSync(args->wb->txn(), kMxFsSyncMtime);
+    args->wb->PinVnode(fbl::move(fbl::WrapRefPtr(this)));
+    return ZX_OK;
+}
+
+bool VnodeMinfs::HasDirIndex() const {
+    const uint32_t slots = inode_.dir_index_slots;
+    return (slots >= kMinfsDirIndexMinSlots) && (slots <= kMinfsDirIndexMaxSlots) &&
+           ((slots & (slots - 1)) == 0) && (inode_.dir_index_seq == inode_.seq_num) &&
+           (inode_.dir_index_tail < kMinfsMaxDirectorySize) &&
+           (inode_.size >= kMinfsDirIndexStart + slots * sizeof(minfs_dir_slot_t));
+}
+
+zx_status_t VnodeMinfs::ReadDirIndexSlot(uint32_t n, minfs_dir_slot_t* slot) {
+    return ReadExactInternal(slot, sizeof(*slot), kMinfsDirIndexStart + n * sizeof(*slot));
+}
+
+zx_status_t VnodeMinfs::FindDirIndexSlot(fbl::StringPiece name, size_t off, uint32_t* out) {
+    const uint32_t hash = fnv1a32(name.data(), name.length());
+    const uint32_t mask = inode_.dir_index_slots - 1;
+    for (uint32_t i = 0; i <= mask; i++) {
+        minfs_dir_slot_t slot;
+        zx_status_t status;
+        if ((status = ReadDirIndexSlot((hash + i) & mask, &slot)) != ZX_OK) {
+            return status;
+        } else if (slot.off == kMinfsDirIndexFree) {
+            break;
+        } else if ((slot.off == off) && (slot.hash == hash)) {
+            *out = (hash + i) & mask;
+            return ZX_OK;
+        }
+    }
+    return ZX_ERR_NOT_FOUND;
+}
+
+void VnodeMinfs::DirIndexInsert(WriteTxn* txn, const minfs_dirent_t* de, size_t off) {
+    if (!HasDirIndex()) {
+        return;
+    }
+    if (de->reclen & kMinfsReclenLast) {
+        inode_.dir_index_tail = static_cast<uint32_t>(off);
+    }
+    inode_.dir_index_live += DirentSize(de->namelen);
+
+    const uint32_t hash = fnv1a32(de->name, de->namelen);
+    const uint32_t mask = inode_.dir_index_slots - 1;
+    for (uint32_t i = 0; i <= mask; i++) {
+        const uint32_t n = (hash + i) & mask;
+        minfs_dir_slot_t slot;
+        if (ReadDirIndexSlot(n, &slot) != ZX_OK) {
+            break;
+        } else if ((slot.off != kMinfsDirIndexFree) && (slot.off != kMinfsDirIndexRemoved)) {
+            continue;
+        }
+        if (slot.off == kMinfsDirIndexFree) {
+            inode_.dir_index_used++;
+        }
+        slot.hash = hash;
+        slot.off = static_cast<uint32_t>(off);
+        if (WriteExactInternal(txn, &slot, sizeof(slot),
+                               kMinfsDirIndexStart + n * sizeof(slot)) != ZX_OK) {
+            break;
+        }
+        return;
+    }
+    inode_.dir_index_slots = 0;
+}
+
+void VnodeMinfs::DirIndexRemove(WriteTxn* txn, const minfs_dirent_t* de, size_t off) {
+    if (!HasDirIndex()) {
+        return;
+    }
+    inode_.dir_index_live -= DirentSize(de->namelen);
+
+    // Leave the hash behind, so probes for other names carry on past the slot.
+    uint32_t n;
+    minfs_dir_slot_t slot;
+    slot.hash = fnv1a32(de->name, de->namelen);
+    slot.off = kMinfsDirIndexRemoved;
+    if ((FindDirIndexSlot(fbl::StringPiece(de->name, de->namelen), off, &n) != ZX_OK) ||
+        (WriteExactInternal(txn, &slot, sizeof(slot),
+                            kMinfsDirIndexStart + n * sizeof(slot)) != ZX_OK)) {
+        inode_.dir_index_slots = 0;
+    }
+}
+
+// The most directory blocks written by one transaction while compacting the
+// dirents or building an index, leaving room for the block bitmap and
+// indirect blocks they allocate.
+constexpr size_t kDirIndexBlocksPerTxn = 4;
+
+zx_status_t VnodeMinfs::BuildDirIndex() {
+    uint32_t slots = kMinfsDirIndexMinSlots;
+    while ((slots < inode_.dirent_count * 4) && (slots < kMinfsDirIndexMaxSlots)) {
+        slots *= 2;
+    }
+    fbl::AllocChecker ac;
+    fbl::unique_ptr<minfs_dir_slot_t[]> table(new (&ac) minfs_dir_slot_t[slots]());
+    if (!ac.check()) {
+        return ZX_ERR_NO_MEMORY;
+    }
+
+    // Drop any old index before moving dirents or overwriting it, and only
+    // adopt the new one along with its final block, so that an interrupted
+    // build on disk is never mistaken for a valid index.
+    fbl::unique_ptr<WritebackWork> wb(new (&ac) WritebackWork(fs_->bc_.get()));
+    if (!ac.check()) {
+        return ZX_ERR_NO_MEMORY;
+    }
+    inode_.dir_index_slots = 0;
+    InodeSync(wb->txn(), kMxFsSyncDefault);
+    wb->PinVnode(fbl::move(fbl::WrapRefPtr(this)));
+    fs_->EnqueueWork(fbl::move(wb));
+
+    // Readdir cookies hold dirent offsets, so only move dirents while no
+    // one has the directory open.
+    if (fd_count_ == 0) {
+        zx_status_t status = CompactDirents();
+        if (status != ZX_OK) {
+            return status;
+        }
+    }
+
+    // Fill the table in memory, with the same probing used on disk.
+    char data[kMinfsMaxDirentSize];
+    minfs_dirent_t* de = (minfs_dirent_t*) data;
+    uint32_t used = 0;
+    uint32_t live = 0;
+    size_t off = 0;
+    while (true) {
+        if (off + MINFS_DIRENT_SIZE >= kMinfsMaxDirectorySize) {
+            return ZX_ERR_IO;
+        }
+        size_t r;
+        zx_status_t status = ReadInternal(data, kMinfsMaxDirentSize, off, &r);
+        if (status != ZX_OK) {
+            return status;
+        } else if ((status = validate_dirent(de, r, off)) != ZX_OK) {
+            return status;
+        }
+
+        fbl::StringPiece name(de->name, de->namelen);
+        if (de->ino != 0) {
+            live += DirentSize(de->namelen);
+        }
+        if ((de->ino != 0) && (name != ".") && (name != "..")) {
+            if (used * 2 >= slots) {
+                // dirent_count was wrong; fsck will say so.
+                return ZX_ERR_IO_DATA_INTEGRITY;
+            }
+            uint32_t hash = fnv1a32(de->name, de->namelen);
+            uint32_t n = hash & (slots - 1);
+            while (table[n].off != kMinfsDirIndexFree) {
+                n = (n + 1) & (slots - 1);
+            }
+            table[n].hash = hash;
+            table[n].off = static_cast<uint32_t>(off);
+            used++;
+        }
+        if (de->reclen & kMinfsReclenLast) {
+            break;
+        }
+        off += MinfsReclen(de, off);
+    }
+
+    const size_t len = slots * sizeof(minfs_dir_slot_t);
+    const size_t chunk = kDirIndexBlocksPerTxn * kMinfsBlockSize;
+    for (size_t pos = 0; pos < len; pos += chunk) {
+        wb.reset(new (&ac) WritebackWork(fs_->bc_.get()));
+        if (!ac.check()) {
+            inode_.dir_index_slots = 0;
+            return ZX_ERR_NO_MEMORY;
+        }
+        const size_t xfer = fbl::min(chunk, len - pos);
+        if (pos + xfer == len) {
+            inode_.dir_index_seq = inode_.seq_num;
+            inode_.dir_index_slots = slots;
+            inode_.dir_index_used = used;
+            inode_.dir_index_tail = static_cast<uint32_t>(off);
+            inode_.dir_index_live = live;
+        }
+        zx_status_t status = WriteExactInternal(wb->txn(),
+                                                reinterpret_cast<char*>(table.get()) + pos,
+                                                xfer, kMinfsDirIndexStart + pos);
+        if (status != ZX_OK) {
+            inode_.dir_index_slots = 0;
+            return status;
+        }
+        wb->PinVnode(fbl::move(fbl::WrapRefPtr(this)));
+        fs_->EnqueueWork(fbl::move(wb));
+    }
+    return ZX_OK;
+}
+
+bool VnodeMinfs::DirentsFragmented() const {
+    return (fd_count_ == 0) && (inode_.dir_index_tail >= kMinfsBlockSize) &&
+           (inode_.dir_index_tail / 2 >= inode_.dir_index_live);
+}
+
+zx_status_t VnodeMinfs::CompactDirents() {
+    char data[kMinfsMaxDirentSize];
+    minfs_dirent_t* de = (minfs_dirent_t*) data;
+    // The last live dirent placed so far, which becomes the last record if
+    // only free space follows it. "." always comes first, so there is one.
+    char last_data[kMinfsMaxDirentSize];
+    minfs_dirent_t* last_de = (minfs_dirent_t*) last_data;
+    size_t last_off = kMinfsMaxDirectorySize;
+
+    fbl::AllocChecker ac;
+    fbl::unique_ptr<WritebackWork> wb;
+    size_t wb_block = 0;
+    // Starts a new transaction unless the current one already covers the
+    // blocks from |start| to |end|.
+    auto prepare = [&](size_t start, size_t end) -> zx_status_t {
+        if ((wb != nullptr) && (start / kMinfsBlockSize >= wb_block) &&
+            (end / kMinfsBlockSize < wb_block + kDirIndexBlocksPerTxn)) {
+            return ZX_OK;
+        }
+        if (wb != nullptr) {
+            wb->PinVnode(fbl::move(fbl::WrapRefPtr(this)));
+            fs_->EnqueueWork(fbl::move(wb));
+        }
+        wb.reset(new (&ac) WritebackWork(fs_->bc_.get()));
+        if (!ac.check()) {
+            return ZX_ERR_NO_MEMORY;
+        }
+        wb_block = start / kMinfsBlockSize;
+        return ZX_OK;
+    };
+
+    size_t src = 0;
+    size_t dst = 0;
+    zx_status_t status;
+    while (true) {
+        if (src + MINFS_DIRENT_SIZE >= kMinfsMaxDirectorySize) {
+            return ZX_ERR_IO;
+        }
+        size_t r;
+        if ((status = ReadInternal(data, kMinfsMaxDirentSize, src, &r)) != ZX_OK) {
+            return status;
+        } else if ((status = validate_dirent(de, r, src)) != ZX_OK) {
+            return status;
+        }
+        const bool last = de->reclen & kMinfsReclenLast;
+        const size_t next = src + MinfsReclen(de, src);
+
+        if (de->ino == 0) {
+            if (!last) {
+                src = next;
+                continue;
+            }
+            if (last_off == kMinfsMaxDirectorySize) {
+                return ZX_ERR_IO;
+            }
+            last_de->reclen = DirentSize(last_de->namelen) | kMinfsReclenLast;
+            if ((status = prepare(last_off, last_off + MINFS_DIRENT_SIZE)) != ZX_OK) {
+                return status;
+            } else if ((status = WriteExactInternal(wb->txn(), last_de, MINFS_DIRENT_SIZE,
+                                                    last_off)) != ZX_OK) {
+                return status;
+            }
+            break;
+        }
+
+        // Whatever lies between this dirent and the next one becomes a free
+        // record, unless it is too small to hold one.
+        size_t reclen = DirentSize(de->namelen);
+        size_t gap = last ? 0 : next - (dst + reclen);
+        if (gap < MINFS_DIRENT_SIZE) {
+            reclen += gap;
+            gap = 0;
+        }
+        if ((dst != src) || (gap != 0)) {
+            if ((status = prepare(dst, dst + reclen + MINFS_DIRENT_SIZE)) != ZX_OK) {
+                return status;
+            }
+            de->reclen = static_cast<uint32_t>(reclen) | (last ? kMinfsReclenLast : 0);
+            if ((status = WriteExactInternal(wb->txn(), de, DirentSize(de->namelen),
+                                             dst)) != ZX_OK) {
+                return status;
+            }
+            if (gap != 0) {
+                minfs_dirent_t free_de = {};
+                free_de.reclen = static_cast<uint32_t>(gap);
+                if ((status = WriteExactInternal(wb->txn(), &free_de, MINFS_DIRENT_SIZE,
+                                                 dst + reclen)) != ZX_OK) {
+                    return status;
+                }
+            }
+        }
+        if (last) {
+            break;
+        }
+        memcpy(last_data, data, DirentSize(de->namelen));
+        last_off = dst;
+        dst += reclen;
+        src = next;
+    }
+
+    if (wb != nullptr) {
+        wb->PinVnode(fbl::move(fbl::WrapRefPtr(this)));
+        fs_->EnqueueWork(fbl::move(wb));
+    }
+    return ZX_OK;
+}
+
 void VnodeMinfs::fbl_recycle() {
     if (fd_count_ != 0 || !IsUnlinked()) {
         // If this node has not been purged already, remove it from the
@@ -1371,7 +1780,7 @@ zx_status_t VnodeMinfs::LookupInternal(fbl::RefPtr<fs::Vnode>* out, fbl::StringP
     DirArgs args = DirArgs();
     args.name = name;
     zx_status_t status;
-    if ((status = ForEachDirent(&args, DirentCallbackFind)) < 0) {
+    if ((status = ForNamedDirent(&args, DirentCallbackFind)) < 0) {
         return status;
     }
     fbl::RefPtr<VnodeMinfs> vn;
@@ -1560,7 +1969,7 @@ zx_status_t VnodeMinfs::Create(fbl::RefPtr<fs::Vnode>* out, fbl::StringPiece nam
     args.name = name;
     // ensure file does not exist
     zx_status_t status;
-    if ((status = ForEachDirent(&args, DirentCallbackFind)) != ZX_ERR_NOT_FOUND) {
+    if ((status = ForNamedDirent(&args, DirentCallbackFind)) != ZX_ERR_NOT_FOUND) {
         return ZX_ERR_ALREADY_EXISTS;
     }
 
@@ -1596,7 +2005,7 @@ zx_status_t VnodeMinfs::Create(fbl::RefPtr<fs::Vnode>* out, fbl::StringPiece nam
     args.type = type;
     args.reclen = static_cast<uint32_t>(DirentSize(static_cast<uint8_t>(name.length())));
     args.wb = wb.get();
-    if ((status = ForEachDirent(&args, DirentCallbackAppend)) < 0) {
+    if ((status = AppendDirent(&args)) < 0) {
         return status;
     }
 
@@ -1679,7 +2088,7 @@ zx_status_t VnodeMinfs::Unlink(fbl::StringPiece name, bool must_be_dir) {
     args.name = name;
     args.type = must_be_dir ? kMinfsTypeDir : 0;
     args.wb = wb.get();
-    zx_status_t status = ForEachDirent(&args, DirentCallbackUnlink);
+    zx_status_t status = ForNamedDirent(&args, DirentCallbackUnlink);
     if (status == ZX_OK) {
         wb->PinVnode(fbl::move(fbl::WrapRefPtr(this)));
         fs_->EnqueueWork(fbl::move(wb));
@@ -1822,7 +2231,7 @@ zx_status_t VnodeMinfs::Rename(fbl::RefPtr<fs::Vnode> _newdir, fbl::StringPiece
     // acquire the 'oldname' node (it must exist)
     DirArgs args = DirArgs();
     args.name = oldname;
-    if ((status = ForEachDirent(&args, DirentCallbackFind)) < 0) {
+    if ((status = ForNamedDirent(&args, DirentCallbackFind)) < 0) {
         return status;
     } else if ((status = fs_->VnodeGet(&oldvn, args.ino)) < 0) {
         return status;
@@ -1846,11 +2255,11 @@ zx_status_t VnodeMinfs::Rename(fbl::RefPtr<fs::Vnode> _newdir, fbl::StringPiece
     args.name = newname;
     args.ino = oldvn->ino_;
     args.type = oldvn->IsDirectory() ? kMinfsTypeDir : kMinfsTypeFile;
-    status = newdir->ForEachDirent(&args, DirentCallbackAttemptRename);
+    status = newdir->ForNamedDirent(&args, DirentCallbackAttemptRename);
     if (status == ZX_ERR_NOT_FOUND) {
         // if 'newname' does not exist, create it
         args.reclen = static_cast<uint32_t>(DirentSize(static_cast<uint8_t>(newname.length())));
-        if ((status = newdir->ForEachDirent(&args, DirentCallbackAppend)) < 0) {
+        if ((status = newdir->AppendDirent(&args)) < 0) {
             return status;
         }
     } else if (status != ZX_OK) {
@@ -1867,7 +2276,7 @@ zx_status_t VnodeMinfs::Rename(fbl::RefPtr<fs::Vnode> _newdir, fbl::StringPiece
         auto vn = fbl::RefPtr<VnodeMinfs>::Downcast(vn_fs);
         args.name = "..";
         args.ino = newdir->ino_;
-        if ((status = vn->ForEachDirent(&args, DirentCallbackUpdateInode)) < 0) {
+        if ((status = vn->ForNamedDirent(&args, DirentCallbackUpdateInode)) < 0) {
             return status;
         }
     }
@@ -1878,7 +2287,7 @@ zx_status_t VnodeMinfs::Rename(fbl::RefPtr<fs::Vnode> _newdir, fbl::StringPiece
 
     // finally, remove oldname from its original position
     args.name = oldname;
-    status = ForEachDirent(&args, DirentCallbackForceUnlink);
+    status = ForNamedDirent(&args, DirentCallbackForceUnlink);
     wb->PinVnode(oldvn);
     wb->PinVnode(newdir);
     fs_->EnqueueWork(fbl::move(wb));
@@ -1905,7 +2314,7 @@ zx_status_t VnodeMinfs::Link(fbl::StringPiece name, fbl::RefPtr<fs::Vnode> _targ
     DirArgs args = DirArgs();
     args.name = name;
     zx_status_t status;
-    if ((status = ForEachDirent(&args, DirentCallbackFind)) != ZX_ERR_NOT_FOUND) {
+    if ((status = ForNamedDirent(&args, DirentCallbackFind)) != ZX_ERR_NOT_FOUND) {
         return (status == ZX_OK) ? ZX_ERR_ALREADY_EXISTS : status;
     }
 
@@ -1918,7 +2327,7 @@ zx_status_t VnodeMinfs::Link(fbl::StringPiece name, fbl::RefPtr<fs::Vnode> _targ
     args.type = kMinfsTypeFile; // We can't hard link directories
     args.reclen = static_cast<uint32_t>(DirentSize(static_cast<uint8_t>(name.length())));
     args.wb = wb.get();
-    if ((status = ForEachDirent(&args, DirentCallbackAppend)) < 0) {
+    if ((status = AppendDirent(&args)) < 0) {
         return status;
     }
 
@@ -42,6 +42,11 @@ public:
         return zx_port_wait(get(), deadline.get(), packet, size);
     }
 
+    zx_status_t wait_many(zx::time deadline, zx_port_packet_t* packets, size_t count,
+                          size_t* actual) const {
+        return zx_port_wait_many(get(), deadline.get(), packets, count, actual);
+    }
+
     zx_status_t cancel(zx_handle_t source, uint64_t key) const {
         return zx_port_cancel(get(), source, key);
     }
@@ -2,6 +2,7 @@
 // Use of this source code is governed by a BSD-style license that can be
 // found in the LICENSE file.
 
+#include <inttypes.h>
 #include <threads.h>
 
 #include <zircon/syscalls.h>
@@ -665,6 +666,36 @@ bool receiver_shutdown_test() {
     END_TEST;
 }
 
+// Measures how quickly a single-threaded loop drains a port that is backed
+// up with packets.
+bool receiver_throughput_test() {
+    BEGIN_TEST;
+
+    constexpr uint32_t kPacketsPerRound = 1000u;
+    constexpr uint32_t kRounds = 20u;
+
+    async::Loop loop;
+    TestReceiver receiver;
+
+    zx_time_t elapsed = 0u;
+    for (uint32_t round = 0u; round < kRounds; round++) {
+        for (uint32_t i = 0u; i < kPacketsPerRound; i++) {
+            ASSERT_EQ(ZX_OK, receiver.op.Queue(loop.async()), "queue");
+        }
+        zx_time_t start = zx_clock_get(ZX_CLOCK_MONOTONIC);
+        EXPECT_EQ(ZX_OK, loop.RunUntilIdle(), "run loop");
+        elapsed += zx_clock_get(ZX_CLOCK_MONOTONIC) - start;
+    }
+    EXPECT_EQ(kPacketsPerRound * kRounds, receiver.run_count, "run count");
+
+    if (elapsed > 0u) {
+        unittest_printf("dispatched %" PRIu64 " packets/sec\n",
+                        uint64_t{kPacketsPerRound} * kRounds * ZX_SEC(1) / elapsed);
+    }
+
+    END_TEST;
+}
+
 class GetDefaultDispatcherTask : public QuitTask {
 public:
     async_t* last_default_dispatcher;
@@ -956,6 +987,7 @@ RUN_TEST(task_test)
 RUN_TEST(task_shutdown_test)
 RUN_TEST(receiver_test)
 RUN_TEST(receiver_shutdown_test)
+RUN_TEST(receiver_throughput_test)
 RUN_TEST(threads_have_default_dispatcher)
 for (int i = 0; i < 3; i++) {
     RUN_TEST(threads_quit)
@@ -12,14 +12,17 @@
 #include <unistd.h>
 
 #include <digest/merkle-tree.h>
+#include <fdio/vfs.h>
 #include <zircon/device/vfs.h>
 #include <zircon/device/rtc.h>
 #include <zircon/syscalls.h>
+#include <fbl/algorithm.h>
 #include <fbl/new.h>
 #include <fbl/unique_ptr.h>
 #include <fbl/vector.h>
 #include <unittest/unittest.h>
 
+#include "blob-fill.h"
 #include "blobstore-bench.h"
 
 using digest::Digest;
@@ -36,6 +39,12 @@ using digest::MerkleTree;
    RUN_TEST_PERFORMANCE((test_type<blob_size, blob_count, FIRST>))   \
    RUN_TEST_PERFORMANCE((test_type<blob_size, blob_count, LAST>))
 
+#define RUN_FOR_ALL_DATA_TYPES(test_type, blob_size, blob_count)                      \
+   RUN_TEST_PERFORMANCE((test_type<blob_size, blob_count, DEFAULT, INCOMPRESSIBLE>)) \
+   RUN_TEST_PERFORMANCE((test_type<blob_size, blob_count, DEFAULT, COMPRESSIBLE>))   \
+   RUN_TEST_PERFORMANCE((test_type<blob_size, blob_count, RANDOM, INCOMPRESSIBLE>))  \
+   RUN_TEST_PERFORMANCE((test_type<blob_size, blob_count, RANDOM, COMPRESSIBLE>))
+
 static char start_time[50];
 
 // Sets start_time to current time reported by rtc
@@ -65,16 +74,18 @@ static int GetStartTime() {
 
 // Creates, writes, reads (to verify) and operates on a blob.
 // Returns the result of the post-processing 'func' (true == success).
-static bool GenerateBlob(fbl::unique_ptr<blob_info_t>* out, size_t blob_size) {
+static bool GenerateBlob(fbl::unique_ptr<blob_info_t>* out, size_t blob_size,
+                         data_type_t data_type) {
     // Generate a Blob of random data
     fbl::AllocChecker ac;
     fbl::unique_ptr<blob_info_t> info(new (&ac) blob_info_t);
     EXPECT_EQ(ac.check(), true);
     info->data.reset(new (&ac) char[blob_size]);
     EXPECT_EQ(ac.check(), true);
-    unsigned int seed = static_cast<unsigned int>(zx_ticks_get());
-    for (size_t i = 0; i < blob_size; i++) {
-        info->data[i] = (char)rand_r(&seed);
+    if (data_type == COMPRESSIBLE) {
+        CompressibleFill(info->data.get(), blob_size);
+    } else {
+        RandomFill(info->data.get(), blob_size);
     }
     info->size_data = blob_size;
 
@@ -119,7 +130,7 @@ static inline int StreamAll(T func, int fd, U* buf, size_t max) {
 }
 
 
-TestData::TestData(size_t blob_size, size_t blob_count, traversal_order_t order) : blob_size(blob_size), blob_count(blob_count), order(order) {
+TestData::TestData(size_t blob_size, size_t blob_count, traversal_order_t order, data_type_t data_type) : blob_size(blob_size), blob_count(blob_count), order(order), data_type(data_type) {
     indices = new size_t[blob_count];
     samples = new zx_time_t*[NAME_COUNT];
     paths = new char*[blob_count];
@@ -262,6 +273,17 @@ void TestData::get_order_str(char* order_str) {
     }
 }
 
+void TestData::get_data_type_str(char* data_type_str) {
+    switch(data_type) {
+    case COMPRESSIBLE:
+        strcpy(data_type_str, "compressible");
+        break;
+    default:
+        strcpy(data_type_str, "random");
+        break;
+    }
+}
+
 void TestData::print_order() {
     for (size_t i = 0; i < blob_count; i++) {
         printf("Index %lu: %lu\n", i, indices[i]);
@@ -321,16 +343,28 @@ bool TestData::report_test(test_name_t name) {
 
     char test_name[10];
     char test_order[10];
+    char test_data_type[15];
     get_name_str(name, test_name);
     get_order_str(test_order);
+    get_data_type_str(test_data_type);
     printf("\nBenchmark %10s: [%10lu] msec, average: [%8.2f] msec, min: [%8.2f] msec, max: [%8.2f] msec - %lu outliers (above [%8.2f] msec)",
             test_name, total, avg, min, max, outlier_count, outlier) ;
 
+    // Read throughput, for comparing how fast compressible and random blobs
+    // read. It is left at 0 for every other operation.
+    double throughput = 0;
+    if (name == READ) {
+        if (avg > 0) {
+            throughput = (static_cast<double>(blob_size) / MB) / (avg / 1000);
+        }
+        printf(", %s data: [%8.2f] MB/sec", test_data_type, throughput);
+    }
+
     FILE* results = fopen(RESULT_FILE, "a");
 
     ASSERT_NONNULL(results, "Failed to open results file");
 
-    fprintf(results, "%lu,%lu,%s,%s,%s,%f,%f,%f,%f,%f,%lu\n", blob_size, blob_count, start_time, test_name, test_order, avg, min, max, stddev, outlier, outlier_count);
+    fprintf(results, "%lu,%lu,%s,%s,%s,%f,%f,%f,%f,%f,%lu,%s,%f\n", blob_size, blob_count, start_time, test_name, test_order, avg, min, max, stddev, outlier, outlier_count, test_data_type, throughput);
     fclose(results);
 
     test_name[0] = '\0';
@@ -340,6 +374,9 @@ bool TestData::report_test(test_name_t name) {
 
 bool TestData::create_blobs() {
     size_t sample_index = 0;
+    // Bytes handed to blobstore, data and Merkle tree, and what it stored.
+    size_t raw_bytes = 0;
+    size_t stored_bytes = 0;
 
     for (size_t i = 0; i < blob_count; i++) {
         bool record = (order != FIRST && order != LAST);
@@ -347,7 +384,7 @@ bool TestData::create_blobs() {
         record |= (order == LAST && i >= blob_count - END_COUNT);
 
         fbl::unique_ptr<blob_info_t> info;
-        ASSERT_TRUE(GenerateBlob(&info, blob_size));
+        ASSERT_TRUE(GenerateBlob(&info, blob_size, data_type));
         strcpy(paths[i], info->path);
 
         // create
@@ -367,6 +404,11 @@ bool TestData::create_blobs() {
         ASSERT_EQ(StreamAll(write, fd, info->data.get(), blob_size), 0, "Failed to write Data");
         if (record) { sample_end(start, WRITE, sample_index); }
 
+        struct stat s;
+        ASSERT_EQ(fstat(fd, &s), 0, "Failed to stat blob");
+        raw_bytes += info->size_merkle + blob_size;
+        stored_bytes += static_cast<size_t>(s.st_blocks) * VNATTR_BLKSIZE;
+
         ASSERT_EQ(close(fd), 0, "Failed to close blob");
 
         if (record) {
@@ -378,6 +420,15 @@ bool TestData::create_blobs() {
     ASSERT_TRUE(report_test(TRUNCATE));
     ASSERT_TRUE(report_test(WRITE));
 
+    // How much compression saved, next to the read throughput that it costs
+    // or gains. Random data is stored raw, so its blobs only lose the
+    // rounding to whole blocks.
+    char test_data_type[15];
+    get_data_type_str(test_data_type);
+    printf("\nStorage %s data: [%10lu] bytes stored for [%10lu] bytes written (%6.2f%%)",
+           test_data_type, stored_bytes, raw_bytes,
+           raw_bytes ? 100.0 * static_cast<double>(stored_bytes) / static_cast<double>(raw_bytes) : 0);
+
     return true;
 }
 
@@ -468,11 +519,12 @@ static bool EndBlobstoreBenchmark() {
     return true;
 }
 
-template <size_t BlobSize, size_t BlobCount, traversal_order_t Order>
+template <size_t BlobSize, size_t BlobCount, traversal_order_t Order,
+          data_type_t DataType = INCOMPRESSIBLE>
 static bool benchmark_blob_basic() {
     BEGIN_TEST;
     ASSERT_TRUE(StartBlobstoreBenchmark(BlobSize, BlobCount, Order));
-    TestData data(BlobSize, BlobCount, Order);
+    TestData data(BlobSize, BlobCount, Order, DataType);
     bool success = data.run_tests();
     ASSERT_TRUE(EndBlobstoreBenchmark()); //clean up
     ASSERT_TRUE(success);
@@ -505,6 +557,10 @@ RUN_FOR_ALL_ORDER(benchmark_blob_basic, 512 * KB, 10000);
 RUN_FOR_ALL_ORDER(benchmark_blob_basic, MB, 500);
 RUN_FOR_ALL_ORDER(benchmark_blob_basic, MB, 1000);
 
+RUN_FOR_ALL_DATA_TYPES(benchmark_blob_basic, 128 * KB, 500);
+RUN_FOR_ALL_DATA_TYPES(benchmark_blob_basic, 512 * KB, 500);
+RUN_FOR_ALL_DATA_TYPES(benchmark_blob_basic, MB, 500);
+
 END_TEST_CASE(blobstore_benchmarks)
 
 int main(int argc, char** argv) {
@@ -17,6 +17,11 @@ typedef enum {
     ORDER_COUNT, // number of order options
 } traversal_order_t;
 
+typedef enum {
+    INCOMPRESSIBLE, // random bytes
+    COMPRESSIBLE, // runs of a few distinct bytes
+} data_type_t;
+
 typedef enum {
     CREATE, // create blob
     TRUNCATE, // truncate blob
@@ -39,7 +44,7 @@ typedef struct blob_info {
 
 class TestData {
 public:
-    TestData(size_t blob_size, size_t blob_count, traversal_order_t order);
+    TestData(size_t blob_size, size_t blob_count, traversal_order_t order, data_type_t data_type);
     ~TestData();
     bool run_tests();
 private:
@@ -48,6 +53,7 @@ private:
     size_t get_max_count();
     void get_name_str(test_name_t name, char* name_str);
     void get_order_str(char* order_str);
+    void get_data_type_str(char* data_type_str);
     void print_order();
 
     // reporting
@@ -63,6 +69,7 @@ private:
     size_t blob_size;
     size_t blob_count;
     traversal_order_t order;
+    data_type_t data_type;
     size_t* indices;
     zx_time_t** samples;
     char** paths;
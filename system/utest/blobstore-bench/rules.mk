@@ -25,4 +25,8 @@ MODULE_LIBS := \
     system/ulib/zircon \
     system/ulib/unittest \
 
+# For the blob contents shared with the blobstore tests.
+MODULE_COMPILEFLAGS := \
+    -Isystem/utest/blobstore \
+
 include make/module.mk
@@ -0,0 +1,35 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <zircon/syscalls.h>
+#include <fbl/algorithm.h>
+
+// Blob contents shared by the blobstore tests and blobstore-bench, so that
+// both exercise compression with the same data.
+
+typedef void (*BlobSrcFunction)(char* data, size_t length);
+
+// Fills |data| with random bytes, which don't compress.
+static inline void RandomFill(char* data, size_t length) {
+    static unsigned int seed = static_cast<unsigned int>(zx_ticks_get());
+    for (size_t i = 0; i < length; i++) {
+        data[i] = (char)rand_r(&seed);
+    }
+}
+
+// Fills |data| with random runs of a few distinct bytes, which compress well.
+static inline void CompressibleFill(char* data, size_t length) {
+    static unsigned int seed = static_cast<unsigned int>(zx_ticks_get());
+    size_t i = 0;
+    while (i < length) {
+        size_t run = fbl::min(static_cast<size_t>(1 + rand_r(&seed) % 64), length - i);
+        memset(&data[i], 'a' + rand_r(&seed) % 4, run);
+        i += run;
+    }
+}
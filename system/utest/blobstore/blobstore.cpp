@@ -22,6 +22,7 @@
 #include <blobstore/format.h>
 #include <digest/digest.h>
 #include <digest/merkle-tree.h>
+#include <fdio/vfs.h>
 #include <fs-management/mount.h>
 #include <fs-management/ramdisk.h>
 #include <fvm/fvm.h>
@@ -37,6 +38,8 @@
 #include <fbl/unique_ptr.h>
 #include <unittest/unittest.h>
 
+#include "blob-fill.h"
+
 #define MOUNT_PATH "/tmp/zircon-blobstore-test"
 
 namespace {
@@ -349,18 +352,15 @@ typedef struct blob_info {
 
 // Creates, writes, reads (to verify) and operates on a blob.
 // Returns the result of the post-processing 'func' (true == success).
-static bool GenerateBlob(size_t size_data, fbl::unique_ptr<blob_info_t>* out) {
+static bool GenerateBlob(size_t size_data, fbl::unique_ptr<blob_info_t>* out,
+                         BlobSrcFunction fill = RandomFill) {
     // Generate a Blob of random data
     fbl::AllocChecker ac;
     fbl::unique_ptr<blob_info_t> info(new (&ac) blob_info_t);
     EXPECT_EQ(ac.check(), true);
     info->data.reset(new (&ac) char[size_data]);
     EXPECT_EQ(ac.check(), true);
-    static unsigned int seed = static_cast<unsigned int>(zx_ticks_get());
-
-    for (size_t i = 0; i < size_data; i++) {
-        info->data[i] = (char)rand_r(&seed);
-    }
+    fill(info->data.get(), size_data);
     info->size_data = size_data;
 
     // Generate the Merkle Tree
@@ -844,6 +844,177 @@ static bool CreateUmountRemountSmall(void) {
     END_TEST;
 }
 
+// Reads a large blob piecemeal after remounting, so that its data is loaded
+// and verified on demand, in an order which isn't sequential.
+template <fs_test_type_t TestType>
+static bool ReadPartialAfterRemount(void) {
+    BEGIN_TEST;
+    test_info_t test_info;
+    ASSERT_EQ(StartBlobstoreTest<TestType>(&test_info), 0, "Mounting Blobstore");
+
+    fbl::unique_ptr<blob_info_t> info;
+    ASSERT_TRUE(GenerateBlob((1 << 22) + 4321, &info));
+
+    int fd;
+    ASSERT_TRUE(MakeBlob(info->path, info->merkle.get(), info->size_merkle,
+                         info->data.get(), info->size_data, &fd));
+    ASSERT_EQ(close(fd), 0);
+    ASSERT_EQ(umount(MOUNT_PATH), ZX_OK, "Could not unmount blobstore");
+    ASSERT_EQ(MountBlobstore(test_info.ramdisk_path), 0, "Could not re-mount blobstore");
+
+    fd = open(info->path, O_RDONLY);
+    ASSERT_GT(fd, 0, "Failed to open blob");
+
+    // Walk backwards in strides which straddle block boundaries.
+    const size_t kStride = 3 * 8192 + 17;
+    char buf[100];
+    for (size_t off = info->size_data - 1; off > kStride; off -= kStride) {
+        size_t len = fbl::min(sizeof(buf), info->size_data - off);
+        ASSERT_EQ(pread(fd, buf, len, off), static_cast<ssize_t>(len));
+        ASSERT_EQ(memcmp(buf, &info->data[off], len), 0, "Read data, but it was bad");
+    }
+
+    ASSERT_TRUE(VerifyContents(fd, info->data.get(), info->size_data));
+    ASSERT_EQ(close(fd), 0, "Could not close blob");
+    ASSERT_EQ(unlink(info->path), 0);
+
+    ASSERT_EQ(EndBlobstoreTest<TestType>(&test_info), 0, "unmounting blobstore");
+    END_TEST;
+}
+
+// Writes a blob which compresses well, and checks that it takes less space
+// than its data, and reads back correctly, in pieces and whole, both before
+// and after remounting.
+template <fs_test_type_t TestType>
+static bool CompressibleBlob(void) {
+    BEGIN_TEST;
+    test_info_t test_info;
+    ASSERT_EQ(StartBlobstoreTest<TestType>(&test_info), 0, "Mounting Blobstore");
+
+    for (size_t i = 14; i < 23; i += 4) {
+        fbl::unique_ptr<blob_info_t> info;
+        ASSERT_TRUE(GenerateBlob((1 << i) + 4321, &info, CompressibleFill));
+
+        int fd;
+        ASSERT_TRUE(MakeBlob(info->path, info->merkle.get(), info->size_merkle,
+                             info->data.get(), info->size_data, &fd));
+        struct stat s;
+        ASSERT_EQ(fstat(fd, &s), 0);
+        ASSERT_LT(static_cast<size_t>(s.st_blocks) * VNATTR_BLKSIZE,
+                  info->size_merkle + info->size_data, "Blob was not compressed");
+        ASSERT_EQ(close(fd), 0);
+
+        ASSERT_EQ(umount(MOUNT_PATH), ZX_OK, "Could not unmount blobstore");
+        ASSERT_EQ(MountBlobstore(test_info.ramdisk_path), 0, "Could not re-mount blobstore");
+
+        fd = open(info->path, O_RDONLY);
+        ASSERT_GT(fd, 0, "Failed to open blob");
+
+        // Walk backwards in strides which straddle chunk boundaries.
+        const size_t kStride = 9 * 8192 + 17;
+        char buf[100];
+        for (size_t off = info->size_data - 1; off > kStride; off -= kStride) {
+            size_t len = fbl::min(sizeof(buf), info->size_data - off);
+            ASSERT_EQ(pread(fd, buf, len, off), static_cast<ssize_t>(len));
+            ASSERT_EQ(memcmp(buf, &info->data[off], len), 0, "Read data, but it was bad");
+        }
+
+        ASSERT_TRUE(VerifyContents(fd, info->data.get(), info->size_data));
+        ASSERT_EQ(close(fd), 0, "Could not close blob");
+        ASSERT_EQ(unlink(info->path), 0);
+    }
+
+    ASSERT_EQ(EndBlobstoreTest<TestType>(&test_info), 0, "unmounting blobstore");
+    END_TEST;
+}
+
+// Checks the cache statistics of the blobstore mounted at MOUNT_PATH.
+static bool CheckCacheInfo(int dirfd, uint64_t blob_count, uint64_t hits, uint64_t misses,
+                           uint64_t evictions) {
+    vfs_blob_cache_info_t info;
+    ASSERT_EQ(ioctl_vfs_get_blob_cache_info(dirfd, &info), sizeof(info));
+    ASSERT_EQ(info.blob_count, blob_count);
+    ASSERT_EQ(info.hits, hits);
+    ASSERT_EQ(info.misses, misses);
+    ASSERT_EQ(info.evictions, evictions);
+    ASSERT_LE(info.resident_bytes, info.budget_bytes);
+    return true;
+}
+
+template <fs_test_type_t TestType>
+static bool BlobCache(void) {
+    BEGIN_TEST;
+    test_info_t test_info;
+    ASSERT_EQ(StartBlobstoreTest<TestType>(&test_info), 0, "Mounting Blobstore");
+
+    int dirfd = open(MOUNT_PATH "/.", O_RDONLY | O_ADMIN);
+    ASSERT_GT(dirfd, 0, "Cannot open root directory");
+    vfs_blob_cache_info_t info;
+    ASSERT_EQ(ioctl_vfs_get_blob_cache_info(dirfd, &info), sizeof(info));
+    const uint64_t default_budget = info.budget_bytes;
+    ASSERT_TRUE(CheckCacheInfo(dirfd, 0, 0, 0, 0));
+
+    // Blobs which have just been written stay in memory once closed.
+    fbl::unique_ptr<blob_info_t> first;
+    fbl::unique_ptr<blob_info_t> second;
+    ASSERT_TRUE(GenerateBlob(1 << 20, &first));
+    ASSERT_TRUE(GenerateBlob(1 << 20, &second));
+    int fd;
+    ASSERT_TRUE(MakeBlob(first->path, first->merkle.get(), first->size_merkle,
+                         first->data.get(), first->size_data, &fd));
+    ASSERT_EQ(close(fd), 0);
+    ASSERT_TRUE(MakeBlob(second->path, second->merkle.get(), second->size_merkle,
+                         second->data.get(), second->size_data, &fd));
+    ASSERT_EQ(close(fd), 0);
+    ASSERT_TRUE(CheckCacheInfo(dirfd, 2, 0, 0, 0));
+    ASSERT_EQ(ioctl_vfs_get_blob_cache_info(dirfd, &info), sizeof(info));
+    ASSERT_GE(info.resident_bytes, first->size_data + second->size_data);
+    const uint64_t blob_bytes = info.resident_bytes / 2;
+
+    // Reopening a cached blob takes it out of the cache, and closing it puts
+    // it back as the most recently used.
+    fd = open(first->path, O_RDONLY);
+    ASSERT_GT(fd, 0, "Failed to open blob");
+    ASSERT_TRUE(CheckCacheInfo(dirfd, 1, 1, 0, 0));
+    ASSERT_TRUE(VerifyContents(fd, first->data.get(), first->size_data));
+    ASSERT_EQ(close(fd), 0);
+    ASSERT_TRUE(CheckCacheInfo(dirfd, 2, 1, 0, 0));
+
+    // Shrinking the budget evicts the least recently used blob, which must
+    // then be read from disk again.
+    ASSERT_EQ(ioctl_vfs_set_blob_cache_budget(dirfd, &blob_bytes), 0);
+    ASSERT_TRUE(CheckCacheInfo(dirfd, 1, 1, 0, 1));
+    fd = open(second->path, O_RDONLY);
+    ASSERT_GT(fd, 0, "Failed to open blob");
+    ASSERT_TRUE(CheckCacheInfo(dirfd, 1, 1, 1, 1));
+    ASSERT_TRUE(VerifyContents(fd, second->data.get(), second->size_data));
+    ASSERT_EQ(close(fd), 0);
+    ASSERT_TRUE(CheckCacheInfo(dirfd, 1, 1, 1, 2));
+
+    // Unlinking a cached blob releases it immediately.
+    ASSERT_EQ(ioctl_vfs_set_blob_cache_budget(dirfd, &default_budget), 0);
+    ASSERT_EQ(unlink(second->path), 0);
+    ASSERT_TRUE(CheckCacheInfo(dirfd, 0, 1, 1, 2));
+    fd = open(second->path, O_RDONLY);
+    ASSERT_LT(fd, 0, "Unlinked blob is still present");
+
+    // With no budget, nothing is kept.
+    const uint64_t no_budget = 0;
+    ASSERT_EQ(ioctl_vfs_set_blob_cache_budget(dirfd, &no_budget), 0);
+    fd = open(first->path, O_RDONLY);
+    ASSERT_GT(fd, 0, "Failed to open blob");
+    ASSERT_TRUE(VerifyContents(fd, first->data.get(), first->size_data));
+    ASSERT_EQ(close(fd), 0);
+    ASSERT_TRUE(CheckCacheInfo(dirfd, 0, 1, 2, 3));
+    ASSERT_EQ(ioctl_vfs_get_blob_cache_info(dirfd, &info), sizeof(info));
+    ASSERT_EQ(info.resident_bytes, 0);
+
+    ASSERT_EQ(unlink(first->path), 0);
+    ASSERT_EQ(close(dirfd), 0);
+    ASSERT_EQ(EndBlobstoreTest<TestType>(&test_info), 0, "unmounting blobstore");
+    END_TEST;
+}
+
 enum TestState {
     empty,
     configured,
@@ -1608,6 +1779,9 @@ RUN_TEST_FOR_ALL_TYPES(MEDIUM, CorruptedBlob)
 RUN_TEST_FOR_ALL_TYPES(MEDIUM, CorruptedDigest)
 RUN_TEST_FOR_ALL_TYPES(MEDIUM, EdgeAllocation)
 RUN_TEST_FOR_ALL_TYPES(MEDIUM, CreateUmountRemountSmall)
+RUN_TEST_FOR_ALL_TYPES(MEDIUM, ReadPartialAfterRemount)
+RUN_TEST_FOR_ALL_TYPES(MEDIUM, CompressibleBlob)
+RUN_TEST_FOR_ALL_TYPES(MEDIUM, BlobCache)
 RUN_TEST_FOR_ALL_TYPES(MEDIUM, EarlyRead)
 RUN_TEST_FOR_ALL_TYPES(MEDIUM, WaitForRead)
 RUN_TEST_FOR_ALL_TYPES(MEDIUM, WriteSeekIgnored)
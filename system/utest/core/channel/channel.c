@@ -10,6 +10,7 @@
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <threads.h>
 #include <unistd.h>
 
@@ -858,6 +859,191 @@ static bool channel_disallow_write_to_self(void) {
     END_TEST;
 }
 
+// Round-trips messages around the kernel's size class and page boundaries,
+// with and without handles, and checks that every byte survives.
+static bool channel_message_sizes(void) {
+    BEGIN_TEST;
+
+    static const uint32_t sizes[] = {
+        0u, 1u, 240u, 241u, 1000u, 2016u, 4000u, 4032u, 4033u, 4096u, 4097u,
+        8191u, 8192u, 12345u, ZX_CHANNEL_MAX_MSG_BYTES - 1, ZX_CHANNEL_MAX_MSG_BYTES,
+    };
+
+    zx_handle_t channel[2];
+    ASSERT_EQ(zx_channel_create(0, &channel[0], &channel[1]), ZX_OK, "");
+
+    uint8_t* out = malloc(ZX_CHANNEL_MAX_MSG_BYTES);
+    uint8_t* in = malloc(ZX_CHANNEL_MAX_MSG_BYTES);
+    ASSERT_NONNULL(out, "");
+    ASSERT_NONNULL(in, "");
+
+    for (size_t i = 0; i < countof(sizes); i++) {
+        for (uint32_t num_handles = 0; num_handles <= ZX_CHANNEL_MAX_MSG_HANDLES;
+             num_handles += ZX_CHANNEL_MAX_MSG_HANDLES) {
+            for (uint32_t j = 0; j < sizes[i]; j++) {
+                out[j] = (uint8_t)(j * 7 + i);
+            }
+            zx_handle_t handles[ZX_CHANNEL_MAX_MSG_HANDLES];
+            for (uint32_t j = 0; j < num_handles; j++) {
+                ASSERT_EQ(zx_event_create(0u, &handles[j]), ZX_OK, "");
+            }
+
+            ASSERT_EQ(zx_channel_write(channel[0], 0u, out, sizes[i], handles, num_handles),
+                      ZX_OK, "");
+
+            uint32_t actual_bytes, actual_handles;
+            memset(in, 0, sizes[i]);
+            ASSERT_EQ(zx_channel_read(channel[1], 0u, in, handles, sizes[i],
+                                      ZX_CHANNEL_MAX_MSG_HANDLES, &actual_bytes,
+                                      &actual_handles),
+                      ZX_OK, "");
+            EXPECT_EQ(actual_bytes, sizes[i], "");
+            EXPECT_EQ(actual_handles, num_handles, "");
+            EXPECT_EQ(memcmp(in, out, sizes[i]), 0, "message data mismatch");
+
+            for (uint32_t j = 0; j < actual_handles; j++) {
+                EXPECT_EQ(zx_handle_close(handles[j]), ZX_OK, "");
+            }
+        }
+    }
+
+    free(out);
+    free(in);
+    EXPECT_EQ(zx_handle_close(channel[0]), ZX_OK, "");
+    EXPECT_EQ(zx_handle_close(channel[1]), ZX_OK, "");
+
+    END_TEST;
+}
+
+static bool channel_batch(void) {
+    BEGIN_TEST;
+
+    zx_handle_t channel[2];
+    ASSERT_EQ(zx_channel_create(0, &channel[0], &channel[1]), ZX_OK, "");
+
+    // Eight messages of growing size; every other one carries an event.
+    uint32_t out[8][8];
+    zx_handle_t events[8];
+    zx_channel_msg_t msgs[8];
+    for (uint32_t i = 0; i < 8; i++) {
+        for (uint32_t j = 0; j < 8; j++) {
+            out[i][j] = i * 100 + j;
+        }
+        msgs[i].bytes = out[i];
+        msgs[i].num_bytes = (i + 1) * sizeof(uint32_t);
+        msgs[i].handles = &events[i];
+        msgs[i].num_handles = i % 2;
+        if (i % 2) {
+            ASSERT_EQ(zx_event_create(0u, &events[i]), ZX_OK, "");
+        }
+    }
+    ASSERT_EQ(zx_channel_write_batch(channel[0], 0u, msgs, 8u), ZX_OK, "");
+
+    // Read them back with room for more messages than are queued.
+    uint32_t in[10][8];
+    zx_handle_t handles[10];
+    zx_channel_msg_t rd[10];
+    for (uint32_t i = 0; i < 10; i++) {
+        rd[i].bytes = in[i];
+        rd[i].num_bytes = sizeof(in[i]);
+        rd[i].handles = &handles[i];
+        rd[i].num_handles = 1u;
+    }
+    uint32_t actual = 0;
+    ASSERT_EQ(zx_channel_read_batch(channel[1], 0u, rd, 10u, &actual), ZX_OK, "");
+    ASSERT_EQ(actual, 8u, "");
+    for (uint32_t i = 0; i < 8; i++) {
+        EXPECT_EQ(rd[i].num_bytes, (i + 1) * sizeof(uint32_t), "");
+        EXPECT_EQ(rd[i].num_handles, i % 2, "");
+        EXPECT_EQ(memcmp(in[i], out[i], rd[i].num_bytes), 0, "message data mismatch");
+        if (i % 2) {
+            EXPECT_EQ(zx_handle_close(handles[i]), ZX_OK, "");
+        }
+    }
+    EXPECT_EQ(get_satisfied_signals(channel[1]), ZX_CHANNEL_WRITABLE, "");
+    EXPECT_EQ(zx_channel_read_batch(channel[1], 0u, rd, 10u, &actual), ZX_ERR_SHOULD_WAIT, "");
+
+    EXPECT_EQ(zx_channel_read_batch(channel[1], 0u, rd, 0u, &actual), ZX_ERR_OUT_OF_RANGE, "");
+    EXPECT_EQ(zx_channel_write_batch(channel[0], 0u, msgs, ZX_CHANNEL_MAX_BATCH_MSGS + 1),
+              ZX_ERR_OUT_OF_RANGE, "");
+
+    EXPECT_EQ(zx_handle_close(channel[0]), ZX_OK, "");
+    EXPECT_EQ(zx_handle_close(channel[1]), ZX_OK, "");
+
+    END_TEST;
+}
+
+// A batch read stops at the first message that doesn't fit its buffers and
+// leaves it queued.
+static bool channel_batch_read_too_small(void) {
+    BEGIN_TEST;
+
+    zx_handle_t channel[2];
+    ASSERT_EQ(zx_channel_create(0, &channel[0], &channel[1]), ZX_OK, "");
+
+    static const char small[4] = "abc";
+    static const char large[100] = "0123456789";
+    ASSERT_EQ(zx_channel_write(channel[0], 0u, small, sizeof(small), NULL, 0u), ZX_OK, "");
+    ASSERT_EQ(zx_channel_write(channel[0], 0u, large, sizeof(large), NULL, 0u), ZX_OK, "");
+
+    char in[2][8];
+    zx_channel_msg_t rd[2] = {
+        {in[0], NULL, sizeof(in[0]), 0u},
+        {in[1], NULL, sizeof(in[1]), 0u},
+    };
+    uint32_t actual = 0;
+    ASSERT_EQ(zx_channel_read_batch(channel[1], 0u, rd, 2u, &actual), ZX_OK, "");
+    EXPECT_EQ(actual, 1u, "");
+    EXPECT_EQ(rd[0].num_bytes, sizeof(small), "");
+    EXPECT_EQ(memcmp(in[0], small, sizeof(small)), 0, "");
+
+    rd[0].num_bytes = sizeof(in[0]);
+    EXPECT_EQ(zx_channel_read_batch(channel[1], 0u, rd, 2u, &actual),
+              ZX_ERR_BUFFER_TOO_SMALL, "");
+    EXPECT_EQ(rd[0].num_bytes, sizeof(large), "");
+
+    char buf[sizeof(large)];
+    uint32_t actual_bytes;
+    EXPECT_EQ(zx_channel_read(channel[1], 0u, buf, NULL, sizeof(buf), 0u, &actual_bytes, NULL),
+              ZX_OK, "");
+    EXPECT_EQ(actual_bytes, sizeof(large), "");
+
+    EXPECT_EQ(zx_handle_close(channel[0]), ZX_OK, "");
+    EXPECT_EQ(zx_handle_close(channel[1]), ZX_OK, "");
+
+    END_TEST;
+}
+
+// If any message of a batch can't be written, none are, and every handle
+// stays with the writer.
+static bool channel_batch_write_failure(void) {
+    BEGIN_TEST;
+
+    zx_handle_t channel[2];
+    ASSERT_EQ(zx_channel_create(0, &channel[0], &channel[1]), ZX_OK, "");
+
+    zx_handle_t event;
+    ASSERT_EQ(zx_event_create(0u, &event), ZX_OK, "");
+    zx_handle_t bad = ZX_HANDLE_INVALID;
+
+    static const uint32_t data = 0xdeadbeef;
+    zx_channel_msg_t msgs[2] = {
+        {(void*)&data, &event, sizeof(data), 1u},
+        {(void*)&data, &bad, sizeof(data), 1u},
+    };
+    EXPECT_EQ(zx_channel_write_batch(channel[0], 0u, msgs, 2u), ZX_ERR_BAD_HANDLE, "");
+    EXPECT_EQ(get_satisfied_signals(channel[1]), ZX_CHANNEL_WRITABLE, "");
+
+    // The same goes for a batch written to a closed channel.
+    EXPECT_EQ(zx_handle_close(channel[1]), ZX_OK, "");
+    EXPECT_EQ(zx_channel_write_batch(channel[0], 0u, msgs, 1u), ZX_ERR_PEER_CLOSED, "");
+
+    EXPECT_EQ(zx_handle_close(event), ZX_OK, "");
+    EXPECT_EQ(zx_handle_close(channel[0]), ZX_OK, "");
+
+    END_TEST;
+}
+
 BEGIN_TEST_CASE(channel_tests)
 RUN_TEST(channel_test)
 RUN_TEST(channel_read_error_test)
@@ -871,6 +1057,10 @@ RUN_TEST(channel_call2)
 RUN_TEST(bad_channel_call_finish)
 RUN_TEST(channel_nest)
 RUN_TEST(channel_disallow_write_to_self)
+RUN_TEST(channel_message_sizes)
+RUN_TEST(channel_batch)
+RUN_TEST(channel_batch_read_too_small)
+RUN_TEST(channel_batch_write_failure)
 END_TEST_CASE(channel_tests)
 
 #ifndef BUILD_COMBINED_TESTS
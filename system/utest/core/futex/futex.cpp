@@ -452,6 +452,65 @@ static bool test_futex_misaligned() {
     END_TEST;
 }
 
+// Pairs of threads hand a token back and forth, each pair through its own
+// futex, so that waits and wakes on many unrelated futexes run concurrently.
+// Each futex sits on its own cache line, as unrelated futexes usually do, so
+// that the pairs don't share lines and the kernel sees addresses far apart.
+struct alignas(64) PingPongTurn {
+    zx_futex_t value;
+};
+
+struct PingPongPlayer {
+    zx_futex_t* turn;
+    int self;
+    int rounds;
+};
+
+static int ping_pong_thread(void* arg) {
+    auto player = static_cast<PingPongPlayer*>(arg);
+    const int other = 1 - player->self;
+    for (int i = 0; i < player->rounds; ++i) {
+        int turn;
+        while ((turn = __atomic_load_n(player->turn, __ATOMIC_SEQ_CST)) != player->self) {
+            zx_status_t status = zx_futex_wait(player->turn, turn, ZX_TIME_INFINITE);
+            if (status != ZX_OK && status != ZX_ERR_BAD_STATE)
+                return -1;
+        }
+        __atomic_store_n(player->turn, other, __ATOMIC_SEQ_CST);
+        if (zx_futex_wake(player->turn, 1) != ZX_OK)
+            return -1;
+    }
+    return 0;
+}
+
+static bool test_futex_many_futexes_contention() {
+    BEGIN_TEST;
+    constexpr int kPairs = 16;
+    constexpr int kRounds = 2000;
+
+    PingPongTurn turns[kPairs] = {};
+    PingPongPlayer players[kPairs * 2];
+    thrd_t threads[kPairs * 2];
+
+    zx_time_t start = zx_clock_get(ZX_CLOCK_MONOTONIC);
+    for (int i = 0; i < kPairs * 2; ++i) {
+        players[i] = PingPongPlayer{&turns[i / 2].value, i % 2, kRounds};
+        ASSERT_EQ(thrd_create_with_name(&threads[i], ping_pong_thread, &players[i],
+                                        "ping_pong_thread"),
+                  thrd_success, "thread creation");
+    }
+    for (int i = 0; i < kPairs * 2; ++i) {
+        int ret;
+        ASSERT_EQ(thrd_join(threads[i], &ret), thrd_success, "thrd_join");
+        EXPECT_EQ(ret, 0, "futex operation failed");
+    }
+    zx_time_t elapsed = zx_clock_get(ZX_CLOCK_MONOTONIC) - start;
+
+    unittest_printf("%d futex pairs: %" PRIu64 " ns per hand-off\n", kPairs,
+                    elapsed / (kPairs * kRounds * 2));
+    END_TEST;
+}
+
 static void log(const char* str) {
     uint64_t now = zx_clock_get(ZX_CLOCK_MONOTONIC);
     unittest_printf("[%08" PRIu64 ".%08" PRIu64 "]: %s",
@@ -544,6 +603,7 @@ RUN_TEST(test_futex_requeue_unqueued_on_timeout);
 RUN_TEST(test_futex_thread_killed);
 RUN_TEST(test_futex_thread_suspended);
 RUN_TEST(test_futex_misaligned);
+RUN_TEST(test_futex_many_futexes_contention);
 RUN_TEST(test_event_signaling);
 END_TEST_CASE(futex_tests)
 
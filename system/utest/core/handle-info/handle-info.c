@@ -4,6 +4,7 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <threads.h>
 
 #include <zircon/process.h>
 #include <zircon/syscalls.h>
@@ -144,10 +145,60 @@ static bool handle_rights_test(void) {
     END_TEST;
 }
 
+#define DUP_THREADS 8
+#define DUP_ITERATIONS 2000
+#define DUP_BATCH 16
+
+static int dup_close_thread(void* arg) {
+    zx_handle_t event = *(zx_handle_t*)arg;
+    for (int i = 0; i < DUP_ITERATIONS; i++) {
+        zx_handle_t dups[DUP_BATCH];
+        for (int j = 0; j < DUP_BATCH; j++) {
+            if (zx_handle_duplicate(event, ZX_RIGHT_SAME_RIGHTS, &dups[j]) != ZX_OK)
+                return -1;
+        }
+        for (int j = 0; j < DUP_BATCH; j++) {
+            if (zx_handle_close(dups[j]) != ZX_OK)
+                return -1;
+            // The slot may already be reused, but never under the same value.
+            if (zx_handle_close(dups[j]) != ZX_ERR_BAD_HANDLE)
+                return -1;
+        }
+    }
+    return 0;
+}
+
+static bool handle_concurrent_dup_close_test(void) {
+    BEGIN_TEST;
+
+    zx_handle_t event;
+    ASSERT_EQ(zx_event_create(0u, &event), ZX_OK, "");
+
+    thrd_t threads[DUP_THREADS];
+    for (int i = 0; i < DUP_THREADS; i++) {
+        ASSERT_EQ(thrd_create(&threads[i], dup_close_thread, &event), thrd_success, "");
+    }
+    for (int i = 0; i < DUP_THREADS; i++) {
+        int result;
+        ASSERT_EQ(thrd_join(threads[i], &result), thrd_success, "");
+        EXPECT_EQ(result, 0, "dup/close failed");
+    }
+
+    zx_info_handle_count_t info = {};
+    ASSERT_EQ(zx_object_get_info(event, ZX_INFO_HANDLE_COUNT, &info, sizeof(info), NULL, NULL),
+              ZX_OK, "");
+    EXPECT_EQ(info.handle_count, 1u, "handle count should be back to one");
+
+    ASSERT_EQ(zx_handle_close(event), ZX_OK, "");
+
+    END_TEST;
+}
+
 BEGIN_TEST_CASE(handle_info_tests)
 RUN_TEST(handle_info_test)
 RUN_TEST(handle_related_koid_test)
 RUN_TEST(handle_rights_test)
+RUN_TEST(handle_concurrent_dup_close_test)
 END_TEST_CASE(handle_info_tests)
 
 #ifndef BUILD_COMBINED_TESTS
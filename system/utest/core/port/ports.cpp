@@ -139,6 +139,51 @@ static bool wait_count_invalid_test() {
     END_TEST;
 }
 
+static bool wait_many_test() {
+    BEGIN_TEST;
+
+    zx_handle_t port;
+    zx_status_t status = zx_port_create(0u, &port);
+    EXPECT_EQ(status, ZX_OK);
+
+    constexpr size_t kQueued = 20u;
+    for (size_t i = 0u; i < kQueued; ++i) {
+        zx_port_packet_t in = {};
+        in.key = i;
+        status = zx_port_queue(port, &in, 1u);
+        EXPECT_EQ(status, ZX_OK);
+    }
+
+    zx_port_packet_t out[32] = {};
+    size_t actual = 0u;
+    EXPECT_EQ(zx_port_wait_many(port, ZX_TIME_INFINITE, out, 0u, &actual),
+              ZX_ERR_INVALID_ARGS);
+
+    // Packets come out in FIFO order, no more than asked for.
+    status = zx_port_wait_many(port, ZX_TIME_INFINITE, out, 3u, &actual);
+    EXPECT_EQ(status, ZX_OK);
+    EXPECT_EQ(actual, 3u);
+    for (size_t i = 0u; i < actual; ++i) {
+        EXPECT_EQ(out[i].key, i);
+        EXPECT_EQ(out[i].type, ZX_PKT_TYPE_USER);
+    }
+
+    // The rest come out in one call when there is room for them.
+    status = zx_port_wait_many(port, ZX_TIME_INFINITE, out, fbl::count_of(out), &actual);
+    EXPECT_EQ(status, ZX_OK);
+    EXPECT_EQ(actual, kQueued - 3u);
+    for (size_t i = 0u; i < actual; ++i) {
+        EXPECT_EQ(out[i].key, i + 3u);
+    }
+
+    status = zx_port_wait_many(port, 0u, out, fbl::count_of(out), &actual);
+    EXPECT_EQ(status, ZX_ERR_TIMED_OUT);
+
+    EXPECT_EQ(zx_handle_close(port), ZX_OK);
+
+    END_TEST;
+}
+
 static bool queue_and_close_test(void) {
     BEGIN_TEST;
     zx_status_t status;
@@ -746,6 +791,7 @@ RUN_TEST(wait_count_valid_test<0u>)
 RUN_TEST(wait_count_valid_test<1u>)
 RUN_TEST(wait_count_invalid_test<2u>)
 RUN_TEST(wait_count_invalid_test<23u>)
+RUN_TEST(wait_many_test)
 RUN_TEST(queue_and_close_test)
 RUN_TEST(async_wait_channel_test)
 RUN_TEST(async_wait_event_test_single)
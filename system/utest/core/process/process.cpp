@@ -3,6 +3,7 @@
 // found in the LICENSE file.
 
 #include <assert.h>
+#include <inttypes.h>
 
 #include <zircon/process.h>
 #include <zircon/syscalls.h>
@@ -307,6 +308,51 @@ bool info_reflects_process_state() {
     END_TEST;
 }
 
+// Measures round trips over a channel to another process.  Each round trip
+// switches address spaces twice, so this tracks what those switches cost,
+// e.g. with and without kernel.x86.disable_pcid.
+bool cross_process_channel_ping_pong() {
+    BEGIN_TEST;
+
+    zx_handle_t proc;
+    zx_handle_t thread;
+    zx_handle_t vmar;
+
+    ASSERT_EQ(zx_process_create(zx_job_default(), "ping-pong", 9u, 0, &proc, &vmar), ZX_OK);
+    ASSERT_EQ(zx_thread_create(proc, "ping-pong", 9u, 0u, &thread), ZX_OK);
+
+    zx_handle_t event;
+    ASSERT_EQ(zx_event_create(0u, &event), ZX_OK);
+
+    zx_handle_t cmd_channel;
+    ASSERT_EQ(start_mini_process_etc(proc, thread, vmar, event, &cmd_channel), ZX_OK);
+
+    // Warm up before measuring.
+    for (int i = 0; i < 100; ++i) {
+        ASSERT_EQ(mini_process_cmd(cmd_channel, MINIP_CMD_ECHO_MSG, nullptr), ZX_OK);
+    }
+
+    const int kRoundTrips = 10000;
+    zx_status_t status = ZX_OK;
+    zx_time_t start = zx_clock_get(ZX_CLOCK_MONOTONIC);
+    for (int i = 0; i < kRoundTrips && status == ZX_OK; ++i) {
+        status = mini_process_cmd(cmd_channel, MINIP_CMD_ECHO_MSG, nullptr);
+    }
+    zx_time_t elapsed = zx_clock_get(ZX_CLOCK_MONOTONIC) - start;
+    ASSERT_EQ(status, ZX_OK);
+
+    unittest_printf_critical("\n%d cross-process round trips: %" PRIu64 " ns per round trip\n",
+                             kRoundTrips, elapsed / kRoundTrips);
+
+    EXPECT_EQ(mini_process_cmd(cmd_channel, MINIP_CMD_EXIT_NORMAL, nullptr), ZX_ERR_PEER_CLOSED);
+
+    zx_handle_close(cmd_channel);
+    zx_handle_close(thread);
+    zx_handle_close(proc);
+    zx_handle_close(vmar);
+    END_TEST;
+}
+
 } // namespace
 
 BEGIN_TEST_CASE(process_tests)
@@ -318,6 +364,7 @@ RUN_TEST(kill_process_via_thread_kill);
 RUN_TEST_ENABLE_CRASH_HANDLER(kill_process_via_vmar_destroy);
 RUN_TEST(kill_channel_handle_cycle);
 RUN_TEST(info_reflects_process_state);
+RUN_TEST(cross_process_channel_ping_pong);
 END_TEST_CASE(process_tests)
 
 #ifndef BUILD_COMBINED_TESTS
@@ -3,11 +3,15 @@
 // found in the LICENSE file.
 
 #include <assert.h>
+#include <limits.h>
+#include <zircon/compiler.h>
 #include <zircon/syscalls.h>
+#include <zircon/syscalls/object.h>
 #include <unittest/unittest.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 
 static zx_signals_t get_satisfied_signals(zx_handle_t handle) {
@@ -460,8 +464,11 @@ static bool socket_short_write(void) {
     status = zx_socket_create(0, &h0, &h1);
     ASSERT_EQ(status, ZX_OK, "");
 
-    // TODO(qsr): Request socket buffer and use (socket_buffer + 1).
-    const size_t buffer_size = 256 * 1024 + 1;
+    size_t buffer_size = 0;
+    status = zx_object_get_property(h1, ZX_PROP_SOCKET_RX_BUF_MAX,
+                                    &buffer_size, sizeof(buffer_size));
+    ASSERT_EQ(status, ZX_OK, "");
+    buffer_size += 1;
     char* buffer = malloc(buffer_size);
     size_t written = ~(size_t)0; // This should get overwritten by the syscall.
     status = zx_socket_write(h0, 0u, buffer, buffer_size, &written);
@@ -552,8 +559,11 @@ static bool socket_datagram_no_short_write(void) {
     status = zx_socket_create(ZX_SOCKET_DATAGRAM, &h0, &h1);
     ASSERT_EQ(status, ZX_OK, "");
 
-    // TODO(qsr): Request socket buffer and use (socket_buffer + 1).
-    const size_t buffer_size = 256 * 1024 + 1;
+    size_t buffer_size = 0;
+    status = zx_object_get_property(h1, ZX_PROP_SOCKET_RX_BUF_MAX,
+                                    &buffer_size, sizeof(buffer_size));
+    ASSERT_EQ(status, ZX_OK, "");
+    buffer_size += 1;
     char* buffer = malloc(buffer_size);
     size_t written = 999;
     status = zx_socket_write(h0, 0u, buffer, buffer_size, &written);
@@ -799,6 +809,250 @@ static bool socket_accept(void) {
     END_TEST;
 }
 
+static bool socket_writev_readv(void) {
+    BEGIN_TEST;
+
+    zx_status_t status;
+    size_t count;
+
+    zx_handle_t h0, h1;
+    status = zx_socket_create(0, &h0, &h1);
+    ASSERT_EQ(status, ZX_OK, "");
+
+    char big[3000];
+    for (size_t i = 0; i < sizeof(big); i++)
+        big[i] = (char)i;
+    zx_iovec_t wvec[] = {
+        { "abc", 3u },
+        { NULL, 0u },
+        { big, sizeof(big) },
+        { "xyz", 3u },
+    };
+    status = zx_socket_writev(h0, 0u, wvec, countof(wvec), &count);
+    EXPECT_EQ(status, ZX_OK, "");
+    EXPECT_EQ(count, sizeof(big) + 6u, "");
+
+    char head[5];
+    char body[sizeof(big)];
+    zx_iovec_t rvec[] = {
+        { head, sizeof(head) },
+        { body, sizeof(body) },
+    };
+    status = zx_socket_readv(h1, 0u, rvec, countof(rvec), &count);
+    EXPECT_EQ(status, ZX_OK, "");
+    EXPECT_EQ(count, sizeof(big) + 5u, "");
+    EXPECT_EQ(memcmp(head, "abc", 3), 0, "");
+    EXPECT_EQ(memcmp(head + 3, big, 2), 0, "");
+    EXPECT_EQ(memcmp(body, big + 2, sizeof(big) - 2), 0, "");
+    EXPECT_EQ(memcmp(body + sizeof(big) - 2, "xy", 2), 0, "");
+
+    status = zx_socket_read(h1, 0u, head, sizeof(head), &count);
+    EXPECT_EQ(status, ZX_OK, "");
+    EXPECT_EQ(count, 1u, "");
+    EXPECT_EQ(head[0], 'z', "");
+
+    status = zx_socket_writev(h0, 0u, wvec, 0u, &count);
+    EXPECT_EQ(status, ZX_ERR_OUT_OF_RANGE, "");
+    status = zx_socket_writev(h0, 0u, wvec, ZX_SOCKET_MAX_IOVECS + 1u, &count);
+    EXPECT_EQ(status, ZX_ERR_OUT_OF_RANGE, "");
+    status = zx_socket_writev(h0, 1u, wvec, countof(wvec), &count);
+    EXPECT_EQ(status, ZX_ERR_INVALID_ARGS, "");
+
+    zx_handle_close(h0);
+    zx_handle_close(h1);
+
+    END_TEST;
+}
+
+static bool socket_datagram_writev_readv(void) {
+    BEGIN_TEST;
+
+    zx_status_t status;
+    size_t count;
+
+    zx_handle_t h0, h1;
+    status = zx_socket_create(ZX_SOCKET_DATAGRAM, &h0, &h1);
+    ASSERT_EQ(status, ZX_OK, "");
+
+    zx_iovec_t wvec[] = {
+        { "pac", 3u },
+        { "ket1", 5u },
+    };
+    status = zx_socket_writev(h0, 0u, wvec, countof(wvec), &count);
+    EXPECT_EQ(status, ZX_OK, "");
+    EXPECT_EQ(count, 8u, "");
+    status = zx_socket_write(h0, 0u, "pkt2", 5u, &count);
+    EXPECT_EQ(status, ZX_OK, "");
+
+    // A short read discards the rest of the packet.
+    char a[2], b[2];
+    zx_iovec_t rvec[] = {
+        { a, sizeof(a) },
+        { b, sizeof(b) },
+    };
+    status = zx_socket_readv(h1, 0u, rvec, countof(rvec), &count);
+    EXPECT_EQ(status, ZX_OK, "");
+    EXPECT_EQ(count, 4u, "");
+    EXPECT_EQ(memcmp(a, "pa", 2), 0, "");
+    EXPECT_EQ(memcmp(b, "ck", 2), 0, "");
+
+    char rbuf[16];
+    status = zx_socket_read(h1, 0u, rbuf, sizeof(rbuf), &count);
+    EXPECT_EQ(status, ZX_OK, "");
+    EXPECT_EQ(count, 5u, "");
+    EXPECT_EQ(memcmp(rbuf, "pkt2", 5), 0, "");
+
+    zx_handle_close(h0);
+    zx_handle_close(h1);
+
+    END_TEST;
+}
+
+static bool socket_rx_buf_max(void) {
+    BEGIN_TEST;
+
+    zx_status_t status;
+    size_t count;
+
+    zx_handle_t h0, h1;
+    status = zx_socket_create(0, &h0, &h1);
+    ASSERT_EQ(status, ZX_OK, "");
+
+    size_t size_max = 0;
+    status = zx_object_get_property(h1, ZX_PROP_SOCKET_RX_BUF_MAX,
+                                    &size_max, sizeof(size_max));
+    EXPECT_EQ(status, ZX_OK, "");
+    EXPECT_GT(size_max, 0u, "");
+
+    size_max = 0;
+    status = zx_object_set_property(h1, ZX_PROP_SOCKET_RX_BUF_MAX,
+                                    &size_max, sizeof(size_max));
+    EXPECT_EQ(status, ZX_ERR_OUT_OF_RANGE, "");
+    size_max = ZX_SOCKET_MAX_RX_BUF + 1u;
+    status = zx_object_set_property(h1, ZX_PROP_SOCKET_RX_BUF_MAX,
+                                    &size_max, sizeof(size_max));
+    EXPECT_EQ(status, ZX_ERR_OUT_OF_RANGE, "");
+
+    size_max = 10u;
+    status = zx_object_set_property(h1, ZX_PROP_SOCKET_RX_BUF_MAX,
+                                    &size_max, sizeof(size_max));
+    EXPECT_EQ(status, ZX_OK, "");
+
+    char buf[16] = {0};
+    status = zx_socket_write(h0, 0u, buf, sizeof(buf), &count);
+    EXPECT_EQ(status, ZX_OK, "");
+    EXPECT_EQ(count, 10u, "");
+    EXPECT_EQ(get_satisfied_signals(h0) & ZX_SOCKET_WRITABLE, 0u, "");
+
+    // Raising the limit makes the peer writable again.
+    size_max = 20u;
+    status = zx_object_set_property(h1, ZX_PROP_SOCKET_RX_BUF_MAX,
+                                    &size_max, sizeof(size_max));
+    EXPECT_EQ(status, ZX_OK, "");
+    EXPECT_EQ(get_satisfied_signals(h0) & ZX_SOCKET_WRITABLE, ZX_SOCKET_WRITABLE, "");
+
+    // Lowering it below what is queued keeps the bytes but blocks writes.
+    size_max = 4u;
+    status = zx_object_set_property(h1, ZX_PROP_SOCKET_RX_BUF_MAX,
+                                    &size_max, sizeof(size_max));
+    EXPECT_EQ(status, ZX_OK, "");
+    EXPECT_EQ(get_satisfied_signals(h0) & ZX_SOCKET_WRITABLE, 0u, "");
+    status = zx_socket_write(h0, 0u, buf, sizeof(buf), &count);
+    EXPECT_EQ(status, ZX_ERR_SHOULD_WAIT, "");
+
+    status = zx_socket_read(h1, 0u, NULL, 0, &count);
+    EXPECT_EQ(status, ZX_OK, "");
+    EXPECT_EQ(count, 10u, "");
+    status = zx_socket_read(h1, 0u, buf, sizeof(buf), &count);
+    EXPECT_EQ(status, ZX_OK, "");
+    EXPECT_EQ(count, 10u, "");
+    EXPECT_EQ(get_satisfied_signals(h0) & ZX_SOCKET_WRITABLE, ZX_SOCKET_WRITABLE, "");
+
+    zx_handle_close(h0);
+    zx_handle_close(h1);
+
+    END_TEST;
+}
+
+static bool socket_write_vmo(void) {
+    BEGIN_TEST;
+
+    zx_status_t status;
+    size_t count;
+
+    zx_handle_t h0, h1;
+    status = zx_socket_create(0, &h0, &h1);
+    ASSERT_EQ(status, ZX_OK, "");
+
+    const size_t vmo_size = 4 * PAGE_SIZE;
+    zx_handle_t vmo;
+    status = zx_vmo_create(vmo_size, 0u, &vmo);
+    ASSERT_EQ(status, ZX_OK, "");
+    char* data = malloc(vmo_size);
+    for (size_t i = 0; i < vmo_size; i++)
+        data[i] = (char)(i * 7);
+    status = zx_vmo_write(vmo, data, 0u, vmo_size, &count);
+    ASSERT_EQ(status, ZX_OK, "");
+
+    // An unaligned range spanning several pages.
+    const uint64_t offset = 100u;
+    const size_t len = 2 * PAGE_SIZE + 50u;
+    status = zx_socket_write_vmo(h0, 0u, vmo, offset, len, &count);
+    EXPECT_EQ(status, ZX_OK, "");
+    EXPECT_EQ(count, len, "");
+    EXPECT_EQ(get_satisfied_signals(h1) & ZX_SOCKET_READABLE, ZX_SOCKET_READABLE, "");
+
+    // Later writes to the VMO are not seen by the reader.
+    char junk[16] = {0};
+    status = zx_vmo_write(vmo, junk, offset, sizeof(junk), &count);
+    EXPECT_EQ(status, ZX_OK, "");
+
+    // Bytes written normally queue up behind the VMO range.
+    status = zx_socket_write(h0, 0u, "tail", 4u, &count);
+    EXPECT_EQ(status, ZX_OK, "");
+
+    char* rbuf = malloc(len + 4u);
+    size_t total = 0;
+    while (total < len + 4u) {
+        status = zx_socket_read(h1, 0u, rbuf + total, 1000u, &count);
+        ASSERT_EQ(status, ZX_OK, "");
+        total += count;
+    }
+    EXPECT_EQ(memcmp(rbuf, data + offset, len), 0, "");
+    EXPECT_EQ(memcmp(rbuf + len, "tail", 4), 0, "");
+
+    status = zx_socket_write_vmo(h0, 0u, vmo, vmo_size - 10u, 11u, &count);
+    EXPECT_EQ(status, ZX_ERR_OUT_OF_RANGE, "");
+
+    // A write to a full socket is refused, and one that only partly fits
+    // is cut short at the reader's limit.
+    size_t rx_max = PAGE_SIZE;
+    status = zx_object_set_property(h1, ZX_PROP_SOCKET_RX_BUF_MAX,
+                                    &rx_max, sizeof(rx_max));
+    EXPECT_EQ(status, ZX_OK, "");
+    status = zx_socket_write_vmo(h0, 0u, vmo, 0u, vmo_size, &count);
+    EXPECT_EQ(status, ZX_OK, "");
+    EXPECT_EQ(count, rx_max, "");
+    status = zx_socket_write_vmo(h0, 0u, vmo, 0u, vmo_size, &count);
+    EXPECT_EQ(status, ZX_ERR_SHOULD_WAIT, "");
+
+    zx_handle_t d0, d1;
+    status = zx_socket_create(ZX_SOCKET_DATAGRAM, &d0, &d1);
+    ASSERT_EQ(status, ZX_OK, "");
+    status = zx_socket_write_vmo(d0, 0u, vmo, 0u, 10u, &count);
+    EXPECT_EQ(status, ZX_ERR_NOT_SUPPORTED, "");
+
+    free(rbuf);
+    free(data);
+    zx_handle_close(vmo);
+    zx_handle_close(d0);
+    zx_handle_close(d1);
+    zx_handle_close(h0);
+    zx_handle_close(h1);
+
+    END_TEST;
+}
+
 BEGIN_TEST_CASE(socket_tests)
 RUN_TEST(socket_basic)
 RUN_TEST(socket_signals)
@@ -814,6 +1068,10 @@ RUN_TEST(socket_control_plane_absent)
 RUN_TEST(socket_control_plane)
 RUN_TEST(socket_control_plane_shutdown)
 RUN_TEST(socket_accept)
+RUN_TEST(socket_writev_readv)
+RUN_TEST(socket_datagram_writev_readv)
+RUN_TEST(socket_rx_buf_max)
+RUN_TEST(socket_write_vmo)
 END_TEST_CASE(socket_tests)
 
 #ifndef BUILD_COMBINED_TESTS
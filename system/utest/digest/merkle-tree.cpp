@@ -4,11 +4,16 @@
 
 #include <digest/merkle-tree.h>
 
+#include <inttypes.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include <digest/digest.h>
+#include <fbl/alloc_checker.h>
+#include <fbl/unique_ptr.h>
 #include <zircon/assert.h>
 #include <zircon/status.h>
+#include <zircon/syscalls.h>
 #include <unittest/unittest.h>
 
 namespace {
@@ -603,6 +608,21 @@ bool VerifyBadTree(void) {
     END_TEST;
 }
 
+bool VerifyBadTreeSmallRange(void) {
+    BEGIN_TEST_WITH_RC;
+    size_t tree_len = MerkleTree::GetTreeLength(kLarge);
+    Digest digest;
+    ASSERT_OK(MerkleTree::Create(gData, kLarge, gTree, tree_len, &digest));
+    // Corrupt the digest of the second data node.  Checking a single byte of
+    // the first data node must still catch it, since both digests share a
+    // tree node.
+    gTree[Digest::kLength] ^= 1;
+    ASSERT_ERR(
+        ZX_ERR_IO_DATA_INTEGRITY,
+        MerkleTree::Verify(gData, kLarge, gTree, tree_len, 0, 1, digest));
+    END_TEST;
+}
+
 bool VerifyGoodPartOfBadLeaves(void) {
     BEGIN_TEST_WITH_RC;
     size_t tree_len = MerkleTree::GetTreeLength(kSmall);
@@ -692,6 +712,137 @@ bool CreateAndVerifyHugePRNGData(void) {
     END_TEST;
 }
 
+// The most threads the parallel tests below split a tree across.
+const size_t kMaxThreads = 8;
+
+// Used by CreateParallelAll below.
+bool CreateParallel(size_t data_len, const char* digest) {
+    zx_status_t rc;
+    size_t tree_len = MerkleTree::GetTreeLength(data_len);
+    Digest expected;
+    ASSERT_OK(expected.Parse(digest, strlen(digest)));
+    // Keep the tree made by Create() to compare against.
+    uint8_t tree[sizeof(gTree)];
+    Digest sequential;
+    ASSERT_OK(MerkleTree::Create(gData, data_len, tree, tree_len, &sequential));
+    for (size_t num_threads = 1; num_threads <= kMaxThreads; ++num_threads) {
+        Digest actual;
+        memset(gTree, 0xff, sizeof(gTree));
+        ASSERT_OK(MerkleTree::CreateParallel(gData, data_len, gTree, tree_len,
+                                             &actual, num_threads));
+        ASSERT_TRUE(actual == expected, "Incorrect root digest");
+        ASSERT_EQ(memcmp(tree, gTree, tree_len), 0, "Incorrect Merkle tree");
+    }
+    return true;
+}
+
+bool CreateParallelAll(void) {
+    BEGIN_TEST;
+    for (size_t i = 0; i < kNumCases; ++i) {
+        if (!CreateParallel(kCases[i].data_len, kCases[i].digest)) {
+            unittest_printf_critical(
+                "CreateParallelAll failed with data length of %zu\n",
+                kCases[i].data_len);
+        }
+    }
+    END_TEST;
+}
+
+bool CreateParallelTreeTooSmall(void) {
+    BEGIN_TEST_WITH_RC;
+    Digest digest;
+    ASSERT_ERR(ZX_ERR_BUFFER_TOO_SMALL,
+               MerkleTree::CreateParallel(gData, kLarge, gTree, kNodeSize,
+                                          &digest, kMaxThreads));
+    END_TEST;
+}
+
+bool VerifyParallelAll(void) {
+    BEGIN_TEST_WITH_RC;
+    for (size_t i = 0; i < kNumCases; ++i) {
+        size_t data_len = kCases[i].data_len;
+        size_t tree_len = MerkleTree::GetTreeLength(data_len);
+        Digest digest;
+        ASSERT_OK(MerkleTree::Create(gData, data_len, gTree, tree_len, &digest));
+        for (size_t num_threads = 1; num_threads <= kMaxThreads; ++num_threads) {
+            ASSERT_OK(MerkleTree::VerifyParallel(gData, data_len, gTree, tree_len,
+                                                 0, data_len, digest, num_threads));
+        }
+    }
+    END_TEST;
+}
+
+bool VerifyParallelBadTree(void) {
+    BEGIN_TEST_WITH_RC;
+    size_t tree_len = MerkleTree::GetTreeLength(kLarge);
+    Digest digest;
+    ASSERT_OK(MerkleTree::Create(gData, kLarge, gTree, tree_len, &digest));
+    // Corrupt the digest of the last data node, which falls to the last thread.
+    gTree[(kLarge / kNodeSize - 1) * Digest::kLength] ^= 1;
+    ASSERT_ERR(ZX_ERR_IO_DATA_INTEGRITY,
+               MerkleTree::VerifyParallel(gData, kLarge, gTree, tree_len, 0,
+                                          kLarge, digest, kMaxThreads));
+    END_TEST;
+}
+
+bool VerifyParallelBadLeaves(void) {
+    BEGIN_TEST_WITH_RC;
+    size_t tree_len = MerkleTree::GetTreeLength(kLarge);
+    Digest digest;
+    ASSERT_OK(MerkleTree::Create(gData, kLarge, gTree, tree_len, &digest));
+    gData[kLarge / 2] ^= 1;
+    rc = MerkleTree::VerifyParallel(gData, kLarge, gTree, tree_len, 0, kLarge,
+                                    digest, kMaxThreads);
+    gData[kLarge / 2] ^= 1;
+    ASSERT_EQ(rc, ZX_ERR_IO_DATA_INTEGRITY, zx_status_get_string(rc));
+    END_TEST;
+}
+
+// Compares the throughput of creating and verifying a Merkle tree over a large
+// buffer on one thread and on every CPU.
+bool BenchmarkParallel(void) {
+    BEGIN_TEST_WITH_RC;
+    const size_t kDataLen = 128 * 1024 * 1024;
+    fbl::AllocChecker ac;
+    fbl::unique_ptr<uint8_t[]> data(new (&ac) uint8_t[kDataLen]);
+    ASSERT_TRUE(ac.check());
+    size_t tree_len = MerkleTree::GetTreeLength(kDataLen);
+    fbl::unique_ptr<uint8_t[]> tree(new (&ac) uint8_t[tree_len]);
+    ASSERT_TRUE(ac.check());
+    for (size_t i = 0; i < kDataLen; ++i) {
+        data[i] = static_cast<uint8_t>(rand());
+    }
+
+    size_t num_cpus = zx_system_get_num_cpus();
+    uint64_t ticks_per_sec = zx_ticks_per_second();
+    size_t thread_counts[] = {1, num_cpus};
+    Digest expected;
+    for (size_t num_threads : thread_counts) {
+        Digest digest;
+        uint64_t start = zx_ticks_get();
+        ASSERT_OK(MerkleTree::CreateParallel(data.get(), kDataLen, tree.get(),
+                                             tree_len, &digest, num_threads));
+        uint64_t created = zx_ticks_get();
+        ASSERT_OK(MerkleTree::VerifyParallel(data.get(), kDataLen, tree.get(),
+                                             tree_len, 0, kDataLen, digest,
+                                             num_threads));
+        uint64_t verified = zx_ticks_get();
+        if (num_threads == 1) {
+            expected = digest.AcquireBytes();
+            digest.ReleaseBytes();
+        } else {
+            ASSERT_TRUE(digest == expected, "Parallel root digest differs");
+        }
+        unittest_printf_critical(
+            "\n%zu MB on %zu thread(s): create %" PRIu64 " MB/s, verify %" PRIu64
+            " MB/s",
+            kDataLen / (1024 * 1024), num_threads,
+            (kDataLen / (1024 * 1024)) * ticks_per_sec / (created - start),
+            (kDataLen / (1024 * 1024)) * ticks_per_sec / (verified - created));
+    }
+    END_TEST;
+}
+
 } // namespace
 
 BEGIN_TEST_CASE(MerkleTreeTests)
@@ -737,7 +888,14 @@ RUN_TEST(VerifyZeroLength)
 RUN_TEST(VerifyBadRoot)
 RUN_TEST(VerifyGoodPartOfBadTree)
 RUN_TEST(VerifyBadTree)
+RUN_TEST(VerifyBadTreeSmallRange)
 RUN_TEST(VerifyGoodPartOfBadLeaves)
 RUN_TEST(VerifyBadLeaves)
 RUN_TEST(CreateAndVerifyHugePRNGData)
+RUN_TEST(CreateParallelAll)
+RUN_TEST(CreateParallelTreeTooSmall)
+RUN_TEST(VerifyParallelAll)
+RUN_TEST(VerifyParallelBadTree)
+RUN_TEST(VerifyParallelBadLeaves)
+RUN_TEST_PERFORMANCE(BenchmarkParallel)
 END_TEST_CASE(MerkleTreeTests)
@@ -202,6 +202,74 @@ bool benchmark_path_walk(void) {
     END_TEST;
 }
 
+inline void time_end_per_op(const char* str, uint64_t start, size_t ops) {
+    uint64_t end = zx_ticks_get();
+    uint64_t ticks_per_usec = zx_ticks_per_second() / 1000000;
+    printf("Benchmark %s: [%10lu] usec/op\n", str, (end - start) / ticks_per_usec / ops);
+}
+
+constexpr size_t kDirSampleOps = 100;
+
+// Measures how lookup and create latency grow with the number of entries
+// already in a directory. Timings are taken from the last |kDirSampleOps|
+// entries, so that they reflect a directory of (about) NumEntries entries.
+template <size_t NumEntries>
+bool benchmark_directory_size(void) {
+    BEGIN_TEST;
+    static_assert(NumEntries > kDirSampleOps, "Too few entries to sample");
+    printf("\nBenchmarking Directory size (%lu entries)\n", NumEntries);
+    ASSERT_EQ(mkdir(MOUNT_POINT "/dir", 0666), 0);
+    char path[PATH_MAX];
+    uint64_t start;
+
+    const size_t fill = NumEntries - kDirSampleOps;
+    for (size_t i = 0; i < fill; i++) {
+        snprintf(path, sizeof(path), MOUNT_POINT "/dir/entry-%zu", i);
+        int fd = open(path, O_CREAT | O_EXCL | O_RDWR, 0644);
+        ASSERT_GT(fd, 0, "Cannot create file");
+        ASSERT_EQ(close(fd), 0);
+    }
+
+    start = zx_ticks_get();
+    for (size_t i = fill; i < NumEntries; i++) {
+        snprintf(path, sizeof(path), MOUNT_POINT "/dir/entry-%zu", i);
+        int fd = open(path, O_CREAT | O_EXCL | O_RDWR, 0644);
+        ASSERT_GT(fd, 0, "Cannot create file");
+        ASSERT_EQ(close(fd), 0);
+    }
+    time_end_per_op("create", start, kDirSampleOps);
+
+    // Look up entries spread across the whole directory.
+    struct stat buf;
+    start = zx_ticks_get();
+    for (size_t i = 0; i < kDirSampleOps; i++) {
+        snprintf(path, sizeof(path), MOUNT_POINT "/dir/entry-%zu", i * NumEntries / kDirSampleOps);
+        ASSERT_EQ(stat(path, &buf), 0, "Could not stat file");
+    }
+    time_end_per_op("lookup", start, kDirSampleOps);
+
+    start = zx_ticks_get();
+    for (size_t i = 0; i < kDirSampleOps; i++) {
+        snprintf(path, sizeof(path), MOUNT_POINT "/dir/missing-%zu", i);
+        ASSERT_EQ(stat(path, &buf), -1, "Stat of missing file succeeded");
+    }
+    time_end_per_op("lookup (missing)", start, kDirSampleOps);
+
+    start = zx_ticks_get();
+    for (size_t i = 0; i < NumEntries; i++) {
+        snprintf(path, sizeof(path), MOUNT_POINT "/dir/entry-%zu", i);
+        ASSERT_EQ(unlink(path), 0, "Could not unlink file");
+    }
+    time_end("unlink", start);
+    ASSERT_EQ(rmdir(MOUNT_POINT "/dir"), 0);
+
+    int fd = open(MOUNT_POINT, O_DIRECTORY | O_RDONLY);
+    ASSERT_GE(fd, 0);
+    ASSERT_EQ(syncfs(fd), 0);
+    ASSERT_EQ(close(fd), 0);
+    END_TEST;
+}
+
 BEGIN_TEST_CASE(basic_benchmarks)
 RUN_TEST_PERFORMANCE((benchmark_write_read<16 * KB, 1024>))
 RUN_TEST_PERFORMANCE((benchmark_write_read<16 * KB, 2048>))
@@ -212,4 +280,8 @@ RUN_TEST_PERFORMANCE((benchmark_path_walk<125>))
 RUN_TEST_PERFORMANCE((benchmark_path_walk<250>))
 RUN_TEST_PERFORMANCE((benchmark_path_walk<500>))
 RUN_TEST_PERFORMANCE((benchmark_path_walk<1000>))
+RUN_TEST_PERFORMANCE((benchmark_directory_size<1000>))
+RUN_TEST_PERFORMANCE((benchmark_directory_size<4000>))
+RUN_TEST_PERFORMANCE((benchmark_directory_size<16000>))
+RUN_TEST_PERFORMANCE((benchmark_directory_size<32000>))
 END_TEST_CASE(basic_benchmarks)
@@ -4,9 +4,13 @@
 
 // Tests for MinFS-specific behavior.
 
+#include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
 #include <unistd.h>
 
 #include <minfs/format.h>
@@ -44,6 +48,100 @@ bool QueryInfo(size_t expected_nodes) {
     return true;
 }
 
+// Enough entries for a directory to carry a hash index.
+constexpr uint32_t kIndexedEntries = minfs::kMinfsDirIndexMinEntries * 2;
+
+void EntryPath(char* path, size_t len, const char* dir, uint32_t n) {
+    snprintf(path, len, "::%s/entry-%u", dir, n);
+}
+
+bool CreateEntries(const char* dir, uint32_t start, uint32_t count) {
+    BEGIN_HELPER;
+    for (uint32_t i = start; i < start + count; i++) {
+        char path[PATH_MAX];
+        EntryPath(path, sizeof(path), dir, i);
+        int fd = open(path, O_CREAT | O_EXCL | O_RDWR, 0644);
+        ASSERT_GT(fd, 0, "Failed to create entry");
+        ASSERT_EQ(close(fd), 0);
+    }
+    END_HELPER;
+}
+
+// Looks up entries [start, start + count) of |dir|, which must all exist or
+// all be missing.
+bool CheckEntries(const char* dir, uint32_t start, uint32_t count, bool exist) {
+    BEGIN_HELPER;
+    for (uint32_t i = start; i < start + count; i++) {
+        char path[PATH_MAX];
+        EntryPath(path, sizeof(path), dir, i);
+        struct stat s;
+        if (exist) {
+            ASSERT_EQ(stat(path, &s), 0, path);
+        } else {
+            ASSERT_EQ(stat(path, &s), -1, path);
+            ASSERT_EQ(errno, ENOENT);
+        }
+    }
+    END_HELPER;
+}
+
+bool GetIno(const char* path, minfs::ino_t* ino) {
+    BEGIN_HELPER;
+    struct stat s;
+    ASSERT_EQ(stat(path, &s), 0, path);
+    *ino = static_cast<minfs::ino_t>(s.st_ino);
+    END_HELPER;
+}
+
+// Reads inode |ino| straight off the disk of the unmounted filesystem, or with
+// |write|, replaces it with |inode|.
+bool AccessInode(minfs::ino_t ino, minfs::minfs_inode_t* inode, bool write) {
+    BEGIN_HELPER;
+    int fd = open(test_disk_path, O_RDWR);
+    ASSERT_GE(fd, 0, "Could not open disk");
+
+    char blk[minfs::kMinfsBlockSize];
+    ASSERT_EQ(read(fd, blk, sizeof(blk)), static_cast<ssize_t>(sizeof(blk)));
+    minfs::minfs_info_t info;
+    memcpy(&info, blk, sizeof(info));
+    ASSERT_EQ(info.magic0, minfs::kMinfsMagic0);
+    ASSERT_EQ(info.magic1, minfs::kMinfsMagic1);
+
+    off_t off = static_cast<off_t>(info.ino_block + ino / minfs::kMinfsInodesPerBlock) *
+                minfs::kMinfsBlockSize;
+    char* slot = blk + (ino % minfs::kMinfsInodesPerBlock) * minfs::kMinfsInodeSize;
+    ASSERT_EQ(lseek(fd, off, SEEK_SET), off);
+    ASSERT_EQ(read(fd, blk, sizeof(blk)), static_cast<ssize_t>(sizeof(blk)));
+    if (write) {
+        memcpy(slot, inode, sizeof(*inode));
+        ASSERT_EQ(lseek(fd, off, SEEK_SET), off);
+        ASSERT_EQ(::write(fd, blk, sizeof(blk)), static_cast<ssize_t>(sizeof(blk)));
+    } else {
+        memcpy(inode, slot, sizeof(*inode));
+    }
+    ASSERT_EQ(close(fd), 0);
+    END_HELPER;
+}
+
+// Unmounts and checks the filesystem, then reads back the inode of the
+// directory |ino| before mounting it again.
+bool RemountAndReadInode(minfs::ino_t ino, minfs::minfs_inode_t* inode) {
+    BEGIN_HELPER;
+    ASSERT_EQ(test_info->unmount(test_root_path), 0);
+    ASSERT_EQ(test_info->fsck(test_disk_path), 0);
+    ASSERT_TRUE(AccessInode(ino, inode, false));
+    ASSERT_EQ(test_info->mount(test_disk_path, test_root_path), 0);
+    END_HELPER;
+}
+
+bool CheckIndexed(const minfs::minfs_inode_t& inode) {
+    BEGIN_HELPER;
+    ASSERT_GE(inode.dir_index_slots, minfs::kMinfsDirIndexMinSlots);
+    ASSERT_EQ(inode.dir_index_seq, inode.seq_num, "Directory index is stale");
+    ASSERT_LE(inode.dir_index_used * 2, inode.dir_index_slots);
+    END_HELPER;
+}
+
 }  // namespace
 
 bool TestQueryInfo(void) {
@@ -64,9 +162,202 @@ bool TestQueryInfo(void) {
     END_TEST;
 }
 
+bool TestDirIndexRemount(void) {
+    BEGIN_TEST;
+
+    ASSERT_EQ(mkdir("::index_remount", 0755), 0);
+    ASSERT_TRUE(CreateEntries("index_remount", 0, kIndexedEntries));
+    minfs::ino_t ino;
+    ASSERT_TRUE(GetIno("::index_remount", &ino));
+
+    minfs::minfs_inode_t inode;
+    ASSERT_TRUE(RemountAndReadInode(ino, &inode));
+    ASSERT_TRUE(CheckIndexed(inode));
+
+    // Lookups go through the index read back from disk.
+    ASSERT_TRUE(CheckEntries("index_remount", 0, kIndexedEntries, true));
+    ASSERT_TRUE(CheckEntries("index_remount", kIndexedEntries, 1, false));
+    END_TEST;
+}
+
+bool TestDirIndexRename(void) {
+    BEGIN_TEST;
+
+    ASSERT_EQ(mkdir("::index_rename_a", 0755), 0);
+    ASSERT_EQ(mkdir("::index_rename_b", 0755), 0);
+    ASSERT_TRUE(CreateEntries("index_rename_a", 0, kIndexedEntries));
+    ASSERT_TRUE(CreateEntries("index_rename_b", 0, kIndexedEntries));
+
+    // Over an existing entry in the same directory.
+    minfs::ino_t moved;
+    ASSERT_TRUE(GetIno("::index_rename_a/entry-0", &moved));
+    ASSERT_EQ(rename("::index_rename_a/entry-0", "::index_rename_a/entry-1"), 0);
+    minfs::ino_t ino;
+    ASSERT_TRUE(GetIno("::index_rename_a/entry-1", &ino));
+    ASSERT_EQ(ino, moved);
+
+    // To a new name in another directory.
+    ASSERT_EQ(rename("::index_rename_a/entry-2", "::index_rename_b/entry-9999"), 0);
+
+    // Over an existing entry in another directory.
+    ASSERT_TRUE(GetIno("::index_rename_b/entry-3", &moved));
+    ASSERT_EQ(rename("::index_rename_b/entry-3", "::index_rename_a/entry-4"), 0);
+    ASSERT_TRUE(GetIno("::index_rename_a/entry-4", &ino));
+    ASSERT_EQ(ino, moved);
+
+    minfs::ino_t ino_a, ino_b;
+    ASSERT_TRUE(GetIno("::index_rename_a", &ino_a));
+    ASSERT_TRUE(GetIno("::index_rename_b", &ino_b));
+    for (int pass = 0; pass < 2; pass++) {
+        ASSERT_TRUE(CheckEntries("index_rename_a", 0, 1, false));
+        ASSERT_TRUE(CheckEntries("index_rename_a", 1, 1, true));
+        ASSERT_TRUE(CheckEntries("index_rename_a", 2, 1, false));
+        ASSERT_TRUE(CheckEntries("index_rename_a", 3, kIndexedEntries - 3, true));
+        ASSERT_TRUE(CheckEntries("index_rename_b", 0, 3, true));
+        ASSERT_TRUE(CheckEntries("index_rename_b", 3, 1, false));
+        ASSERT_TRUE(CheckEntries("index_rename_b", 4, kIndexedEntries - 4, true));
+        ASSERT_TRUE(CheckEntries("index_rename_b", 9999, 1, true));
+
+        if (pass == 0) {
+            minfs::minfs_inode_t inode;
+            ASSERT_TRUE(RemountAndReadInode(ino_a, &inode));
+            ASSERT_TRUE(CheckIndexed(inode));
+            ASSERT_TRUE(RemountAndReadInode(ino_b, &inode));
+            ASSERT_TRUE(CheckIndexed(inode));
+        }
+    }
+    END_TEST;
+}
+
+bool TestDirIndexUnlinkTail(void) {
+    BEGIN_TEST;
+
+    ASSERT_EQ(mkdir("::index_tail", 0755), 0);
+    ASSERT_TRUE(CreateEntries("index_tail", 0, kIndexedEntries));
+
+    // The newest entries are the last records in the directory; once they
+    // are gone, new entries are appended in their place.
+    char path[PATH_MAX];
+    EntryPath(path, sizeof(path), "index_tail", kIndexedEntries - 1);
+    ASSERT_EQ(unlink(path), 0);
+    EntryPath(path, sizeof(path), "index_tail", kIndexedEntries - 2);
+    ASSERT_EQ(unlink(path), 0);
+    ASSERT_TRUE(CreateEntries("index_tail", kIndexedEntries, 2));
+
+    minfs::ino_t ino;
+    ASSERT_TRUE(GetIno("::index_tail", &ino));
+    for (int pass = 0; pass < 2; pass++) {
+        ASSERT_TRUE(CheckEntries("index_tail", 0, kIndexedEntries - 2, true));
+        ASSERT_TRUE(CheckEntries("index_tail", kIndexedEntries - 2, 2, false));
+        ASSERT_TRUE(CheckEntries("index_tail", kIndexedEntries, 2, true));
+
+        if (pass == 0) {
+            minfs::minfs_inode_t inode;
+            ASSERT_TRUE(RemountAndReadInode(ino, &inode));
+            ASSERT_TRUE(CheckIndexed(inode));
+        }
+    }
+    END_TEST;
+}
+
+bool TestDirIndexGrow(void) {
+    BEGIN_TEST;
+
+    // Past half of the smallest index, so that it must be rebuilt larger.
+    const uint32_t count = minfs::kMinfsDirIndexMinSlots / 2 + 64;
+    ASSERT_EQ(mkdir("::index_grow", 0755), 0);
+    ASSERT_TRUE(CreateEntries("index_grow", 0, count));
+
+    minfs::ino_t ino;
+    ASSERT_TRUE(GetIno("::index_grow", &ino));
+    minfs::minfs_inode_t inode;
+    ASSERT_TRUE(RemountAndReadInode(ino, &inode));
+    ASSERT_TRUE(CheckIndexed(inode));
+    ASSERT_GT(inode.dir_index_slots, minfs::kMinfsDirIndexMinSlots);
+
+    ASSERT_TRUE(CheckEntries("index_grow", 0, count, true));
+    ASSERT_TRUE(CheckEntries("index_grow", count, 1, false));
+    END_TEST;
+}
+
+bool TestDirIndexStale(void) {
+    BEGIN_TEST;
+
+    ASSERT_EQ(mkdir("::index_stale", 0755), 0);
+    ASSERT_TRUE(CreateEntries("index_stale", 0, kIndexedEntries));
+    minfs::ino_t ino;
+    ASSERT_TRUE(GetIno("::index_stale", &ino));
+
+    // Leave the index behind the directory, as a driver which does not know
+    // about it would.
+    ASSERT_EQ(test_info->unmount(test_root_path), 0);
+    minfs::minfs_inode_t inode;
+    ASSERT_TRUE(AccessInode(ino, &inode, false));
+    ASSERT_TRUE(CheckIndexed(inode));
+    inode.dir_index_seq = inode.seq_num - 1;
+    ASSERT_TRUE(AccessInode(ino, &inode, true));
+    ASSERT_EQ(test_info->fsck(test_disk_path), 0);
+    ASSERT_EQ(test_info->mount(test_disk_path, test_root_path), 0);
+
+    // Lookups fall back to scanning the dirents.
+    ASSERT_TRUE(CheckEntries("index_stale", 0, kIndexedEntries, true));
+    ASSERT_TRUE(CheckEntries("index_stale", kIndexedEntries, 1, false));
+
+    // Changing the directory works without the index, and the next append
+    // rebuilds it.
+    char path[PATH_MAX];
+    EntryPath(path, sizeof(path), "index_stale", 0);
+    ASSERT_EQ(unlink(path), 0);
+    ASSERT_TRUE(CreateEntries("index_stale", kIndexedEntries, 1));
+
+    ASSERT_TRUE(RemountAndReadInode(ino, &inode));
+    ASSERT_TRUE(CheckIndexed(inode));
+    ASSERT_TRUE(CheckEntries("index_stale", 0, 1, false));
+    ASSERT_TRUE(CheckEntries("index_stale", 1, kIndexedEntries, true));
+    END_TEST;
+}
+
+bool TestDirIndexChurn(void) {
+    BEGIN_TEST;
+
+    ASSERT_EQ(mkdir("::index_churn", 0755), 0);
+    ASSERT_TRUE(CreateEntries("index_churn", 0, kIndexedEntries));
+
+    // Replace the oldest entry with a new one, over and over, so that new
+    // entries keep landing at the tail while free records pile up before it.
+    const uint32_t churn = kIndexedEntries * 16;
+    for (uint32_t i = 0; i < churn; i++) {
+        char path[PATH_MAX];
+        EntryPath(path, sizeof(path), "index_churn", i);
+        ASSERT_EQ(unlink(path), 0);
+        ASSERT_TRUE(CreateEntries("index_churn", kIndexedEntries + i, 1));
+    }
+
+    minfs::ino_t ino;
+    ASSERT_TRUE(GetIno("::index_churn", &ino));
+    minfs::minfs_inode_t inode;
+    ASSERT_TRUE(RemountAndReadInode(ino, &inode));
+    ASSERT_TRUE(CheckIndexed(inode));
+
+    // Compaction keeps the dirents within a small multiple of the space the
+    // live ones need, rather than growing with every entry ever created.
+    ASSERT_LT(inode.dir_index_tail, 2 * inode.dir_index_live + minfs::kMinfsBlockSize);
+
+    ASSERT_TRUE(CheckEntries("index_churn", 0, churn, false));
+    ASSERT_TRUE(CheckEntries("index_churn", churn, kIndexedEntries, true));
+    ASSERT_TRUE(CheckEntries("index_churn", churn + kIndexedEntries, 1, false));
+    END_TEST;
+}
+
 #define RUN_MINFS_TESTS(name, CASE_TESTS) \
     FS_TEST_CASE(name, DEFAULT_DISK_SIZE, CASE_TESTS, FS_TEST_FVM, minfs, 1)
 
 RUN_MINFS_TESTS(FsMinfsTestsFvm,
     RUN_TEST_MEDIUM(TestQueryInfo)
+    RUN_TEST_MEDIUM(TestDirIndexRemount)
+    RUN_TEST_MEDIUM(TestDirIndexRename)
+    RUN_TEST_MEDIUM(TestDirIndexUnlinkTail)
+    RUN_TEST_MEDIUM(TestDirIndexGrow)
+    RUN_TEST_MEDIUM(TestDirIndexStale)
+    RUN_TEST_MEDIUM(TestDirIndexChurn)
 )
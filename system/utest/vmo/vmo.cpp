@@ -1313,6 +1313,62 @@ bool vmo_clone_rights_test() {
     END_TEST;
 }
 
+// Touches a copy-on-write clone through a mapping under each access hint. Neighbouring
+// pages mapped on a read fault must still copy on write and leave the parent alone.
+bool vmo_fault_around_test() {
+    BEGIN_TEST;
+
+    static const uint32_t hints[] = {
+        ZX_VMO_OP_ACCESS_DEFAULT,
+        ZX_VMO_OP_ACCESS_RANDOM,
+        ZX_VMO_OP_ACCESS_SEQUENTIAL,
+    };
+    const size_t pages = 64;
+    const size_t len = pages * PAGE_SIZE;
+
+    for (uint32_t hint : hints) {
+        zx_handle_t vmo;
+        ASSERT_EQ(ZX_OK, zx_vmo_create(len, 0, &vmo), "vm_object_create");
+        for (size_t i = 0; i < pages; i++) {
+            size_t actual;
+            EXPECT_EQ(ZX_OK, zx_vmo_write(vmo, &i, i * PAGE_SIZE, sizeof(i), &actual), "");
+        }
+
+        zx_handle_t clone;
+        ASSERT_EQ(ZX_OK, zx_vmo_clone(vmo, ZX_VMO_CLONE_COPY_ON_WRITE, 0, len, &clone), "");
+        EXPECT_EQ(ZX_OK, zx_vmo_op_range(clone, hint, 0, 0, nullptr, 0), "access hint");
+
+        uintptr_t ptr;
+        ASSERT_EQ(ZX_OK, zx_vmar_map(zx_vmar_root_self(), 0, clone, 0, len,
+                                     ZX_VM_FLAG_PERM_READ | ZX_VM_FLAG_PERM_WRITE, &ptr),
+                  "map");
+        volatile size_t* base = reinterpret_cast<volatile size_t*>(ptr);
+
+        // read every page in order, then write every other one
+        for (size_t i = 0; i < pages; i++) {
+            EXPECT_EQ(i, base[i * PAGE_SIZE / sizeof(size_t)], "read through clone");
+        }
+        for (size_t i = 0; i < pages; i += 2) {
+            base[i * PAGE_SIZE / sizeof(size_t)] = i + 1000;
+        }
+
+        for (size_t i = 0; i < pages; i++) {
+            size_t expected = (i % 2) ? i : i + 1000;
+            EXPECT_EQ(expected, base[i * PAGE_SIZE / sizeof(size_t)], "clone contents");
+
+            size_t val, actual;
+            EXPECT_EQ(ZX_OK, zx_vmo_read(vmo, &val, i * PAGE_SIZE, sizeof(val), &actual), "");
+            EXPECT_EQ(i, val, "parent unchanged");
+        }
+
+        EXPECT_EQ(ZX_OK, zx_vmar_unmap(zx_vmar_root_self(), ptr, len), "unmap");
+        EXPECT_EQ(ZX_OK, zx_handle_close(clone), "");
+        EXPECT_EQ(ZX_OK, zx_handle_close(vmo), "");
+    }
+
+    END_TEST;
+}
+
 bool vmo_unmap_coherency() {
     BEGIN_TEST;
 
@@ -1430,6 +1486,7 @@ RUN_TEST(vmo_clone_test_4);
 RUN_TEST(vmo_clone_decommit_test);
 RUN_TEST(vmo_clone_commit_test);
 RUN_TEST(vmo_clone_rights_test);
+RUN_TEST(vmo_fault_around_test);
 RUN_TEST_LARGE(vmo_unmap_coherency);
 END_TEST_CASE(vmo_tests)
 